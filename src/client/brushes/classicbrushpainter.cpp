@@ -17,11 +17,14 @@
    along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "classicbrushpainter.h"
 #include "../shared/net/brushes.h"
 #include "core/brushmask.h"
 #include "core/layer.h"
 
 #include <QCache>
+#include <QMutex>
+#include <QAtomicInt>
 
 #include <cmath>
 
@@ -34,6 +37,7 @@ template<typename T> T square(T x) { return x*x; }
 typedef QVector<float> LUT;
 static const int LUT_RADIUS = 128;
 static QCache<int, LUT> LUT_CACHE;
+static QMutex LUT_CACHE_MUTEX;
 
 // Generate a lookup table for Gimp style exponential brush shape
 // The value at r² (where r is distance from brush center, scaled to LUT_RADIUS) is
@@ -57,6 +61,7 @@ static LUT cachedGimpStyleBrushLUT(float hardness)
 {
 	const int h = hardness * 100;
 	Q_ASSERT(h>=0 && h<=100);
+	QMutexLocker lock(&LUT_CACHE_MUTEX);
 	if(!LUT_CACHE.contains(h))
 		LUT_CACHE.insert(h, new LUT(makeGimpStyleBrushLUT(hardness)));
 
@@ -223,6 +228,75 @@ static paintcore::BrushMask offsetMask(const paintcore::BrushMask &mask, float x
 	return paintcore::BrushMask(diameter, data);
 }
 
+// Cache of finished brush stamps.
+// Dab parameters are quantized in the protocol (size in 1/256 pixels,
+// coordinates in 1/4 pixels,) so identical parameters always produce an
+// identical mask. The stamp position is stored relative to the dab's
+// whole pixel coordinates.
+static const int STAMP_CACHE_MAX_COST = 8 * 1024 * 1024; // total mask bytes
+static QCache<quint64, paintcore::BrushStamp> STAMP_CACHE(STAMP_CACHE_MAX_COST);
+static QMutex STAMP_CACHE_MUTEX;
+static QAtomicInt STAMP_CACHE_HITS;
+static QAtomicInt STAMP_CACHE_MISSES;
+
+static paintcore::BrushStamp cachedClassicBrushStamp(int x, int y, const protocol::ClassicBrushDab &d)
+{
+	// Split the coordinates into whole pixels and the subpixel phase
+	const int px = x & 3;
+	const int py = y & 3;
+	const int wx = (x - px) / 4;
+	const int wy = (y - py) / 4;
+
+	const quint64 key =
+		quint64(d.size) |
+		quint64(d.hardness) << 16 |
+		quint64(d.opacity) << 24 |
+		quint64(px) << 32 |
+		quint64(py) << 34;
+
+	paintcore::BrushStamp s;
+	{
+		QMutexLocker lock(&STAMP_CACHE_MUTEX);
+		const paintcore::BrushStamp *cached = STAMP_CACHE.object(key);
+		if(cached)
+			s = *cached;
+	}
+
+	if(s.mask.diameter() > 0) {
+		STAMP_CACHE_HITS.ref();
+
+	} else {
+		STAMP_CACHE_MISSES.ref();
+		s = makeGimpStyleBrushStamp(
+			QPointF(px/4.0, py/4.0),
+			d.size/256.0,
+			d.hardness/255.0,
+			d.opacity/255.0
+		);
+
+		const int cost = s.mask.diameter() * s.mask.diameter();
+		if(cost <= STAMP_CACHE_MAX_COST) {
+			QMutexLocker lock(&STAMP_CACHE_MUTEX);
+			STAMP_CACHE.insert(key, new paintcore::BrushStamp(s), cost);
+		}
+	}
+
+	s.left += wx;
+	s.top += wy;
+	return s;
+}
+
+}
+
+BrushStampCacheStats brushStampCacheStats()
+{
+	QMutexLocker lock(&STAMP_CACHE_MUTEX);
+	return BrushStampCacheStats {
+		STAMP_CACHE_HITS.load(),
+		STAMP_CACHE_MISSES.load(),
+		STAMP_CACHE.size(),
+		STAMP_CACHE.totalCost()
+	};
 }
 
 paintcore::BrushStamp makeGimpStyleBrushStamp(const QPointF &point, qreal radius, qreal hardness, qreal opacity)
@@ -282,12 +356,7 @@ void drawClassicBrushDabs(const protocol::DrawDabsClassic &dabs, paintcore::Edit
 	for(const protocol::ClassicBrushDab &d : dabs.dabs()) {
 		const int nextX = lastX + d.x;
 		const int nextY = lastY + d.y;
-		const paintcore::BrushStamp bs = makeGimpStyleBrushStamp(
-			QPointF(nextX/4.0, nextY/4.0),
-			d.size/256.0,
-			d.hardness/255.0,
-			d.opacity/255.0
-		);
+		const paintcore::BrushStamp bs = cachedClassicBrushStamp(nextX, nextY, d);
 		layer.putBrushStamp(bs, color, blendmode);
 		lastX = nextX;
 		lastY = nextY;
@@ -41,6 +41,20 @@ void drawClassicBrushDabs(const protocol::DrawDabsClassic &dabs, paintcore::Edit
 
 paintcore::BrushStamp makeGimpStyleBrushStamp(const QPointF &point, qreal radius, qreal hardness, qreal opacity);
 
+struct BrushStampCacheStats {
+	int hits;      // number of dabs drawn using a cached stamp
+	int misses;    // number of stamps generated
+	int entries;   // number of stamps currently in the cache
+	int totalCost; // size of the cached masks in bytes
+};
+
+/**
+ * @brief Get the classic brush stamp cache statistics
+ *
+ * The stamp cache is used by drawClassicBrushDabs.
+ */
+BrushStampCacheStats brushStampCacheStats();
+
 }
 
 #endif
@@ -31,6 +31,12 @@ CanvasSaverRunnable::CanvasSaverRunnable(const CanvasModel *canvas, const QStrin
 {
 }
 
+CanvasSaverRunnable::CanvasSaverRunnable(const CanvasModel *canvas, const QString &filename, QSharedPointer<openraster::LayerImageCache> cache, QObject *parent)
+	: CanvasSaverRunnable(canvas, filename, parent)
+{
+	m_cache = cache;
+}
+
 void CanvasSaverRunnable::run()
 {
 	bool ok;
@@ -38,7 +44,7 @@ void CanvasSaverRunnable::run()
 
 	if(m_filename.endsWith(".ora", Qt::CaseInsensitive)) {
 		// Special case: Save as OpenRaster with all the layers intact.
-		ok = openraster::saveOpenRaster(m_filename, m_layerstack, &errorMessage);
+		ok = openraster::saveOpenRaster(m_filename, m_layerstack, &errorMessage, m_cache.data());
 
 	} else {
 		// Regular image formats: flatten the image first.
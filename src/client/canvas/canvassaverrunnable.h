@@ -21,11 +21,16 @@
 
 #include <QObject>
 #include <QRunnable>
+#include <QSharedPointer>
 
 namespace paintcore {
     class LayerStack;
 }
 
+namespace openraster {
+	struct LayerImageCache;
+}
+
 namespace canvas {
 
 class CanvasModel;
@@ -34,12 +39,17 @@ class CanvasModel;
  * @brief A runnable for saving a canvas in a background thread
  *
  * When constructed, a copy of the layerstack is made.
+ *
+ * If a layer image cache is given, layers that haven't changed since
+ * the previous save with the same cache are not re-encoded when saving
+ * in OpenRaster format.
  */
 class CanvasSaverRunnable : public QObject, public QRunnable
 {
 	Q_OBJECT
 public:
 	CanvasSaverRunnable(const CanvasModel *canvas, const QString &filename, QObject *parent = nullptr);
+	CanvasSaverRunnable(const CanvasModel *canvas, const QString &filename, QSharedPointer<openraster::LayerImageCache> cache, QObject *parent = nullptr);
 
 	void run() override;
 
@@ -53,6 +63,7 @@ signals:
 private:
 	paintcore::LayerStack *m_layerstack;
 	QString m_filename;
+	QSharedPointer<openraster::LayerImageCache> m_cache;
 };
 
 }
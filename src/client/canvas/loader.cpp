@@ -27,6 +27,7 @@
 #include "core/layerstack.h"
 #include "core/layer.h"
 #include "core/tilevector.h"
+#include "core/concurrent.h"
 
 #include "../shared/net/layer.h"
 #include "../shared/net/annotation.h"
@@ -148,12 +149,24 @@ QList<MessagePtr> SnapshotLoader::loadInitCommands()
 		msgs.append(protocol::Chat::pin(m_contextId, m_session->pinnedMessage()));
 	}
 
+	// Encode all layers in parallel, then compress their tiles together
+	// so identical tiles in different layers are compressed only once.
+	QVector<paintcore::LayerTileSet> tilesets(m_layers->layerCount());
+	{
+		paintcore::LayerTileSet *ts = tilesets.data();
+		const paintcore::LayerStack *layers = m_layers;
+		paintcore::concurrentForChunks(tilesets.size(), tilesets.size(), [ts, layers](int, int begin, int end) {
+			for(int i=begin;i<end;++i)
+				ts[i] = paintcore::LayerTileSet::fromLayer(*layers->getLayerByIndex(i));
+		});
+	}
+	paintcore::LayerTileSet::compressTiles(tilesets);
+
 	// Create layers
 	for(int i=0;i<m_layers->layerCount();++i) {
 		const paintcore::Layer *layer = m_layers->getLayerByIndex(i);
 
-		msgs << paintcore::LayerTileSet::fromLayer(*layer)
-			.toInitCommands(m_contextId, layer->info());
+		msgs << tilesets[i].toInitCommands(m_contextId, layer->info());
 
 		// Set layer ACLs (if found)
 		if(m_session) {
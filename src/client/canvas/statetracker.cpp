@@ -23,10 +23,10 @@
 
 #include "core/layerstack.h"
 #include "core/layer.h"
+#include "core/concurrent.h"
 #include "brushes/brushpainter.h"
 #include "net/commands.h"
 #include "net/internalmsg.h"
-#include "tools/selection.h" // for selection transform utils
 
 #include "../shared/net/brushes.h"
 #include "../shared/net/layer.h"
@@ -38,21 +38,36 @@
 #include <QDateTime>
 #include <QTimer>
 #include <QElapsedTimer>
+#include <QHash>
 #include <QSettings>
 #include <QPainter>
+#include <QPolygonF>
+#include <QTransform>
 
 namespace canvas {
 
 struct StateSavepoint::Data {
-	Data() : timestamp(0), canvas(nullptr), streampointer(-1), m_refcount(1) {}
+	Data() : timestamp(0), lastUsed(0), canvas(nullptr), streampointer(-1), compressed(false), m_refcount(1) {}
 	Data(const Data &) = delete;
 	Data &operator=(const Data&) = delete;
 	~Data() { delete canvas; }
 
 	qint64 timestamp;
+	qint64 lastUsed; // for evicting savepoints in LRU order
 	paintcore::Savepoint *canvas;
 	QVector<LayerListItem> layermodel;
 	int streampointer;
+	bool compressed; // has compression been done (or tried) since the last restore
+
+	//! Restore this savepoint into the given layer stack
+	void restoreTo(paintcore::EditableLayerStack editor)
+	{
+		// Restoring decompresses the shared savepoint in place,
+		// so it must be compressed again once it falls behind
+		if(canvas->isCompressed())
+			compressed = false;
+		editor.restoreSavepoint(canvas);
+	}
 
 private:
 	int m_refcount;
@@ -110,7 +125,7 @@ QImage StateSavepoint::thumbnail(const QSize &maxSize) const
 		return QImage();
 
 	paintcore::LayerStack stack;
-	stack.editor().restoreSavepoint(m_data->canvas);
+	m_data->restoreTo(stack.editor());
 	QImage img = stack.toFlatImage(true, true);
 	if(img.width() > maxSize.width() || img.height() > maxSize.height()) {
 		img = img.scaled(maxSize, Qt::KeepAspectRatio);
@@ -124,7 +139,7 @@ QList<protocol::MessagePtr> StateSavepoint::initCommands(uint8_t contextId, Canv
 		return QList<protocol::MessagePtr>();
 
 	paintcore::LayerStack stack;
-	stack.editor().restoreSavepoint(m_data->canvas);
+	m_data->restoreTo(stack.editor());
 	SnapshotLoader loader(contextId, &stack, canvas);
 	return loader.loadInitCommands();
 }
@@ -147,6 +162,7 @@ StateTracker::StateTracker(paintcore::LayerStack *image, LayerListModel *layerli
 		_showallmarkers(false),
 		m_hasParticipated(false),
 		m_localPenDown(false),
+		m_truncatedUndos(0),
 		m_isQueued(false)
 {
 	connect(m_layerlist, &LayerListModel::layerOpacityPreview, this, &StateTracker::previewLayerOpacity);
@@ -236,7 +252,17 @@ void StateTracker::processQueuedCommands()
 	elapsed.start();
 
 	while(!m_msgqueue.isEmpty() && elapsed.elapsed() < 100) {
-		receiveCommand(m_msgqueue.takeFirst());
+		if(isParallelizable(m_msgqueue.first())) {
+			// Gather a run of pixel commands that can be executed as a batch
+			static const int MAX_BATCH = 256;
+			QList<protocol::MessagePtr> batch;
+			while(batch.size() < MAX_BATCH && !m_msgqueue.isEmpty() && isParallelizable(m_msgqueue.first()))
+				batch << m_msgqueue.takeFirst();
+			receiveCommandBatch(batch);
+
+		} else {
+			receiveCommand(m_msgqueue.takeFirst());
+		}
 	}
 
 	if(!m_msgqueue.isEmpty()) {
@@ -248,22 +274,13 @@ void StateTracker::processQueuedCommands()
 	}
 }
 
-void StateTracker::receiveCommand(protocol::MessagePtr msg)
+/**
+ * @brief Release old history and savepoints if the history has grown too big
+ */
+void StateTracker::trimHistory()
 {
 	static const uint HISTORY_SIZE_LIMIT = 60 * 1024*1024;
 
-	if(msg->type() == protocol::MSG_INTERNAL) {
-		const auto &ci = msg.cast<protocol::ClientInternal>();
-		if(ci.internalType() == protocol::ClientInternal::Type::Catchup)
-			emit catchupProgress(ci.value());
-		else if(ci.internalType() == protocol::ClientInternal::Type::SequencePoint)
-			emit sequencePoint(ci.value());
-		else if(ci.internalType() == protocol::ClientInternal::Type::TruncateHistory)
-			handleTruncateHistory();
-
-		return;
-	}
-
 	if(m_history.lengthInBytes() > HISTORY_SIZE_LIMIT) {
 		const uint oldlen = m_history.lengthInBytes();
 
@@ -274,22 +291,12 @@ void StateTracker::receiveCommand(protocol::MessagePtr msg)
 
 		// Clear out old savepoints
 		// First, find the oldest undo point in the stream
-		int undopoint = m_history.offset();
-		while(undopoint<m_history.end()) {
-			if(m_history.at(undopoint)->type() == protocol::MSG_UNDOPOINT)
-				break;
-			++undopoint;
-		}
+		int undopoint = oldestUndoPoint();
 
-		if(undopoint == m_history.end()) {
+		if(undopoint < 0) {
 			qWarning() << "no undo point found after cleaning history!";
 		} else {
 			// Find the newest savepoint older or same age as the undo point
-
-			// If a local fork exists, we need a savepoint that precedes it in case we need to roll back.
-			if(!m_localfork.isEmpty())
-				undopoint = qMin(undopoint, m_localfork.offset());
-
 			int savepoint=0;
 			while(savepoint < m_savepoints.count()) {
 				if(m_savepoints[savepoint]->streampointer >= undopoint) {
@@ -305,6 +312,112 @@ void StateTracker::receiveCommand(protocol::MessagePtr msg)
 				m_savepoints.removeFirst();
 		}
 	}
+}
+
+/**
+ * @brief Can this message be executed as a part of a parallel batch?
+ *
+ * Only commands that modify the pixels of a single layer can be.
+ * When a local fork exists, every received message must be checked
+ * against it individually, so batching is not done then.
+ */
+bool StateTracker::isParallelizable(const protocol::MessagePtr &msg) const
+{
+	if(!m_localfork.isEmpty())
+		return false;
+
+	switch(msg->type()) {
+	using namespace protocol;
+	case MSG_DRAWDABS_CLASSIC:
+	case MSG_DRAWDABS_PIXEL:
+	case MSG_DRAWDABS_PIXEL_SQUARE:
+	case MSG_PUTIMAGE:
+	case MSG_PUTTILE:
+	case MSG_FILLRECT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Receive a batch of pixel commands
+ *
+ * This is equivalent to calling receiveCommand for each message in order,
+ * but the commands are executed in parallel where possible.
+ *
+ * A command depends on every earlier command in the batch that targets
+ * the same layer, since pixel operations are not commutative and a layer's
+ * tile map cannot be modified by two threads at once. Commands on different
+ * layers are always independent. The dependency graph is thus a set of
+ * per-layer chains, each of which is executed in order by one worker.
+ * The end result is identical to serial execution.
+ */
+void StateTracker::receiveCommandBatch(const QList<protocol::MessagePtr> &batch)
+{
+	trimHistory();
+
+	for(const protocol::MessagePtr &msg : batch)
+		m_history.append(msg);
+
+	// Note: MessagePtr's reference count is not atomic, so the workers
+	// get plain pointers. The history keeps the messages alive.
+	QVector<const protocol::Message*> messages;
+	messages.reserve(batch.size());
+
+	QVector<QVector<int>> chains;
+	{
+		QHash<int, int> layerChains;
+		for(int i=0;i<batch.size();++i) {
+			const protocol::Message *msg = &*batch.at(i);
+			messages << msg;
+
+			int chain = layerChains.value(msg->layer(), -1);
+			if(chain < 0) {
+				chain = chains.size();
+				layerChains[msg->layer()] = chain;
+				chains.append(QVector<int>());
+			}
+			chains[chain] << i;
+		}
+	}
+
+	QVector<char> results(batch.size());
+	{
+		auto layers = m_layerstack->editor();
+		const protocol::Message * const *msgs = messages.constData();
+		char *result = results.data();
+
+		paintcore::concurrentForChunks(chains.size(), chains.size(), [&chains, &layers, msgs, result](int, int begin, int end) {
+			for(int i=begin;i<end;++i) {
+				for(const int cmd : chains.at(i))
+					result[cmd] = applyPixelCommand(*msgs[cmd], layers);
+			}
+		});
+	}
+
+	// Signals are emitted in the main thread, in the original order
+	for(int i=0;i<batch.size();++i) {
+		if(results.at(i))
+			emitPixelCommandMarker(*messages.at(i));
+	}
+}
+
+void StateTracker::receiveCommand(protocol::MessagePtr msg)
+{
+	if(msg->type() == protocol::MSG_INTERNAL) {
+		const auto &ci = msg.cast<protocol::ClientInternal>();
+		if(ci.internalType() == protocol::ClientInternal::Type::Catchup)
+			emit catchupProgress(ci.value());
+		else if(ci.internalType() == protocol::ClientInternal::Type::SequencePoint)
+			emit sequencePoint(ci.value());
+		else if(ci.internalType() == protocol::ClientInternal::Type::TruncateHistory)
+			handleTruncateHistory();
+
+		return;
+	}
+
+	trimHistory();
 
 	// Add command to history and execute it
 	m_history.append(msg);
@@ -331,7 +444,8 @@ void StateTracker::receiveCommand(protocol::MessagePtr msg)
 			qWarning("No savepoint for rolling back local fork at %d!", m_localfork.offset());
 
 		} else {
-			const StateSavepoint &sp = m_savepoints.at(savepoint);
+			StateSavepoint sp = m_savepoints.at(savepoint);
+			sp->lastUsed = QDateTime::currentMSecsSinceEpoch();
 			qDebug("inconsistency at %d (local fork at %d). Rolling back to %d", m_history.end(), m_localfork.offset(), sp->streampointer);
 
 			// Avoid rollback churn by clearing the local fork, but not if
@@ -378,14 +492,14 @@ void StateTracker::handleCommand(protocol::MessagePtr msg, bool replay, int pos)
 		case MSG_DRAWDABS_CLASSIC:
 		case MSG_DRAWDABS_PIXEL:
 		case MSG_DRAWDABS_PIXEL_SQUARE:
-			handleDrawDabs(*msg);
+		case MSG_PUTIMAGE:
+		case MSG_PUTTILE:
+		case MSG_FILLRECT:
+			handlePixelCommand(*msg);
 			break;
 		case MSG_PEN_UP:
 			handlePenUp(msg.cast<PenUp>());
 			break;
-		case MSG_PUTIMAGE:
-			handlePutImage(msg.cast<PutImage>());
-			break;
 		case MSG_UNDOPOINT:
 			handleUndoPoint(msg.cast<UndoPoint>(), replay, pos);
 			break;
@@ -404,15 +518,9 @@ void StateTracker::handleCommand(protocol::MessagePtr msg, bool replay, int pos)
 		case MSG_ANNOTATION_DELETE:
 			handleAnnotationDelete(msg.cast<AnnotationDelete>());
 			break;
-		case MSG_FILLRECT:
-			handleFillRect(msg.cast<FillRect>());
-			break;
 		case MSG_REGION_MOVE:
 			handleMoveRegion(msg.cast<MoveRegion>());
 			break;
-		case MSG_PUTTILE:
-			handlePutTile(msg.cast<PutTile>());
-			break;
 		case MSG_CANVAS_BACKGROUND:
 			handleCanvasBackground(msg.cast<CanvasBackground>());
 			break;
@@ -632,14 +740,11 @@ void StateTracker::handleLayerDelete(const protocol::LayerDelete &cmd)
 	m_layerlist->deleteLayer(cmd.layer());
 }
 
-void StateTracker::handleDrawDabs(const protocol::Message &cmd)
+void StateTracker::handlePixelCommand(const protocol::Message &cmd)
 {
 	auto layers = m_layerstack->editor();
-
-	brushes::drawBrushDabs(cmd, layers);
-
-	if(_showallmarkers || cmd.contextId() != localId())
-		emit userMarkerMove(cmd.contextId(), cmd.layer(), static_cast<const protocol::DrawDabs&>(cmd).lastPoint());
+	if(applyPixelCommand(cmd, layers))
+		emitPixelCommandMarker(cmd);
 }
 
 void StateTracker::handlePenUp(const protocol::PenUp &cmd)
@@ -649,67 +754,111 @@ void StateTracker::handlePenUp(const protocol::PenUp &cmd)
 	emit userMarkerHide(cmd.contextId());
 }
 
-void StateTracker::handlePutImage(const protocol::PutImage &cmd)
+/**
+ * @brief Apply a command that modifies the pixels of a single layer
+ *
+ * This does not touch any StateTracker state, so commands targeting
+ * different layers can be applied in parallel.
+ *
+ * @return false if the command was invalid
+ */
+bool StateTracker::applyPixelCommand(const protocol::Message &msg, paintcore::EditableLayerStack &layers)
 {
-	auto layers = m_layerstack->editor();
-	auto layer = layers.getEditableLayer(cmd.layer());
-	if(layer.isNull()) {
-		qWarning("PutImage on non-existent layer #%d", cmd.layer());
-		return;
-	}
+	switch(msg.type()) {
+	using namespace protocol;
+	case MSG_DRAWDABS_CLASSIC:
+	case MSG_DRAWDABS_PIXEL:
+	case MSG_DRAWDABS_PIXEL_SQUARE:
+		brushes::drawBrushDabs(msg, layers);
+		return true;
 
-	const int expectedLen = cmd.width() * cmd.height() * 4;
-	QByteArray data = qUncompress(cmd.image());
-	if(data.length() != expectedLen) {
-		qWarning() << "Invalid putImage: Expected" << expectedLen << "bytes, but got" << data.length();
-		return;
+	case MSG_PUTIMAGE: {
+		const PutImage &cmd = static_cast<const PutImage&>(msg);
+		auto layer = layers.getEditableLayer(cmd.layer());
+		if(layer.isNull()) {
+			qWarning("PutImage on non-existent layer #%d", cmd.layer());
+			return false;
+		}
+
+		const int expectedLen = cmd.width() * cmd.height() * 4;
+		QByteArray data = qUncompress(cmd.image());
+		if(data.length() != expectedLen) {
+			qWarning() << "Invalid putImage: Expected" << expectedLen << "bytes, but got" << data.length();
+			return false;
+		}
+		QImage img(reinterpret_cast<const uchar*>(data.constData()), cmd.width(), cmd.height(), QImage::Format_ARGB32_Premultiplied);
+		layer.putImage(cmd.x(), cmd.y(), img, paintcore::BlendMode::Mode(cmd.blendmode()));
+		return true;
 	}
-	QImage img(reinterpret_cast<const uchar*>(data.constData()), cmd.width(), cmd.height(), QImage::Format_ARGB32_Premultiplied);
-	layer.putImage(cmd.x(), cmd.y(), img, paintcore::BlendMode::Mode(cmd.blendmode()));
 
-	if(_showallmarkers || cmd.contextId() != m_myId)
-		emit userMarkerMove(cmd.contextId(), layer->id(), QPoint(cmd.x() + cmd.width()/2, cmd.y()+cmd.height()/2));
-}
+	case MSG_PUTTILE: {
+		const PutTile &cmd = static_cast<const PutTile&>(msg);
+		auto layer = layers.getEditableLayer(cmd.layer());
+		if(layer.isNull()) {
+			qWarning("PutTile on non-existent layer #%d", cmd.layer());
+			return false;
+		}
 
-void StateTracker::handlePutTile(const protocol::PutTile &cmd)
-{
-	auto layers = m_layerstack->editor();
-	auto layer = layers.getEditableLayer(cmd.layer());
-	if(layer.isNull()) {
-		qWarning("PutTile on non-existent layer #%d", cmd.layer());
-		return;
-	}
+		paintcore::Tile t;
+		if(cmd.isSolidColor()) {
+			t = paintcore::Tile(QColor::fromRgba(cmd.color()));
 
-	paintcore::Tile t;
-	if(cmd.isSolidColor()) {
-		t = paintcore::Tile(QColor::fromRgba(cmd.color()));
+		} else {
+			QByteArray data = qUncompress(cmd.image());
+			if(data.length() != paintcore::Tile::BYTES) {
+				qWarning() << "Invalid putTile: Expected" << paintcore::Tile::BYTES << "bytes, but got" << data.length();
+				return false;
+			}
 
-	} else {
-		QByteArray data = qUncompress(cmd.image());
-		if(data.length() != paintcore::Tile::BYTES) {
-			qWarning() << "Invalid putTile: Expected" << paintcore::Tile::BYTES << "bytes, but got" << data.length();
-			return;
+			t = paintcore::Tile(data);
 		}
 
-		t = paintcore::Tile(data);
+		layer.putTile(cmd.column(), cmd.row(), cmd.repeat(), t, cmd.sublayer());
+		return true;
 	}
 
-	layer.putTile(cmd.column(), cmd.row(), cmd.repeat(), t, cmd.sublayer());
+	case MSG_FILLRECT: {
+		const FillRect &cmd = static_cast<const FillRect&>(msg);
+		auto layer = layers.getEditableLayer(cmd.layer());
+		if(layer.isNull()) {
+			qWarning("FillRect on non-existent layer #%d", cmd.layer());
+			return false;
+		}
+
+		layer.fillRect(QRect(cmd.x(), cmd.y(), cmd.width(), cmd.height()), QColor::fromRgba(cmd.color()), paintcore::BlendMode::Mode(cmd.blend()));
+		return true;
+	}
+
+	default:
+		Q_ASSERT_X(false, "applyPixelCommand", "not a pixel command");
+		return false;
+	}
 }
 
-void StateTracker::handleFillRect(const protocol::FillRect &cmd)
+void StateTracker::emitPixelCommandMarker(const protocol::Message &msg)
 {
-	auto layers = m_layerstack->editor();
-	auto layer = layers.getEditableLayer(cmd.layer());
-	if(layer.isNull()) {
-		qWarning("FillRect on non-existent layer #%d", cmd.layer());
+	if(!_showallmarkers && msg.contextId() == localId())
 		return;
-	}
-
-	layer.fillRect(QRect(cmd.x(), cmd.y(), cmd.width(), cmd.height()), QColor::fromRgba(cmd.color()), paintcore::BlendMode::Mode(cmd.blend()));
 
-	if(_showallmarkers || cmd.contextId() != m_myId)
-		emit userMarkerMove(cmd.contextId(), layer->id(), QPoint(cmd.x() + cmd.width()/2, cmd.y()+cmd.height()/2));
+	switch(msg.type()) {
+	using namespace protocol;
+	case MSG_DRAWDABS_CLASSIC:
+	case MSG_DRAWDABS_PIXEL:
+	case MSG_DRAWDABS_PIXEL_SQUARE:
+		emit userMarkerMove(msg.contextId(), msg.layer(), static_cast<const DrawDabs&>(msg).lastPoint());
+		break;
+	case MSG_PUTIMAGE: {
+		const PutImage &cmd = static_cast<const PutImage&>(msg);
+		emit userMarkerMove(cmd.contextId(), cmd.layer(), QPoint(cmd.x() + cmd.width()/2, cmd.y()+cmd.height()/2));
+		break;
+	}
+	case MSG_FILLRECT: {
+		const FillRect &cmd = static_cast<const FillRect&>(msg);
+		emit userMarkerMove(cmd.contextId(), cmd.layer(), QPoint(cmd.x() + cmd.width()/2, cmd.y()+cmd.height()/2));
+		break;
+	}
+	default: break;
+	}
 }
 
 void StateTracker::handleMoveRegion(const protocol::MoveRegion &cmd)
@@ -760,8 +909,8 @@ void StateTracker::handleMoveRegion(const protocol::MoveRegion &cmd)
 		mask = mask.convertToFormat(QImage::Format_ARGB32_Premultiplied);
 	}
 
-	// Extract selected pixels
-	QImage selbuf = layer->toImage().copy(bounds); // TODO optimize
+	// Extract selected pixels (only the tiles under the bounds are read)
+	QImage selbuf = layer->toImage(bounds);
 
 	// Mask out unselected pixels (if necessary)
 	if(!mask.isNull()) {
@@ -770,18 +919,18 @@ void StateTracker::handleMoveRegion(const protocol::MoveRegion &cmd)
 		mp.drawImage(0, 0, mask);
 	}
 
-	// Transform selected pixels
-
-	QPoint offset;
-	QImage transformed;
-	if(target.boundingRect().size() == bounds.size() && target[0].x() < target[1].x()) {
-		// Just translation
-		transformed = selbuf;
-		offset = target[0];
-
-	} else {
-		transformed = tools::SelectionTool::transformSelectionImage(selbuf, target, &offset);
-		if(transformed.isNull()) {
+	// Selection transformation (relative to the target's bounding box, like SelectionTool::transformSelectionImage)
+	const QRect targetBounds = target.boundingRect();
+	const bool justTranslation = targetBounds.size() == bounds.size() && target[0].x() < target[1].x();
+	QTransform transform;
+	if(!justTranslation) {
+		const QPolygonF srcPolygon({
+			QPointF(0, 0),
+			QPointF(selbuf.width(), 0),
+			QPointF(selbuf.width(), selbuf.height()),
+			QPointF(0, selbuf.height())
+		});
+		if(!QTransform::quadToQuad(srcPolygon, QPolygonF(target.translated(-targetBounds.topLeft())), transform)) {
 			qWarning("moveRegion: transformation failed (%d, %d -> %d, %d -> %d, %d -> %d, %d)!",
 				cmd.x1(), cmd.y1(), cmd.x2(), cmd.y2(), cmd.x3(), cmd.y3(), cmd.x4(), cmd.y4());
 			return;
@@ -795,7 +944,10 @@ void StateTracker::handleMoveRegion(const protocol::MoveRegion &cmd)
 		layer.putImage(bounds.x(), bounds.y(), mask, paintcore::BlendMode::MODE_ERASE);
 	}
 
-	layer.putImage(offset.x(), offset.y(), transformed, paintcore::BlendMode::MODE_NORMAL);
+	if(justTranslation)
+		layer.putImage(target[0].x(), target[0].y(), selbuf, paintcore::BlendMode::MODE_NORMAL);
+	else
+		layer.putTransformedImage(selbuf, transform, targetBounds, paintcore::BlendMode::MODE_NORMAL);
 
 	if(_showallmarkers || cmd.contextId() != m_myId)
 		emit userMarkerMove(cmd.contextId(), layer->id(), target.boundingRect().center());
@@ -895,6 +1047,9 @@ void StateTracker::handleUndo(protocol::Undo &cmd)
 			}
 		}
 
+		if(!m_history.isValidIndex(pos) && m_history.offset() > 0)
+			++m_truncatedUndos;
+
 		if(redostart == m_history.end()) {
 			qDebug() << "nothing to redo for user" << cmd.contextId();
 			return;
@@ -911,6 +1066,9 @@ void StateTracker::handleUndo(protocol::Undo &cmd)
 					break;
 			}
 		}
+
+		if(!m_history.isValidIndex(pos) && m_history.offset() > 0)
+			++m_truncatedUndos;
 	}
 
 	if(upCount > protocol::UNDO_DEPTH_LIMIT) {
@@ -974,6 +1132,7 @@ StateSavepoint StateTracker::createSavepoint(int pos)
 {
 	StateSavepoint savepoint;
 	savepoint->timestamp = QDateTime::currentMSecsSinceEpoch();
+	savepoint->lastUsed = savepoint->timestamp;
 	savepoint->streampointer = pos<0 ? m_history.end() : pos;
 	savepoint->canvas = m_layerstack->makeSavepoint();
 	savepoint->layermodel = m_layerlist->getLayers();
@@ -999,6 +1158,102 @@ void StateTracker::makeSavepoint(int pos)
 
 	// Looks like a good spot for a savepoint
 	m_savepoints.append(createSavepoint(pos));
+
+	manageSavepointMemory();
+}
+
+/**
+ * @brief Find the oldest undo point in the retained history
+ *
+ * If a local fork exists, its offset is returned if it is older, since
+ * a savepoint that precedes it is needed in case we need to roll back.
+ *
+ * @return stream position or -1 if there are no undo points
+ */
+int StateTracker::oldestUndoPoint() const
+{
+	int undopoint = m_history.offset();
+	while(undopoint<m_history.end()) {
+		if(m_history.at(undopoint)->type() == protocol::MSG_UNDOPOINT)
+			break;
+		++undopoint;
+	}
+
+	if(undopoint == m_history.end())
+		return -1;
+
+	if(!m_localfork.isEmpty())
+		undopoint = qMin(undopoint, m_localfork.offset());
+
+	return undopoint;
+}
+
+/**
+ * @brief Keep savepoint memory usage in check
+ *
+ * Savepoints that have fallen behind the newest few are compressed.
+ * If the savepoints still use more memory than the budget allows,
+ * the least recently used ones are dropped. The newest savepoint and
+ * the one needed to reach the oldest undo point are always kept.
+ */
+void StateTracker::manageSavepointMemory()
+{
+	static const int UNCOMPRESSED_SAVEPOINTS = 3;
+	static const qint64 SAVEPOINT_MEMORY_BUDGET = 256 * 1024*1024;
+
+	for(int i=0;i<m_savepoints.size()-UNCOMPRESSED_SAVEPOINTS;++i) {
+		StateSavepoint sp = m_savepoints.at(i);
+		if(!sp->compressed) {
+			sp->canvas->compress();
+			sp->compressed = true;
+		}
+	}
+
+	qint64 total = 0;
+	for(const StateSavepoint &sp : m_savepoints)
+		total += sp->canvas->uniqueBytes();
+
+	if(total <= SAVEPOINT_MEMORY_BUDGET)
+		return;
+
+	StateSavepoint required;
+	const int undopoint = oldestUndoPoint();
+	if(undopoint >= 0) {
+		for(const StateSavepoint &sp : m_savepoints) {
+			if(sp->streampointer > undopoint)
+				break;
+			required = sp;
+		}
+	}
+
+	const int oldCount = m_savepoints.size();
+	while(total > SAVEPOINT_MEMORY_BUDGET) {
+		int lru = -1;
+		for(int i=0;i<m_savepoints.size()-1;++i) {
+			const StateSavepoint &sp = m_savepoints.at(i);
+			if(sp != required && (lru<0 || sp->lastUsed < m_savepoints.at(lru)->lastUsed))
+				lru = i;
+		}
+		if(lru<0)
+			break;
+
+		total -= m_savepoints.at(lru)->canvas->uniqueBytes();
+		m_savepoints.removeAt(lru);
+	}
+
+	if(m_savepoints.size() < oldCount)
+		qDebug() << "Savepoint memory budget exceeded: dropped" << oldCount - m_savepoints.size() << "savepoints," << m_savepoints.size() << "left using" << total / float(1024*1024) << "Mb.";
+}
+
+StateTracker::SavepointStats StateTracker::savepointStats() const
+{
+	SavepointStats stats { m_savepoints.size(), 0, 0 };
+	for(const StateSavepoint &sp : m_savepoints) {
+		if(sp->canvas->isCompressed())
+			++stats.compressed;
+		stats.bytes += sp->canvas->uniqueBytes();
+	}
+	return stats;
 }
 
 
@@ -1013,7 +1268,7 @@ void StateTracker::resetToSavepoint(const StateSavepoint savepoint)
 	m_history.resetTo(savepoint->streampointer);
 	m_savepoints.clear();
 
-	m_layerstack->editor().restoreSavepoint(savepoint->canvas);
+	StateSavepoint(savepoint)->restoreTo(m_layerstack->editor());
 	m_layerlist->setLayers(savepoint->layermodel);
 
 	m_savepoints.append(savepoint);
@@ -1032,7 +1287,13 @@ void StateTracker::revertSavepointAndReplay(const StateSavepoint savepoint)
 		return;
 	}
 
-	m_layerstack->editor().restoreSavepoint(savepoint->canvas);
+	// Restoring decompresses the savepoint. It is now the newest one,
+	// so it stays uncompressed until it falls behind again.
+	{
+		StateSavepoint sp = savepoint;
+		sp->restoreTo(m_layerstack->editor());
+		sp->lastUsed = QDateTime::currentMSecsSinceEpoch();
+	}
 	m_layerlist->setLayers(savepoint->layermodel);
 
 	// Reverting a savepoint destroys all newer savepoints
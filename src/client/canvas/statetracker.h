@@ -54,6 +54,7 @@ namespace protocol {
 
 namespace paintcore {
 	class LayerStack;
+	class EditableLayerStack;
 	class Savepoint;
 }
 
@@ -192,9 +193,29 @@ public:
 	 */
 	void resetToSavepoint(StateSavepoint sp);
 
+	/**
+	 * @brief Number of undo/redo commands that ran out of history
+	 *
+	 * Messages older than the savepoint the tracker was reset to are not
+	 * available. An undo or redo whose search reached the start of the
+	 * retained history might have found a different target if the
+	 * full history had been available.
+	 */
+	int truncatedUndoCount() const { return m_truncatedUndos; }
+
 	//! Get all existing savepoints (can be used for selecting a reset point)
 	QList<StateSavepoint> getSavepoints() const { return m_savepoints; }
 
+	//! Savepoint memory usage statistics
+	struct SavepointStats {
+		int count;      // number of savepoints
+		int compressed; // number of savepoints with compressed tiles
+		qint64 bytes;   // memory used by tiles not shared with the canvas or other savepoints
+	};
+
+	//! Get savepoint memory usage statistics
+	SavepointStats savepointStats() const;
+
 signals:
 	void myAnnotationCreated(int id);
 	void layerAutoselectRequest(int);
@@ -240,19 +261,25 @@ private:
 	void handleLayerDefault(const protocol::DefaultLayer &cmd);
 	
 	// Drawing related commands
-	void handleDrawDabs(const protocol::Message &msg);
+	void handlePixelCommand(const protocol::Message &msg);
 	void handlePenUp(const protocol::PenUp &cmd);
-	void handlePutImage(const protocol::PutImage &cmd);
-	void handlePutTile(const protocol::PutTile &cmd);
-	void handleFillRect(const protocol::FillRect &cmd);
 	void handleMoveRegion(const protocol::MoveRegion &cmd);
 
 	// Undo/redo
 	void handleUndoPoint(const protocol::UndoPoint &cmd, bool replay, int pos);
 	void handleUndo(protocol::Undo &cmd);
 	void makeSavepoint(int pos);
+	void manageSavepointMemory();
 	void revertSavepointAndReplay(const StateSavepoint savepoint);
+	int oldestUndoPoint() const;
 	void handleTruncateHistory();
+	void trimHistory();
+
+	// Parallel execution of pixel commands
+	bool isParallelizable(const protocol::MessagePtr &msg) const;
+	void receiveCommandBatch(const QList<protocol::MessagePtr> &batch);
+	static bool applyPixelCommand(const protocol::Message &msg, paintcore::EditableLayerStack &layers);
+	void emitPixelCommandMarker(const protocol::Message &msg);
 
 	// Annotation related commands
 	void handleAnnotationCreate(const protocol::AnnotationCreate &cmd);
@@ -276,6 +303,7 @@ private:
 	bool _showallmarkers;
 	bool m_hasParticipated;
 	bool m_localPenDown;
+	int m_truncatedUndos;
 
 	QList<protocol::MessagePtr> m_msgqueue;
 	QTimer *m_queuetimer;
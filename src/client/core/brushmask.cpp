@@ -19,6 +19,8 @@
 
 #include "brushmask.h"
 
+#include <QMutex>
+
 #include <cmath>
 
 namespace paintcore {
@@ -27,17 +29,20 @@ template<typename T> static T square(T x) { return x*x; }
 
 static const int LUT_RADIUS = 128;
 
+static QVector<uchar> makeColorSamplingLut()
+{
+	// Generate a lookup table for a Gimp style exponential brush shape
+	const qreal hardness = 0.5;
+	const qreal exponent = 0.4 / (1.0 - hardness);
+	QVector<uchar> lut(square(LUT_RADIUS));
+	for(int i=0;i<lut.size();++i)
+		lut[i] = 255 * (1-pow(pow(sqrt(i)/LUT_RADIUS, exponent), 2));
+	return lut;
+}
+
 static BrushMask makeColorSamplingStamp(int radius)
 {
-	static QVector<uchar> lut;
-	if(lut.isEmpty()) {
-		// Generate a lookup table for a Gimp style exponential brush shape
-		const qreal hardness = 0.5;
-		const qreal exponent = 0.4 / (1.0 - hardness);
-		lut.resize(square(LUT_RADIUS));
-		for(int i=0;i<lut.size();++i)
-			lut[i] = 255 * (1-pow(pow(sqrt(i)/LUT_RADIUS, exponent), 2));
-	}
+	static const QVector<uchar> lut = makeColorSamplingLut();
 
 	const int diameter = radius*2;
 	const float lut_scale = square((LUT_RADIUS-1) / double(radius));
@@ -60,8 +65,11 @@ BrushStamp makeColorSamplingStamp(int radius, const QPoint &point)
 {
 	Q_ASSERT(radius>0);
 
-	// Sampling mask doesn't change size very often
+	// Sampling mask doesn't change size very often.
+	// (Brushes may be drawn on different layers in parallel, hence the lock.)
 	static BrushMask mask;
+	static QMutex maskMutex;
+	QMutexLocker lock(&maskMutex);
 	if(mask.diameter() != radius*2)
 		mask = makeColorSamplingStamp(radius);
 
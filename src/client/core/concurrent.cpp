@@ -0,0 +1,228 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2019 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "concurrent.h"
+
+#include <QThread>
+
+namespace paintcore {
+
+/**
+ * A single parallel loop.
+ *
+ * Each slot has its own range of chunks. The owner takes chunks from the
+ * front of its range and other threads steal from the back.
+ */
+struct TaskScheduler::Job {
+	struct Range {
+		QMutex mutex;
+		int begin = 0;
+		int end = 0;
+	};
+
+	const std::function<void(int, int, int)> *func;
+	int count;
+	int grain;
+	int slots;
+	Range *ranges;
+
+	// These are guarded by the scheduler's mutex
+	int joined;
+	int participants;
+
+	bool take(int slot, int &chunk)
+	{
+		Range &r = ranges[slot];
+		QMutexLocker lock(&r.mutex);
+		if(r.begin >= r.end)
+			return false;
+		chunk = r.begin++;
+		return true;
+	}
+
+	bool steal(int slot)
+	{
+		for(int i=1;i<slots;++i) {
+			Range &victim = ranges[(slot + i) % slots];
+			int begin, end;
+			{
+				QMutexLocker lock(&victim.mutex);
+				const int left = victim.end - victim.begin;
+				if(left <= 0)
+					continue;
+
+				end = victim.end;
+				begin = end - (left + 1) / 2;
+				victim.end = begin;
+			}
+
+			Range &own = ranges[slot];
+			QMutexLocker lock(&own.mutex);
+			own.begin = begin;
+			own.end = end;
+			return true;
+		}
+		return false;
+	}
+
+	void run(int slot)
+	{
+		for(;;) {
+			int chunk;
+			if(!take(slot, chunk)) {
+				if(!steal(slot))
+					break;
+				continue;
+			}
+
+			const int begin = chunk * grain;
+			(*func)(slot, begin, qMin(begin + grain, count));
+		}
+	}
+};
+
+class TaskScheduler::Worker : public QThread {
+public:
+	explicit Worker(TaskScheduler *scheduler) : m_scheduler(scheduler) { }
+
+protected:
+	void run() override { m_scheduler->workerLoop(); }
+
+private:
+	TaskScheduler *m_scheduler;
+};
+
+TaskScheduler *TaskScheduler::instance()
+{
+	// The calling thread takes part in every loop, so one less worker is needed
+	static TaskScheduler scheduler(QThread::idealThreadCount() - 1);
+	return &scheduler;
+}
+
+TaskScheduler::TaskScheduler(int threads)
+	: m_quit(false)
+{
+	for(int i=0;i<threads;++i) {
+		Worker *w = new Worker(this);
+		w->start();
+		m_workers << w;
+	}
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		QMutexLocker lock(&m_mutex);
+		m_quit = true;
+		m_jobAdded.wakeAll();
+	}
+
+	for(Worker *w : m_workers) {
+		w->wait();
+		delete w;
+	}
+}
+
+void TaskScheduler::workerLoop()
+{
+	QMutexLocker lock(&m_mutex);
+	while(!m_quit) {
+		Job *job = nullptr;
+		for(Job *j : m_jobs) {
+			if(j->joined < j->slots) {
+				job = j;
+				break;
+			}
+		}
+
+		if(!job) {
+			m_jobAdded.wait(&m_mutex);
+			continue;
+		}
+
+		const int slot = job->joined++;
+		++job->participants;
+
+		lock.unlock();
+		job->run(slot);
+		lock.relock();
+
+		if(--job->participants == 0)
+			m_jobLeft.wakeAll();
+	}
+}
+
+void TaskScheduler::parallelFor(int count, int grain, const std::function<void(int, int, int)> &func)
+{
+	if(count <= 0)
+		return;
+
+	grain = qMax(1, grain);
+	const int chunks = (count + grain - 1) / grain;
+	const int slots = qMin(chunks, slotCount());
+
+	if(slots <= 1) {
+		// Not worth waking up the workers, but the chunks must
+		// still be no larger than the grain
+		for(int begin=0;begin<count;begin+=grain)
+			func(0, begin, qMin(begin + grain, count));
+		return;
+	}
+
+	// Divide the chunks evenly between the slots
+	Job::Range *ranges = new Job::Range[slots];
+	const int perSlot = chunks / slots;
+	const int remainder = chunks % slots;
+	int begin = 0;
+	for(int i=0;i<slots;++i) {
+		ranges[i].begin = begin;
+		begin += perSlot + (i < remainder ? 1 : 0);
+		ranges[i].end = begin;
+	}
+
+	Job job;
+	job.func = &func;
+	job.count = count;
+	job.grain = grain;
+	job.slots = slots;
+	job.ranges = ranges;
+	job.joined = 1; // the calling thread takes the first slot
+	job.participants = 0;
+
+	{
+		QMutexLocker lock(&m_mutex);
+		m_jobs << &job;
+		for(int i=1;i<slots;++i)
+			m_jobAdded.wakeOne();
+	}
+
+	job.run(0);
+
+	// Nothing is left to steal, but the workers may still be busy with their last chunks
+	{
+		QMutexLocker lock(&m_mutex);
+		m_jobs.removeOne(&job);
+		while(job.participants > 0)
+			m_jobLeft.wait(&m_mutex);
+	}
+
+	delete [] ranges;
+}
+
+}
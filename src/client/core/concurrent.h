@@ -20,56 +20,117 @@
 #ifndef PAINTCORE_CONCURRENT_H
 #define PAINTCORE_CONCURRENT_H
 
-#include <QThreadPool>
-#include <QSemaphore>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QList>
+#include <QVector>
+
 #include <functional>
 
 namespace paintcore {
 
+/**
+ * @brief A persistent pool of worker threads for paintcore's parallel loops
+ *
+ * A parallel loop is split into chunks, which are divided evenly between
+ * the participating threads. Each thread processes chunks from the front of
+ * its own range, and when that runs out, steals half of the chunks left
+ * in another thread's range.
+ *
+ * The calling thread participates in the loop too. This means small loops
+ * don't have to wait for a worker to wake up, and a loop can be started
+ * from inside another loop without deadlocking.
+ */
+class TaskScheduler {
+public:
+	//! Get the global scheduler
+	static TaskScheduler *instance();
+
+	/**
+	 * @brief Get the number of threads that can take part in a loop
+	 *
+	 * This includes the calling thread. Per-thread scratch buffers
+	 * should be allocated for this many slots.
+	 */
+	int slotCount() const { return m_workers.size() + 1; }
+
+	/**
+	 * @brief Process the range [0, count) in parallel
+	 *
+	 * The range is processed in pieces of at most grain items. Each piece
+	 * starts at a multiple of grain.
+	 *
+	 * The function is called with the slot index of the thread and
+	 * the item range [begin, end) of the piece. The slot index is in
+	 * the range [0, slotCount()). No two threads share a slot index during
+	 * the same loop, so it can be used to pick a per-thread scratch buffer.
+	 *
+	 * This returns when all pieces have been processed.
+	 *
+	 * @param count number of items
+	 * @param grain number of items to process per function call
+	 * @param func the function to call for each piece
+	 */
+	void parallelFor(int count, int grain, const std::function<void(int slot, int begin, int end)> &func);
+
+private:
+	struct Job;
+	class Worker;
+
+	explicit TaskScheduler(int threads);
+	~TaskScheduler();
+
+	void workerLoop();
+
+	QMutex m_mutex;
+	QWaitCondition m_jobAdded;
+	QWaitCondition m_jobLeft;
+	QList<Job*> m_jobs;
+	QVector<Worker*> m_workers;
+	bool m_quit;
+};
+
 template<typename T>
 void concurrentForEach(QList<T> &list, std::function<void(T)> func)
 {
 	if(list.isEmpty())
 		return;
 
-	if(list.size() == 1) {
-		// Just one item: don't bother with threads
-		func(list[0]);
+	// Only const access from the workers, so the list won't be detached
+	const QList<T> &items = list;
+	TaskScheduler::instance()->parallelFor(items.size(), 1, [&items, &func](int, int begin, int end) {
+		for(int i=begin;i<end;++i)
+			func(items.at(i));
+	});
+}
+
+/**
+ * @brief Split a range of items into chunks and process them in parallel
+ *
+ * The range [0, count) is split into at most the given number of contiguous
+ * chunks. Unlike concurrentForEach, this does one dispatch per chunk rather
+ * than per item.
+ *
+ * The function is called with the chunk index and the item range [begin, end)
+ * of that chunk. The chunk index can be used to select a per-thread scratch buffer.
+ *
+ * @param count number of items
+ * @param chunks maximum number of chunks
+ * @param func the function to call for each chunk
+ */
+inline void concurrentForChunks(int count, int chunks, const std::function<void(int chunk, int begin, int end)> &func)
+{
+	if(count <= 0)
 		return;
-	}
-
-	class ConcurrentForEachRunnable : public QRunnable {
-	public:
-		T value;
-		std::function<void(T)> func;
-		QSemaphore *semaphore;
-
-		void run() override
-		{
-			func(value);
-			semaphore->release();
-		}
-	};
-
-	QSemaphore s;
-	QThreadPool *tp = QThreadPool::globalInstance();
-
-	// Run functions in the thread pool
-	ConcurrentForEachRunnable *runnables = new ConcurrentForEachRunnable[list.size()];
-	for(int i=0;i<list.size();++i) {
-		runnables[i].setAutoDelete(false);
-		runnables[i].value = list[i];
-		runnables[i].func = func;
-		runnables[i].semaphore = &s;
-		tp->start(&runnables[i]);
-	}
-
-	// Wait for all functions to finish
-	s.acquire(list.size());
-	delete [] runnables;
+
+	chunks = qBound(1, chunks, count);
+	const int chunkSize = (count + chunks - 1) / chunks;
+
+	TaskScheduler::instance()->parallelFor(count, chunkSize, [chunkSize, &func](int, int begin, int end) {
+		func(begin / chunkSize, begin, end);
+	});
 }
 
 }
 
 #endif
-
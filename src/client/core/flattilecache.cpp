@@ -0,0 +1,82 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2019 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "flattilecache.h"
+
+#include <QPair>
+
+#include <algorithm>
+
+namespace paintcore {
+
+void FlatTileCache::prepare(int tileCount)
+{
+	if(m_entries.size() != tileCount) {
+		m_entries = QVector<Entry>(tileCount);
+		m_used = 0;
+
+	} else if(m_used.load() > MAX_ENTRIES) {
+		// Evict a little extra so this doesn't have to be done on every pass
+		evict(MAX_ENTRIES * 3 / 4);
+	}
+
+	// Zero is reserved for unused entries
+	if(++m_generation == 0)
+		m_generation = 1;
+}
+
+void FlatTileCache::clear()
+{
+	m_entries.clear();
+	m_used = 0;
+}
+
+FlatTileCache::Entry &FlatTileCache::use(int index)
+{
+	Q_ASSERT(index >= 0 && index < m_entries.size());
+	Entry &e = m_entries[index];
+	if(e.lastUsed == 0)
+		m_used.ref();
+	e.lastUsed = m_generation;
+	return e;
+}
+
+void FlatTileCache::evict(int keep)
+{
+	QVector<QPair<quint32, int>> used;
+	used.reserve(m_used.load());
+
+	for(int i=0;i<m_entries.size();++i) {
+		const quint32 lastUsed = m_entries.at(i).lastUsed;
+		if(lastUsed != 0)
+			used.append(qMakePair(m_generation - lastUsed, i));
+	}
+
+	if(used.size() <= keep)
+		return;
+
+	// Drop everything but the most recently used entries
+	std::nth_element(used.begin(), used.begin() + keep, used.end());
+	for(auto it=used.begin()+keep;it!=used.end();++it)
+		m_entries[it->second] = Entry();
+
+	m_used = keep;
+}
+
+}
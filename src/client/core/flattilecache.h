@@ -0,0 +1,111 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2019 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PAINTCORE_FLATTILECACHE_H
+#define PAINTCORE_FLATTILECACHE_H
+
+#include "tile.h"
+
+#include <QVector>
+#include <QAtomicInt>
+
+namespace paintcore {
+
+/**
+ * @brief Partially flattened tiles of a layer stack
+ *
+ * Typically, only one layer changes between two repaints of a tile.
+ * For recently flattened tiles, this cache keeps the composite of everything
+ * below the changing ("split") layer, so only the split layer and the layers
+ * above it need to be composited again. The layers above are not
+ * pre-composited: 8 bit premultiplied blending is not associative, so the
+ * result would depend on what is in the cache.
+ *
+ * Each entry records the state of all the layers it was built from.
+ * Since the entry holds a reference to the layer tiles, editing them
+ * detaches the tile and stale entries are found by comparing tile pointers.
+ * The split layer's tile is not referenced, so editing it does not cause
+ * any extra copying.
+ *
+ * Entries of different tiles may be used concurrently, but prepare()
+ * must be called (from one thread) before each flattening pass.
+ */
+class FlatTileCache {
+public:
+	//! Maximum number of tiles to keep in the cache
+	static const int MAX_ENTRIES = 512;
+
+	//! The state of a layer as far as flattening one tile is concerned
+	struct LayerState {
+		Tile tile;
+		quint32 tint;
+		int opacity; // -1 if the layer is hidden
+		int blendmode;
+		bool censored;
+		bool hasSublayers;
+
+		bool operator==(const LayerState &o) const {
+			// Sublayers are not tracked, so a layer that has them must always be recomposited
+			if(hasSublayers || o.hasSublayers)
+				return false;
+			if(opacity < 0 || o.opacity < 0)
+				return opacity == o.opacity;
+			return tile == o.tile && tint == o.tint && opacity == o.opacity
+				&& blendmode == o.blendmode && censored == o.censored;
+		}
+		bool operator!=(const LayerState &o) const { return !(*this == o); }
+	};
+
+	struct Entry {
+		Tile base;
+		QVector<LayerState> layers;
+		Tile below;            // base + all layers below the split layer
+		int split = -1;        // layer that is always composited (-1 if no partial composites yet)
+		quint32 lastUsed = 0;  // zero if the entry is not in use
+	};
+
+	FlatTileCache() : m_generation(1) { }
+
+	/**
+	 * @brief Prepare the cache for a new flattening pass
+	 *
+	 * The cache is cleared if the number of tiles has changed and the least
+	 * recently used entries are dropped if there are too many.
+	 */
+	void prepare(int tileCount);
+
+	//! Drop all cached tiles
+	void clear();
+
+	//! Get the (possibly empty) entry for the tile at the given index
+	Entry &use(int index);
+
+	//! Number of entries in use
+	int size() const { return m_used.load(); }
+
+private:
+	void evict(int keep);
+
+	QVector<Entry> m_entries;
+	QAtomicInt m_used;
+	quint32 m_generation;
+};
+
+}
+
+#endif
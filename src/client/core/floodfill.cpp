@@ -21,20 +21,35 @@
 #include "layerstack.h"
 #include "layer.h"
 
-#include <QStack>
 #include <QPainter>
 #include <QVarLengthArray>
+#include <QVector>
+
+#include <algorithm>
+#include <cstring>
 
 namespace paintcore {
 
 namespace {
 
+/**
+ * A scanline flood fill.
+ *
+ * The fill works on horizontal spans. For each tile touched by the fill,
+ * a bitmap of pixels matching the seed color (within tolerance) is computed
+ * once. Filled pixels are cleared from the bitmap, so the fill never needs
+ * to look at the source tiles again. The filled spans are recorded and
+ * rendered into the result image at the end.
+ */
 class Floodfill {
 public:
 	Floodfill(const LayerStack *image, int sourceLayer, bool merge, const QColor &color, int colorTolerance, unsigned int sizelimit) :
 		source(image),
-		scratch(0, QString(), Qt::transparent, image->size()),
-		fill(0, QString(), Qt::transparent, image->size()),
+		width(image->width()),
+		height(image->height()),
+		xtiles(Tile::roundTiles(image->width())),
+		ytiles(Tile::roundTiles(image->height())),
+		matchTiles(xtiles * ytiles),
 		layer(sourceLayer),
 		merge(merge),
 		fillColor(color.rgba()),
@@ -43,58 +58,60 @@ public:
 		sizelimit(sizelimit)
 	{ }
 
-	Tile &scratchTile(int x, int y)
-	{
-		Tile &t = EditableLayer(&scratch, nullptr).rtile(x, y);
-		if(t.isNull()) {
-			if(merge) {
-				t = source->getFlatTile(x, y);
-			} else {
-				const Layer *sl = source->getLayer(layer);
-				Q_ASSERT(sl);
-				const Tile &st = sl->tile(x, y);
-				if(st.isNull())
-					t = Tile(Qt::transparent);
-				else
-					t = st;
-			}
-		}
+	Floodfill(const Floodfill&) = delete;
+	Floodfill &operator=(const Floodfill&) = delete;
 
-		return t;
+	~Floodfill()
+	{
+		for(uchar *m : matchTiles)
+			delete [] m;
 	}
 
-	Tile &fillTile(int x, int y) {
-		Tile &t = EditableLayer(&fill, nullptr).rtile(x, y);
-		if(t.isNull())
-			t = Tile(Qt::transparent);
+	//! Get the source tile for color matching
+	Tile sourceTile(int tx, int ty) const
+	{
+		if(merge)
+			return source->getFlatTile(tx, ty);
 
-		return t;
+		const Layer *sl = source->getLayer(layer);
+		Q_ASSERT(sl);
+		return sl->tile(tx, ty);
 	}
 
-	QRgb colorAt(int x, int y)
+	//! Get (and generate, if needed) the match bitmap of the given tile
+	uchar *matchTile(int tx, int ty)
 	{
-		int tx = x / Tile::SIZE;
-		int ty = y / Tile::SIZE;
-		x = x - tx * Tile::SIZE;
-		y = y - ty * Tile::SIZE;
-
-		const Tile &t = scratchTile(tx, ty);
+		Q_ASSERT(tx>=0 && tx<xtiles && ty>=0 && ty<ytiles);
+		uchar *&m = matchTiles[ty * xtiles + tx];
+		if(!m) {
+			m = new uchar[Tile::LENGTH];
+
+			const Tile t = sourceTile(tx, ty);
+			if(t.isNull()) {
+				memset(m, isSameColor(0, oldColor), Tile::LENGTH);
+			} else {
+				const quint32 *pixels = t.constData();
+				for(int i=0;i<Tile::LENGTH;++i)
+					m[i] = isSameColor(pixels[i], oldColor);
+			}
 
-		return t.constData()[y*Tile::SIZE + x];
+			// Pixels outside the canvas never match
+			const int w = qMin(int(Tile::SIZE), width - tx * Tile::SIZE);
+			const int h = qMin(int(Tile::SIZE), height - ty * Tile::SIZE);
+			for(int y=0;y<h;++y)
+				memset(m + y * Tile::SIZE + w, 0, Tile::SIZE - w);
+			memset(m + h * Tile::SIZE, 0, (Tile::SIZE - h) * Tile::SIZE);
+		}
+		return m;
 	}
 
-	void setPixel(int x, int y) {
-		int tx = x / Tile::SIZE;
-		int ty = y / Tile::SIZE;
-		x = x - tx * Tile::SIZE;
-		y = y - ty * Tile::SIZE;
-
-		int i = y*Tile::SIZE+x;
-		scratchTile(tx, ty).data()[i] = fillColor;
-		fillTile(tx, ty).data()[i] = fillColor;
+	//! Get a pointer to the match bitmap row containing the given pixel
+	uchar *matchRow(int x, int y)
+	{
+		return matchTile(x / Tile::SIZE, y / Tile::SIZE) + (y % Tile::SIZE) * Tile::SIZE;
 	}
 
-	bool isSameColor(QRgb c1, QRgb c2) {
+	bool isSameColor(QRgb c1, QRgb c2) const {
 		// TODO better color distance function
 		int r = (c1 & 0xff) - (signed int)(c2 & 0xff);
 		int g = (c1>>8 & 0xff) - (signed int)(c2>>8 & 0xff);
@@ -103,13 +120,86 @@ public:
 		return r*r + g*g + b*b + a*a <= tolerance * tolerance;
 	}
 
-	inline bool isOldColorAt(int x, int y) {
-		return isSameColor(colorAt(x, y), oldColor);
+	//! Find the leftmost matching pixel of the run that includes x
+	int scanLeft(int x, int y)
+	{
+		while(x > 0) {
+			const uchar *row = matchRow(x, y);
+			int lx = x % Tile::SIZE;
+			while(lx > 0 && row[lx-1])
+				--lx;
+
+			x = x - x % Tile::SIZE + lx;
+			if(lx > 0 || !matchRow(x-1, y)[Tile::SIZE-1])
+				break;
+			--x;
+		}
+		return x;
+	}
+
+	//! Find the rightmost matching pixel of the run that includes x
+	int scanRight(int x, int y)
+	{
+		const int w1 = width - 1;
+		while(x < w1) {
+			const uchar *row = matchRow(x, y);
+			int lx = x % Tile::SIZE;
+			while(lx < Tile::SIZE-1 && row[lx+1])
+				++lx;
+
+			x = x - x % Tile::SIZE + lx;
+			if(lx < Tile::SIZE-1 || x >= w1 || !matchRow(x+1, y)[0])
+				break;
+			++x;
+		}
+		return x;
+	}
+
+	//! Mark the span as filled and queue seeds for the matching runs above and below it
+	void fillSpan(int x0, int x1, int y)
+	{
+		for(int x=x0;x<=x1;) {
+			const int len = qMin(x1 + 1, (x / Tile::SIZE + 1) * Tile::SIZE) - x;
+			memset(matchRow(x, y) + x % Tile::SIZE, 0, len);
+			x += len;
+		}
+
+		spans.append(Span { x0, x1, y });
+		filledSize += x1 - x0 + 1;
+
+		if(y > 0)
+			queueRuns(x0, x1, y-1);
+		if(y < height-1)
+			queueRuns(x0, x1, y+1);
+	}
+
+	void queueRuns(int x0, int x1, int y)
+	{
+		bool inRun = false;
+		for(int x=x0;x<=x1;) {
+			const uchar *row = matchRow(x, y);
+			const int tileEnd = qMin(x1 + 1, (x / Tile::SIZE + 1) * Tile::SIZE);
+			for(;x<tileEnd;++x) {
+				if(row[x % Tile::SIZE]) {
+					if(!inRun) {
+						seeds.append(QPoint(x, y));
+						inRun = true;
+					}
+				} else {
+					inRun = false;
+				}
+			}
+		}
 	}
 
 	void start(const QPoint &startPoint)
 	{
-		oldColor = colorAt(startPoint.x(), startPoint.y());
+		{
+			const int tx = startPoint.x() / Tile::SIZE;
+			const int ty = startPoint.y() / Tile::SIZE;
+			oldColor = sourceTile(tx, ty).pixel(startPoint.x() - tx * Tile::SIZE, startPoint.y() - ty * Tile::SIZE);
+		}
+
 		if(qAlpha(fillColor) == 0) {
 			// Transparent fill: assign fill color to some other color
 			// than the starting point, unless it's transparent
@@ -139,65 +229,66 @@ public:
 			layerSeedColor = sl->tile(tx, ty).pixel(x, y);
 		}
 
-		QStack<QPoint> stack;
-		stack.push(startPoint);
-
-		const int w1 = scratch.width()-1;
-
-		while(!stack.isEmpty() && filledSize < sizelimit) {
-			QPoint p = stack.pop();
-
-			const int x = p.x();
-			int y = p.y();
+		seeds.append(startPoint);
 
-			bool spanLeft = false;
-			bool spanRight = false;
+		while(!seeds.isEmpty() && filledSize < sizelimit) {
+			const QPoint p = seeds.takeLast();
 
-			while(y>=0 && isOldColorAt(x, y)) --y;
-			++y;
+			// The seed may have been filled already via another span
+			if(!matchRow(p.x(), p.y())[p.x() % Tile::SIZE])
+				continue;
 
-			while(y < scratch.height() && isOldColorAt(x, y)) {
-				setPixel(x, y);
-				++filledSize;
-
-				if(!spanLeft && x>0 && isOldColorAt(x-1, y)) {
-					stack.push(QPoint(x-1, y));
-					spanLeft = true;
-
-				} else if(spanLeft && x>0 && !isOldColorAt(x-1, y)) {
-					spanLeft = false;
-
-				} else if(!spanRight && x<w1 && isOldColorAt(x+1, y)) {
-					stack.push(QPoint(x+1, y));
-					spanRight = true;
-
-				} else if(spanRight && x<w1 && !isOldColorAt(x+1, y)) {
-					spanRight = false;
-				}
-				++y;
-			}
+			fillSpan(scanLeft(p.x(), p.y()), scanRight(p.x(), p.y()), p.y());
 		}
 	}
 
 	FillResult result() const
 	{
 		FillResult res;
-		res.image = fill.toCroppedImage(&res.x, &res.y);
 		res.layerSeedColor = layerSeedColor;
 		res.oversize = filledSize >= sizelimit;
+
+		if(spans.isEmpty())
+			return res;
+
+		int left = width, right = 0, top = height, bottom = 0;
+		for(const Span &s : spans) {
+			left = qMin(left, s.x0);
+			right = qMax(right, s.x1);
+			top = qMin(top, s.y);
+			bottom = qMax(bottom, s.y);
+		}
+
+		res.x = left;
+		res.y = top;
+		res.image = QImage(right - left + 1, bottom - top + 1, QImage::Format_ARGB32_Premultiplied);
+		res.image.fill(0);
+
+		for(const Span &s : spans) {
+			quint32 *row = reinterpret_cast<quint32*>(res.image.scanLine(s.y - top));
+			std::fill(row + s.x0 - left, row + s.x1 - left + 1, fillColor);
+		}
+
 		return res;
 	}
 
 private:
+	struct Span {
+		int x0, x1, y;
+	};
 
 	const LayerStack *source;
+	const int width, height;
+	const int xtiles, ytiles;
+
+	// Match bitmaps (1 for pixels yet to be filled) for each tile, generated on demand.
+	QVector<uchar*> matchTiles;
 
-	// The (optionally) merged tile from the image. This layer is also
-	// updated during the fill.
-	Layer scratch;
+	// The filled spans
+	QVector<Span> spans;
 
-	// The fill layer, containing just the filled pixels
-	Layer fill;
+	// Unprocessed fill seeds
+	QVector<QPoint> seeds;
 
 	// Target layer
 	int layer;
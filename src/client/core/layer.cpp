@@ -28,11 +28,16 @@
 
 #include <QPainter>
 #include <QImage>
+#include <QPolygonF>
+#include <QTransform>
 #include <QDataStream>
 #include <cmath>
 
 namespace paintcore {
 
+// Number of tiles merged per scheduled task
+static const int MERGE_GRAIN = 4;
+
 namespace {
 
 //! Sample colors at layer edges and return the most frequent color
@@ -107,12 +112,12 @@ Layer::Layer(int id, const QString& title, const QColor& color, const QSize& siz
 	  m_width(size.width()),
 	  m_height(size.height()),
 	  m_xtiles(Tile::roundTiles(size.width())),
-	  m_ytiles(Tile::roundTiles(size.height()))
+	  m_ytiles(Tile::roundTiles(size.height())),
+	  m_xoffset(0),
+	  m_yoffset(0)
 {
-	m_tiles = QVector<Tile>(
-		m_xtiles * m_ytiles,
-		color.alpha() > 0 ? Tile(color) : Tile()
-	);
+	if(color.alpha() > 0)
+		m_defaultTile = Tile(color);
 }
 
 Layer::Layer(int id, const QSize &size)
@@ -125,8 +130,10 @@ Layer::Layer(const Layer &layer)
 	: m_info(layer.m_info),
 	  m_changeBounds(layer.m_changeBounds),
 	  m_tiles(layer.m_tiles),
+	  m_defaultTile(layer.m_defaultTile),
 	  m_width(layer.m_width), m_height(layer.m_height),
-	  m_xtiles(layer.m_xtiles), m_ytiles(layer.m_ytiles)
+	  m_xtiles(layer.m_xtiles), m_ytiles(layer.m_ytiles),
+	  m_xoffset(layer.m_xoffset), m_yoffset(layer.m_yoffset)
 {
 	// Hidden and ephemeral layers are not copied, since hiding a sublayer is
 	// effectively the same as deleting it and ephemeral layers are not considered
@@ -137,39 +144,103 @@ Layer::Layer(const Layer &layer)
 	}
 }
 
+bool Layer::hasSharedPixels(const Layer &other) const
+{
+	return m_width == other.m_width && m_height == other.m_height &&
+		m_xoffset == other.m_xoffset && m_yoffset == other.m_yoffset &&
+		m_defaultTile == other.m_defaultTile &&
+		(m_tiles.isSharedWith(other.m_tiles) || (m_tiles.isEmpty() && other.m_tiles.isEmpty()));
+}
+
 Layer::~Layer() {
 	for(Layer *sl : m_sublayers)
 		delete sl;
 }
 
+void Layer::clearTiles(const Tile &defaultTile)
+{
+	m_tiles.clear();
+	m_defaultTile = defaultTile;
+	m_xoffset = 0;
+	m_yoffset = 0;
+}
+
 QImage Layer::toImage() const {
 	QImage image(m_width, m_height, QImage::Format_ARGB32_Premultiplied);
-	int i=0;
 	for(int y=0;y<m_ytiles;++y) {
-		for(int x=0;x<m_xtiles;++x,++i)
-			m_tiles[i].copyToImage(image, x*Tile::SIZE, y*Tile::SIZE);
+		for(int x=0;x<m_xtiles;++x)
+			tile(x, y).copyToImage(image, x*Tile::SIZE, y*Tile::SIZE);
 	}
 	return image;
 }
 
+/**
+ * Only the tiles under the area are read, so this is cheap even when
+ * the layer is huge.
+ */
+QImage Layer::toImage(const QRect &rect) const
+{
+	QImage image(rect.size(), QImage::Format_ARGB32_Premultiplied);
+	image.fill(0);
+
+	const QRect area = rect & QRect(0, 0, m_width, m_height);
+	if(area.isEmpty())
+		return image;
+
+	const int tx0 = area.left() / Tile::SIZE;
+	const int tx1 = area.right() / Tile::SIZE;
+	const int ty0 = area.top() / Tile::SIZE;
+	const int ty1 = area.bottom() / Tile::SIZE;
+
+	for(int ty=ty0;ty<=ty1;++ty) {
+		for(int tx=tx0;tx<=tx1;++tx) {
+			const Tile &t = tile(tx, ty);
+			if(t.isNull())
+				continue;
+
+			const QRect tileRect(tx*Tile::SIZE, ty*Tile::SIZE, Tile::SIZE, Tile::SIZE);
+			const QRect r = tileRect & area;
+			const quint32 *src = t.constData() + (r.y() - tileRect.y()) * Tile::SIZE + (r.x() - tileRect.x());
+
+			for(int y=r.top();y<=r.bottom();++y,src+=Tile::SIZE) {
+				memcpy(
+					image.scanLine(y - rect.y()) + (r.x() - rect.x()) * 4,
+					src,
+					r.width() * 4
+				);
+			}
+		}
+	}
+
+	return image;
+}
+
 QImage Layer::toCroppedImage(int *xOffset, int *yOffset) const
 {
 	int top=m_ytiles, bottom=0;
 	int left=m_xtiles, right=0;
 
 	// Find bounding rectangle of non-blank tiles
-	for(int y=0;y<m_ytiles;++y) {
-		for(int x=0;x<m_xtiles;++x) {
-			const Tile &t = m_tiles.at(y*m_xtiles + x);
-			if(!t.isBlank()) {
-				if(x<left)
-					left=x;
-				if(x>right)
-					right=x;
-				if(y<top)
-					top=y;
-				if(y>bottom)
-					bottom=y;
+	if(!m_defaultTile.isBlank() && m_tiles.size() < m_xtiles*m_ytiles) {
+		// At least one tile is the (non-blank) default tile. We could find out
+		// exactly where, but that's rarely useful: the whole layer is likely nonblank.
+		top = 0;
+		left = 0;
+		bottom = m_ytiles-1;
+		right = m_xtiles-1;
+
+	} else {
+		for(auto i=m_tiles.constBegin();i!=m_tiles.constEnd();++i) {
+			if(!i.value().isBlank()) {
+				const QPoint p = tilePosition(i.key());
+				if(p.x()<left)
+					left=p.x();
+				if(p.x()>right)
+					right=p.x();
+				if(p.y()<top)
+					top=p.y();
+				if(p.y()>bottom)
+					bottom=p.y();
 			}
 		}
 	}
@@ -183,7 +254,7 @@ QImage Layer::toCroppedImage(int *xOffset, int *yOffset) const
 	QImage image((right-left+1)*Tile::SIZE, (bottom-top+1)*Tile::SIZE, QImage::Format_ARGB32_Premultiplied);
 	for(int y=top;y<=bottom;++y) {
 		for(int x=left;x<=right;++x) {
-			m_tiles.at(y*m_xtiles+x).copyToImage(image, (x-left)*Tile::SIZE, (y-top)*Tile::SIZE);
+			tile(x, y).copyToImage(image, (x-left)*Tile::SIZE, (y-top)*Tile::SIZE);
 		}
 	}
 
@@ -346,9 +417,7 @@ QColor Layer::getDabColor(const BrushStamp &stamp) const
 			const int xindex = x / Tile::SIZE;
 			const int xt = x - xindex * Tile::SIZE;
 			const int wb = xt+dia-xb < Tile::SIZE ? dia-xb : Tile::SIZE-xt;
-			const int i = m_xtiles * yindex + xindex;
-
-			std::array<quint32, 5> avg = m_tiles.at(i).weightedAverage(weights + yb * dia + xb, xt, yt, wb, hb, dia-wb);
+			std::array<quint32, 5> avg = tile(xindex, yindex).weightedAverage(weights + yb * dia + xb, xt, yt, wb, hb, dia-wb);
 			weight += avg[0];
 			red += avg[1];
 			green += avg[2];
@@ -378,15 +447,45 @@ QColor Layer::getDabColor(const BrushStamp &stamp) const
 	return QColor::fromRgbF(red, green, blue, alpha);
 }
 
+/**
+ * Tiles still shared with a copy of the layer (such as a savepoint) are not counted.
+ */
+qint64 Layer::uniqueTileBytes() const
+{
+	qint64 bytes = 0;
+
+	// If the whole tile map is shared, so are the tiles in it
+	if(m_tiles.isDetached()) {
+		for(const Tile &t : m_tiles) {
+			if(!t.isNull() && !t.isShared())
+				bytes += Tile::BYTES;
+		}
+	}
+	if(!m_defaultTile.isNull() && !m_defaultTile.isShared())
+		bytes += Tile::BYTES;
+
+	for(const Layer *sl : m_sublayers)
+		bytes += sl->uniqueTileBytes();
+
+	return bytes;
+}
+
 /**
  * Free all tiles that are completely transparent
  */
 void Layer::optimize()
 {
-	// Optimize tile memory usage
-	for(int i=0;i<m_tiles.size();++i) {
-		if(!m_tiles[i].isNull() && m_tiles[i].isBlank())
-			m_tiles[i] = Tile();
+	// Optimize tile memory usage: drop tiles that are identical to the
+	// default tile. (When the default tile is null, any blank tile is identical.)
+	QMutableHashIterator<quint32, Tile> ti(m_tiles);
+	while(ti.hasNext()) {
+		const Tile &t = ti.next().value();
+		if(m_defaultTile.isNull() ? t.isBlank() : t == m_defaultTile)
+			ti.remove();
+	}
+	if(m_tiles.isEmpty()) {
+		m_xoffset = 0;
+		m_yoffset = 0;
 	}
 
 	// Delete unused sublayers
@@ -409,7 +508,7 @@ Layer *Layer::getSubLayer(int id, BlendMode::Mode blendmode, uchar opacity)
 		if(sl->id() == id) {
 			if(sl->isHidden()) {
 				// Hidden, reset properties
-				sl->m_tiles.fill(Tile());
+				sl->clearTiles(Tile());
 				sl->m_info.opacity = opacity;
 				sl->m_info.blend = blendmode;
 				sl->m_info.hidden = false;
@@ -423,7 +522,7 @@ Layer *Layer::getSubLayer(int id, BlendMode::Mode blendmode, uchar opacity)
 		if(sl->isHidden()) {
 			// Set these flags directly to avoid markDirty call.
 			// We know the layer is invisible at this point
-			sl->m_tiles.fill(Tile());
+			sl->clearTiles(Tile());
 			sl->m_info.id = id;
 			sl->m_info.opacity = opacity;
 			sl->m_info.blend = blendmode;
@@ -451,8 +550,9 @@ void Layer::toDatastream(QDataStream &out) const
 	out << m_info.hidden;
 
 	// Write layer content
-	for(const Tile &t : m_tiles)
-		out << t;
+	for(int y=0;y<m_ytiles;++y)
+		for(int x=0;x<m_xtiles;++x)
+			out << tile(x, y);
 
 	// Write sublayers
 	out << quint8(m_sublayers.size());
@@ -481,8 +581,14 @@ Layer *Layer::fromDatastream(QDataStream &in)
 	// Read tiles
 	Layer *layer = new Layer(id, title, Qt::transparent, QSize(lw, lh));
 
-	for(Tile &t : layer->m_tiles)
-		in >> t;
+	for(int y=0;y<layer->m_ytiles;++y) {
+		for(int x=0;x<layer->m_xtiles;++x) {
+			Tile t;
+			in >> t;
+			if(!t.isNull())
+				layer->m_tiles.insert(layer->tileKey(x, y), t);
+		}
+	}
 
 	layer->m_info.opacity = opacity;
 	layer->m_info.blend = BlendMode::Mode(blend);
@@ -518,24 +624,21 @@ void EditableLayer::resize(int top, int right, int bottom, int left)
 	int width = left + d->m_width + right;
 	int height = top + d->m_height + bottom;
 
-	int xtiles = Tile::roundTiles(width);
-	int ytiles = Tile::roundTiles(height);
-	QVector<Tile> tiles(xtiles * ytiles);
+	const int xtiles = Tile::roundTiles(width);
+	const int ytiles = Tile::roundTiles(height);
 
 	// if there is no old content, resizing is simple
-	bool hascontent = false;
-	for(int i=0;i<d->m_tiles.size();++i) {
-		if(!d->m_tiles.at(i).isBlank()) {
+	bool hascontent = !d->m_defaultTile.isBlank();
+	for(auto i=d->m_tiles.constBegin();!hascontent && i!=d->m_tiles.constEnd();++i) {
+		if(!i.value().isBlank())
 			hascontent = true;
-			break;
-		}
 	}
 	if(!hascontent) {
 		d->m_width = width;
 		d->m_height = height;
 		d->m_xtiles = xtiles;
 		d->m_ytiles = ytiles;
-		d->m_tiles = tiles;
+		d->clearTiles(Tile());
 		return;
 	}
 
@@ -558,7 +661,6 @@ void EditableLayer::resize(int top, int right, int bottom, int left)
 		d->m_height = height;
 		d->m_xtiles = xtiles;
 		d->m_ytiles = ytiles;
-		d->m_tiles = tiles;
 		if(left<0 || top<0) {
 			int cropx = 0;
 			if(left<0) {
@@ -573,40 +675,75 @@ void EditableLayer::resize(int top, int right, int bottom, int left)
 			oldcontent = oldcontent.copy(cropx, cropy, oldcontent.width()-cropx, oldcontent.height()-cropy);
 		}
 
-		d->m_tiles.fill(bgtile);
+		d->clearTiles(bgtile);
 
 		putImage(left, top, oldcontent, BlendMode::MODE_REPLACE);
 
 	} else {
 		// top/left offset is aligned at tile boundary:
-		// existing tile content can be reused
+		// existing tile content can be reused by shifting the tile map's origin.
+		const int dx = left / Tile::SIZE;
+		const int dy = top / Tile::SIZE;
 
-		const int firstrow = Tile::roundTiles(-top);
-		const int firstcol = Tile::roundTiles(-left);
+		// The old content area, in new tile coordinates
+		const QRect oldArea = QRect(dx, dy, d->m_xtiles, d->m_ytiles).intersected(QRect(0, 0, xtiles, ytiles));
+
+		const Tile oldDefault = d->m_defaultTile;
+
+		d->m_xoffset -= dx;
+		d->m_yoffset -= dy;
+		d->m_width = width;
+		d->m_height = height;
+		d->m_xtiles = xtiles;
+		d->m_ytiles = ytiles;
 
-		int oldy = firstrow;
-		for(int y=0;y<ytiles;++y,++oldy) {
-			int oldx = firstcol;
-			const int oldyy = d->m_xtiles * oldy;
-			const int yy = xtiles * y;
-			for(int x=0;x<xtiles;++x,++oldx) {
-				const int i = yy + x;
+		// Drop tiles that are now outside the layer
+		QMutableHashIterator<quint32, Tile> ti(d->m_tiles);
+		while(ti.hasNext()) {
+			if(!oldArea.contains(d->tilePosition(ti.next().key())))
+				ti.remove();
+		}
 
-				if(oldy<0 || oldy>=d->m_ytiles || oldx<0 || oldx>=d->m_xtiles) {
-					tiles[i] = bgtile;
+		// Fill the newly exposed area. When the old default tile is
+		// the same as the background, nothing needs to be done. Otherwise
+		// whichever area is smaller gets its tiles stored explicitly.
+		if(!oldDefault.equals(bgtile)) {
+			const int newTiles = xtiles * ytiles - oldArea.width() * oldArea.height();
+			if(newTiles <= oldArea.width() * oldArea.height()) {
+				for(int y=0;y<ytiles;++y) {
+					for(int x=0;x<xtiles;++x) {
+						if(!oldArea.contains(x, y))
+							d->m_tiles.insert(d->tileKey(x, y), bgtile);
+					}
+				}
 
-				} else {
-					const int oldi = oldyy + oldx;
-					tiles[i] = d->m_tiles.at(oldi);
+			} else {
+				for(int y=oldArea.top();y<=oldArea.bottom();++y) {
+					for(int x=oldArea.left();x<=oldArea.right();++x) {
+						const quint32 key = d->tileKey(x, y);
+						if(!d->m_tiles.contains(key))
+							d->m_tiles.insert(key, oldDefault);
+					}
 				}
+				d->m_defaultTile = bgtile;
 			}
 		}
 
-		d->m_width = width;
-		d->m_height = height;
-		d->m_xtiles = xtiles;
-		d->m_ytiles = ytiles;
-		d->m_tiles = tiles;
+		// Keep the offsets (and thus the tile map keys) within range
+		if(d->m_tiles.isEmpty()) {
+			d->m_xoffset = 0;
+			d->m_yoffset = 0;
+
+		} else if(qAbs(d->m_xoffset) > 0x3fff || qAbs(d->m_yoffset) > 0x3fff) {
+			QHash<quint32, Tile> tiles;
+			for(auto i=d->m_tiles.constBegin();i!=d->m_tiles.constEnd();++i) {
+				const QPoint p = d->tilePosition(i.key());
+				tiles.insert(quint32(p.y()) << 16 | quint32(p.x()), i.value());
+			}
+			d->m_tiles = tiles;
+			d->m_xoffset = 0;
+			d->m_yoffset = 0;
+		}
 	}
 }
 
@@ -699,6 +836,60 @@ void EditableLayer::putImage(int x, int y, QImage image, BlendMode::Mode mode)
 		owner->markDirty(QRect(x, y, image.width(), image.height()));
 }
 
+/**
+ * The image is rendered one tile at a time, so no temporary buffer larger
+ * than a tile is needed. Only the tiles the transformed image touches are
+ * rendered and written to.
+ *
+ * Each tile is rendered with the same transformation and clipping as if the
+ * whole target rectangle was rendered into one image first, so the result
+ * is the same.
+ */
+void EditableLayer::putTransformedImage(const QImage &image, const QTransform &transform, const QRect &target, BlendMode::Mode mode)
+{
+	Q_ASSERT(d);
+	Q_ASSERT(image.format() == QImage::Format_ARGB32_Premultiplied);
+
+	const QRect bounds = target & QRect(0, 0, d->m_width, d->m_height);
+	if(bounds.isEmpty())
+		return;
+
+	const QPolygonF quad = transform.map(QPolygonF(QRectF(image.rect()))).translated(target.topLeft());
+
+	const int tx0 = bounds.left() / Tile::SIZE;
+	const int tx1 = bounds.right() / Tile::SIZE;
+	const int ty0 = bounds.top() / Tile::SIZE;
+	const int ty1 = bounds.bottom() / Tile::SIZE;
+
+	QImage tileImage(Tile::SIZE, Tile::SIZE, QImage::Format_ARGB32_Premultiplied);
+
+	for(int ty=ty0;ty<=ty1;++ty) {
+		for(int tx=tx0;tx<=tx1;++tx) {
+			const QRect tileRect(tx*Tile::SIZE, ty*Tile::SIZE, Tile::SIZE, Tile::SIZE);
+
+			// Skip tiles within the bounding box, but outside the (rotated) quad
+			if(quad.intersected(QPolygonF(QRectF(tileRect.adjusted(-1, -1, 1, 1)))).isEmpty())
+				continue;
+
+			tileImage.fill(0);
+			{
+				QPainter painter(&tileImage);
+				painter.setRenderHint(QPainter::SmoothPixmapTransform);
+				painter.setClipRect(target.translated(-tileRect.topLeft()));
+				painter.setTransform(transform * QTransform::fromTranslate(target.x() - tileRect.x(), target.y() - tileRect.y()));
+				painter.drawImage(0, 0, image);
+			}
+
+			const Tile t(tileImage, 0, 0);
+			if(!t.isBlank())
+				d->rtile(tx, ty).merge(t, 255, mode);
+		}
+	}
+
+	if(owner && d->isVisible())
+		owner->markDirty(bounds);
+}
+
 void EditableLayer::putTile(int col, int row, int repeat, const Tile &tile, int sublayer)
 {
 	Q_ASSERT(d);
@@ -713,9 +904,9 @@ void EditableLayer::putTile(int col, int row, int repeat, const Tile &tile, int
 	}
 
 	int i=row*d->m_xtiles+col;
-	const int end = qMin(i+repeat, d->m_tiles.size()-1);
+	const int end = qMin(i+repeat, d->m_xtiles*d->m_ytiles-1);
 	for(;i<=end;++i) {
-		d->m_tiles[i] = tile;
+		d->rtile(i % d->m_xtiles, i / d->m_xtiles) = tile;
 		if(owner && d->isVisible())
 			owner->markDirty(i);
 	}
@@ -727,7 +918,7 @@ void EditableLayer::fillRect(const QRect &rectangle, const QColor &color, BlendM
 
 	if(rectangle.contains(canvas) && blendmode==BlendMode::MODE_REPLACE) {
 		// Special case: overwrite whole layer
-		d->m_tiles.fill(Tile(color));
+		d->clearTiles(color.alpha() > 0 ? Tile(color) : Tile());
 
 	} else {
 		// The usual case: only a portion of the layer is filled or pixel blending is needed
@@ -761,10 +952,8 @@ void EditableLayer::fillRect(const QRect &rectangle, const QColor &color, BlendM
 				int w = qMin((tx+1)*size, right) - tx*size - left;
 				int h = qMin((ty+1)*size, bottom) - ty*size - top;
 
-				Tile &t = d->m_tiles[ty*d->m_xtiles+tx];
-
-				if(!t.isNull() || canIncrOpacity)
-					t.composite(blendmode, mask, color, left, top, w, h, 0);
+				if(canIncrOpacity || !d->tile(tx, ty).isNull())
+					d->rtile(tx, ty).composite(blendmode, mask, color, left, top, w, h, 0);
 			}
 		}
 	}
@@ -802,8 +991,7 @@ void EditableLayer::putBrushStamp(const BrushStamp &bs, const QColor &color, Ble
 			const int xindex = x / Tile::SIZE;
 			const int xt = x - xindex * Tile::SIZE;
 			const int wb = xt+dia-xb < Tile::SIZE ? dia-xb : Tile::SIZE-xt;
-			const int i = d->m_xtiles * yindex + xindex;
-			d->m_tiles[i].composite(
+			d->rtile(xindex, yindex).composite(
 					blendmode,
 					values + yb * dia + xb,
 					color,
@@ -837,30 +1025,60 @@ void EditableLayer::merge(const Layer *layer)
 	Q_ASSERT(layer->m_xtiles == d->m_xtiles);
 	Q_ASSERT(layer->m_ytiles == d->m_ytiles);
 
+	struct MergeTile {
+		Tile *target;
+		const Tile *source;
+	};
+
 	// Gather a list of non-null source tiles to merge
-	QList<int> mergeidx;
-	for(int i=0;i<d->m_tiles.size();++i) {
-		if(!layer->m_tiles.at(i).isNull())
-			mergeidx.append(i);
+	QVector<QPoint> positions;
+	if(!layer->m_defaultTile.isNull()) {
+		positions.reserve(d->m_xtiles * d->m_ytiles);
+		for(int y=0;y<d->m_ytiles;++y)
+			for(int x=0;x<d->m_xtiles;++x)
+				positions << QPoint(x, y);
+
+	} else {
+		positions.reserve(layer->m_tiles.size());
+		for(auto i=layer->m_tiles.constBegin();i!=layer->m_tiles.constEnd();++i) {
+			if(!i.value().isNull())
+				positions << layer->tilePosition(i.key());
+		}
 	}
 
-	// Detach tile vector explicitly to make sure concurrent modifications
-	// are all done to the same vector
-	d->m_tiles.detach();
+	// Make sure all target tiles exist in the tile map before taking
+	// references to them, so the concurrent phase below will not modify
+	// the tile map itself.
+	for(const QPoint &p : positions)
+		d->rtile(p.x(), p.y());
+
+	QVector<MergeTile> merges;
+	merges.reserve(positions.size());
+	for(const QPoint &p : positions)
+		merges << MergeTile { &d->rtile(p.x(), p.y()), &layer->tile(p.x(), p.y()) };
 
 	// Merge tiles
-	concurrentForEach<int>(mergeidx, [this, layer](int idx) {
-		d->m_tiles[idx].merge(layer->m_tiles.at(idx), layer->opacity(), layer->blendmode());
+	const MergeTile *mergeData = merges.constData();
+	const uchar opacity = layer->opacity();
+	const BlendMode::Mode blendmode = layer->blendmode();
+	TaskScheduler::instance()->parallelFor(merges.size(), MERGE_GRAIN, [mergeData, opacity, blendmode](int, int begin, int end) {
+		for(int i=begin;i<end;++i)
+			mergeData[i].target->merge(*mergeData[i].source, opacity, blendmode);
 	});
 
 	// Merging a layer does not cause an immediate visual change, so we don't
-	// mark the area as dirty here.
+	// mark the area as dirty here. The flattened image without sublayers
+	// does change, though.
+	if(owner) {
+		for(const QPoint &p : positions)
+			owner->markChanged(p.x(), p.y());
+	}
 }
 
 void EditableLayer::makeBlank()
 {
 	Q_ASSERT(d);
-	d->m_tiles.fill(Tile());
+	d->clearTiles(Tile());
 
 	if(owner && d->isVisible())
 		owner->markDirty();
@@ -935,9 +1153,16 @@ void EditableLayer::markOpaqueDirty(bool forceVisible)
 	if(!owner || !(forceVisible || d->isVisible()))
 		return;
 
-	for(int i=0;i<d->m_tiles.size();++i) {
-		if(!d->m_tiles.at(i).isNull())
-			owner->markDirty(i);
+	if(!d->m_defaultTile.isNull()) {
+		owner->markDirty();
+
+	} else {
+		for(auto i=d->m_tiles.constBegin();i!=d->m_tiles.constEnd();++i) {
+			if(!i.value().isNull()) {
+				const QPoint p = d->tilePosition(i.key());
+				owner->markDirty(p.x(), p.y());
+			}
+		}
 	}
 }
 
@@ -21,11 +21,12 @@
 
 #include "tile.h"
 
-#include <QVector>
+#include <QHash>
 #include <QColor>
 #include <QRect>
 
 class QImage;
+class QTransform;
 class QSize;
 class QDataStream;
 
@@ -64,6 +65,12 @@ struct LayerInfo {
  * Although images of arbitrary size can be created, the true layer size is
  * always a multiple of Tile::SIZE.
  *
+ * The tiles are stored sparsely: only tiles that differ from the layer's
+ * default tile (typically a null tile, or the fill color the layer was
+ * created with) are kept in the tile map. Copying a layer, taking a
+ * savepoint or doing a tile aligned resize is therefore proportional to the
+ * painted area rather than the layer size.
+ *
  * Layer editing functions are provided via the EditableLayer wrapper class.
  * However, you should typically not instantiate this class yourself. Instead,
  * use the LayerStackWriteSequence class.
@@ -72,6 +79,7 @@ struct LayerInfo {
  */
 class Layer {
 	friend class EditableLayer;
+	friend class Savepoint;
 public:
 	//! Construct a layer filled with solid color
 	Layer(int id, const QString& title, const QColor& color, const QSize& size);
@@ -95,6 +103,9 @@ public:
 	//! Get the layer as an image
 	QImage toImage() const;
 
+	//! Get an area of the layer as an image (parts outside the layer are transparent)
+	QImage toImage(const QRect &rect) const;
+
 	//! Get the layer as an image with excess transparency cropped away
 	QImage toCroppedImage(int *xOffset, int *yOffset) const;
 
@@ -151,11 +162,32 @@ public:
 	const Tile &tile(int x, int y) const {
 		Q_ASSERT(x>=0 && x<m_xtiles);
 		Q_ASSERT(y>=0 && y<m_ytiles);
-		return m_tiles[y*m_xtiles+x];
+		const auto i = m_tiles.constFind(tileKey(x, y));
+		return i != m_tiles.constEnd() ? i.value() : m_defaultTile;
 	}
 
 	//! Get a tile
-	const Tile &tile(int index) const { Q_ASSERT(index>=0 && index<m_xtiles*m_ytiles); return m_tiles[index]; }
+	const Tile &tile(int index) const { Q_ASSERT(index>=0 && index<m_xtiles*m_ytiles); return tile(index % m_xtiles, index / m_xtiles); }
+
+	//! Get the number of tile columns
+	int xtiles() const { return m_xtiles; }
+
+	//! Get the number of tile rows
+	int ytiles() const { return m_ytiles; }
+
+	//! Get the number of explicitly stored (non-default) tiles
+	int storedTileCount() const { return m_tiles.size(); }
+
+	//! Get the memory used by tiles (including sublayers') not shared with any other layer
+	qint64 uniqueTileBytes() const;
+
+	/**
+	 * @brief Check if this layer's pixel content is shared with the other layer
+	 *
+	 * This is a quick check that returns true only when neither layer's tiles have been
+	 * modified since one was copied from the other. Sublayers are not compared.
+	 */
+	bool hasSharedPixels(const Layer &other) const;
 
 	//! Get the sublayers
 	const QList<Layer*> &sublayers() const { return m_sublayers; }
@@ -179,9 +211,6 @@ public:
 	void toDatastream(QDataStream &out) const;
 	static Layer *fromDatastream(QDataStream &in);
 
-	//! Get this layer's tile vector
-	const QVector<Tile> tiles() const { return m_tiles; }
-
 	/**
 	 * @brief Get the layer's change bounds
 	 */
@@ -211,20 +240,42 @@ private:
 	Tile &rtile(int x, int y) {
 		Q_ASSERT(x>=0 && x<m_xtiles);
 		Q_ASSERT(y>=0 && y<m_ytiles);
-		return m_tiles[y*m_xtiles+x];
+		const quint32 key = tileKey(x, y);
+		auto i = m_tiles.find(key);
+		if(i == m_tiles.end())
+			i = m_tiles.insert(key, m_defaultTile);
+		return i.value();
+	}
+
+	//! Get the tile map key for the given tile coordinates
+	quint32 tileKey(int x, int y) const {
+		return quint32((y + m_yoffset) & 0xffff) << 16 | quint32((x + m_xoffset) & 0xffff);
+	}
+
+	//! Get the tile coordinates of a tile map key
+	QPoint tilePosition(quint32 key) const {
+		return QPoint(qint16(key & 0xffff) - m_xoffset, qint16(key >> 16) - m_yoffset);
 	}
 
+	//! Remove all stored tiles and set a new default tile
+	void clearTiles(const Tile &defaultTile);
 
 	LayerInfo m_info;
 	QRect m_changeBounds;
 
-	QVector<Tile> m_tiles;
+	// Explicitly stored tiles. Tiles not in the map are equal to m_defaultTile.
+	// The keys are tile coordinates offset by m_xoffset and m_yoffset,
+	// so a tile aligned resize only needs to change the offset.
+	QHash<quint32, Tile> m_tiles;
+	Tile m_defaultTile;
 	QList<Layer*> m_sublayers;
 
 	int m_width;
 	int m_height;
 	int m_xtiles;
 	int m_ytiles;
+	int m_xoffset;
+	int m_yoffset;
 };
 
 /**
@@ -269,6 +320,16 @@ public:
 	//! Draw an image onto the layer
 	void putImage(int x, int y, QImage image, BlendMode::Mode mode);
 
+	/**
+	 * @brief Draw a transformed image onto the layer
+	 *
+	 * @param image the image to draw
+	 * @param transform transformation relative to the top-left corner of the target rectangle
+	 * @param target the image is clipped to this rectangle
+	 * @param mode blending mode
+	 */
+	void putTransformedImage(const QImage &image, const QTransform &transform, const QRect &target, BlendMode::Mode mode);
+
 	//! Set a tile
 	void putTile(int col, int row, int repeat, const Tile &tile, int sublayer=0);
 
@@ -26,6 +26,7 @@
 #include <QPainter>
 #include <QMimeData>
 #include <QDataStream>
+#include <QVarLengthArray>
 
 namespace paintcore {
 
@@ -103,21 +104,13 @@ int LayerStack::indexOf(int id) const
 	return -1;
 }
 
-namespace {
-
-struct UpdateTile {
-	UpdateTile() : x(-1), y(-1) {}
-	UpdateTile(int x_, int y_) : x(x_), y(y_) {}
-
-	int x, y;
-	quint32 data[Tile::LENGTH];
-};
-
-}
-
 /**
  * The dirty flag for each painted tile will be cleared.
  *
+ * If the target is a premultiplied ARGB QImage, the tiles are flattened
+ * and copied straight into the image in parallel. Otherwise, they are
+ * flattened in batches into a reusable scratch buffer and painted with QPainter.
+ *
  * @param rect area of the image to limit repainting to (rounded upwards to tile boundaries)
  * @param target device to paint onto
  */
@@ -133,14 +126,14 @@ void LayerStack::paintChangedTiles(const QRect& rect, QPaintDevice *target, bool
 	const int ty1 = qBound(ty0, rect.bottom() / Tile::SIZE, m_ytiles-1);
 
 	// Gather list of tiles in need of updating
-	QList<UpdateTile*> updates;
+	m_paintQueue.resize(0);
 
 	for(int ty=ty0;ty<=ty1;++ty) {
 		const int y = ty*m_xtiles;
 		for(int tx=tx0;tx<=tx1;++tx) {
 			const int i = y+tx;
 			if(m_dirtytiles.testBit(i)) {
-				updates.append(new UpdateTile(tx, ty));
+				m_paintQueue.append(QPoint(tx, ty));
 
 				// TODO this conditional is for transitioning to QtQuick. Remove once old view is removed.
 				if(clean)
@@ -149,35 +142,111 @@ void LayerStack::paintChangedTiles(const QRect& rect, QPaintDevice *target, bool
 		}
 	}
 
-	if(!updates.isEmpty()) {
-		// Flatten tiles
-		concurrentForEach<UpdateTile*>(updates, [this](UpdateTile *t) {
-			m_paintBackgroundTile.copyTo(t->data);
-			flattenTile(t->data, t->x, t->y);
+	if(m_paintQueue.isEmpty())
+		return;
+
+	m_paintCache.prepare(m_xtiles * m_ytiles);
+
+	TaskScheduler *scheduler = TaskScheduler::instance();
+	const int threads = scheduler->slotCount();
+
+	QImage *image = nullptr;
+	if(target->devType() == QInternal::Image) {
+		image = static_cast<QImage*>(target);
+		if(image->format() != QImage::Format_ARGB32_Premultiplied)
+			image = nullptr;
+	}
+
+	if(image) {
+		// Flatten tiles directly into the target image.
+		// Each thread needs just one scratch tile.
+		if(m_paintScratch.size() < threads * Tile::LENGTH)
+			m_paintScratch.resize(threads * Tile::LENGTH);
+
+		quint32 *scratchPool = m_paintScratch.data();
+		uchar *bits = image->bits();
+		const int bpl = image->bytesPerLine();
+		const int imageWidth = image->width();
+		const int imageHeight = image->height();
+
+		// The cost of flattening varies a lot from tile to tile, so the tiles are
+		// scheduled one by one and idle threads steal work from the busy ones.
+		scheduler->parallelFor(m_paintQueue.size(), 1, [this, scratchPool, bits, bpl, imageWidth, imageHeight](int slot, int begin, int end) {
+			quint32 *scratch = scratchPool + slot * Tile::LENGTH;
+
+			for(int i=begin;i<end;++i) {
+				const QPoint &t = m_paintQueue.at(i);
+				const int x = t.x() * Tile::SIZE;
+				const int y = t.y() * Tile::SIZE;
+				const int w = qMin(int(Tile::SIZE), imageWidth - x);
+				const int h = qMin(int(Tile::SIZE), imageHeight - y);
+				if(w<=0 || h<=0)
+					continue;
+
+				flattenCachedTile(m_paintCache, m_paintBackgroundTile, scratch, t.x(), t.y());
+
+				for(int row=0;row<h;++row) {
+					memcpy(
+						bits + (y+row) * bpl + x * 4,
+						scratch + row * Tile::SIZE,
+						w * 4
+					);
+				}
+			}
 		});
 
-		// Paint flattened tiles
+	} else {
+		// Flatten tiles in batches and paint them
+		const int batchSize = threads * PAINT_BATCH_PER_THREAD;
+		if(m_paintScratch.size() < batchSize * Tile::LENGTH)
+			m_paintScratch.resize(batchSize * Tile::LENGTH);
+
+		quint32 *scratchPool = m_paintScratch.data();
+
 		QPainter painter(target);
 		painter.setCompositionMode(QPainter::CompositionMode_Source);
-		while(!updates.isEmpty()) {
-			UpdateTile *ut = updates.takeLast();
-			painter.drawImage(
-				ut->x*Tile::SIZE,
-				ut->y*Tile::SIZE,
-				QImage(reinterpret_cast<const uchar*>(ut->data),
-					Tile::SIZE, Tile::SIZE,
-					QImage::Format_ARGB32_Premultiplied
-				)
-			);
-			delete ut;
+
+		for(int batch=0;batch<m_paintQueue.size();batch+=batchSize) {
+			const int batchLen = qMin(batchSize, m_paintQueue.size() - batch);
+
+			scheduler->parallelFor(batchLen, 1, [this, scratchPool, batch](int, int begin, int end) {
+				for(int i=begin;i<end;++i) {
+					quint32 *scratch = scratchPool + i * Tile::LENGTH;
+					const QPoint &t = m_paintQueue.at(batch + i);
+					flattenCachedTile(m_paintCache, m_paintBackgroundTile, scratch, t.x(), t.y());
+				}
+			});
+
+			for(int i=0;i<batchLen;++i) {
+				const QPoint &t = m_paintQueue.at(batch + i);
+				painter.drawImage(
+					t.x()*Tile::SIZE,
+					t.y()*Tile::SIZE,
+					QImage(reinterpret_cast<const uchar*>(scratchPool + i * Tile::LENGTH),
+						Tile::SIZE, Tile::SIZE,
+						QImage::Format_ARGB32_Premultiplied
+					)
+				);
+			}
 		}
 	}
 }
 
 Tile LayerStack::getFlatTile(int x, int y) const
 {
-	Tile t = m_backgroundTile;
-	flattenTile(t.data(), x, y);
+	Tile t;
+
+	// If another thread is using the cache, just flatten the tile from scratch
+	const bool inside = x>=0 && x<m_xtiles && y>=0 && y<m_ytiles;
+	if(inside && m_flatCacheMutex.tryLock()) {
+		m_flatCache.prepare(m_xtiles * m_ytiles);
+		flattenCachedTile(m_flatCache, m_backgroundTile, t.data(), x, y);
+		m_flatCacheMutex.unlock();
+
+	} else {
+		t = m_backgroundTile;
+		flattenTile(t.data(), x, y);
+	}
 	return t;
 }
 
@@ -262,6 +331,64 @@ QImage LayerStack::toFlatImage(bool includeAnnotations, bool includeBackground)
 	return image;
 }
 
+/**
+ * The tiles are merged exactly like in toFlatImage (visible layers only,
+ * without sublayers, censoring or view mode effects,) but one tile at a time.
+ */
+QRect LayerStack::updateFlatImage(QImage &image, const QBitArray &tiles) const
+{
+	Q_ASSERT(image.size() == size());
+	Q_ASSERT(image.format() == QImage::Format_ARGB32_Premultiplied);
+	Q_ASSERT(tiles.size() == m_xtiles * m_ytiles);
+
+	QVector<QPoint> queue;
+	QRect bounds;
+	for(int ty=0;ty<m_ytiles;++ty) {
+		for(int tx=0;tx<m_xtiles;++tx) {
+			if(tiles.testBit(ty*m_xtiles + tx)) {
+				queue << QPoint(tx, ty);
+				bounds |= QRect(tx*Tile::SIZE, ty*Tile::SIZE, Tile::SIZE, Tile::SIZE);
+			}
+		}
+	}
+
+	if(queue.isEmpty())
+		return QRect();
+
+	// Note: bits() detaches the image, so it must be called before the threads start
+	uchar *bits = image.bits();
+	const int bpl = image.bytesPerLine();
+	const int width = m_width;
+	const int height = m_height;
+	const QPoint *queueData = queue.constData();
+
+	TaskScheduler::instance()->parallelFor(queue.size(), 1, [this, queueData, bits, bpl, width, height](int, int begin, int end) {
+		for(int i=begin;i<end;++i) {
+			const QPoint &t = queueData[i];
+
+			Tile tile = m_backgroundTile;
+			for(const Layer *l : m_layers) {
+				if(l->isVisible())
+					tile.merge(l->tile(t.x(), t.y()), l->opacity(), l->blendmode());
+			}
+
+			const int x = t.x() * Tile::SIZE;
+			const int y = t.y() * Tile::SIZE;
+			const int w = qMin(int(Tile::SIZE), width - x);
+			const int h = qMin(int(Tile::SIZE), height - y);
+			for(int row=0;row<h;++row) {
+				uchar *target = bits + (y+row) * bpl + x * 4;
+				if(tile.isNull())
+					memset(target, 0, w * 4);
+				else
+					memcpy(target, tile.constData() + row * Tile::SIZE, w * 4);
+			}
+		}
+	});
+
+	return bounds & QRect(0, 0, m_width, m_height);
+}
+
 QImage LayerStack::flatLayerImage(int layerIdx) const
 {
 	Q_ASSERT(layerIdx>=0 && layerIdx < m_layers.size());
@@ -278,54 +405,139 @@ QImage LayerStack::flatLayerImage(int layerIdx) const
 // Flatten a single tile
 void LayerStack::flattenTile(quint32 *data, int xindex, int yindex) const
 {
-	// Composite visible layers
-	int layeridx = 0;
-	for(const Layer *l : m_layers) {
-		if(isVisible(layeridx)) {
-			const Tile &tile = l->tile(xindex, yindex);
-			const quint32 tint = layerTint(layeridx);
-
-			if(m_censorLayers && l->isCensored()) {
-				// This layer must be censored
-				if(!tile.isNull())
-					compositePixels(l->blendmode(), data, CENSORED_TILE.constData(),
-							Tile::LENGTH, layerOpacity(layeridx));
-
-			} else if(l->sublayers().count() || tint!=0) {
-				// Sublayers (or tint) present, composite them first
-				quint32 ldata[Tile::SIZE*Tile::SIZE];
-				tile.copyTo(ldata);
-
-				for(const Layer *sl : l->sublayers()) {
-					if(sl->isVisible()) {
-						const Tile &subtile = sl->tile(xindex, yindex);
-						if(!subtile.isNull()) {
-							compositePixels(sl->blendmode(), ldata, subtile.constData(),
-									Tile::LENGTH, sl->opacity());
-						}
-					}
-				}
+	for(int i=0;i<m_layers.size();++i)
+		compositeLayer(data, i, xindex, yindex);
+}
 
-				if(tint)
-					tintPixels(ldata, sizeof ldata / sizeof *ldata, tint);
+/**
+ * Flatten a single tile (including the base) using the cached partial composites.
+ *
+ * If only the cached split layer has changed since the last pass, the tile
+ * is composed starting from the cached composite below it. Otherwise,
+ * the tile is flattened normally and the topmost changed layer becomes the
+ * new split layer, since that is most likely the one being edited.
+ *
+ * The layers are always composited in the same order as in flattenTile(),
+ * so the result is identical.
+ */
+void LayerStack::flattenCachedTile(FlatTileCache &cache, const Tile &base, quint32 *data, int xindex, int yindex) const
+{
+	FlatTileCache::Entry &e = cache.use(yindex * m_xtiles + xindex);
+
+	const int count = m_layers.size();
+	QVarLengthArray<FlatTileCache::LayerState, 64> layers(count);
+	for(int i=0;i<count;++i) {
+		const Layer *l = m_layers.at(i);
+		FlatTileCache::LayerState &ls = layers[i];
+		ls.opacity = isVisible(i) ? layerOpacity(i) : -1;
+		if(ls.opacity >= 0)
+			ls.tile = l->tile(xindex, yindex);
+		ls.tint = layerTint(i);
+		ls.blendmode = l->blendmode();
+		ls.censored = m_censorLayers && l->isCensored();
+		ls.hasSublayers = !l->sublayers().isEmpty();
+	}
 
-				// Composite merged tile
-				compositePixels(l->blendmode(), data, ldata,
-						Tile::SIZE*Tile::SIZE, layerOpacity(layeridx));
+	// Find the topmost changed layer
+	const bool restructured = e.lastUsed == 0 || e.base != base || e.layers.size() != count;
+	int changed = -1;
+	if(!restructured) {
+		for(int i=count-1;i>=0;--i) {
+			if(i != e.split && layers[i] != e.layers.at(i)) {
+				changed = i;
+				break;
+			}
+		}
+	}
+
+	if(!restructured && changed < 0 && e.split >= 0) {
+		// Only the split layer has (possibly) changed
+		e.below.copyTo(data);
+		for(int i=e.split;i<count;++i)
+			compositeLayer(data, i, xindex, yindex);
+		return;
+	}
+
+	// When the whole entry is new, we can't know yet which layer is
+	// going to be edited, so just record the layer states.
+	const int split = restructured ? -1 : changed;
+
+	base.copyTo(data);
+
+	if(split < 0) {
+		for(int i=0;i<count;++i)
+			compositeLayer(data, i, xindex, yindex);
+		e.below = Tile();
+
+	} else {
+		for(int i=0;i<split;++i)
+			compositeLayer(data, i, xindex, yindex);
+		memcpy(e.below.data(), data, Tile::BYTES);
+
+		for(int i=split;i<count;++i)
+			compositeLayer(data, i, xindex, yindex);
+	}
 
-			} else if(!tile.isNull()) {
-				// No sublayers or tint, just this tile as it is
-				compositePixels(l->blendmode(), data, tile.constData(),
-						Tile::LENGTH, layerOpacity(layeridx));
+	e.base = base;
+	e.split = split;
+	e.layers.resize(count);
+	for(int i=0;i<count;++i)
+		e.layers[i] = layers[i];
+
+	// Don't hold a reference to the split layer's tile, so editing it
+	// won't have to detach it.
+	if(split >= 0)
+		e.layers[split].tile = Tile();
+}
+
+// Composite a layer (and its sublayers) onto a flattened tile
+void LayerStack::compositeLayer(quint32 *data, int layeridx, int xindex, int yindex) const
+{
+	if(!isVisible(layeridx))
+		return;
+
+	const Layer *l = m_layers.at(layeridx);
+	const Tile &tile = l->tile(xindex, yindex);
+	const quint32 tint = layerTint(layeridx);
+
+	if(m_censorLayers && l->isCensored()) {
+		// This layer must be censored
+		if(!tile.isNull())
+			compositePixels(l->blendmode(), data, CENSORED_TILE.constData(),
+					Tile::LENGTH, layerOpacity(layeridx));
+
+	} else if(l->sublayers().count() || tint!=0) {
+		// Sublayers (or tint) present, composite them first
+		quint32 ldata[Tile::SIZE*Tile::SIZE];
+		tile.copyTo(ldata);
+
+		for(const Layer *sl : l->sublayers()) {
+			if(sl->isVisible()) {
+				const Tile &subtile = sl->tile(xindex, yindex);
+				if(!subtile.isNull()) {
+					compositePixels(sl->blendmode(), ldata, subtile.constData(),
+							Tile::LENGTH, sl->opacity());
+				}
 			}
 		}
 
-		++layeridx;
+		if(tint)
+			tintPixels(ldata, sizeof ldata / sizeof *ldata, tint);
+
+		// Composite merged tile
+		compositePixels(l->blendmode(), data, ldata,
+				Tile::SIZE*Tile::SIZE, layerOpacity(layeridx));
+
+	} else if(!tile.isNull()) {
+		// No sublayers or tint, just this tile as it is
+		compositePixels(l->blendmode(), data, tile.constData(),
+				Tile::LENGTH, layerOpacity(layeridx));
 	}
 }
 
 void LayerStack::markDirty(const QRect &area)
 {
+	QMutexLocker lock(&m_dirtyMutex);
 	if(m_layers.isEmpty() || m_width<=0 || m_height<=0)
 		return;
 	const int tx0 = qBound(0, area.left() / Tile::SIZE, m_xtiles-1);
@@ -335,31 +547,38 @@ void LayerStack::markDirty(const QRect &area)
 	
 	for(;ty0<=ty1;++ty0) {
 		m_dirtytiles.fill(true, ty0*m_xtiles + tx0, ty0*m_xtiles + tx1);
+		m_changedtiles.fill(true, ty0*m_xtiles + tx0, ty0*m_xtiles + tx1);
 	}
 	m_dirtyrect |= area;
 }
 
 void LayerStack::markDirty()
 {
+	QMutexLocker lock(&m_dirtyMutex);
 	m_dirtytiles.fill(true);
+	m_changedtiles.fill(true);
 	m_dirtyrect = QRect(0, 0, m_width, m_height);
 }
 
 void LayerStack::markDirty(int x, int y)
 {
+	QMutexLocker lock(&m_dirtyMutex);
 	Q_ASSERT(x>=0 && x < m_xtiles);
 	Q_ASSERT(y>=0 && y < m_ytiles);
 
 	m_dirtytiles.setBit(y*m_xtiles + x);
+	m_changedtiles.setBit(y*m_xtiles + x);
 
 	m_dirtyrect |= QRect(x*Tile::SIZE, y*Tile::SIZE, Tile::SIZE, Tile::SIZE);
 }
 
 void LayerStack::markDirty(int index)
 {
+	QMutexLocker lock(&m_dirtyMutex);
 	Q_ASSERT(index>=0 && index < m_dirtytiles.size());
 
 	m_dirtytiles.setBit(index);
+	m_changedtiles.setBit(index);
 
 	const int y = index / m_xtiles;
 	const int x = index % m_xtiles;
@@ -367,6 +586,30 @@ void LayerStack::markDirty(int index)
 	m_dirtyrect |= QRect(x*Tile::SIZE, y*Tile::SIZE, Tile::SIZE, Tile::SIZE);
 }
 
+void LayerStack::markChanged(int x, int y)
+{
+	QMutexLocker lock(&m_dirtyMutex);
+	Q_ASSERT(x>=0 && x < m_xtiles);
+	Q_ASSERT(y>=0 && y < m_ytiles);
+
+	m_changedtiles.setBit(y*m_xtiles + x);
+}
+
+QBitArray LayerStack::takeChangedTiles()
+{
+	QMutexLocker lock(&m_dirtyMutex);
+	const QBitArray changed = m_changedtiles;
+	m_changedtiles = QBitArray(m_xtiles * m_ytiles);
+	return changed;
+}
+
+void LayerStack::clearTileCaches()
+{
+	m_paintCache.clear();
+	QMutexLocker lock(&m_flatCacheMutex);
+	m_flatCache.clear();
+}
+
 void LayerStack::beginWriteSequence()
 {
 	++m_openEditors;
@@ -453,8 +696,59 @@ Savepoint *LayerStack::makeSavepoint()
 	return sp;
 }
 
+qint64 Savepoint::uniqueBytes() const
+{
+	qint64 bytes = 0;
+	for(const Layer *l : layers)
+		bytes += l->uniqueTileBytes();
+	for(const CompressedTile &ct : compressed)
+		bytes += ct.data.size();
+	return bytes;
+}
+
+qint64 Savepoint::compress()
+{
+	const qint64 before = uniqueBytes();
+	for(Layer *l : layers)
+		compressLayer(l);
+	return before - uniqueBytes();
+}
+
+void Savepoint::compressLayer(Layer *layer)
+{
+	// Compressed tiles are replaced with null tiles (rather than removed)
+	// so the tile map keeps its structure.
+	// If the tile map itself is shared, so are all the tiles in it.
+	if(layer->m_tiles.isDetached()) {
+		for(auto i=layer->m_tiles.begin();i!=layer->m_tiles.end();++i) {
+			const Tile &t = i.value();
+			if(t.isNull() || t.isShared())
+				continue;
+
+			const QByteArray data = qCompress(reinterpret_cast<const uchar*>(t.constData()), Tile::BYTES, 1);
+			if(data.size() >= Tile::BYTES)
+				continue;
+
+			compressed << CompressedTile { layer, i.key(), data };
+			i.value() = Tile();
+		}
+	}
+
+	for(Layer *sl : layer->m_sublayers)
+		compressLayer(sl);
+}
+
+void Savepoint::decompress() const
+{
+	for(const CompressedTile &ct : compressed)
+		ct.layer->m_tiles[ct.key] = Tile(qUncompress(ct.data));
+	compressed.clear();
+}
+
 void EditableLayerStack::restoreSavepoint(const Savepoint *savepoint)
 {
+	savepoint->decompress();
+
 	const QSize oldsize(d->m_width, d->m_height);
 	if(d->m_width != savepoint->width || d->m_height != savepoint->height) {
 		// Restore canvas size if it was different in the savepoint
@@ -463,6 +757,7 @@ void EditableLayerStack::restoreSavepoint(const Savepoint *savepoint)
 		d->m_xtiles = Tile::roundTiles(savepoint->width);
 		d->m_ytiles = Tile::roundTiles(savepoint->height);
 		d->m_dirtytiles = QBitArray(d->m_xtiles*d->m_ytiles, true);
+		d->m_changedtiles = QBitArray(d->m_xtiles*d->m_ytiles, true);
 		emit d->resized(0, 0, oldsize);
 
 	} else {
@@ -472,7 +767,9 @@ void EditableLayerStack::restoreSavepoint(const Savepoint *savepoint)
 			// Layers added or deleted, just refresh everything
 			// (force refresh even if layer stack is empty)
 			d->m_dirtytiles.fill(true);
+			d->m_changedtiles.fill(true);
 			d->m_dirtyrect = QRect(0, 0, d->m_width, d->m_height);
+			d->clearTileCaches();
 
 		} else {
 			// Layer count has not changed, compare layer contents
@@ -510,6 +807,8 @@ void EditableLayerStack::restoreSavepoint(const Savepoint *savepoint)
 
 void Savepoint::toDatastream(QDataStream &out) const
 {
+	decompress();
+
 	// Write size
 	out << quint32(width) << quint32(height);
 
@@ -573,6 +872,7 @@ void EditableLayerStack::resize(int top, int right, int bottom, int left)
 	d->m_xtiles = Tile::roundTiles(d->m_width);
 	d->m_ytiles = Tile::roundTiles(d->m_height);
 	d->m_dirtytiles = QBitArray(d->m_xtiles*d->m_ytiles, true);
+	d->m_changedtiles = QBitArray(d->m_xtiles*d->m_ytiles, true);
 
 	for(Layer *l : d->m_layers)
 		EditableLayer(l, d).resize(top, right, bottom, left);
@@ -705,6 +1005,9 @@ bool EditableLayerStack::deleteLayer(int id)
 			EditableLayer(d->m_layers.at(i), d).markOpaqueDirty();
 			delete d->m_layers.takeAt(i);
 
+			// Release the deleted layer's tiles
+			d->clearTileCaches();
+
 			return true;
 		}
 	}
@@ -779,6 +1082,7 @@ void EditableLayerStack::reset()
 		delete l;
 	d->m_layers.clear();
 	d->m_annotations->clear();
+	d->clearTileCaches();
 
 	d->m_backgroundTile = Tile();
 	Tile::fillChecker(d->m_paintBackgroundTile.data(), QColor(128,128,128), Qt::white);
@@ -20,6 +20,7 @@
 #define LAYERSTACK_H
 
 #include "annotationmodel.h"
+#include "flattilecache.h"
 #include "tile.h"
 
 #include <cstdint>
@@ -28,6 +29,9 @@
 #include <QList>
 #include <QImage>
 #include <QBitArray>
+#include <QVector>
+#include <QPoint>
+#include <QMutex>
 
 class QDataStream;
 
@@ -106,6 +110,29 @@ public:
 	//! Get a merged tile
 	Tile getFlatTile(int x, int y) const;
 
+	/**
+	 * @brief Flatten the given tiles into an image
+	 *
+	 * The result is the same as toFlatImage(false, true) would give for those tiles,
+	 * so an exported frame can be kept up to date without flattening the
+	 * whole canvas each time.
+	 *
+	 * @param image an ARGB32_Premultiplied image the size of the layer stack
+	 * @param tiles the tiles to update (see takeChangedTiles())
+	 * @return the updated area
+	 */
+	QRect updateFlatImage(QImage &image, const QBitArray &tiles) const;
+
+	/**
+	 * @brief Get and reset the set of tiles changed since the last call
+	 *
+	 * This is tracked separately from the view's dirty tiles, so repainting
+	 * the view does not clear it. Unlike the dirty tiles, this also includes
+	 * tiles that changed only in the flattened image without sublayers,
+	 * such as when an indirect stroke is merged.
+	 */
+	QBitArray takeChangedTiles();
+
 	//! Mark the tiles under the area dirty
 	void markDirty(const QRect &area);
 
@@ -118,6 +145,9 @@ public:
 	//! Mark the tile at the given index as dirty
 	void markDirty(int index);
 
+	//! Mark the tile as changed (see takeChangedTiles) without repainting it in the view
+	void markChanged(int x, int y);
+
 	//! Create a new savepoint
 	Savepoint *makeSavepoint();
 
@@ -152,6 +182,9 @@ private:
 	void endWriteSequence();
 
 	void flattenTile(quint32 *data, int xindex, int yindex) const;
+	void flattenCachedTile(FlatTileCache &cache, const Tile &base, quint32 *data, int xindex, int yindex) const;
+	void compositeLayer(quint32 *data, int layeridx, int xindex, int yindex) const;
+	void clearTileCaches();
 
 	bool isVisible(int idx) const;
 	int layerOpacity(int idx) const;
@@ -166,6 +199,18 @@ private:
 
 	QBitArray m_dirtytiles;
 	QRect m_dirtyrect;
+	QBitArray m_changedtiles;
+	QMutex m_dirtyMutex; // layers on different threads may mark tiles dirty concurrently
+
+	// Reusable buffers for paintChangedTiles
+	static const int PAINT_BATCH_PER_THREAD = 8;
+	QVector<QPoint> m_paintQueue;
+	QVector<quint32> m_paintScratch;
+
+	// Partially flattened tiles for paintChangedTiles and getFlatTile
+	FlatTileCache m_paintCache;
+	mutable FlatTileCache m_flatCache;
+	mutable QMutex m_flatCacheMutex;
 
 	ViewMode m_viewmode;
 	int m_viewlayeridx;
@@ -185,12 +230,44 @@ public:
 	void toDatastream(QDataStream &out) const;
 	static Savepoint *fromDatastream(QDataStream &in);
 
+	/**
+	 * @brief Get the memory used by this savepoint's unshared tiles
+	 *
+	 * Tiles shared with the canvas or other savepoints are not counted.
+	 * Compressed tiles are counted by their compressed size.
+	 */
+	qint64 uniqueBytes() const;
+
+	/**
+	 * @brief Compress the tiles that are not shared with anything else
+	 *
+	 * Shared tiles are left as they are, since compressing them would
+	 * not free any memory. The tiles are decompressed automatically
+	 * when the savepoint is used.
+	 *
+	 * @return number of bytes saved
+	 */
+	qint64 compress();
+
+	//! Does this savepoint contain compressed tiles
+	bool isCompressed() const { return !compressed.isEmpty(); }
+
 private:
+	struct CompressedTile {
+		Layer *layer;
+		quint32 key;
+		QByteArray data;
+	};
+
 	Savepoint() {}
+	void compressLayer(Layer *layer);
+	void decompress() const;
+
 	QList<Layer*> layers;
 	QList<Annotation> annotations;
 	Tile background;
 	int width, height;
+	mutable QVector<CompressedTile> compressed;
 };
 
 /**
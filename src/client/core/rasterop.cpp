@@ -18,9 +18,14 @@
 */
 
 #include "rasterop.h"
+#include "rasterop_simd.h"
 
 #include <QRgb>
 
+#if defined(HAVE_RASTEROP_SIMD) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 namespace paintcore {
 
 // This is borrowed from Pigment of koffice libs:
@@ -453,24 +458,119 @@ void doPixelComposite(quint32 *base, const quint32 *source, uchar alpha, int len
 	}
 }
 
+void doMaskComposite(SimdBlendOp op, quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip)
+{
+	switch(op) {
+	case SimdBlendOp::Multiply: doMaskComposite<blend_multiply>(base, color, mask, w, h, maskskip, baseskip); break;
+	case SimdBlendOp::Darken: doMaskComposite<blend_darken>(base, color, mask, w, h, maskskip, baseskip); break;
+	case SimdBlendOp::Lighten: doMaskComposite<blend_lighten>(base, color, mask, w, h, maskskip, baseskip); break;
+	case SimdBlendOp::Subtract: doMaskComposite<blend_subtract>(base, color, mask, w, h, maskskip, baseskip); break;
+	case SimdBlendOp::Add: doMaskComposite<blend_add>(base, color, mask, w, h, maskskip, baseskip); break;
+	case SimdBlendOp::Recolor: doMaskComposite<blend_blend>(base, color, mask, w, h, maskskip, baseskip); break;
+	}
+}
+
+void doPixelComposite(SimdBlendOp op, quint32 *destination, const quint32 *source, uchar opacity, int len)
+{
+	switch(op) {
+	case SimdBlendOp::Multiply: doPixelComposite<blend_multiply>(destination, source, opacity, len); break;
+	case SimdBlendOp::Darken: doPixelComposite<blend_darken>(destination, source, opacity, len); break;
+	case SimdBlendOp::Lighten: doPixelComposite<blend_lighten>(destination, source, opacity, len); break;
+	case SimdBlendOp::Subtract: doPixelComposite<blend_subtract>(destination, source, opacity, len); break;
+	case SimdBlendOp::Add: doPixelComposite<blend_add>(destination, source, opacity, len); break;
+	case SimdBlendOp::Recolor: doPixelComposite<blend_blend>(destination, source, opacity, len); break;
+	}
+}
+
+const quint32 *unpremultiplyFactors()
+{
+	// qUnpremultiply computes (c * (0x00ff00ff / alpha) + 0x8000) >> 16.
+	// A zero factor for alpha 0 gives the same result as its special case.
+	static const struct Factors {
+		quint32 f[256];
+		Factors() {
+			f[0] = 0;
+			for(uint a=1;a<256;++a)
+				f[a] = 0x00ff00ffu / a;
+		}
+	} factors;
+	return factors.f;
+}
+
+SimdLevel detectSimdLevel()
+{
+#if defined(HAVE_RASTEROP_SIMD) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	if(!(info[3] & (1<<26)))
+		return SimdLevel::None;
+
+	// AVX2 requires OS support for saving the YMM registers
+	const bool osxsave = info[2] & (1<<27);
+	if(maxLeaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6) {
+		__cpuidex(info, 7, 0);
+		if(info[1] & (1<<5))
+			return SimdLevel::AVX2;
+	}
+	return SimdLevel::SSE2;
+
+#elif defined(HAVE_RASTEROP_SIMD)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return SimdLevel::AVX2;
+	if(__builtin_cpu_supports("sse2"))
+		return SimdLevel::SSE2;
+	return SimdLevel::None;
+
+#else
+	return SimdLevel::None;
+#endif
+}
+
+static SimdLevel SIMD_LEVEL = detectSimdLevel();
+
+SimdLevel simdLevel()
+{
+	return SIMD_LEVEL;
+}
+
+void setSimdLevel(SimdLevel level)
+{
+	SIMD_LEVEL = qMin(level, detectSimdLevel());
+}
+
+#ifdef HAVE_RASTEROP_SIMD
+#define DISPATCH(fn, ...) \
+	switch(SIMD_LEVEL) { \
+	case SimdLevel::AVX2: avx2::fn(__VA_ARGS__); break; \
+	case SimdLevel::SSE2: sse2::fn(__VA_ARGS__); break; \
+	case SimdLevel::None: fn(__VA_ARGS__); break; \
+	}
+#else
+#define DISPATCH(fn, ...) fn(__VA_ARGS__)
+#endif
+
 void compositeMask(BlendMode::Mode mode, quint32 *base, quint32 color, const uchar *mask,
 		int w, int h, int maskskip, int baseskip)
 {
 	switch(mode) {
-	case BlendMode::MODE_ERASE: doMaskErase(base, mask, w, h, maskskip, baseskip); break;
-	case BlendMode::MODE_NORMAL: doAlphaMaskBlend(base, color, mask, w, h, maskskip, baseskip); break;
-	case BlendMode::MODE_MULTIPLY: doMaskComposite<blend_multiply>(base, color, mask, w, h, maskskip, baseskip); break;
+	case BlendMode::MODE_ERASE: DISPATCH(doMaskErase, base, mask, w, h, maskskip, baseskip); break;
+	case BlendMode::MODE_NORMAL: DISPATCH(doAlphaMaskBlend, base, color, mask, w, h, maskskip, baseskip); break;
+	case BlendMode::MODE_MULTIPLY: DISPATCH(doMaskComposite, SimdBlendOp::Multiply, base, color, mask, w, h, maskskip, baseskip); break;
 	case BlendMode::MODE_DIVIDE: doMaskComposite<blend_divide>(base, color, mask, w, h, maskskip, baseskip); break;
 	case BlendMode::MODE_BURN: doMaskComposite<blend_burn>(base, color, mask, w, h, maskskip, baseskip); break;
 	case BlendMode::MODE_DODGE: doMaskComposite<blend_dodge>(base, color, mask, w, h, maskskip, baseskip); break;
-	case BlendMode::MODE_DARKEN: doMaskComposite<blend_darken>(base, color, mask, w, h, maskskip, baseskip); break;
-	case BlendMode::MODE_LIGHTEN: doMaskComposite<blend_lighten>(base, color, mask, w, h, maskskip, baseskip); break;
-	case BlendMode::MODE_SUBTRACT: doMaskComposite<blend_subtract>(base, color, mask, w, h, maskskip, baseskip); break;
-	case BlendMode::MODE_ADD: doMaskComposite<blend_add>(base, color, mask, w, h, maskskip, baseskip); break;
-	case BlendMode::MODE_RECOLOR: doMaskComposite<blend_blend>(base, color, mask, w, h, maskskip, baseskip); break;
-	case BlendMode::MODE_BEHIND: doAlphaMaskUnder(base, color, mask, w, h, maskskip, baseskip); break;
+	case BlendMode::MODE_DARKEN: DISPATCH(doMaskComposite, SimdBlendOp::Darken, base, color, mask, w, h, maskskip, baseskip); break;
+	case BlendMode::MODE_LIGHTEN: DISPATCH(doMaskComposite, SimdBlendOp::Lighten, base, color, mask, w, h, maskskip, baseskip); break;
+	case BlendMode::MODE_SUBTRACT: DISPATCH(doMaskComposite, SimdBlendOp::Subtract, base, color, mask, w, h, maskskip, baseskip); break;
+	case BlendMode::MODE_ADD: DISPATCH(doMaskComposite, SimdBlendOp::Add, base, color, mask, w, h, maskskip, baseskip); break;
+	case BlendMode::MODE_RECOLOR: DISPATCH(doMaskComposite, SimdBlendOp::Recolor, base, color, mask, w, h, maskskip, baseskip); break;
+	case BlendMode::MODE_BEHIND: DISPATCH(doAlphaMaskUnder, base, color, mask, w, h, maskskip, baseskip); break;
 	case BlendMode::MODE_COLORERASE: doMaskColorErase(base, color, mask, w, h, maskskip, baseskip); break;
-	case BlendMode::MODE_REPLACE: doMaskCopy(base, color, mask, w, h, maskskip, baseskip); break;
+	case BlendMode::MODE_REPLACE: DISPATCH(doMaskCopy, base, color, mask, w, h, maskskip, baseskip); break;
 	}
 }
 
@@ -479,18 +579,18 @@ void compositePixels(BlendMode::Mode mode, quint32 *base, const quint32 *over, i
 	Q_ASSERT(len>=0);
 
 	switch(mode) {
-	case BlendMode::MODE_ERASE: doPixelErase(base, over, opacity, len); break;
-	case BlendMode::MODE_NORMAL: doPixelAlphaBlend(base, over, opacity, len); break;
-	case BlendMode::MODE_MULTIPLY: doPixelComposite<blend_multiply>(base, over, opacity, len); break;
+	case BlendMode::MODE_ERASE: DISPATCH(doPixelErase, base, over, opacity, len); break;
+	case BlendMode::MODE_NORMAL: DISPATCH(doPixelAlphaBlend, base, over, opacity, len); break;
+	case BlendMode::MODE_MULTIPLY: DISPATCH(doPixelComposite, SimdBlendOp::Multiply, base, over, opacity, len); break;
 	case BlendMode::MODE_DIVIDE: doPixelComposite<blend_divide>(base, over, opacity, len); break;
 	case BlendMode::MODE_BURN: doPixelComposite<blend_burn>(base, over, opacity, len); break;
 	case BlendMode::MODE_DODGE: doPixelComposite<blend_dodge>(base, over, opacity, len); break;
-	case BlendMode::MODE_DARKEN: doPixelComposite<blend_darken>(base, over, opacity, len); break;
-	case BlendMode::MODE_LIGHTEN: doPixelComposite<blend_lighten>(base, over, opacity, len); break;
-	case BlendMode::MODE_SUBTRACT: doPixelComposite<blend_subtract>(base, over, opacity, len); break;
-	case BlendMode::MODE_ADD: doPixelComposite<blend_add>(base, over, opacity, len); break;
-	case BlendMode::MODE_RECOLOR: doPixelComposite<blend_blend>(base, over, opacity, len); break;
-	case BlendMode::MODE_BEHIND: doPixelAlphaUnder(base, over, opacity, len); break;
+	case BlendMode::MODE_DARKEN: DISPATCH(doPixelComposite, SimdBlendOp::Darken, base, over, opacity, len); break;
+	case BlendMode::MODE_LIGHTEN: DISPATCH(doPixelComposite, SimdBlendOp::Lighten, base, over, opacity, len); break;
+	case BlendMode::MODE_SUBTRACT: DISPATCH(doPixelComposite, SimdBlendOp::Subtract, base, over, opacity, len); break;
+	case BlendMode::MODE_ADD: DISPATCH(doPixelComposite, SimdBlendOp::Add, base, over, opacity, len); break;
+	case BlendMode::MODE_RECOLOR: DISPATCH(doPixelComposite, SimdBlendOp::Recolor, base, over, opacity, len); break;
+	case BlendMode::MODE_BEHIND: DISPATCH(doPixelAlphaUnder, base, over, opacity, len); break;
 	case BlendMode::MODE_COLORERASE: doPixelColorErase(base, over, opacity, len); break;
 	case BlendMode::MODE_REPLACE: /* not implemented */ break;
 	}
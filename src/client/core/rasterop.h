@@ -67,6 +67,33 @@ std::array<quint32, 5> sampleMask(const quint32 *pixels, const uchar *mask, int
  */
 void tintPixels(quint32 *pixels, int len, quint32 tint);
 
+/**
+ * Instruction set extensions the composition functions can use
+ */
+enum class SimdLevel {
+	None,
+	SSE2,
+	AVX2
+};
+
+/**
+ * Get the best instruction set extension level supported by this CPU
+ */
+SimdLevel detectSimdLevel();
+
+/**
+ * Get the instruction set extension level currently in use
+ */
+SimdLevel simdLevel();
+
+/**
+ * Set the instruction set extension level to use.
+ *
+ * The level is clamped to what the CPU supports. This is mainly
+ * useful for testing, as all code paths produce identical results.
+ */
+void setSimdLevel(SimdLevel level);
+
 }
 
 #endif
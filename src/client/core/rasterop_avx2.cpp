@@ -0,0 +1,108 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2019 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Note: this file is compiled with AVX2 enabled. To avoid AVX2 instructions
+// leaking into shared inline functions, do not use any inline functions
+// from Qt or the standard library here.
+
+#include "rasterop_simd_kernels.h"
+
+#include <immintrin.h>
+#include <cstring>
+
+namespace paintcore {
+
+namespace {
+
+// AVX2 intrinsics for the kernels in rasterop_simd_kernels.h
+//
+// Note: unpacking works within 128 bit lanes, so the "lo" half of a vector
+// holds pixels 0, 1, 4 and 5 and the "hi" half pixels 2, 3, 6 and 7.
+// Packing puts them back in order.
+struct Avx2 {
+	typedef __m256i Vec;
+	enum { PIXELS = 8 };
+
+	static Vec load(const quint32 *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	static void store(quint32 *p, Vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+
+	static Vec zero() { return _mm256_setzero_si256(); }
+	static Vec set16(int v) { return _mm256_set1_epi16(short(v)); }
+	static Vec set32(quint32 v) { return _mm256_set1_epi32(int(v)); }
+
+	static Vec add16(Vec a, Vec b) { return _mm256_add_epi16(a, b); }
+	static Vec sub16(Vec a, Vec b) { return _mm256_sub_epi16(a, b); }
+	static Vec subs16(Vec a, Vec b) { return _mm256_subs_epu16(a, b); }
+	static Vec mul16(Vec a, Vec b) { return _mm256_mullo_epi16(a, b); }
+	static Vec mulhi16(Vec a, Vec b) { return _mm256_mulhi_epu16(a, b); }
+	static Vec min16(Vec a, Vec b) { return _mm256_min_epi16(a, b); }
+	static Vec max16(Vec a, Vec b) { return _mm256_max_epi16(a, b); }
+	static Vec srl16(Vec a, int n) { return _mm256_srli_epi16(a, n); }
+	static Vec srl32(Vec a, int n) { return _mm256_srli_epi32(a, n); }
+	static Vec sll32(Vec a, int n) { return _mm256_slli_epi32(a, n); }
+
+	static Vec and_(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+	static Vec or_(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+	static Vec andnot(Vec a, Vec b) { return _mm256_andnot_si256(a, b); }
+	static Vec cmpeq16(Vec a, Vec b) { return _mm256_cmpeq_epi16(a, b); }
+	static Vec cmpeq32(Vec a, Vec b) { return _mm256_cmpeq_epi32(a, b); }
+
+	static Vec unpacklo8(Vec a, Vec b) { return _mm256_unpacklo_epi8(a, b); }
+	static Vec unpackhi8(Vec a, Vec b) { return _mm256_unpackhi_epi8(a, b); }
+	static Vec unpacklo32(Vec a, Vec b) { return _mm256_unpacklo_epi32(a, b); }
+	static Vec unpackhi32(Vec a, Vec b) { return _mm256_unpackhi_epi32(a, b); }
+	static Vec packus16(Vec a, Vec b) { return _mm256_packus_epi16(a, b); }
+	static Vec packs16(Vec a, Vec b) { return _mm256_packs_epi16(a, b); }
+
+	// Spread the alpha channel of each unpacked pixel to all four channels
+	static Vec alpha16(Vec p)
+	{
+		return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(p, 0xff), 0xff);
+	}
+
+	// Load eight mask bytes and spread each one to all four channels of a pixel
+	static Vec loadMask(const uchar *mask)
+	{
+		Vec v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(mask)));
+		v = _mm256_or_si256(v, _mm256_slli_epi32(v, 8));
+		return _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+	}
+
+	static bool isZeroMask(const uchar *mask)
+	{
+		quint64 m;
+		memcpy(&m, mask, 8);
+		return m == 0;
+	}
+
+	// Look up table[alpha] for each pixel
+	static Vec gatherAlpha(const quint32 *table, const quint32 *pixels)
+	{
+		return _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), _mm256_srli_epi32(load(pixels), 24), 4);
+	}
+};
+
+}
+
+namespace avx2 {
+
+DEFINE_SIMD_KERNELS(Avx2)
+
+}
+}
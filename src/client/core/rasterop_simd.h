@@ -0,0 +1,87 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2019 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PAINTCORE_RASTEROP_SIMD_H
+#define PAINTCORE_RASTEROP_SIMD_H
+
+// Internal header: vectorized composition kernels.
+//
+// Each instruction set gets its own namespace and translation unit
+// (compiled with the matching compiler flags.) The kernels themselves are
+// shared (see rasterop_simd_kernels.h.) The vectorized kernels have the
+// same signatures as the scalar reference implementations in rasterop.cpp
+// and fall back to them for the unaligned tail of each row.
+//
+// The separable blending modes that go through qUnpremultiply/qPremultiply
+// are vectorized by doing the same integer arithmetic as Qt's inline
+// functions. Divide, burn and dodge are not: they need an integer division
+// by a value that varies from channel to channel, and SSE2 and AVX2 have
+// no integer division instructions. Color erase is done in floating point
+// with per channel branches and is not vectorized either.
+
+#include <QtGlobal>
+
+namespace paintcore {
+
+//! Separable blending modes with a vectorized implementation
+enum class SimdBlendOp {
+	Multiply,
+	Darken,
+	Lighten,
+	Subtract,
+	Add,
+	Recolor
+};
+
+//! Get the per alpha factors qUnpremultiply uses (0x00ff00ff / alpha)
+const quint32 *unpremultiplyFactors();
+
+// Scalar reference implementations
+void doAlphaMaskBlend(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip);
+void doAlphaMaskUnder(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip);
+void doMaskErase(quint32 *base, const uchar *mask, int w, int h, int maskskip, int baseskip);
+void doMaskCopy(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip);
+void doMaskComposite(SimdBlendOp op, quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip);
+void doPixelAlphaBlend(quint32 *destination, const quint32 *source, uchar opacity, int len);
+void doPixelAlphaUnder(quint32 *destination, const quint32 *source, uchar opacity, int len);
+void doPixelErase(quint32 *destination, const quint32 *source, uchar opacity, int len);
+void doPixelComposite(SimdBlendOp op, quint32 *destination, const quint32 *source, uchar opacity, int len);
+
+#ifdef HAVE_RASTEROP_SIMD
+
+#define DECLARE_SIMD_KERNELS \
+	void doAlphaMaskBlend(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip); \
+	void doAlphaMaskUnder(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip); \
+	void doMaskErase(quint32 *base, const uchar *mask, int w, int h, int maskskip, int baseskip); \
+	void doMaskCopy(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip); \
+	void doMaskComposite(SimdBlendOp op, quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip); \
+	void doPixelAlphaBlend(quint32 *destination, const quint32 *source, uchar opacity, int len); \
+	void doPixelAlphaUnder(quint32 *destination, const quint32 *source, uchar opacity, int len); \
+	void doPixelErase(quint32 *destination, const quint32 *source, uchar opacity, int len); \
+	void doPixelComposite(SimdBlendOp op, quint32 *destination, const quint32 *source, uchar opacity, int len);
+
+namespace sse2 { DECLARE_SIMD_KERNELS }
+namespace avx2 { DECLARE_SIMD_KERNELS }
+
+#undef DECLARE_SIMD_KERNELS
+
+#endif
+
+}
+
+#endif
@@ -0,0 +1,460 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2019 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PAINTCORE_RASTEROP_SIMD_KERNELS_H
+#define PAINTCORE_RASTEROP_SIMD_KERNELS_H
+
+// Internal header: the vectorized composition kernels.
+//
+// The kernels are written once against a thin wrapper around the intrinsics
+// of an instruction set (see rasterop_sse2.cpp and rasterop_avx2.cpp) and
+// process S::PIXELS pixels at a time. The arithmetic is done in 16 bit lanes:
+// a vector of pixels is unpacked into a "lo" and a "hi" half and packed back
+// when done.
+//
+// This header must only be included by the instruction set specific
+// translation units. Everything here is in an anonymous namespace so that
+// code compiled with different instruction sets is never shared.
+
+#include "rasterop_simd.h"
+
+namespace paintcore {
+
+namespace {
+
+// Vectorized UINT8_MULT for 16 bit lanes holding 8 bit values
+template<typename S>
+inline typename S::Vec mult(typename S::Vec a, typename S::Vec b)
+{
+	const typename S::Vec c = S::add16(S::mul16(a, b), S::set16(0x80));
+	return S::srl16(S::add16(S::srl16(c, 8), c), 8);
+}
+
+// Vectorized UINT8_BLEND: a*alpha + b*(1-alpha)
+template<typename S>
+inline typename S::Vec blend(typename S::Vec a, typename S::Vec b, typename S::Vec alpha)
+{
+	const typename S::Vec c = S::add16(
+		S::add16(S::mul16(a, alpha), S::mul16(b, S::sub16(S::set16(0xff), alpha))),
+		S::set16(0x80)
+	);
+	return S::srl16(S::add16(S::srl16(c, 8), c), 8);
+}
+
+// Truncate 16 bit lanes to 8 bits the way the scalar code does when
+// it assigns an uint to an uchar and pack them back into bytes
+template<typename S>
+inline typename S::Vec pack(typename S::Vec lo, typename S::Vec hi)
+{
+	const typename S::Vec mask = S::set16(0xff);
+	return S::packus16(S::and_(lo, mask), S::and_(hi, mask));
+}
+
+// Pick the bits of a where mask is set and the bits of b elsewhere
+template<typename S>
+inline typename S::Vec select(typename S::Vec mask, typename S::Vec a, typename S::Vec b)
+{
+	return S::or_(S::and_(mask, a), S::andnot(mask, b));
+}
+
+// qUnpremultiply for the color channels of one unpacked half.
+// The per pixel factor (0x00ff00ff / alpha) is split into 16 bit halves,
+// since (c * factor + 0x8000) >> 16 does not fit in a 16 bit lane.
+template<typename S>
+inline typename S::Vec unpremultiplyHalf(typename S::Vec c, typename S::Vec factorLo, typename S::Vec factorHi)
+{
+	const typename S::Vec lo = S::mul16(c, factorLo);
+	return S::and_(
+		S::add16(S::add16(S::mul16(c, factorHi), S::mulhi16(c, factorLo)), S::srl16(lo, 15)),
+		S::set16(0xff)
+	);
+}
+
+// qUnpremultiply the color channels of a vector of pixels into unpacked halves.
+// The alpha lanes of the result are not meaningful.
+template<typename S>
+inline void unpremultiply(typename S::Vec pixels, typename S::Vec factors, typename S::Vec &lo, typename S::Vec &hi)
+{
+	typedef typename S::Vec Vec;
+	const Vec zero = S::zero();
+
+	// Spread each half of the factor to both 16 bit lanes of a pixel...
+	const Vec flo = S::and_(factors, S::set32(0xffff));
+	const Vec fhi = S::srl32(factors, 16);
+	const Vec flo2 = S::or_(flo, S::sll32(flo, 16));
+	const Vec fhi2 = S::or_(fhi, S::sll32(fhi, 16));
+
+	// ...and from there to all four channels the same way the pixels are unpacked
+	lo = unpremultiplyHalf<S>(S::unpacklo8(pixels, zero), S::unpacklo32(flo2, flo2), S::unpacklo32(fhi2, fhi2));
+	hi = unpremultiplyHalf<S>(S::unpackhi8(pixels, zero), S::unpackhi32(flo2, flo2), S::unpackhi32(fhi2, fhi2));
+}
+
+// qPremultiply for the color channels of one unpacked half
+template<typename S>
+inline typename S::Vec premultiply(typename S::Vec c, typename S::Vec alpha)
+{
+	const typename S::Vec t = S::mul16(c, alpha);
+	return S::srl16(S::add16(S::add16(t, S::srl16(t, 8)), S::set16(0x80)), 8);
+}
+
+// The vectorized versions of the blend_* functions in rasterop.cpp
+template<typename S, SimdBlendOp Op>
+inline typename S::Vec blendOp(typename S::Vec base, typename S::Vec over)
+{
+	switch(Op) {
+	case SimdBlendOp::Multiply: return mult<S>(base, over);
+	case SimdBlendOp::Darken: return S::min16(base, over);
+	case SimdBlendOp::Lighten: return S::max16(base, over);
+	case SimdBlendOp::Subtract: return S::subs16(base, over);
+	case SimdBlendOp::Add: return S::min16(S::add16(base, over), S::set16(0xff));
+	case SimdBlendOp::Recolor: return over;
+	}
+	return over;
+}
+
+template<typename S>
+void alphaMaskBlend(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip)
+{
+	typedef typename S::Vec Vec;
+	const int vw = w - w % S::PIXELS;
+	const Vec zero = S::zero();
+	const Vec ff = S::set16(0xff);
+
+	// The color with the alpha channel forced to 255
+	const Vec c16 = S::unpacklo8(S::set32(color | 0xff000000), zero);
+
+	for(int y=0;y<h;++y) {
+		for(int x=0;x<vw;x+=S::PIXELS,mask+=S::PIXELS,base+=S::PIXELS) {
+			if(S::isZeroMask(mask))
+				continue;
+
+			const Vec m = S::loadMask(mask);
+			const Vec mlo = S::unpacklo8(m, zero);
+			const Vec mhi = S::unpackhi8(m, zero);
+			const Vec d = S::load(base);
+			const Vec dlo = S::unpacklo8(d, zero);
+			const Vec dhi = S::unpackhi8(d, zero);
+
+			const Vec rlo = S::add16(mult<S>(c16, mlo), mult<S>(dlo, S::sub16(ff, mlo)));
+			const Vec rhi = S::add16(mult<S>(c16, mhi), mult<S>(dhi, S::sub16(ff, mhi)));
+			S::store(base, pack<S>(rlo, rhi));
+		}
+		paintcore::doAlphaMaskBlend(base, color, mask, w-vw, 1, 0, 0);
+		base += w - vw + baseskip;
+		mask += w - vw + maskskip;
+	}
+}
+
+template<typename S>
+void alphaMaskUnder(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip)
+{
+	typedef typename S::Vec Vec;
+	const int vw = w - w % S::PIXELS;
+	const Vec zero = S::zero();
+	const Vec ff = S::set16(0xff);
+	const Vec c16 = S::unpacklo8(S::set32(color | 0xff000000), zero);
+
+	for(int y=0;y<h;++y) {
+		for(int x=0;x<vw;x+=S::PIXELS,mask+=S::PIXELS,base+=S::PIXELS) {
+			if(S::isZeroMask(mask))
+				continue;
+
+			const Vec m = S::loadMask(mask);
+			const Vec d = S::load(base);
+			const Vec dlo = S::unpacklo8(d, zero);
+			const Vec dhi = S::unpackhi8(d, zero);
+
+			const Vec alo = mult<S>(S::sub16(ff, S::alpha16(dlo)), S::unpacklo8(m, zero));
+			const Vec ahi = mult<S>(S::sub16(ff, S::alpha16(dhi)), S::unpackhi8(m, zero));
+
+			const Vec rlo = S::add16(mult<S>(c16, alo), dlo);
+			const Vec rhi = S::add16(mult<S>(c16, ahi), dhi);
+			S::store(base, pack<S>(rlo, rhi));
+		}
+		paintcore::doAlphaMaskUnder(base, color, mask, w-vw, 1, 0, 0);
+		base += w - vw + baseskip;
+		mask += w - vw + maskskip;
+	}
+}
+
+template<typename S>
+void maskErase(quint32 *base, const uchar *mask, int w, int h, int maskskip, int baseskip)
+{
+	typedef typename S::Vec Vec;
+	const int vw = w - w % S::PIXELS;
+	const Vec zero = S::zero();
+	const Vec ff = S::set16(0xff);
+	const Vec alphaMask = S::set32(0xff000000);
+
+	for(int y=0;y<h;++y) {
+		for(int x=0;x<vw;x+=S::PIXELS,mask+=S::PIXELS,base+=S::PIXELS) {
+			if(S::isZeroMask(mask))
+				continue;
+
+			const Vec m = S::loadMask(mask);
+			const Vec d = S::load(base);
+
+			const Vec r = pack<S>(
+				mult<S>(S::unpacklo8(d, zero), S::sub16(ff, S::unpacklo8(m, zero))),
+				mult<S>(S::unpackhi8(d, zero), S::sub16(ff, S::unpackhi8(m, zero)))
+			);
+
+			// Fully transparent destination pixels are left untouched
+			const Vec transparent = S::cmpeq32(S::and_(d, alphaMask), zero);
+			S::store(base, select<S>(transparent, d, r));
+		}
+		paintcore::doMaskErase(base, mask, w-vw, 1, 0, 0);
+		base += w - vw + baseskip;
+		mask += w - vw + maskskip;
+	}
+}
+
+template<typename S>
+void maskCopy(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip)
+{
+	typedef typename S::Vec Vec;
+	const int vw = w - w % S::PIXELS;
+	const Vec zero = S::zero();
+	const Vec c16 = S::unpacklo8(S::set32(color), zero);
+
+	for(int y=0;y<h;++y) {
+		for(int x=0;x<vw;x+=S::PIXELS,mask+=S::PIXELS,base+=S::PIXELS) {
+			const Vec m = S::loadMask(mask);
+			S::store(base, pack<S>(mult<S>(c16, S::unpacklo8(m, zero)), mult<S>(c16, S::unpackhi8(m, zero))));
+		}
+		paintcore::doMaskCopy(base, color, mask, w-vw, 1, 0, 0);
+		base += w - vw + baseskip;
+		mask += w - vw + maskskip;
+	}
+}
+
+template<typename S, SimdBlendOp Op>
+void maskCompositeOp(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip)
+{
+	typedef typename S::Vec Vec;
+	const int vw = w - w % S::PIXELS;
+	const quint32 *factors = unpremultiplyFactors();
+	const Vec zero = S::zero();
+	const Vec alphaMask = S::set32(0xff000000);
+	const Vec c16 = S::unpacklo8(S::set32(color), zero);
+
+	for(int y=0;y<h;++y) {
+		for(int x=0;x<vw;x+=S::PIXELS,mask+=S::PIXELS,base+=S::PIXELS) {
+			if(S::isZeroMask(mask))
+				continue;
+
+			const Vec m = S::loadMask(mask);
+			const Vec d = S::load(base);
+
+			Vec ulo, uhi;
+			unpremultiply<S>(d, S::gatherAlpha(factors, base), ulo, uhi);
+
+			const Vec rlo = premultiply<S>(
+				blend<S>(blendOp<S, Op>(ulo, c16), ulo, S::unpacklo8(m, zero)),
+				S::alpha16(S::unpacklo8(d, zero))
+			);
+			const Vec rhi = premultiply<S>(
+				blend<S>(blendOp<S, Op>(uhi, c16), uhi, S::unpackhi8(m, zero)),
+				S::alpha16(S::unpackhi8(d, zero))
+			);
+
+			// The alpha channel is not changed, and pixels under a transparent
+			// mask pixel or that are completely transparent are left untouched
+			const Vec r = select<S>(alphaMask, d, pack<S>(rlo, rhi));
+			const Vec skip = S::or_(S::cmpeq32(m, zero), S::cmpeq32(d, zero));
+			S::store(base, select<S>(skip, d, r));
+		}
+		paintcore::doMaskComposite(Op, base, color, mask, w-vw, 1, 0, 0);
+		base += w - vw + baseskip;
+		mask += w - vw + maskskip;
+	}
+}
+
+template<typename S>
+void maskComposite(SimdBlendOp op, quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip)
+{
+	switch(op) {
+	case SimdBlendOp::Multiply: maskCompositeOp<S, SimdBlendOp::Multiply>(base, color, mask, w, h, maskskip, baseskip); break;
+	case SimdBlendOp::Darken: maskCompositeOp<S, SimdBlendOp::Darken>(base, color, mask, w, h, maskskip, baseskip); break;
+	case SimdBlendOp::Lighten: maskCompositeOp<S, SimdBlendOp::Lighten>(base, color, mask, w, h, maskskip, baseskip); break;
+	case SimdBlendOp::Subtract: maskCompositeOp<S, SimdBlendOp::Subtract>(base, color, mask, w, h, maskskip, baseskip); break;
+	case SimdBlendOp::Add: maskCompositeOp<S, SimdBlendOp::Add>(base, color, mask, w, h, maskskip, baseskip); break;
+	case SimdBlendOp::Recolor: maskCompositeOp<S, SimdBlendOp::Recolor>(base, color, mask, w, h, maskskip, baseskip); break;
+	}
+}
+
+template<typename S>
+void pixelAlphaBlend(quint32 *destination, const quint32 *source, uchar opacity, int len)
+{
+	typedef typename S::Vec Vec;
+	const int vlen = len - len % S::PIXELS;
+	const Vec op = S::set16(opacity);
+	const Vec ff = S::set16(0xff);
+	const Vec zero = S::zero();
+
+	for(int i=0;i<vlen;i+=S::PIXELS,source+=S::PIXELS,destination+=S::PIXELS) {
+		const Vec s = S::load(source);
+		const Vec d = S::load(destination);
+		const Vec slo = S::unpacklo8(s, zero);
+		const Vec shi = S::unpackhi8(s, zero);
+		const Vec dlo = S::unpacklo8(d, zero);
+		const Vec dhi = S::unpackhi8(d, zero);
+
+		const Vec alo = S::sub16(ff, mult<S>(S::alpha16(slo), op));
+		const Vec ahi = S::sub16(ff, mult<S>(S::alpha16(shi), op));
+
+		const Vec r = pack<S>(
+			S::add16(mult<S>(slo, op), mult<S>(dlo, alo)),
+			S::add16(mult<S>(shi, op), mult<S>(dhi, ahi))
+		);
+
+		// Pixels whose effective source alpha is zero are left untouched
+		const Vec skip = S::packs16(S::cmpeq16(alo, ff), S::cmpeq16(ahi, ff));
+		S::store(destination, select<S>(skip, d, r));
+	}
+	paintcore::doPixelAlphaBlend(destination, source, opacity, len-vlen);
+}
+
+template<typename S>
+void pixelAlphaUnder(quint32 *destination, const quint32 *source, uchar opacity, int len)
+{
+	typedef typename S::Vec Vec;
+	const int vlen = len - len % S::PIXELS;
+	const Vec op = S::set16(opacity);
+	const Vec ff = S::set16(0xff);
+	const Vec zero = S::zero();
+
+	for(int i=0;i<vlen;i+=S::PIXELS,source+=S::PIXELS,destination+=S::PIXELS) {
+		const Vec s = S::load(source);
+		const Vec d = S::load(destination);
+		const Vec slo = S::unpacklo8(s, zero);
+		const Vec shi = S::unpackhi8(s, zero);
+		const Vec dlo = S::unpacklo8(d, zero);
+		const Vec dhi = S::unpackhi8(d, zero);
+
+		const Vec alo = mult<S>(S::sub16(ff, S::alpha16(dlo)), mult<S>(S::alpha16(slo), op));
+		const Vec ahi = mult<S>(S::sub16(ff, S::alpha16(dhi)), mult<S>(S::alpha16(shi), op));
+
+		S::store(destination, pack<S>(
+			S::add16(mult<S>(slo, alo), dlo),
+			S::add16(mult<S>(shi, ahi), dhi)
+		));
+	}
+	paintcore::doPixelAlphaUnder(destination, source, opacity, len-vlen);
+}
+
+template<typename S>
+void pixelErase(quint32 *destination, const quint32 *source, uchar opacity, int len)
+{
+	typedef typename S::Vec Vec;
+	const int vlen = len - len % S::PIXELS;
+	const Vec op = S::set16(opacity);
+	const Vec ff = S::set16(0xff);
+	const Vec zero = S::zero();
+
+	for(int i=0;i<vlen;i+=S::PIXELS,source+=S::PIXELS,destination+=S::PIXELS) {
+		const Vec s = S::load(source);
+		const Vec d = S::load(destination);
+
+		const Vec alo = S::sub16(ff, mult<S>(S::alpha16(S::unpacklo8(s, zero)), op));
+		const Vec ahi = S::sub16(ff, mult<S>(S::alpha16(S::unpackhi8(s, zero)), op));
+
+		S::store(destination, pack<S>(
+			mult<S>(S::unpacklo8(d, zero), alo),
+			mult<S>(S::unpackhi8(d, zero), ahi)
+		));
+	}
+	paintcore::doPixelErase(destination, source, opacity, len-vlen);
+}
+
+template<typename S, SimdBlendOp Op>
+void pixelCompositeOp(quint32 *destination, const quint32 *source, uchar opacity, int len)
+{
+	typedef typename S::Vec Vec;
+	const int vlen = len - len % S::PIXELS;
+	const quint32 *factors = unpremultiplyFactors();
+	const Vec op = S::set16(opacity);
+	const Vec zero = S::zero();
+	const Vec alphaMask = S::set32(0xff000000);
+
+	for(int i=0;i<vlen;i+=S::PIXELS,source+=S::PIXELS,destination+=S::PIXELS) {
+		const Vec s = S::load(source);
+		const Vec d = S::load(destination);
+		const Vec slo = S::unpacklo8(s, zero);
+		const Vec shi = S::unpackhi8(s, zero);
+		const Vec dalo = S::alpha16(S::unpacklo8(d, zero));
+		const Vec dahi = S::alpha16(S::unpackhi8(d, zero));
+
+		Vec ulo, uhi;
+		unpremultiply<S>(d, S::gatherAlpha(factors, destination), ulo, uhi);
+
+		// Source alpha scaled by the opacity and the destination alpha
+		const Vec alo = mult<S>(mult<S>(S::alpha16(slo), op), dalo);
+		const Vec ahi = mult<S>(mult<S>(S::alpha16(shi), op), dahi);
+
+		const Vec rlo = premultiply<S>(blend<S>(blendOp<S, Op>(ulo, slo), ulo, alo), dalo);
+		const Vec rhi = premultiply<S>(blend<S>(blendOp<S, Op>(uhi, shi), uhi, ahi), dahi);
+
+		// The alpha channel is not changed, and pixels are left untouched
+		// if either the source or the destination is completely transparent
+		const Vec r = select<S>(alphaMask, d, pack<S>(rlo, rhi));
+		const Vec skip = S::or_(S::cmpeq32(S::and_(s, alphaMask), zero), S::cmpeq32(d, zero));
+		S::store(destination, select<S>(skip, d, r));
+	}
+	paintcore::doPixelComposite(Op, destination, source, opacity, len-vlen);
+}
+
+template<typename S>
+void pixelComposite(SimdBlendOp op, quint32 *destination, const quint32 *source, uchar opacity, int len)
+{
+	switch(op) {
+	case SimdBlendOp::Multiply: pixelCompositeOp<S, SimdBlendOp::Multiply>(destination, source, opacity, len); break;
+	case SimdBlendOp::Darken: pixelCompositeOp<S, SimdBlendOp::Darken>(destination, source, opacity, len); break;
+	case SimdBlendOp::Lighten: pixelCompositeOp<S, SimdBlendOp::Lighten>(destination, source, opacity, len); break;
+	case SimdBlendOp::Subtract: pixelCompositeOp<S, SimdBlendOp::Subtract>(destination, source, opacity, len); break;
+	case SimdBlendOp::Add: pixelCompositeOp<S, SimdBlendOp::Add>(destination, source, opacity, len); break;
+	case SimdBlendOp::Recolor: pixelCompositeOp<S, SimdBlendOp::Recolor>(destination, source, opacity, len); break;
+	}
+}
+
+}
+
+}
+
+// Define the kernels declared in rasterop_simd.h for the instruction set wrapper S
+#define DEFINE_SIMD_KERNELS(S) \
+	void doAlphaMaskBlend(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip) \
+		{ alphaMaskBlend<S>(base, color, mask, w, h, maskskip, baseskip); } \
+	void doAlphaMaskUnder(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip) \
+		{ alphaMaskUnder<S>(base, color, mask, w, h, maskskip, baseskip); } \
+	void doMaskErase(quint32 *base, const uchar *mask, int w, int h, int maskskip, int baseskip) \
+		{ maskErase<S>(base, mask, w, h, maskskip, baseskip); } \
+	void doMaskCopy(quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip) \
+		{ maskCopy<S>(base, color, mask, w, h, maskskip, baseskip); } \
+	void doMaskComposite(SimdBlendOp op, quint32 *base, quint32 color, const uchar *mask, int w, int h, int maskskip, int baseskip) \
+		{ maskComposite<S>(op, base, color, mask, w, h, maskskip, baseskip); } \
+	void doPixelAlphaBlend(quint32 *destination, const quint32 *source, uchar opacity, int len) \
+		{ pixelAlphaBlend<S>(destination, source, opacity, len); } \
+	void doPixelAlphaUnder(quint32 *destination, const quint32 *source, uchar opacity, int len) \
+		{ pixelAlphaUnder<S>(destination, source, opacity, len); } \
+	void doPixelErase(quint32 *destination, const quint32 *source, uchar opacity, int len) \
+		{ pixelErase<S>(destination, source, opacity, len); } \
+	void doPixelComposite(SimdBlendOp op, quint32 *destination, const quint32 *source, uchar opacity, int len) \
+		{ pixelComposite<S>(op, destination, source, opacity, len); }
+
+#endif
@@ -0,0 +1,111 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2019 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Note: this file is compiled with SSE2 enabled. To avoid SSE2 instructions
+// leaking into shared inline functions, do not use any inline functions
+// from Qt or the standard library here.
+
+#include "rasterop_simd_kernels.h"
+
+#include <emmintrin.h>
+#include <cstring>
+
+namespace paintcore {
+
+namespace {
+
+// SSE2 intrinsics for the kernels in rasterop_simd_kernels.h
+struct Sse2 {
+	typedef __m128i Vec;
+	enum { PIXELS = 4 };
+
+	static Vec load(const quint32 *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+	static void store(quint32 *p, Vec v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+
+	static Vec zero() { return _mm_setzero_si128(); }
+	static Vec set16(int v) { return _mm_set1_epi16(short(v)); }
+	static Vec set32(quint32 v) { return _mm_set1_epi32(int(v)); }
+
+	static Vec add16(Vec a, Vec b) { return _mm_add_epi16(a, b); }
+	static Vec sub16(Vec a, Vec b) { return _mm_sub_epi16(a, b); }
+	static Vec subs16(Vec a, Vec b) { return _mm_subs_epu16(a, b); }
+	static Vec mul16(Vec a, Vec b) { return _mm_mullo_epi16(a, b); }
+	static Vec mulhi16(Vec a, Vec b) { return _mm_mulhi_epu16(a, b); }
+	static Vec min16(Vec a, Vec b) { return _mm_min_epi16(a, b); }
+	static Vec max16(Vec a, Vec b) { return _mm_max_epi16(a, b); }
+	static Vec srl16(Vec a, int n) { return _mm_srli_epi16(a, n); }
+	static Vec srl32(Vec a, int n) { return _mm_srli_epi32(a, n); }
+	static Vec sll32(Vec a, int n) { return _mm_slli_epi32(a, n); }
+
+	static Vec and_(Vec a, Vec b) { return _mm_and_si128(a, b); }
+	static Vec or_(Vec a, Vec b) { return _mm_or_si128(a, b); }
+	static Vec andnot(Vec a, Vec b) { return _mm_andnot_si128(a, b); }
+	static Vec cmpeq16(Vec a, Vec b) { return _mm_cmpeq_epi16(a, b); }
+	static Vec cmpeq32(Vec a, Vec b) { return _mm_cmpeq_epi32(a, b); }
+
+	static Vec unpacklo8(Vec a, Vec b) { return _mm_unpacklo_epi8(a, b); }
+	static Vec unpackhi8(Vec a, Vec b) { return _mm_unpackhi_epi8(a, b); }
+	static Vec unpacklo32(Vec a, Vec b) { return _mm_unpacklo_epi32(a, b); }
+	static Vec unpackhi32(Vec a, Vec b) { return _mm_unpackhi_epi32(a, b); }
+	static Vec packus16(Vec a, Vec b) { return _mm_packus_epi16(a, b); }
+	static Vec packs16(Vec a, Vec b) { return _mm_packs_epi16(a, b); }
+
+	// Spread the alpha channel of each unpacked pixel to all four channels
+	static Vec alpha16(Vec p)
+	{
+		return _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, 0xff), 0xff);
+	}
+
+	// Load four mask bytes and spread each one to all four channels of a pixel
+	static Vec loadMask(const uchar *mask)
+	{
+		int m;
+		memcpy(&m, mask, 4);
+		const Vec v = _mm_cvtsi32_si128(m);
+		const Vec v2 = _mm_unpacklo_epi8(v, v);
+		return _mm_unpacklo_epi16(v2, v2);
+	}
+
+	static bool isZeroMask(const uchar *mask)
+	{
+		int m;
+		memcpy(&m, mask, 4);
+		return m == 0;
+	}
+
+	// Look up table[alpha] for each pixel
+	static Vec gatherAlpha(const quint32 *table, const quint32 *pixels)
+	{
+		return _mm_setr_epi32(
+			int(table[pixels[0] >> 24]),
+			int(table[pixels[1] >> 24]),
+			int(table[pixels[2] >> 24]),
+			int(table[pixels[3] >> 24])
+		);
+	}
+};
+
+}
+
+namespace sse2 {
+
+DEFINE_SIMD_KERNELS(Sse2)
+
+}
+}
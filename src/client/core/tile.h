@@ -148,6 +148,14 @@ class Tile {
 		 */
 		bool isNull() const { return !m_data; }
 
+		/**
+		 * @brief Is the pixel data of this tile shared with another tile?
+		 *
+		 * This is used for memory usage statistics. The result is only
+		 * a snapshot, since other tiles may detach at any time.
+		 */
+		bool isShared() const { return m_data && m_data.constData()->ref.load() > 1; }
+
 		//! Check if this tile is completely transparent
 		bool isBlank() const;
 
@@ -19,30 +19,34 @@
 
 #include "tilevector.h"
 #include "layer.h"
+#include "concurrent.h"
 #include "../shared/net/layer.h"
 #include "../shared/net/image.h"
 
 #include <QImage>
+#include <QThread>
+#include <QMultiHash>
 
 namespace paintcore {
 
 LayerTileSet LayerTileSet::fromLayer(const Layer &layer)
 {
-	const QVector<Tile> tiles = layer.tiles();
-	const int cols = Tile::roundTiles(layer.width());
+	const int cols = layer.xtiles();
+	const int tileCount = layer.xtiles() * layer.ytiles();
 
-	Q_ASSERT(!tiles.isEmpty());
+	Q_ASSERT(tileCount > 0);
 
 	QVector<TileRun> runs;
 
 	// First, Run Length Encode the tile vector
-	runs << TileRun { tiles.first(), 0, 0, 1, tiles.first().solidColor() };
+	runs << TileRun { layer.tile(0), 0, 0, 1, layer.tile(0).solidColor() };
 
-	for(int i=1;i<tiles.size();++i) {
-		if(runs.last().len < 0xffff && runs.last().tile.equals(tiles.at(i))) {
+	for(int i=1;i<tileCount;++i) {
+		const Tile &t = layer.tile(i);
+		if(runs.last().len < 0xffff && runs.last().tile.equals(t)) {
 			runs.last().len++;
 		} else {
-			runs << TileRun { tiles.at(i), i%cols, i/cols, 1, tiles.at(i).solidColor() };
+			runs << TileRun { t, i%cols, i/cols, 1, t.solidColor() };
 		}
 	}
 
@@ -57,7 +61,7 @@ LayerTileSet LayerTileSet::fromLayer(const Layer &layer)
 	// solid color, use that as the background color.
 	// Otherwise, transparency is a safe default choice.
 	QColor background = Qt::transparent;
-	const int treshold = tiles.length() / 2;
+	const int treshold = tileCount / 2;
 	for(QHash<quint32, int>::const_iterator i = colors.constBegin();i!=colors.constEnd();++i) {
 		if(i.value() >= treshold) {
 			background = QColor::fromRgba(i.key());
@@ -91,6 +95,68 @@ LayerTileSet LayerTileSet::fromImage(const QImage &image, const QSize &layerSize
 	return fromLayer(l);
 }
 
+void LayerTileSet::compressTiles(QVector<LayerTileSet> &sets)
+{
+	// Collect the runs that need compressing
+	QVector<TileRun*> runs;
+	for(LayerTileSet &set : sets) {
+		for(TileRun &tr : set.tiles) {
+			if(!tr.color.isValid() && tr.compressed.isEmpty())
+				runs << &tr;
+		}
+	}
+
+	if(runs.isEmpty())
+		return;
+
+	const int threads = QThread::idealThreadCount();
+
+	// Hash tile contents
+	QVector<uint> hashes(runs.size());
+	{
+		uint *h = hashes.data();
+		TileRun * const *r = runs.constData();
+		concurrentForChunks(runs.size(), threads, [h, r](int, int begin, int end) {
+			for(int i=begin;i<end;++i)
+				h[i] = qHashBits(r[i]->tile.constData(), Tile::BYTES);
+		});
+	}
+
+	// Find unique tiles. Hash matches are verified with a full comparison.
+	QVector<Tile> unique;
+	QVector<int> uniqueIndex(runs.size());
+	QMultiHash<uint, int> hashIndex;
+	for(int i=0;i<runs.size();++i) {
+		int idx = -1;
+		for(auto it=hashIndex.constFind(hashes.at(i));it!=hashIndex.constEnd() && it.key()==hashes.at(i);++it) {
+			if(unique.at(it.value()).equals(runs.at(i)->tile)) {
+				idx = it.value();
+				break;
+			}
+		}
+		if(idx < 0) {
+			idx = unique.size();
+			unique << runs.at(i)->tile;
+			hashIndex.insert(hashes.at(i), idx);
+		}
+		uniqueIndex[i] = idx;
+	}
+
+	// Compress the unique tiles
+	QVector<QByteArray> compressed(unique.size());
+	{
+		QByteArray *out = compressed.data();
+		const Tile *in = unique.constData();
+		concurrentForChunks(unique.size(), threads, [out, in](int, int begin, int end) {
+			for(int i=begin;i<end;++i)
+				out[i] = qCompress(reinterpret_cast<const uchar*>(in[i].constData()), Tile::BYTES);
+		});
+	}
+
+	for(int i=0;i<runs.size();++i)
+		runs[i]->compressed = compressed.at(uniqueIndex.at(i));
+}
+
 QList<protocol::MessagePtr> LayerTileSet::toInitCommands(int contextId, const LayerInfo &info)
 {
 	QList<protocol::MessagePtr> msgs;
@@ -120,7 +186,7 @@ QList<protocol::MessagePtr> LayerTileSet::toInitCommands(int contextId, const La
 		} else {
 			Q_ASSERT(!t.tile.isNull());
 			msgs << protocol::MessagePtr(new protocol::PutTile(contextId, info.id, 0, t.col, t.row, t.len-1,
-				qCompress(reinterpret_cast<const uchar*>(t.tile.constData()), paintcore::Tile::BYTES)
+				t.compressed.isEmpty() ? qCompress(reinterpret_cast<const uchar*>(t.tile.constData()), paintcore::Tile::BYTES) : t.compressed
 				));
 		}
 	}
@@ -43,6 +43,7 @@ struct TileRun {
 	int row;
 	int len;      // the length of the tile run (always at least 1)
 	QColor color; // if valid, this tile is filled with solid color
+	QByteArray compressed; // precompressed tile content (see LayerTileSet::compressTiles)
 };
 
 /**
@@ -62,6 +63,16 @@ struct LayerTileSet {
 	static LayerTileSet fromImage(const QImage &image);
 	static LayerTileSet fromImage(const QImage &image, const QSize &layerSize, const QPoint &offset);
 
+	/**
+	 * @brief Compress the tiles of the given tile sets in parallel
+	 *
+	 * Identical tiles are found using content hashes (across all the sets)
+	 * and compressed just once. The duplicates share the compressed data.
+	 *
+	 * After this, toInitCommands will use the precompressed data.
+	 */
+	static void compressTiles(QVector<LayerTileSet> &sets);
+
 	/**
 	 * @brief Generate a set of commands to create a layer from this tileset
 	 *
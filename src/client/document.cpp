@@ -30,6 +30,7 @@
 #include "canvas/loader.h"
 #include "canvas/userlist.h"
 #include "canvas/canvassaverrunnable.h"
+#include "ora/orawriter.h"
 #include "canvas/loader.h"
 #include "tools/toolcontroller.h"
 #include "utils/settings.h"
@@ -109,6 +110,7 @@ void Document::initCanvas()
 {
 	delete m_canvas;
 	m_canvas = new canvas::CanvasModel(m_client->myId(), this);
+	m_layerImageCache.reset(new openraster::LayerImageCache);
 
 	m_toolctrl->setModel(m_canvas);
 
@@ -465,7 +467,7 @@ void Document::saveCanvas()
 	Q_ASSERT(!m_saveInProgress);
 	m_saveInProgress = true;
 
-	auto *saver = new canvas::CanvasSaverRunnable(m_canvas, m_currentFilename);
+	auto *saver = new canvas::CanvasSaverRunnable(m_canvas, m_currentFilename, m_layerImageCache);
 	unmarkDirty();
 	connect(saver, &canvas::CanvasSaverRunnable::saveComplete, this, &Document::onCanvasSaved);
 	emit canvasSaveStarted();
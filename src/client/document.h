@@ -26,6 +26,7 @@
 
 #include <QObject>
 #include <QStringListModel>
+#include <QSharedPointer>
 
 class QString;
 class QTimer;
@@ -43,6 +44,7 @@ namespace net {
 	class AnnouncementListModel;
 }
 namespace recording { class Writer; }
+namespace openraster { struct LayerImageCache; }
 namespace tools { class ToolController; }
 
 /**
@@ -279,6 +281,9 @@ private:
 	bool m_saveInProgress;
 	QTimer *m_autosaveTimer;
 
+	// Encoded layers from the previous save, so autosaves don't need to re-encode unchanged layers
+	QSharedPointer<openraster::LayerImageCache> m_layerImageCache;
+
 	QString m_roomcode;
 
 	bool m_sessionPersistent;
@@ -98,15 +98,36 @@ static Subframe optimizeFrame(const QImage &prev, const QImage &current)
 	const int w = current.width();
 	const int h = current.height();
 
+	// Identical rows can be skipped with a single comparison
+	// when both images have the same pixel format.
+	const bool sameFormat = prev.format() == current.format() && current.depth() == 32;
+
 	// Find bounding rectangle of differing pixels
 	int x1=w, y1=h, x2=0, y2=0;
 	for(int y=0;y<h;++y) {
-		for(int x=0;x<w;++x) {
-			if(prev.pixel(x, y) != current.pixel(x, y)) {
-				x1 = qMin(x1, x);
-				x2 = qMax(x2, x);
-				y1 = qMin(y1, y);
-				y2 = qMax(y2, y);
+		if(sameFormat) {
+			const QRgb *a = reinterpret_cast<const QRgb*>(prev.constScanLine(y));
+			const QRgb *b = reinterpret_cast<const QRgb*>(current.constScanLine(y));
+			if(memcmp(a, b, w * sizeof(QRgb)) == 0)
+				continue;
+
+			for(int x=0;x<w;++x) {
+				if(a[x] != b[x]) {
+					x1 = qMin(x1, x);
+					x2 = qMax(x2, x);
+				}
+			}
+			y1 = qMin(y1, y);
+			y2 = qMax(y2, y);
+
+		} else {
+			for(int x=0;x<w;++x) {
+				if(prev.pixel(x, y) != current.pixel(x, y)) {
+					x1 = qMin(x1, x);
+					x2 = qMax(x2, x);
+					y1 = qMin(y1, y);
+					y2 = qMax(y2, y);
+				}
 			}
 		}
 	}
@@ -132,9 +153,6 @@ void GifExporter::writeFrame(const QImage &image, int repeat)
 	Q_ASSERT(repeat>0);
 	Q_ASSERT(image.size() == framesize());
 
-	// Frame duration in 1/100 seconds
-	int delay = qMax(1, repeat * 100 / fps());
-
 	// Extract changed part of the image if frame optimization is enabled
 	Subframe subframe {0, 0, 0, 0, QImage() };
 
@@ -144,21 +162,49 @@ void GifExporter::writeFrame(const QImage &image, int repeat)
 		p->prevImage = image;
 	}
 
-	if(subframe.frame.isNull()) {
+	if(subframe.frame.isNull())
 		subframe.frame = image;
-		subframe.w = quint16(image.width());
-		subframe.h = quint16(image.height());
+
+	writeSubframe(QPoint(subframe.x, subframe.y), subframe.frame, repeat);
+}
+
+void GifExporter::writePartialFrame(const QImage &image, const QRect &changed, int repeat)
+{
+	Q_ASSERT(repeat>0);
+	Q_ASSERT(image.size() == framesize());
+
+	if(!p->optimize) {
+		writeFrame(image, repeat);
+		return;
+	}
+
+	// The changed area is already known, so there is no need
+	// to keep the previous frame around for comparison.
+	p->prevImage = QImage();
+
+	QRect rect = changed & image.rect();
+	if(rect.isEmpty()) {
+		// Nothing changed, but a frame is still needed for the delay
+		rect = QRect(0, 0, 1, 1);
 	}
 
+	writeSubframe(rect.topLeft(), image.copy(rect), repeat);
+}
+
+void GifExporter::writeSubframe(const QPoint &pos, const QImage &image, int repeat)
+{
+	// Frame duration in 1/100 seconds
+	int delay = qMax(1, repeat * 100 / fps());
+
 	// Convert to 8-bit indexed
-	subframe.frame = subframe.frame.convertToFormat(QImage::Format_Indexed8, p->conversionFlags);
+	const QImage frame = image.convertToFormat(QImage::Format_Indexed8, p->conversionFlags);
 
 	// Get the image palette
 	// note: palette size must be a power of two
 	ColorMapObject *palette = GifMakeMapObject(256, nullptr);
-	Q_ASSERT(subframe.frame.colorCount() > 0 && subframe.frame.colorCount() <= 256);
-	for(int i=0;i<subframe.frame.colorCount();++i) {
-		const QRgb c = subframe.frame.color(i);
+	Q_ASSERT(frame.colorCount() > 0 && frame.colorCount() <= 256);
+	for(int i=0;i<frame.colorCount();++i) {
+		const QRgb c = frame.color(i);
 		palette->Colors[i].Red = qRed(c);
 		palette->Colors[i].Green = qGreen(c);
 		palette->Colors[i].Blue = qBlue(c);
@@ -172,13 +218,13 @@ void GifExporter::writeFrame(const QImage &image, int repeat)
 		0x00                 // transparency index (not used)
 	};
 	EGifPutExtension(p->gif, GRAPHICS_EXT_FUNC_CODE, 4, extcode);
-	EGifPutImageDesc(p->gif, subframe.x, subframe.y, subframe.w, subframe.h, false, palette);
+	EGifPutImageDesc(p->gif, pos.x(), pos.y(), frame.width(), frame.height(), false, palette);
 
 	GifFreeMapObject(palette);
 
 	// Write pixel data
-	for(int y=0;y<subframe.h;++y) {
-		if(EGifPutLine(p->gif, subframe.frame.scanLine(y), subframe.w) == GIF_ERROR) {
+	for(int y=0;y<frame.height();++y) {
+		if(EGifPutLine(p->gif, const_cast<uchar*>(frame.constScanLine(y)), frame.width()) == GIF_ERROR) {
 #ifdef OLD_API
 			emit exporterError(gifErrorQString(0));
 #else
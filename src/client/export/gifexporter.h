@@ -38,9 +38,12 @@ protected:
 	void initExporter();
 	void startExporter();
 	void writeFrame(const QImage &image, int repeat);
+	void writePartialFrame(const QImage &image, const QRect &changed, int repeat);
 	void shutdownExporter();
 
 private:
+	void writeSubframe(const QPoint &pos, const QImage &image, int repeat);
+
 	struct Private;
 	Private *p;
 };
@@ -39,6 +39,16 @@ void VideoExporter::finish()
 }
 
 void VideoExporter::saveFrame(const QImage &image, int count)
+{
+	addFrame(image, nullptr, count);
+}
+
+void VideoExporter::saveFrame(const QImage &image, const QRect &changed, int count)
+{
+	addFrame(image, &changed, count);
+}
+
+void VideoExporter::addFrame(const QImage &image, const QRect *changed, int count)
 {
 	Q_ASSERT(count>0);
 	Q_ASSERT(!image.isNull());
@@ -47,6 +57,7 @@ void VideoExporter::saveFrame(const QImage &image, int count)
 		return;
 
 	QImage frameImage = image;
+	QRect changedArea = changed ? *changed : QRect();
 
 	if(isVariableSize() && !variableSizeSupported()) {
 		// If exporter does not support variable size, fix frame
@@ -74,12 +85,32 @@ void VideoExporter::saveFrame(const QImage &image, int count)
 		painter.end();
 
 		frameImage = newframe;
+
+		// Map the changed area to the scaled frame. Smooth scaling
+		// bleeds into the neighbouring pixels, so leave some margin.
+		if(!changedArea.isEmpty()) {
+			const qreal sx = newsize.width() / qreal(image.width());
+			const qreal sy = newsize.height() / qreal(image.height());
+			const int margin = int(qMax(sx, sy)) + 2;
+			changedArea = QRect(
+				rect.x() + int(changedArea.x() * sx) - margin,
+				rect.y() + int(changedArea.y() * sy) - margin,
+				int(changedArea.width() * sx) + 2 * margin + 1,
+				int(changedArea.height() * sy) + 2 * margin + 1
+			) & rect;
+		}
 	}
 
 	if(_frame==0)
 		startExporter();
 
-	writeFrame(frameImage, count);
+	if(!changed || _frame==0 || image.size() != _lastsize || frameImage.size() != _lastframesize)
+		writeFrame(frameImage, count);
+	else
+		writePartialFrame(frameImage, changedArea, count);
+
+	_lastsize = image.size();
+	_lastframesize = frameImage.size();
 	_frame += count;
 }
 
@@ -22,6 +22,7 @@
 #include <QThread>
 #include <QString>
 #include <QSize>
+#include <QRect>
 
 class QImage;
 
@@ -89,6 +90,18 @@ public:
 	 */
 	void saveFrame(const QImage &image, int count);
 
+	/**
+	 * @brief Add a new frame of which only a part has changed
+	 *
+	 * The image must be the same size as the previous frame. Everything
+	 * outside the changed area must be identical to the previous frame.
+	 *
+	 * @param image frame content
+	 * @param changed the area that may differ from the previous frame
+	 * @param count number of times to write the frame
+	 */
+	void saveFrame(const QImage &image, const QRect &changed, int count);
+
 	/**
 	 * @brief Stop exporter
 	 */
@@ -128,6 +141,16 @@ protected:
 	 */
 	virtual void writeFrame(const QImage &image, int repeat) = 0;
 
+	/**
+	 * @brief Export a frame of which only a part has changed
+	 *
+	 * The changed area is relative to the output frame. This is never
+	 * called for the first frame.
+	 *
+	 * The default implementation just writes the whole frame.
+	 */
+	virtual void writePartialFrame(const QImage &image, const QRect &changed, int repeat) { Q_UNUSED(changed); writeFrame(image, repeat); }
+
 	//! Last frame has been written, shut down the exporter
 	virtual void shutdownExporter() = 0;
 
@@ -138,10 +161,14 @@ protected:
 	virtual bool variableSizeSupported() { return false; }
 
 private:
+	void addFrame(const QImage &image, const QRect *changed, int count);
+
 	int _fps;
 	bool _variablesize;
 	int _frame;
 	QSize _targetsize;
+	QSize _lastsize;      // size of the previous input image
+	QSize _lastframesize; // size of the previous output frame
 };
 
 #endif // VIDEOEXPORTER_H
@@ -18,9 +18,11 @@
 */
 
 #include "webmencoder.h"
+#include "core/concurrent.h"
 
 #include <QImage>
 #include <QFile>
+#include <QThread>
 
 WebmEncoder::WebmEncoder(const QString &filename, QObject *parent)
 	: QObject(parent), m_initialized(false)
@@ -71,6 +73,7 @@ void WebmEncoder::start(int width, int height, int fps)
 	cfg.rc_target_bitrate = 200;
 	cfg.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
 	cfg.g_profile = 1; // Profile 1 needed for 4:4:4 format
+	cfg.g_threads = qBound(1, QThread::idealThreadCount(), 64);
 	m_fps = fps;
 
 	if (vpx_codec_enc_init(&m_codec, codecInterface, &cfg, 0)) {
@@ -78,6 +81,27 @@ void WebmEncoder::start(int width, int height, int fps)
 		return;
 	}
 
+	// The encoder threads can only work in parallel on separate tile columns
+	// (or rows, when row based multithreading is available.)
+	// The encoder limits the number of tile columns based on frame width.
+	int tileColumns = 0;
+	while((2 << tileColumns) <= int(cfg.g_threads) && tileColumns < 6)
+		++tileColumns;
+
+	if (vpx_codec_control(&m_codec, VP9E_SET_TILE_COLUMNS, tileColumns)) {
+		qWarning("VPX error: %s (%s)",
+				vpx_codec_error(&m_codec),
+				vpx_codec_error_detail(&m_codec));
+	}
+
+#ifdef VPX_CTRL_VP9E_SET_ROW_MT
+	if (vpx_codec_control(&m_codec, VP9E_SET_ROW_MT, 1)) {
+		qWarning("VPX error: %s (%s)",
+				vpx_codec_error(&m_codec),
+				vpx_codec_error_detail(&m_codec));
+	}
+#endif
+
 	// Set sRGB color space
 	if (vpx_codec_control(&m_codec, VP9E_SET_COLOR_SPACE, 7)) {
 		qWarning("VPX error: %s (%s)",
@@ -97,29 +121,12 @@ void WebmEncoder::writeFrame(const QImage &image, int repeat)
 		return;
 	}
 
-	const unsigned int w=image.width();
-	const unsigned int h=image.height();
-	Q_ASSERT(w == m_rawFrame.w);
-	Q_ASSERT(h == m_rawFrame.h);
+	Q_ASSERT(unsigned(image.width()) == m_rawFrame.w);
+	Q_ASSERT(unsigned(image.height()) == m_rawFrame.h);
 	Q_ASSERT(image.depth() == 32);
 	Q_ASSERT(repeat>0);
 
-	// Color space is actually sRGB
-	uchar *yplane = m_rawFrame.planes[VPX_PLANE_Y];
-	uchar *uplane = m_rawFrame.planes[VPX_PLANE_U];
-	uchar *vplane = m_rawFrame.planes[VPX_PLANE_V];
-	for(unsigned int y=0;y<h;++y) {
-		const uchar *src = image.constScanLine(y);
-		for(unsigned int x=0;x<w;++x, src+=4) {
-			vplane[x] = src[2]; // red
-			yplane[x] = src[1]; // green
-			uplane[x] = src[0]; // blue
-		}
-
-		yplane += m_rawFrame.stride[VPX_PLANE_Y];
-		uplane += m_rawFrame.stride[VPX_PLANE_U];
-		vplane += m_rawFrame.stride[VPX_PLANE_V];
-	}
+	convertFrame(image);
 
 	// Enqueue frame for encoding
 	const uint64_t duration = uint64_t(repeat) * 1000000000 / m_fps;
@@ -144,7 +151,32 @@ void WebmEncoder::writeFrame(const QImage &image, int repeat)
 
 	writeFrames();
 
-	emit encoderReady();
+	emit frameWritten();
+}
+
+void WebmEncoder::convertFrame(const QImage &image)
+{
+	// Color space is actually sRGB, so the planes are just the color channels.
+	// The rows are independent, so they are converted in parallel slices.
+	const uchar *bits = image.constBits();
+	const int bpl = image.bytesPerLine();
+	const int w = image.width();
+	const vpx_image_t *raw = &m_rawFrame;
+
+	paintcore::TaskScheduler::instance()->parallelFor(image.height(), CONVERSION_ROWS, [bits, bpl, w, raw](int, int begin, int end) {
+		for(int y=begin;y<end;++y) {
+			const uchar *src = bits + y * bpl;
+			uchar *yplane = raw->planes[VPX_PLANE_Y] + y * raw->stride[VPX_PLANE_Y];
+			uchar *uplane = raw->planes[VPX_PLANE_U] + y * raw->stride[VPX_PLANE_U];
+			uchar *vplane = raw->planes[VPX_PLANE_V] + y * raw->stride[VPX_PLANE_V];
+
+			for(int x=0;x<w;++x, src+=4) {
+				vplane[x] = src[2]; // red
+				yplane[x] = src[1]; // green
+				uplane[x] = src[0]; // blue
+			}
+		}
+	});
 }
 
 bool WebmEncoder::writeFrames()
@@ -70,6 +70,9 @@ signals:
 	void encoderReady();
 	void encoderFinished();
 
+	//! A frame passed to writeFrame has been encoded
+	void frameWritten();
+
 public slots:
 	//! Open the exporter. Emits exporterError or exporterReady
 	void open();
@@ -84,6 +87,10 @@ public slots:
 	void finish();
 
 private:
+	// Number of rows converted per parallel chunk
+	static const int CONVERSION_ROWS = 16;
+
+	void convertFrame(const QImage &image);
 	bool writeFrames();
 
 	QFileMkvWriter m_writer;
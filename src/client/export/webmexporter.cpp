@@ -27,6 +27,10 @@ struct WebmExporter::Private {
 	WebmEncoder *encoder = nullptr;
 
 	QString filename;
+
+	int queueDepth = DEFAULT_QUEUE_DEPTH;
+	int queued = 0;       // frames sent to the encoder but not yet encoded
+	bool waiting = false; // exporterReady is emitted when a frame is done
 };
 
 WebmExporter::WebmExporter(QObject *parent)
@@ -49,6 +53,17 @@ void WebmExporter::setFilename(const QString &filename)
 	d->filename = filename;
 }
 
+void WebmExporter::setQueueDepth(int depth)
+{
+	Q_ASSERT(depth>0);
+	d->queueDepth = qMax(1, depth);
+}
+
+int WebmExporter::queueDepth() const
+{
+	return d->queueDepth;
+}
+
 void WebmExporter::initExporter()
 {
 	d->encoderThread = new QThread(this);
@@ -59,6 +74,7 @@ void WebmExporter::initExporter()
 	connect(d->encoderThread, &QThread::started, d->encoder, &WebmEncoder::open);
 
 	connect(d->encoder, &WebmEncoder::encoderReady, this, &WebmExporter::exporterReady);
+	connect(d->encoder, &WebmEncoder::frameWritten, this, &WebmExporter::frameWritten);
 	connect(d->encoder, &WebmEncoder::encoderError, this, &WebmExporter::exporterError);
 	connect(d->encoder, &WebmEncoder::encoderFinished, this, &WebmExporter::exporterFinished);
 
@@ -85,6 +101,23 @@ void WebmExporter::writeFrame(const QImage &image, int repeat)
 		Q_ARG(QImage, image),
 		Q_ARG(int, repeat)
 	);
+
+	// Accept the next frame right away if there is still room in the queue
+	++d->queued;
+	if(d->queued < d->queueDepth)
+		emit exporterReady();
+	else
+		d->waiting = true;
+}
+
+void WebmExporter::frameWritten()
+{
+	Q_ASSERT(d->queued > 0);
+	--d->queued;
+	if(d->waiting && d->queued < d->queueDepth) {
+		d->waiting = false;
+		emit exporterReady();
+	}
 }
 
 void WebmExporter::shutdownExporter()
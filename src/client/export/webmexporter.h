@@ -28,8 +28,25 @@ public:
 	WebmExporter(QObject *parent=nullptr);
 	~WebmExporter();
 
+	//! Default number of frames that can wait for the encoder
+	static const int DEFAULT_QUEUE_DEPTH = 4;
+
 	void setFilename(const QString &filename);
 
+	/**
+	 * @brief Set the maximum number of frames waiting to be encoded
+	 *
+	 * The encoder runs in its own thread. New frames are accepted while
+	 * fewer than this many frames are waiting, so the canvas can be
+	 * replayed while the previous frames are being encoded.
+	 * Each queued frame holds a copy of the image.
+	 *
+	 * A depth of 1 means each frame must be encoded before the next
+	 * one is accepted.
+	 */
+	void setQueueDepth(int depth);
+	int queueDepth() const;
+
 protected:
 	void initExporter() override;
 	void startExporter() override;
@@ -37,6 +54,8 @@ protected:
 	void shutdownExporter() override;
 
 private:
+	void frameWritten();
+
 	struct Private;
 	Private *d;
 };
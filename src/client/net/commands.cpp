@@ -21,8 +21,14 @@
 
 #include "../shared/net/control.h"
 #include "../shared/net/image.h"
+#include "core/tile.h"
+#include "core/concurrent.h"
 
 #include <QImage>
+#include <QThread>
+
+#include <algorithm>
+#include <cstring>
 
 namespace net {
 namespace command {
@@ -91,6 +97,164 @@ void splitImage(uint8_t ctxid, uint16_t layer, int x, int y, const QImage &image
 		)));
 	}
 }
+
+// Copy a rectangle of the image into a contiguous pixel buffer
+QByteArray copyPixels(const QImage &image, const QRect &rect)
+{
+	QByteArray data(rect.width() * rect.height() * 4, Qt::Uninitialized);
+	char *dest = data.data();
+	const int rowlen = rect.width() * 4;
+	for(int y=rect.top();y<=rect.bottom();++y) {
+		memcpy(dest, image.constScanLine(y) + rect.left() * 4, rowlen);
+		dest += rowlen;
+	}
+	return data;
+}
+
+/**
+ * Split a large image into pieces along canvas tile boundaries.
+ *
+ * Each tile is first compressed using a fast compression level to estimate its size.
+ * The tiles are then grouped into as few rectangles as possible whose estimated
+ * size fits into a PutImage message: each tile row is split into horizontal runs,
+ * and runs spanning the same columns in consecutive rows are merged. Empty tiles
+ * are left out if skipempty is set.
+ *
+ * Pieces consisting of a single tile reuse the compressed data from the estimation pass.
+ * Both the estimation and the compression of the larger pieces are done in parallel.
+ * The resulting message list depends only on the input image.
+ *
+ * In the unlikely event a piece still doesn't fit, it is split using splitImage.
+ */
+void splitLargeImage(uint8_t ctxid, uint16_t layer, int x, int y, const QImage &image, uint8_t mode, bool skipempty, QList<protocol::MessagePtr> &list)
+{
+	Q_ASSERT(image.format() == QImage::Format_ARGB32_Premultiplied);
+	const int SIZE = paintcore::Tile::SIZE;
+
+	// Tile grid boundaries in image coordinates, aligned with canvas tiles
+	auto gridLines = [SIZE](int offset, int length) {
+		QVector<int> lines;
+		lines << 0;
+		for(int i=(SIZE - offset % SIZE) % SIZE;i<length;i+=SIZE) {
+			if(i>0)
+				lines << i;
+		}
+		lines << length;
+		return lines;
+	};
+	const QVector<int> cols = gridLines(x, image.width());
+	const QVector<int> rows = gridLines(y, image.height());
+	const int xtiles = cols.size() - 1;
+	const int ytiles = rows.size() - 1;
+
+	auto tileRect = [&cols, &rows](int tx0, int ty0, int tx1, int ty1) {
+		return QRect(QPoint(cols[tx0], rows[ty0]), QPoint(cols[tx1+1]-1, rows[ty1+1]-1));
+	};
+
+	// Compress each tile to estimate its size (a null array means the tile is empty and can be skipped)
+	QVector<QByteArray> tiles(xtiles * ytiles);
+	{
+		QByteArray *out = tiles.data();
+		paintcore::concurrentForChunks(ytiles, QThread::idealThreadCount(), [&](int, int begin, int end) {
+			for(int ty=begin;ty<end;++ty) {
+				for(int tx=0;tx<xtiles;++tx) {
+					const QByteArray pixels = copyPixels(image, tileRect(tx, ty, tx, ty));
+					const quint32 *p = reinterpret_cast<const quint32*>(pixels.constData());
+					const quint32 *pend = p + pixels.length() / 4;
+					if(!skipempty || !std::all_of(p, pend, [](quint32 px) { return px == 0; }))
+						out[ty*xtiles+tx] = qCompress(pixels, 1);
+				}
+			}
+		});
+	}
+
+	// Group tiles into rectangles that should fit in a single message.
+	// Some margin is left for estimation error.
+	const int budget = protocol::PutImage::MAX_LEN * 9 / 10;
+	QVector<QRect> pieces;
+
+	struct Run {
+		int tx0, tx1, ty0;
+		int size;
+	};
+	QVector<Run> growing; // runs of the previous row that may still grow downwards
+
+	for(int ty=0;ty<=ytiles;++ty) {
+		// Split the row into runs of non-empty tiles
+		QVector<Run> row;
+		for(int tx=0;ty<ytiles && tx<xtiles;) {
+			const QByteArray &t = tiles.at(ty*xtiles+tx);
+			if(t.isNull()) {
+				++tx;
+				continue;
+			}
+			Run run { tx, tx, ty, t.length() };
+			while(run.tx1+1 < xtiles) {
+				const QByteArray &next = tiles.at(ty*xtiles+run.tx1+1);
+				if(next.isNull() || run.size + next.length() > budget)
+					break;
+				run.size += next.length();
+				++run.tx1;
+			}
+			row << run;
+			tx = run.tx1 + 1;
+		}
+
+		// Extend the runs of the previous row that span the same columns
+		for(Run &run : row) {
+			for(int i=0;i<growing.size();++i) {
+				const Run &above = growing.at(i);
+				if(above.tx0 == run.tx0 && above.tx1 == run.tx1 && above.size + run.size <= budget) {
+					run.ty0 = above.ty0;
+					run.size += above.size;
+					growing.remove(i);
+					break;
+				}
+			}
+		}
+
+		for(const Run &run : growing)
+			pieces << tileRect(run.tx0, run.ty0, run.tx1, ty-1);
+		growing = row;
+	}
+
+	// Compress the pieces that are larger than a single tile
+	QVector<QByteArray> compressed(pieces.size());
+	{
+		QByteArray *out = compressed.data();
+		paintcore::concurrentForChunks(pieces.size(), QThread::idealThreadCount(), [&](int, int begin, int end) {
+			for(int i=begin;i<end;++i) {
+				const QRect &r = pieces.at(i);
+				const int tx = std::upper_bound(cols.constBegin(), cols.constEnd(), r.left()) - cols.constBegin() - 1;
+				const int ty = std::upper_bound(rows.constBegin(), rows.constEnd(), r.top()) - rows.constBegin() - 1;
+				if(r == tileRect(tx, ty, tx, ty))
+					out[i] = tiles.at(ty*xtiles+tx);
+				else
+					out[i] = qCompress(copyPixels(image, r));
+			}
+		});
+	}
+	tiles.clear();
+
+	for(int i=0;i<pieces.size();++i) {
+		const QRect &r = pieces.at(i);
+		if(compressed.at(i).length() > protocol::PutImage::MAX_LEN) {
+			splitImage(ctxid, layer, x+r.x(), y+r.y(), image.copy(r), mode, skipempty, list);
+
+		} else {
+			list.append(protocol::MessagePtr(new protocol::PutImage(
+				ctxid,
+				layer,
+				mode,
+				x + r.x(),
+				y + r.y(),
+				r.width(),
+				r.height(),
+				compressed.at(i)
+			)));
+		}
+	}
+}
 } // End anonymous namespace
 
 using namespace protocol;
@@ -160,7 +324,13 @@ QList<protocol::MessagePtr> putQImage(uint8_t ctxid, uint16_t layer, int x, int
 	}
 
 	image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
-	splitImage(ctxid, layer, x, y, image, mode, skipempty, list);
+
+	// Small images are compressed as a whole: if the uncompressed data fits
+	// in a message, the compressed data practically always will too.
+	if(image.byteCount() > protocol::PutImage::MAX_LEN)
+		splitLargeImage(ctxid, layer, x, y, image, mode, skipempty, list);
+	else
+		splitImage(ctxid, layer, x, y, image, mode, skipempty, list);
 
 #ifndef NDEBUG
 	if(list.isEmpty()) {
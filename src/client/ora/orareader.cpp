@@ -21,6 +21,7 @@
 #include "core/annotationmodel.h"
 #include "core/tilevector.h"
 #include "core/layer.h"
+#include "core/concurrent.h"
 #include "ora/orareader.h"
 #include "ora/orawriter.h"
 #include "canvas/features.h"
@@ -403,9 +404,9 @@ static OraResult makeInitCommands(KZip &zip, const Canvas &canvas)
 	// Set canvas size
 	result.commands << MessagePtr(new protocol::CanvasResize(ctxId, 0, canvas.size.width(), canvas.size.height(), 0));
 
-	// Create layers
+	// Find the layers to load and read the background tile
 	// Note: layers are stored topmost first in ORA, but we create them bottom-most first
-	uint16_t layerId = uint16_t(ctxId << 8);
+	QVector<int> layerOrder;
 	for(int i=canvas.layers.size()-1;i>=0;--i) {
 		const Layer &layer = canvas.layers[i];
 
@@ -445,36 +446,76 @@ static OraResult makeInitCommands(KZip &zip, const Canvas &canvas)
 			}
 		}
 
-		QImage content;
+		layerOrder << i;
+	}
+
+	// Decode the layer images in parallel, one batch of layers at a time.
+	// Each batch is turned into commands before the next one is decoded, so
+	// only a batch worth of decoded layers is kept in memory at once.
+	// The zip file must be read serially.
+	const int batchSize = paintcore::TaskScheduler::instance()->slotCount();
+	uint16_t layerId = uint16_t(ctxId << 8);
+
+	for(int batch=0;batch<layerOrder.size();batch+=batchSize) {
+		const int count = qMin(batchSize, layerOrder.size() - batch);
+
+		QVector<QByteArray> layerFiles(count);
+		for(int i=0;i<count;++i)
+			layerFiles[i] = utils::getArchiveFile(zip, canvas.layers.at(layerOrder.at(batch+i)).src);
+
+		QVector<paintcore::LayerTileSet> tilesets(count);
+		QVector<char> decoded(count);
 		{
-			QByteArray image = utils::getArchiveFile(zip, layer.src);
-			if(image.isNull() || !content.loadFromData(image)) {
-				return QGuiApplication::tr("Couldn't load layer %1").arg(layer.src);
-			}
+			paintcore::LayerTileSet *ts = tilesets.data();
+			char *ok = decoded.data();
+			paintcore::concurrentForChunks(count, count, [&](int, int begin, int end) {
+				for(int i=begin;i<end;++i) {
+					QImage content;
+					if(layerFiles.at(i).isNull() || !content.loadFromData(layerFiles.at(i))) {
+						ok[i] = false;
+						continue;
+					}
+					ok[i] = true;
+					ts[i] = paintcore::LayerTileSet::fromImage(
+						content.convertToFormat(QImage::Format_ARGB32_Premultiplied),
+						canvas.size,
+						canvas.layers.at(layerOrder.at(batch+i)).offset
+						);
+				}
+			});
+		}
+
+		for(int i=0;i<count;++i) {
+			if(!decoded.at(i))
+				return QGuiApplication::tr("Couldn't load layer %1").arg(canvas.layers.at(layerOrder.at(batch+i)).src);
 		}
+		layerFiles.clear();
 
-		paintcore::LayerInfo info {++layerId, layer.name };
+		paintcore::LayerTileSet::compressTiles(tilesets);
 
-		bool exact_blendop;
-		info.blend = paintcore::findBlendModeByName(layer.compositeOp, &exact_blendop).id;
-		if(!exact_blendop)
-			result.warnings |= OraResult::ORA_EXTENDED;
+		// Create layers
+		for(int i=0;i<count;++i) {
+			const Layer &layer = canvas.layers.at(layerOrder.at(batch+i));
 
-		info.censored = layer.censored;
-		info.opacity = qRound(255 * layer.opacity);
+			paintcore::LayerInfo info {++layerId, layer.name };
 
-		result.commands << paintcore::LayerTileSet::fromImage(
-			content.convertToFormat(QImage::Format_ARGB32_Premultiplied),
-			canvas.size,
-			layer.offset
-			).toInitCommands(ctxId, info);
+			bool exact_blendop;
+			info.blend = paintcore::findBlendModeByName(layer.compositeOp, &exact_blendop).id;
+			if(!exact_blendop)
+				result.warnings |= OraResult::ORA_EXTENDED;
 
-		if(layer.locked) {
-			result.commands << MessagePtr(new protocol::LayerACL(ctxId, layerId, true, int(canvas::Tier::Guest), QList<uint8_t>()));
-		}
+			info.censored = layer.censored;
+			info.opacity = qRound(255 * layer.opacity);
 
-		if(!layer.visibility) {
-			result.commands << MessagePtr(new protocol::LayerVisibility(ctxId, layerId, false));
+			result.commands << tilesets[i].toInitCommands(ctxId, info);
+
+			if(layer.locked) {
+				result.commands << MessagePtr(new protocol::LayerACL(ctxId, layerId, true, int(canvas::Tier::Guest), QList<uint8_t>()));
+			}
+
+			if(!layer.visibility) {
+				result.commands << MessagePtr(new protocol::LayerVisibility(ctxId, layerId, false));
+			}
 		}
 	}
 
@@ -21,6 +21,7 @@
 #include "core/layerstack.h"
 #include "core/layer.h"
 #include "core/blendmodes.h"
+#include "core/concurrent.h"
 
 #include <QXmlStreamWriter>
 #include <QBuffer>
@@ -32,14 +33,18 @@ namespace openraster {
 const QString DP_NAMESPACE = QStringLiteral("http://drawpile.net/");
 const QString MYPAINT_NAMESPACE = QStringLiteral("http://mypaint.org/ns/openraster");
 
-static bool putPngInZip(KZip &zip, const QString &filename, const QImage &image, QString *errorMessage)
+static QByteArray encodePng(const QImage &image)
 {
 	QBuffer buf;
 	image.save(&buf, "PNG");
+	return buf.data();
+}
 
+static bool putPngInZip(KZip &zip, const QString &filename, const QByteArray &png, QString *errorMessage)
+{
 	// PNG is already compressed, so no use attempting to recompress
 	zip.setCompression(KZip::NoCompression);
-	if(!zip.writeFile(filename, buf.data())) {
+	if(!zip.writeFile(filename, png)) {
 		if(errorMessage)
 			*errorMessage = zip.errorString();
 		return false;
@@ -47,6 +52,11 @@ static bool putPngInZip(KZip &zip, const QString &filename, const QImage &image,
 	return true;
 }
 
+static bool putPngInZip(KZip &zip, const QString &filename, const QImage &image, QString *errorMessage)
+{
+	return putPngInZip(zip, filename, encodePng(image), errorMessage);
+}
+
 static void writeStackStack(QXmlStreamWriter &writer, const paintcore::LayerStack *image, const QVector<QPoint> &layerOffsets)
 {
 	writer.writeStartElement("stack");
@@ -143,20 +153,63 @@ static bool writeStackXml(KZip &zip, const paintcore::LayerStack *image, const Q
 	return true;
 }
 
-static bool writeLayer(KZip &zf, const paintcore::LayerStack *layers, int index, QPoint &offset, QString *errorMessage)
+static LayerImageCache::Entry encodeLayer(const paintcore::Layer *layer)
 {
-	const paintcore::Layer *l = layers->getLayerByIndex(index);
-	Q_ASSERT(l);
-
-	QImage image = l->toCroppedImage(&offset.rx(), &offset.ry());
+	LayerImageCache::Entry e;
+	QImage image = layer->toCroppedImage(&e.offset.rx(), &e.offset.ry());
 	if(image.isNull()) {
 		// OpenRaster currently does not specify a way to store blank
 		// layers without a data file, so we just create a small dummy image
 		image = QImage(64, 64, QImage::Format_ARGB32_Premultiplied);
 		image.fill(0);
-		offset = QPoint();
+		e.offset = QPoint();
+	}
+	e.png = encodePng(image);
+	return e;
+}
+
+/**
+ * Encode all layers as PNG images.
+ *
+ * The layers are encoded in parallel. Layers found unchanged in the cache
+ * are not encoded again.
+ */
+static QVector<LayerImageCache::Entry> encodeLayers(const paintcore::LayerStack *layers, LayerImageCache *cache)
+{
+	QVector<LayerImageCache::Entry> encoded(layers->layerCount());
+	QVector<int> toEncode;
+
+	for(int i=0;i<layers->layerCount();++i) {
+		const paintcore::Layer *l = layers->getLayerByIndex(i);
+		if(cache) {
+			const auto cached = cache->layers.constFind(l->id());
+			if(cached != cache->layers.constEnd() && cached->layer->hasSharedPixels(*l)) {
+				encoded[i] = cached.value();
+				continue;
+			}
+		}
+		toEncode << i;
 	}
-	return putPngInZip(zf, QString("data/layer%1.png").arg(index), image, errorMessage);
+
+	LayerImageCache::Entry *out = encoded.data();
+	paintcore::concurrentForChunks(toEncode.size(), toEncode.size(), [out, &toEncode, layers](int, int begin, int end) {
+		for(int i=begin;i<end;++i) {
+			const int idx = toEncode.at(i);
+			out[idx] = encodeLayer(layers->getLayerByIndex(idx));
+		}
+	});
+
+	if(cache) {
+		cache->layers.clear();
+		for(int i=0;i<encoded.size();++i) {
+			const paintcore::Layer *l = layers->getLayerByIndex(i);
+			if(!encoded[i].layer)
+				encoded[i].layer = QSharedPointer<paintcore::Layer>(new paintcore::Layer(*l));
+			cache->layers[l->id()] = encoded.at(i);
+		}
+	}
+
+	return encoded;
 }
 
 static bool writeBackground(KZip &zf, const paintcore::LayerStack *layers, QString *errorMessage)
@@ -191,7 +244,7 @@ static bool writePreviewImages(KZip &zf, const paintcore::LayerStack *layers, QS
 	return putPngInZip(zf, "Thumbnails/thumbnail.png", img, errorMessage);
 }
 
-bool saveOpenRaster(const QString& filename, const paintcore::LayerStack *image, QString *errorMessage)
+bool saveOpenRaster(const QString& filename, const paintcore::LayerStack *image, QString *errorMessage, LayerImageCache *cache)
 {
 	KZip zf(filename);
 	if(!zf.open(QIODevice::WriteOnly)) {
@@ -210,9 +263,11 @@ bool saveOpenRaster(const QString& filename, const paintcore::LayerStack *image,
 	}
 
 	// Each layer is written as an individual PNG image
+	const QVector<LayerImageCache::Entry> layers = encodeLayers(image, cache);
 	QVector<QPoint> layerOffsets(image->layerCount());
 	for(int i=image->layerCount()-1;i>=0;--i) {
-		if(!writeLayer(zf, image, i, layerOffsets[i], errorMessage))
+		layerOffsets[i] = layers.at(i).offset;
+		if(!putPngInZip(zf, QString("data/layer%1.png").arg(i), layers.at(i).png, errorMessage))
 			return false;
 	}
 
@@ -20,9 +20,14 @@
 #define ORAWRITER_H
 
 #include <QList>
+#include <QHash>
+#include <QPoint>
+#include <QByteArray>
+#include <QSharedPointer>
 
 namespace paintcore {
 	class LayerStack;
+	class Layer;
 }
 
 namespace openraster {
@@ -30,15 +35,34 @@ namespace openraster {
 extern const QString DP_NAMESPACE;
 extern const QString MYPAINT_NAMESPACE;
 
+/**
+ * @brief Encoded layer images from a previous save
+ *
+ * When the same canvas is saved repeatedly (e.g. autosave), layers whose
+ * tiles have not changed since the previous save are not encoded again.
+ *
+ * A cache should be used by one save at a time.
+ */
+struct LayerImageCache {
+	struct Entry {
+		QSharedPointer<paintcore::Layer> layer; // copy of the layer as it was when encoded
+		QByteArray png;
+		QPoint offset;
+	};
+
+	QHash<int, Entry> layers; // keyed by layer ID
+};
+
 /**
  * @brief Save the layer stack as an OpenRaster file
  *
  * @param filename target file path
  * @param image layer stack to save
  * @param errorMessage if not null, error message is put here
+ * @param cache if not null, reuse unchanged layer images from the previous save and update the cache
  * @return false on error
  */
-bool saveOpenRaster(const QString &filename, const paintcore::LayerStack *image, QString *errorMessage=nullptr);
+bool saveOpenRaster(const QString &filename, const paintcore::LayerStack *image, QString *errorMessage=nullptr, LayerImageCache *cache=nullptr);
 
 }
 
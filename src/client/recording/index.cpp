@@ -21,8 +21,10 @@
 #include <QDataStream>
 #include <QFile>
 #include <QCryptographicHash>
+#include <QScopedPointer>
 
 #include "index.h"
+#include "../shared/record/blockcompression.h"
 
 namespace recording {
 
@@ -69,6 +71,9 @@ bool Index::writeIndex(QIODevice *out) const
 	// Write action count
 	ds << quint32(m_actioncount);
 
+	// Write the length of the indexed data and the whole recording
+	ds << qint64(m_recordingsize) << qint64(m_datasize);
+
 	return true;
 }
 
@@ -110,24 +115,68 @@ bool Index::readIndex(QIODevice *out)
 	quint32 actioncount;
 	ds >> actioncount;
 
+	// Read the length of the indexed data and the whole recording
+	qint64 recordingsize, datasize;
+	ds >> recordingsize >> datasize;
+
 	m_stops = stops;
 	m_markers = markers;
 	m_actioncount = actioncount;
+	m_recordingsize = recordingsize;
+	m_datasize = datasize;
 
 	return true;
 }
 
-QByteArray hashRecording(const QString &filename)
+static QIODevice *openRecordingData(const QString &filename)
+{
+	QIODevice *file;
+	if(BlockCompressionDevice::isBlockCompressed(filename))
+		file = new BlockCompressionDevice(filename);
+	else
+		file = new QFile(filename);
+
+	if(!file->open(QIODevice::ReadOnly)) {
+		delete file;
+		return nullptr;
+	}
+
+	return file;
+}
+
+QByteArray hashRecording(const QString &filename, qint64 length)
 {
-	QFile file(filename);
-	if(!file.open(QFile::ReadOnly))
+	QScopedPointer<QIODevice> file(openRecordingData(filename));
+	if(!file)
 		return QByteArray();
 
 	QCryptographicHash hash(QCryptographicHash::Sha1);
-	hash.addData(&file);
+
+	if(length < 0) {
+		hash.addData(file.data());
+
+	} else {
+		QByteArray buffer(64 * 1024, 0);
+		while(length > 0) {
+			const qint64 len = file->read(buffer.data(), qMin(length, qint64(buffer.length())));
+			if(len <= 0)
+				return QByteArray();
+
+			hash.addData(buffer.constData(), len);
+			length -= len;
+		}
+	}
 
 	return hash.result();
 }
 
+qint64 recordingDataSize(const QString &filename)
+{
+	QScopedPointer<QIODevice> file(openRecordingData(filename));
+	if(!file)
+		return -1;
+	return file->size();
+}
+
 }
 
@@ -27,7 +27,7 @@ class QIODevice;
 namespace recording {
 
 //! Index format version
-static const quint16 INDEX_VERSION = 0x0005;
+static const quint16 INDEX_VERSION = 0x0006;
 
 struct StopEntry {
 	static const quint8 HAS_SNAPSHOT = 0x01;
@@ -71,6 +71,12 @@ public:
 	//! Get the total number of actions in the recording
 	int actionCount() const { return m_actioncount; }
 
+	//! Get the length of the recording data that was indexed
+	qint64 recordingSize() const { return m_recordingsize; }
+
+	//! Get the length of the recording data when it was indexed (including an incomplete message at the end)
+	qint64 dataSize() const { return m_datasize; }
+
 	/**
 	 * Find the stop closest to the given position, such that stop.index < pos.
 	 * Returns 0 if no such stop is found.
@@ -89,11 +95,24 @@ public:
 private:
 	QVector<StopEntry> m_stops;
 	QVector<MarkerEntry> m_markers;
-	int m_actioncount;
+	int m_actioncount = 0;
+	qint64 m_recordingsize = 0;
+	qint64 m_datasize = 0;
 };
 
-//! Hash the recording file
-QByteArray hashRecording(const QString &filename);
+/**
+ * @brief Hash the recording file
+ *
+ * Block compressed recordings are hashed by their uncompressed content.
+ *
+ * @param filename the recording to hash
+ * @param length hash only this many bytes from the start of the recording (-1 for all)
+ * @return hash or an empty array if the recording could not be read or was too short
+ */
+QByteArray hashRecording(const QString &filename, qint64 length=-1);
+
+//! Get the length of the recording data (uncompressed, if block compressed)
+qint64 recordingDataSize(const QString &filename);
 
 }
 
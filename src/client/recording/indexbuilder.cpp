@@ -25,17 +25,35 @@
 #include "canvas/statetracker.h"
 #include "core/layerstack.h"
 #include "canvas/layerlist.h"
+#include "utils/archive.h"
 
 #include <QDebug>
 #include <QBuffer>
-#include <QBuffer>
+#include <QDataStream>
 #include <QElapsedTimer>
+#include <QFile>
+#include <QSet>
 #include <KZip>
 
 namespace recording {
 
+/**
+ * @brief Index builder state after a snapshot
+ *
+ * When the recording grows, indexing continues from a snapshot instead of
+ * starting over. The session history preceding the snapshot is not available
+ * then, so the snapshot must be far enough behind the end of the indexed part
+ * that undos in the new messages cannot reach past it.
+ */
+struct IndexBuilder::ResumePoint {
+	quint32 stop;             // index of the stop with the snapshot
+	quint32 thumbnails;       // number of thumbnails made
+	quint32 thumbnailActions; // actions since the last thumbnail
+	qint64 snapshotCost;      // time it took to save the snapshot (ns)
+};
+
 IndexBuilder::IndexBuilder(const QString &inputfile, const QString &targetfile, QObject *parent)
-	: QObject(parent), m_inputfile(inputfile), m_targetfile(targetfile)
+	: QObject(parent), m_inputfile(inputfile), m_targetfile(targetfile), m_incremental(false)
 {
 }
 
@@ -47,18 +65,36 @@ void IndexBuilder::abort()
 
 void IndexBuilder::run()
 {
-	// Open output file
-	KZip zip(m_targetfile);
-	if(!zip.open(QIODevice::WriteOnly)) {
-		emit done(false, tr("Error opening %1 for writing").arg(m_targetfile));
+	// The new index is written to a temporary file first, since
+	// the old one is needed when updating an index incrementally.
+	const QString tempfile = m_targetfile + ".new";
+
+	QString error;
+	BuildResult result = buildIndex(tempfile, true, error);
+	if(result == BuildRestart) {
+		qDebug() << "Cannot update index incrementally: indexing the whole recording";
+		result = buildIndex(tempfile, false, error);
+	}
+
+	if(result != BuildOk) {
+		QFile::remove(tempfile);
+		emit done(false, error);
 		return;
 	}
 
-	zip.setCompression(KZip::NoCompression);
+	QFile::remove(m_targetfile);
+	if(!QFile::rename(tempfile, m_targetfile)) {
+		emit done(false, tr("Error writing file"));
+		return;
+	}
 
-	// Write recording hash
-	QByteArray hash = hashRecording(m_inputfile);
-	zip.writeFile("hash", hash);
+	emit done(true, QString());
+}
+
+IndexBuilder::BuildResult IndexBuilder::buildIndex(const QString &targetfile, bool incremental, QString &error)
+{
+	m_index = Index();
+	m_incremental = false;
 
 	// Open the recording
 	Reader reader(m_inputfile);
@@ -66,12 +102,53 @@ void IndexBuilder::run()
 	Compatibility readerOk = reader.open();
 	if(readerOk != COMPATIBLE && readerOk != MINOR_INCOMPATIBILITY) {
 		qWarning() << "Couldn't open recording for indexing. Error code" << readerOk;
-		emit done(false, reader.errorString());
-		return;
+		error = reader.errorString();
+		return BuildFailed;
 	}
 
-	// Generate index and write snapshots and thumbnails
-	generateIndex(zip, reader);
+	// Open output file
+	KZip zip(targetfile);
+	if(!zip.open(QIODevice::WriteOnly)) {
+		error = tr("Error opening %1 for writing").arg(targetfile);
+		return BuildFailed;
+	}
+
+	// We must replay the recorded session to generate canvas snapshots
+	paintcore::LayerStack image;
+	canvas::LayerListModel layermodel;
+	canvas::StateTracker statetracker(&image, &layermodel, 1);
+
+	ResumePoint start { 0, 0, 0, 0 };
+	if(incremental) {
+		if(!resumeIndex(zip, reader, statetracker, start))
+			return BuildRestart;
+		m_incremental = true;
+	}
+
+	// Generate index and write snapshots and thumbnails.
+	// The recording may still be growing: everything up to this size is read,
+	// so any data left over after the last indexed message is incomplete.
+	const qint64 dataSize = recordingDataSize(m_inputfile);
+
+	// The resume point the index was updated from carries forward
+	// if there are no new snapshots far enough from the end
+	QVector<ResumePoint> resumePoints;
+	if(m_incremental)
+		resumePoints << start;
+
+	qint64 indexedLength = 0;
+	if(!generateIndex(zip, reader, statetracker, start, resumePoints, indexedLength)) {
+		error = tr("Indexing aborted");
+		return BuildFailed;
+	}
+
+	// An undo that needed the history from before the point indexing
+	// was resumed from may have had a different result than in the original session.
+	if(m_incremental && statetracker.truncatedUndoCount() > 0)
+		return BuildRestart;
+
+	m_index.m_recordingsize = indexedLength;
+	m_index.m_datasize = qMax(dataSize, indexedLength);
 
 	// Write the index
 	QBuffer indexBuffer;
@@ -81,62 +158,185 @@ void IndexBuilder::run()
 	zip.setCompression(KZip::DeflateCompression);
 	zip.writeFile("index", indexBuffer.data());
 
+	// Write hash of the indexed part of the recording
+	zip.setCompression(KZip::NoCompression);
+	zip.writeFile("hash", hashRecording(m_inputfile, indexedLength));
+
+	// Write the point the index can be updated from.
+	// An undo can reach back UNDO_DEPTH_LIMIT undo points (of any user),
+	// so there must be more than that many undo points after the snapshot.
+	QSet<int> markerStops;
+	for(const MarkerEntry &m : m_index.m_markers)
+		markerStops << m.stop;
+
+	int undoPoints = 0;
+	int stop = m_index.m_stops.size() - 1;
+	for(int i=resumePoints.size()-1;i>=0;--i) {
+		const ResumePoint &rp = resumePoints.at(i);
+		for(;stop > int(rp.stop);--stop) {
+			if(!markerStops.contains(stop))
+				++undoPoints;
+		}
+
+		if(undoPoints > protocol::UNDO_DEPTH_LIMIT) {
+			QBuffer resumeBuffer;
+			resumeBuffer.open(QBuffer::ReadWrite);
+			{
+				QDataStream ds(&resumeBuffer);
+				ds.setVersion(QDataStream::Qt_5_5);
+				ds << rp.stop << rp.thumbnails << rp.thumbnailActions << rp.snapshotCost;
+			}
+			zip.writeFile("resume", resumeBuffer.data());
+			break;
+		}
+	}
+
 	if(!zip.close()) {
-		emit done(false, tr("Error writing file"));
-		return;
+		error = tr("Error writing file");
+		return BuildFailed;
 	}
 
-	emit done(true, QString());
+	return BuildOk;
 }
 
-void IndexBuilder::generateIndex(KZip &zip, Reader &reader)
+/**
+ * @brief Continue from the resume point of the existing index
+ *
+ * The part of the old index up to the resume point is copied to the new one
+ * and the replay state is restored from the snapshot.
+ *
+ * @return false if the existing index cannot be used
+ */
+bool IndexBuilder::resumeIndex(KZip &zip, Reader &reader, canvas::StateTracker &statetracker, ResumePoint &resume)
 {
-	static const qint64 SNAPSHOT_INTERVAL_MS = 1000; // snapshot interval in milliseconds
-	static const int SNAPSHOT_MIN_STOPS = 25; // minimum number of stops between snapshots
-	static const int THUMBNAIL_INTERVAL = 1000; // minimum number of actions between thumbnails
+	KZip old(m_targetfile);
+	if(!old.open(QIODevice::ReadOnly))
+		return false;
+
+	Index index;
+	{
+		QByteArray indexdata = utils::getArchiveFile(old, "index");
+		QBuffer indexbuffer(&indexdata);
+		indexbuffer.open(QBuffer::ReadOnly);
+		if(!index.readIndex(&indexbuffer))
+			return false;
+	}
 
-	// We must replay the recorded session to generate canvas snapshots
-	paintcore::LayerStack image;
-	canvas::LayerListModel layermodel;
-	canvas::StateTracker statetracker(&image, &layermodel, 1);
+	// The indexed part of the recording must not have changed
+	const QByteArray hash = utils::getArchiveFile(old, "hash");
+	if(hash.isEmpty() || hash != hashRecording(m_inputfile, index.recordingSize()))
+		return false;
+
+	{
+		const QByteArray resumedata = utils::getArchiveFile(old, "resume");
+		if(resumedata.isEmpty())
+			return false;
+
+		QDataStream ds(resumedata);
+		ds.setVersion(QDataStream::Qt_5_5);
+		ds >> resume.stop >> resume.thumbnails >> resume.thumbnailActions >> resume.snapshotCost;
+		if(ds.status() != QDataStream::Ok)
+			return false;
+	}
+
+	if(int(resume.stop) >= index.size() || !(index.entry(resume.stop).flags & StopEntry::HAS_SNAPSHOT))
+		return false;
+
+	// Restore the replay state
+	const StopEntry &se = index.entry(resume.stop);
+	canvas::StateSavepoint savepoint;
+	{
+		QByteArray snapshotdata = utils::getArchiveFile(old, QString("snapshot/%1").arg(resume.stop));
+		QBuffer snapshotbuffer(&snapshotdata);
+		snapshotbuffer.open(QBuffer::ReadOnly);
+		QDataStream ds(&snapshotbuffer);
+		savepoint = canvas::StateSavepoint::fromDatastream(ds);
+	}
+	if(!savepoint)
+		return false;
+
+	// The snapshot was taken after the message at the stop was executed
+	reader.seekTo(se.index - 1, se.pos);
+	const MessageRecord record = reader.readNext();
+	if(record.status != MessageRecord::OK || reader.currentIndex() != int(se.index))
+		return false;
+
+	statetracker.resetToSavepoint(savepoint);
+
+	// Copy the part of the index that stays the same
+	zip.setCompression(KZip::DeflateCompression);
+	for(quint32 i=0;i<=resume.stop;++i) {
+		const StopEntry &e = index.entry(i);
+		if((e.flags & StopEntry::HAS_SNAPSHOT)) {
+			const QString name = QString("snapshot/%1").arg(i);
+			zip.writeFile(name, utils::getArchiveFile(old, name));
+		}
+		m_index.m_stops.append(e);
+	}
+
+	for(const MarkerEntry &m : index.markers()) {
+		if(m.stop <= resume.stop)
+			m_index.m_markers.append(m);
+	}
+
+	zip.setCompression(KZip::NoCompression);
+	for(quint32 i=0;i<resume.thumbnails;++i) {
+		const QString name = QString("thumbnail/%1").arg(i);
+		zip.writeFile(name, utils::getArchiveFile(old, name));
+	}
+
+	qDebug() << "Resuming indexing from message" << se.index << "of" << index.actionCount();
+	return true;
+}
+
+bool IndexBuilder::generateIndex(KZip &zip, Reader &reader, canvas::StateTracker &statetracker, const ResumePoint &start, QVector<ResumePoint> &resumePoints, qint64 &indexedLength)
+{
+	// Snapshot spacing adapts to the replay cost: a snapshot is made once replaying
+	// the messages since the previous one takes longer than SNAPSHOT_REPLAY_NS,
+	// but the replay time between snapshots must also be at least SNAPSHOT_COST_RATIO
+	// times the time it takes to save one, so snapshots of a large canvas are made
+	// less often. Markers get a snapshot if the saving cost allows.
+	static const qint64 SNAPSHOT_REPLAY_NS = 500 * 1000000; // max. replay time needed to reach any stop
+	static const int SNAPSHOT_COST_RATIO = 4;
+	static const int THUMBNAIL_INTERVAL = 1000; // minimum number of actions between thumbnails
 
 	// Generate index and snapshots
 	MessageRecord record;
 	QElapsedTimer timer;
-	int snapshotStops = 0;
-	int thumbnailActions = 0;
-	int snapshotCount = 0;
-	int thumbnailCount = 0;
-	timer.start();
+	qint64 replayCost = 0;
+	qint64 snapshotCost = start.snapshotCost;
+	int thumbnailActions = start.thumbnailActions;
+	int thumbnailCount = start.thumbnails;
 	do {
 		if(m_abortflag.load()) {
 			qWarning() << "Indexing aborted";
-			emit done(false, "aborted");
-			return;
+			return false;
 		}
 
-		qint64 offset = reader.filePosition();
+		const qint64 offset = reader.filePosition();
 		record = reader.readNext();
 		if(record.status == MessageRecord::OK) {
-			if(record.message->isCommand())
+			if(record.message->isCommand()) {
+				timer.start();
 				statetracker.receiveCommand(protocol::MessagePtr::fromNullable(record.message));
+				replayCost += timer.nsecsElapsed();
+			}
+
+			bool snapshotMade = false;
 
 			// Add a stop for each UndoPoint and Marker
 			if(record.message->type() == protocol::MSG_UNDOPOINT || record.message->type() == protocol::MSG_MARKER) {
 				StopEntry stop { quint32(reader.currentIndex()), offset, 0 };
-				++snapshotStops;
 
-				// Snapshots can be saved at stops, but with some limits:
-				// - Must have at least SNAPSHOT_MIN_ACTIONS actions between them
-				// - Must be separated by at least SNAPSHOT_INTERVAL_MS milliseconds of CPU time.
-				if(snapshotCount==0 ||
+				const bool worthIt = replayCost >= snapshotCost * SNAPSHOT_COST_RATIO;
+				if(m_index.m_stops.isEmpty() ||
 						(
-							(timer.hasExpired(SNAPSHOT_INTERVAL_MS) || record.message->type() == protocol::MSG_MARKER)
-							&& snapshotStops>=SNAPSHOT_MIN_STOPS
+							worthIt &&
+							(replayCost >= SNAPSHOT_REPLAY_NS || record.message->type() == protocol::MSG_MARKER)
 						)
 						) {
-					++snapshotCount;
 					emit progress(offset);
+					timer.start();
 					canvas::StateSavepoint sp = statetracker.createSavepoint(-1);
 
 					QBuffer buf;
@@ -150,8 +350,9 @@ void IndexBuilder::generateIndex(KZip &zip, Reader &reader)
 					zip.writeFile(QString("snapshot/%1").arg(m_index.size()), buf.data());
 					stop.flags |= StopEntry::HAS_SNAPSHOT;
 
-					snapshotStops= 0;
-					timer.restart();
+					snapshotCost = timer.nsecsElapsed();
+					replayCost = 0;
+					snapshotMade = true;
 				}
 
 				m_index.m_stops.append(stop);
@@ -169,7 +370,7 @@ void IndexBuilder::generateIndex(KZip &zip, Reader &reader)
 			if(thumbnailCount==0 || thumbnailActions >= THUMBNAIL_INTERVAL) {
 				thumbnailActions = 0;
 
-				QImage thumb = image.toFlatImage(false, true).scaled(171, 128, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+				QImage thumb = statetracker.image()->toFlatImage(false, true).scaled(171, 128, Qt::KeepAspectRatio, Qt::SmoothTransformation);
 				QBuffer buf;
 				buf.open(QBuffer::ReadWrite);
 				thumb.save(&buf, "PNG");
@@ -180,13 +381,26 @@ void IndexBuilder::generateIndex(KZip &zip, Reader &reader)
 				++thumbnailActions;
 			}
 
+			if(snapshotMade) {
+				resumePoints << ResumePoint {
+					quint32(m_index.size() - 1),
+					quint32(thumbnailCount),
+					quint32(thumbnailActions),
+					snapshotCost
+				};
+			}
+
 		} else if(record.status == MessageRecord::INVALID) {
 			qWarning() << "invalid message type" << record.invalid_type << "at index" << reader.currentIndex() << " and offset" << offset;
+
+		} else {
+			// Indexing ends after the last complete message
+			indexedLength = offset;
 		}
 	} while(record.status != MessageRecord::END_OF_RECORDING);
 
 	m_index.m_actioncount = reader.currentIndex();
+	return true;
 }
 
 }
-
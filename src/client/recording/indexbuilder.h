@@ -29,6 +29,10 @@
 
 class KZip;
 
+namespace canvas {
+	class StateTracker;
+}
+
 namespace recording {
 
 class Reader;
@@ -42,6 +46,9 @@ public:
 	//! Abort index building (thread-safe)
 	void abort();
 
+	//! Was the existing index updated instead of indexing the whole recording?
+	bool wasIncremental() const { return m_incremental; }
+
 public slots:
 	void run();
 
@@ -50,10 +57,16 @@ signals:
 	void done(bool ok, const QString &msg);
 
 private:
-	void generateIndex(KZip &zip, Reader &reader);
+	struct ResumePoint;
+	enum BuildResult { BuildOk, BuildFailed, BuildRestart };
+
+	BuildResult buildIndex(const QString &targetfile, bool incremental, QString &error);
+	bool resumeIndex(KZip &zip, Reader &reader, canvas::StateTracker &statetracker, ResumePoint &resume);
+	bool generateIndex(KZip &zip, Reader &reader, canvas::StateTracker &statetracker, const ResumePoint &start, QVector<ResumePoint> &resumePoints, qint64 &indexedLength);
 
 	QString m_inputfile, m_targetfile;
 	QAtomicInt m_abortflag;
+	bool m_incremental;
 
 	Index m_index;
 };
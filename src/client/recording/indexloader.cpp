@@ -45,13 +45,6 @@ bool IndexLoader::open()
 	if(!m_file->open(QIODevice::ReadOnly))
 		return false;
 
-	// Make sure this is the right index for the recording
-	QByteArray idxHash = utils::getArchiveFile(*m_file, "hash");
-	QByteArray recHash = hashRecording(m_recordingfile);
-
-	if(idxHash != recHash)
-		return false;
-
 	// Load the index
 	QByteArray indexdata = utils::getArchiveFile(*m_file, "index");
 	QBuffer indexbuffer(&indexdata);
@@ -59,6 +52,18 @@ bool IndexLoader::open()
 	if(!m_index.readIndex(&indexbuffer))
 		return false;
 
+	// Make sure this is the right index for the recording.
+	// If the recording has grown, the index must be updated.
+	// An incomplete message at the end is not indexed, so only the indexed part is hashed.
+	if(recordingDataSize(m_recordingfile) != m_index.dataSize())
+		return false;
+
+	QByteArray idxHash = utils::getArchiveFile(*m_file, "hash");
+	QByteArray recHash = hashRecording(m_recordingfile, m_index.recordingSize());
+
+	if(idxHash != recHash)
+		return false;
+
 	// Count thumbnails
 	const KArchiveEntry *thumbdirentry = m_file->directory()->entry("thumbnail");
 	if(!thumbdirentry) {
@@ -29,6 +29,7 @@
 
 #include "canvas/statetracker.h"
 #include "canvas/canvasmodel.h"
+#include "core/layerstack.h"
 
 #include <QStringList>
 #include <QThread>
@@ -79,7 +80,7 @@ qint64 PlaybackController::progress() const
 
 qint64 PlaybackController::maxProgress() const
 {
-	if(m_reader->isCompressed())
+	if(!m_reader->isSeekable())
 		return -1;
 	return m_reader->filesize();
 }
@@ -372,7 +373,7 @@ void PlaybackController::buildIndex()
 
 void PlaybackController::loadIndex()
 {
-	if(m_reader->isCompressed()) {
+	if(!m_reader->isSeekable()) {
 		emit indexLoadError(tr("Cannot index compressed recordings."), false);
 		return;
 	}
@@ -463,6 +464,7 @@ void PlaybackController::startVideoExport(VideoExporter *exporter)
 
 	m_exporterReady = false;
 	m_waitedForExporter = false;
+	m_exportImage = QImage();
 
 	connect(m_exporter, &VideoExporter::exporterReady, this, &PlaybackController::exporterReady, Qt::QueuedConnection);
 	connect(m_exporter, SIGNAL(exporterError(QString)), this, SLOT(exporterError(QString)), Qt::QueuedConnection);
@@ -516,12 +518,24 @@ void PlaybackController::exportFrame(int count)
 		count = 1;
 
 	if(m_exporter) {
-		QImage img = m_canvas->toImage();
-		if(!img.isNull()) {
+		paintcore::LayerStack *layers = m_canvas->layerStack();
+		if(layers->layerCount() > 0 && !layers->size().isEmpty()) {
+			// Only the tiles changed since the previous frame need to be flattened
+			QBitArray changed = layers->takeChangedTiles();
+			const bool fullFrame = m_exportImage.size() != layers->size();
+			if(fullFrame) {
+				m_exportImage = QImage(layers->size(), QImage::Format_ARGB32_Premultiplied);
+				changed.fill(true);
+			}
+			const QRect changedArea = layers->updateFlatImage(m_exportImage, changed);
+
 			Q_ASSERT(m_exporterReady);
 			m_exporterReady = false;
 			emit canSaveFrameChanged(canSaveFrame());
-			m_exporter->saveFrame(img, count);
+			if(fullFrame)
+				m_exporter->saveFrame(m_exportImage, count);
+			else
+				m_exporter->saveFrame(m_exportImage, changedArea, count);
 		}
 	} else {
 		qWarning("exportFrame(%d): exported not active!", count);
@@ -26,6 +26,7 @@
 #include <QPointer>
 #include <QScopedPointer>
 #include <QElapsedTimer>
+#include <QImage>
 
 class QTimer;
 class QStringList;
@@ -159,6 +160,7 @@ private:
 	QScopedPointer<IndexLoader> m_indexloader;
 	QPointer<IndexBuilder> m_indexbuilder;
 	VideoExporter *m_exporter;
+	QImage m_exportImage; // kept up to date using the layer stack's changed tiles
 
 	canvas::CanvasModel *m_canvas;
 
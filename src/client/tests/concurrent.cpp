@@ -0,0 +1,165 @@
+#include "../core/concurrent.h"
+
+#include <QtTest/QtTest>
+#include <QThreadPool>
+#include <QSemaphore>
+
+using namespace paintcore;
+
+// The per-item QThreadPool dispatch that paintcore used before the task scheduler
+static void threadPoolForEach(int count, const std::function<void(int)> &func)
+{
+	class Runnable : public QRunnable {
+	public:
+		int item;
+		const std::function<void(int)> *func;
+		QSemaphore *semaphore;
+
+		void run() override
+		{
+			(*func)(item);
+			semaphore->release();
+		}
+	};
+
+	QSemaphore s;
+	Runnable *runnables = new Runnable[count];
+	for(int i=0;i<count;++i) {
+		runnables[i].setAutoDelete(false);
+		runnables[i].item = i;
+		runnables[i].func = &func;
+		runnables[i].semaphore = &s;
+		QThreadPool::globalInstance()->start(&runnables[i]);
+	}
+	s.acquire(count);
+	delete [] runnables;
+}
+
+// A small job, comparable to compositing a part of a tile
+static quint32 smallJob(int item)
+{
+	quint32 h = item;
+	for(int i=0;i<512;++i)
+		h = h * 31 + i;
+	return h;
+}
+
+class TestConcurrent : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testParallelFor_data()
+	{
+		QTest::addColumn<int>("count");
+		QTest::addColumn<int>("grain");
+
+		QTest::newRow("single") << 1 << 1;
+		QTest::newRow("one chunk") << 10 << 100;
+		QTest::newRow("many items") << 4000 << 1;
+		QTest::newRow("uneven chunks") << 1001 << 7;
+	}
+
+	void testParallelFor()
+	{
+		QFETCH(int, count);
+		QFETCH(int, grain);
+
+		TaskScheduler *scheduler = TaskScheduler::instance();
+		QVector<QAtomicInt> visits(count);
+		QVector<QAtomicInt> busySlots(scheduler->slotCount());
+		QAtomicInt errors;
+
+		scheduler->parallelFor(count, grain, [&](int slot, int begin, int end) {
+			if(slot < 0 || slot >= busySlots.size() || !busySlots[slot].testAndSetOrdered(0, 1)) {
+				errors.ref();
+				return;
+			}
+
+			if(begin % grain != 0 || end - begin > grain || end > count)
+				errors.ref();
+
+			for(int i=begin;i<end;++i)
+				visits[i].ref();
+
+			busySlots[slot].storeRelease(0);
+		});
+
+		QCOMPARE(errors.load(), 0);
+		for(int i=0;i<count;++i)
+			QCOMPARE(visits.at(i).load(), 1);
+	}
+
+	void testNestedLoops()
+	{
+		QAtomicInt total;
+		TaskScheduler::instance()->parallelFor(16, 1, [&total](int, int begin, int end) {
+			for(int i=begin;i<end;++i) {
+				TaskScheduler::instance()->parallelFor(100, 3, [&total](int, int b, int e) {
+					total.fetchAndAddOrdered(e - b);
+				});
+			}
+		});
+
+		QCOMPARE(total.load(), 16 * 100);
+	}
+
+	void testForChunks()
+	{
+		const int chunks = 6;
+		QVector<QAtomicInt> used(chunks);
+		QAtomicInt items;
+		QAtomicInt errors;
+
+		// The test macros may only be used in the test thread,
+		// so violations are just counted here.
+		concurrentForChunks(100, chunks, [&](int chunk, int begin, int end) {
+			if(chunk < 0 || chunk >= chunks) {
+				errors.ref();
+				return;
+			}
+			used[chunk].ref();
+			items.fetchAndAddOrdered(end - begin);
+		});
+
+		QCOMPARE(errors.load(), 0);
+		QCOMPARE(items.load(), 100);
+		for(int i=0;i<chunks;++i)
+			QVERIFY(used.at(i).load() <= 1);
+	}
+
+	void benchmarkSmallJobs_data()
+	{
+		QTest::addColumn<bool>("scheduler");
+
+		QTest::newRow("thread pool") << false;
+		QTest::newRow("task scheduler") << true;
+	}
+
+	void benchmarkSmallJobs()
+	{
+		QFETCH(bool, scheduler);
+
+		const int count = 4000;
+		QVector<quint32> results(count);
+		quint32 *out = results.data();
+
+		QBENCHMARK {
+			if(scheduler) {
+				TaskScheduler::instance()->parallelFor(count, 1, [out](int, int begin, int end) {
+					for(int i=begin;i<end;++i)
+						out[i] = smallJob(i);
+				});
+			} else {
+				threadPoolForEach(count, [out](int i) {
+					out[i] = smallJob(i);
+				});
+			}
+		}
+
+		QCOMPARE(results.at(count-1), smallJob(count-1));
+	}
+};
+
+
+QTEST_MAIN(TestConcurrent)
+#include "concurrent.moc"
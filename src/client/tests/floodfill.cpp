@@ -0,0 +1,127 @@
+#include "../core/floodfill.h"
+#include "../core/layerstack.h"
+#include "../core/layer.h"
+
+#include <QtTest/QtTest>
+
+using namespace paintcore;
+
+/**
+ * A straightforward 4-connected flood fill to compare against.
+ * Returns the set of filled pixels as a mask image.
+ */
+static QImage referenceFill(const QImage &source, const QPoint &seed)
+{
+	QImage mask(source.size(), QImage::Format_Grayscale8);
+	mask.fill(0);
+
+	const QRgb oldColor = source.pixel(seed);
+	QVector<QPoint> stack { seed };
+	while(!stack.isEmpty()) {
+		const QPoint p = stack.takeLast();
+		if(!source.rect().contains(p) || mask.scanLine(p.y())[p.x()] || source.pixel(p) != oldColor)
+			continue;
+		mask.scanLine(p.y())[p.x()] = 1;
+		stack << QPoint(p.x()-1, p.y()) << QPoint(p.x()+1, p.y()) << QPoint(p.x(), p.y()-1) << QPoint(p.x(), p.y()+1);
+	}
+	return mask;
+}
+
+static void drawMaze(LayerStack &stack, const QSize &size)
+{
+	auto editor = stack.editor();
+	editor.resize(0, size.width(), size.height(), 0);
+	auto layer = editor.createLayer(1, 0, Qt::transparent, false, false, "Test");
+
+	// Walls with gaps at alternating ends, crossing tile boundaries
+	for(int x=20, i=0;x<size.width();x+=Tile::SIZE/2+3, ++i) {
+		const int gap = i % 2 ? 0 : size.height() - 15;
+		layer.fillRect(QRect(x, 0, 3, size.height()), Qt::black, BlendMode::MODE_NORMAL);
+		layer.fillRect(QRect(x, gap, 3, 15), Qt::transparent, BlendMode::MODE_REPLACE);
+	}
+	// Some enclosed islands
+	layer.fillRect(QRect(5, 5, 10, 10), Qt::black, BlendMode::MODE_NORMAL);
+	layer.fillRect(QRect(7, 7, 6, 6), Qt::transparent, BlendMode::MODE_REPLACE);
+}
+
+class TestFloodfill : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testMatchesReference_data()
+	{
+		QTest::addColumn<QSize>("size");
+		QTest::addColumn<QPoint>("seed");
+
+		QTest::newRow("single tile") << QSize(50, 40) << QPoint(0, 0);
+		QTest::newRow("partial edge tiles") << QSize(300, 200) << QPoint(299, 199);
+		QTest::newRow("exact tiles") << QSize(Tile::SIZE*4, Tile::SIZE*2) << QPoint(Tile::SIZE, Tile::SIZE);
+	}
+
+	void testMatchesReference()
+	{
+		QFETCH(QSize, size);
+		QFETCH(QPoint, seed);
+
+		LayerStack stack;
+		drawMaze(stack, size);
+
+		const FillResult result = floodfill(&stack, seed, Qt::red, 0, 1, false, 100000000);
+		QVERIFY(!result.oversize);
+		QVERIFY(!result.image.isNull());
+
+		const QImage expected = referenceFill(stack.getLayer(1)->toImage(), seed);
+
+		for(int y=0;y<size.height();++y) {
+			for(int x=0;x<size.width();++x) {
+				const QPoint p = QPoint(x, y) - QPoint(result.x, result.y);
+				const bool filled = result.image.rect().contains(p) && qAlpha(result.image.pixel(p)) > 0;
+				if(filled != bool(expected.scanLine(y)[x]))
+					QFAIL(qPrintable(QString("Mismatch at %1,%2").arg(x).arg(y)));
+			}
+		}
+	}
+
+	void testSizeLimit()
+	{
+		LayerStack stack;
+		drawMaze(stack, QSize(300, 200));
+
+		const FillResult result = floodfill(&stack, QPoint(0, 0), Qt::red, 0, 1, false, 100);
+		QVERIFY(result.oversize);
+	}
+
+	void testSameColor()
+	{
+		LayerStack stack;
+		drawMaze(stack, QSize(300, 200));
+
+		const FillResult result = floodfill(&stack, QPoint(20, 20), Qt::black, 0, 1, false, 100000);
+		QVERIFY(result.image.isNull());
+	}
+
+	void benchmarkFill_data()
+	{
+		QTest::addColumn<int>("side");
+
+		QTest::newRow("256x256") << 256;
+		QTest::newRow("1024x1024") << 1024;
+		QTest::newRow("4096x4096") << 4096;
+	}
+
+	void benchmarkFill()
+	{
+		QFETCH(int, side);
+
+		LayerStack stack;
+		drawMaze(stack, QSize(side, side));
+
+		QBENCHMARK {
+			floodfill(&stack, QPoint(0, 0), Qt::red, 10, 1, false, side * side);
+		}
+	}
+};
+
+
+QTEST_MAIN(TestFloodfill)
+#include "floodfill.moc"
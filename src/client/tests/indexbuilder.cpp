@@ -0,0 +1,193 @@
+#include "../recording/indexbuilder.h"
+#include "../recording/indexloader.h"
+#include "../canvas/statetracker.h"
+#include "../canvas/layerlist.h"
+#include "../core/layerstack.h"
+#include "../core/blendmodes.h"
+#include "../../shared/record/writer.h"
+#include "../../shared/record/reader.h"
+#include "../../shared/net/layer.h"
+#include "../../shared/net/image.h"
+#include "../../shared/net/undo.h"
+#include "../../shared/net/recording.h"
+
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+
+using namespace recording;
+using namespace protocol;
+
+static bool saveFile(const QString &filename, const QByteArray &content)
+{
+	QFile f(filename);
+	if(!f.open(QFile::WriteOnly))
+		return false;
+	return f.write(content) == content.length();
+}
+
+static bool buildIndex(const QString &recording, const QString &index, bool *incremental)
+{
+	IndexBuilder builder(recording, index);
+	QSignalSpy done(&builder, &IndexBuilder::done);
+	builder.run();
+	*incremental = builder.wasIncremental();
+	return done.count() == 1 && done.at(0).at(0).toBool();
+}
+
+class TestIndexBuilder : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testIncrementalIndex()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+
+		// Make a recording that grows in the middle of a drawing session.
+		// Undos are done by both users in both parts.
+		QByteArray recording;
+		qint64 prefixLength = 0;
+		{
+			QBuffer buffer(&recording);
+			buffer.open(QBuffer::WriteOnly);
+			Writer writer(&buffer, false);
+			QVERIFY(writer.writeHeader());
+
+			writer.recordMessage(MessagePtr(new CanvasResize(1, 0, 300, 200, 0)));
+			writer.recordMessage(MessagePtr(new LayerCreate(1, 0x0101, 0, 0, 0, "Layer")));
+
+			for(int i=0;i<100;++i) {
+				if(i == 60)
+					prefixLength = buffer.pos();
+
+				const uint8_t user = 1 + i % 2;
+				writer.recordMessage(MessagePtr(new UndoPoint(user)));
+				writer.recordMessage(MessagePtr(new FillRect(user, 0x0101, paintcore::BlendMode::MODE_NORMAL, (i * 37) % 250, (i * 23) % 150, 40, 30, 0xff000000 | (i * 0x123457 & 0xffffff))));
+				if(i % 7 == 6)
+					writer.recordMessage(MessagePtr(new Undo(user, 0, false)));
+				if(i % 11 == 10)
+					writer.recordMessage(MessagePtr(new Undo(user, 0, true)));
+				if(i % 30 == 15)
+					writer.recordMessage(MessagePtr(new Marker(user, QString("Marker %1").arg(i))));
+			}
+		}
+
+		const QString recfile = dir.filePath("test.dprec");
+		const QString idxfile = dir.filePath("test.dpidx");
+		bool incremental;
+
+		// Index the first part of the recording
+		QVERIFY(saveFile(recfile, recording.left(prefixLength)));
+		QVERIFY(buildIndex(recfile, idxfile, &incremental));
+		QVERIFY(!incremental);
+
+		// The index is out of date once the recording has grown
+		QVERIFY(saveFile(recfile, recording));
+		{
+			IndexLoader loader(recfile, idxfile);
+			QVERIFY(!loader.open());
+		}
+
+		// Only the new part needs to be indexed
+		QVERIFY(buildIndex(recfile, idxfile, &incremental));
+		QVERIFY(incremental);
+
+		// The updated index should be the same as a freshly built one
+		const QString fullRecfile = dir.filePath("full.dprec");
+		const QString fullIdxfile = dir.filePath("full.dpidx");
+		QVERIFY(saveFile(fullRecfile, recording));
+		QVERIFY(buildIndex(fullRecfile, fullIdxfile, &incremental));
+		QVERIFY(!incremental);
+
+		IndexLoader updated(recfile, idxfile);
+		IndexLoader full(fullRecfile, fullIdxfile);
+		QVERIFY(updated.open());
+		QVERIFY(full.open());
+
+		const Index &index = updated.index();
+		QCOMPARE(index.size(), full.index().size());
+		QCOMPARE(index.actionCount(), full.index().actionCount());
+		QCOMPARE(index.recordingSize(), full.index().recordingSize());
+		QCOMPARE(index.markers().size(), full.index().markers().size());
+		for(int i=0;i<index.size();++i) {
+			QCOMPARE(index.entry(i).index, full.index().entry(i).index);
+			QCOMPARE(index.entry(i).pos, full.index().entry(i).pos);
+		}
+		QCOMPARE(updated.thumbnailsAvailable(), full.thumbnailsAvailable());
+
+		// Snapshots must match the canvas of a full replay
+		Reader reader(recfile);
+		QCOMPARE(reader.open(), COMPATIBLE);
+
+		paintcore::LayerStack image;
+		canvas::LayerListModel layers;
+		canvas::StateTracker statetracker(&image, &layers, 1);
+
+		int snapshots = 0;
+		for(int i=0;i<index.size();++i) {
+			while(reader.currentIndex() < int(index.entry(i).index)) {
+				const MessageRecord record = reader.readNext();
+				QCOMPARE(record.status, MessageRecord::OK);
+				if(record.message->isCommand())
+					statetracker.receiveCommand(MessagePtr::fromNullable(record.message));
+			}
+
+			if(!(index.entry(i).flags & StopEntry::HAS_SNAPSHOT))
+				continue;
+
+			paintcore::LayerStack snapshotImage;
+			canvas::LayerListModel snapshotLayers;
+			canvas::StateTracker snapshotTracker(&snapshotImage, &snapshotLayers, 1);
+			snapshotTracker.resetToSavepoint(updated.loadSavepoint(i));
+
+			QCOMPARE(snapshotImage.toFlatImage(false, true), image.toFlatImage(false, true));
+			++snapshots;
+		}
+		QVERIFY(snapshots > 0);
+	}
+
+	void testIncompleteMessage()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+
+		QByteArray recording;
+		qint64 completeLength = 0;
+		{
+			QBuffer buffer(&recording);
+			buffer.open(QBuffer::WriteOnly);
+			Writer writer(&buffer, false);
+			QVERIFY(writer.writeHeader());
+
+			writer.recordMessage(MessagePtr(new CanvasResize(1, 0, 300, 200, 0)));
+			writer.recordMessage(MessagePtr(new LayerCreate(1, 0x0101, 0, 0, 0, "Layer")));
+			writer.recordMessage(MessagePtr(new UndoPoint(1)));
+			completeLength = buffer.pos();
+			writer.recordMessage(MessagePtr(new FillRect(1, 0x0101, paintcore::BlendMode::MODE_NORMAL, 0, 0, 40, 30, 0xff000000)));
+		}
+
+		const QString recfile = dir.filePath("test.dprec");
+		const QString idxfile = dir.filePath("test.dpidx");
+		bool incremental;
+
+		// A recording that is still being written may end in an incomplete message
+		QVERIFY(saveFile(recfile, recording.left(completeLength + 3)));
+		QVERIFY(buildIndex(recfile, idxfile, &incremental));
+		{
+			IndexLoader loader(recfile, idxfile);
+			QVERIFY(loader.open());
+			QCOMPARE(loader.index().recordingSize(), completeLength);
+		}
+
+		// Once the message is complete, the index is out of date
+		QVERIFY(saveFile(recfile, recording));
+		{
+			IndexLoader loader(recfile, idxfile);
+			QVERIFY(!loader.open());
+		}
+	}
+};
+
+
+QTEST_MAIN(TestIndexBuilder)
+#include "indexbuilder.moc"
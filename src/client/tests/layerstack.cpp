@@ -0,0 +1,191 @@
+#include "../core/layerstack.h"
+#include "../core/layer.h"
+
+#include <QtTest/QtTest>
+
+#include <functional>
+
+using namespace paintcore;
+
+class TestLayerStack : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testPaintChangedTiles_data()
+	{
+		QTest::addColumn<QSize>("size");
+
+		QTest::newRow("single tile") << QSize(40, 30);
+		QTest::newRow("partial edge tiles") << QSize(300, 200);
+		QTest::newRow("exact tiles") << QSize(Tile::SIZE*4, Tile::SIZE*2);
+	}
+
+	void testPaintChangedTiles()
+	{
+		QFETCH(QSize, size);
+
+		LayerStack stack;
+		{
+			auto editor = stack.editor();
+			editor.resize(0, size.width(), size.height(), 0);
+			auto layer = editor.createLayer(1, 0, Qt::white, false, false, "Test");
+			layer.fillRect(QRect(10, 10, size.width() - 20, size.height() - 20), Qt::red, BlendMode::MODE_NORMAL);
+			layer.fillRect(QRect(size.width() / 2, 0, 5, size.height()), QColor(0, 0, 255, 128), BlendMode::MODE_NORMAL);
+		}
+
+		const QImage expected = stack.toFlatImage(false, true).convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+		// Premultiplied images are written to directly
+		QImage direct(size, QImage::Format_ARGB32_Premultiplied);
+		direct.fill(Qt::black);
+		stack.markDirty();
+		stack.paintChangedTiles(direct.rect(), &direct);
+		QCOMPARE(direct, expected);
+
+		// Other formats are painted with QPainter
+		QImage painted(size, QImage::Format_RGB32);
+		painted.fill(Qt::black);
+		stack.markDirty();
+		stack.paintChangedTiles(painted.rect(), &painted);
+		QCOMPARE(painted, expected.convertToFormat(QImage::Format_RGB32));
+
+		// Only dirty tiles are repainted
+		direct.fill(Qt::black);
+		stack.paintChangedTiles(direct.rect(), &direct);
+		QCOMPARE(direct.pixel(0, 0), QColor(Qt::black).rgb());
+	}
+
+	void testCachedFlattening()
+	{
+		LayerStack stack;
+		{
+			auto editor = stack.editor();
+			editor.resize(0, 300, 200, 0);
+			editor.createLayer(1, 0, Qt::white, false, false, "Background");
+			editor.createLayer(2, 0, Qt::transparent, false, false, "Multiply").setBlend(BlendMode::MODE_MULTIPLY);
+			editor.createLayer(3, 0, Qt::transparent, false, false, "Middle");
+			editor.createLayer(4, 0, Qt::transparent, false, false, "Top");
+
+			// Semi-transparent layers above the edited ones: compositing
+			// them in a different order would cause rounding differences
+			editor.createLayer(5, 0, Qt::transparent, false, false, "Glaze 1")
+				.fillRect(QRect(0, 0, 200, 150), QColor(200, 40, 90, 100), BlendMode::MODE_NORMAL);
+			editor.createLayer(6, 0, Qt::transparent, false, false, "Glaze 2")
+				.fillRect(QRect(40, 30, 220, 150), QColor(30, 160, 220, 77), BlendMode::MODE_NORMAL);
+		}
+
+		QImage image(stack.size(), QImage::Format_ARGB32_Premultiplied);
+
+		const auto edit = [&stack](int layer, const QRect &rect, const QColor &color) {
+			stack.editor().getEditableLayer(layer).fillRect(rect, color, BlendMode::MODE_NORMAL);
+		};
+		const auto hide = [&stack](int layer, bool hidden) {
+			stack.editor().getEditableLayer(layer).setHidden(hidden);
+		};
+
+		const QList<std::function<void()>> steps {
+			[&]() { edit(3, QRect(50, 50, 100, 100), Qt::blue); },
+			[&]() { edit(2, QRect(0, 0, 120, 120), QColor(255, 0, 0, 128)); },
+			[&]() { edit(2, QRect(60, 20, 120, 120), QColor(0, 255, 0, 100)); },
+			[&]() { edit(2, QRect(100, 100, 120, 120), QColor(0, 0, 255, 200)); },
+			[&]() { edit(4, QRect(70, 0, 10, 200), Qt::black); },
+			[&]() { edit(4, QRect(90, 0, 10, 200), Qt::yellow); },
+			[&]() { hide(3, true); },
+			[&]() { edit(1, QRect(0, 0, 300, 200), QColor(0, 0, 0, 50)); },
+			[&]() { edit(1, QRect(10, 10, 280, 180), QColor(0, 128, 0, 60)); },
+			[&]() { hide(3, false); },
+			[&]() { edit(2, QRect(0, 0, 300, 200), QColor(128, 128, 128, 128)); },
+		};
+
+		for(int i=0;i<steps.size();++i) {
+			steps.at(i)();
+			stack.paintChangedTiles(image.rect(), &image);
+			QCOMPARE(image, stack.toFlatImage(false, false).convertToFormat(QImage::Format_ARGB32_Premultiplied));
+
+			const Tile expected(stack.toFlatImage(false, true), Tile::SIZE, Tile::SIZE);
+			QVERIFY(stack.getFlatTile(1, 1).equals(expected));
+		}
+	}
+
+	void testChangedTiles()
+	{
+		LayerStack stack;
+		{
+			auto editor = stack.editor();
+			editor.resize(0, 300, 200, 0);
+			editor.createLayer(1, 0, Qt::white, false, false, "Background");
+			editor.createLayer(2, 0, Qt::transparent, false, false, "Top").setBlend(BlendMode::MODE_MULTIPLY);
+		}
+
+		// Everything has changed after a resize
+		QImage image(stack.size(), QImage::Format_ARGB32_Premultiplied);
+		QBitArray changed = stack.takeChangedTiles();
+		QCOMPARE(changed.count(true), changed.size());
+		QCOMPARE(stack.updateFlatImage(image, changed), QRect(0, 0, 300, 200));
+		QCOMPARE(image, stack.toFlatImage(false, true));
+
+		// Repainting the view does not reset the changed tiles
+		QImage view(stack.size(), QImage::Format_ARGB32_Premultiplied);
+		stack.editor().getEditableLayer(2).fillRect(QRect(70, 10, 10, 10), Qt::red, BlendMode::MODE_NORMAL);
+		stack.paintChangedTiles(view.rect(), &view);
+
+		changed = stack.takeChangedTiles();
+		QCOMPARE(changed.count(true), 1);
+		QCOMPARE(stack.updateFlatImage(image, changed), QRect(Tile::SIZE, 0, Tile::SIZE, Tile::SIZE));
+		QCOMPARE(image, stack.toFlatImage(false, true));
+		QCOMPARE(stack.takeChangedTiles().count(true), 0);
+
+		// Merging a sublayer changes the flattened image (which excludes sublayers)
+		// even though the view does not change.
+		{
+			auto layer = stack.editor().getEditableLayer(1);
+			layer.getEditableSubLayer(1, BlendMode::MODE_NORMAL, 255).fillRect(QRect(10, 150, 20, 20), Qt::blue, BlendMode::MODE_NORMAL);
+			stack.takeChangedTiles();
+			layer.mergeSublayer(1);
+		}
+
+		changed = stack.takeChangedTiles();
+		QCOMPARE(changed.count(true), 1);
+		stack.updateFlatImage(image, changed);
+		QCOMPARE(image, stack.toFlatImage(false, true));
+	}
+
+	void testSavepointCompression()
+	{
+		LayerStack stack;
+		{
+			auto editor = stack.editor();
+			editor.resize(0, 300, 200, 0);
+			auto layer = editor.createLayer(1, 0, Qt::transparent, false, false, "Test");
+			layer.fillRect(QRect(10, 10, 100, 100), Qt::red, BlendMode::MODE_NORMAL);
+		}
+		const QImage original = stack.toFlatImage(false, false);
+
+		Savepoint *sp = stack.makeSavepoint();
+
+		// All tiles are still shared with the canvas
+		QCOMPARE(sp->uniqueBytes(), qint64(0));
+		QCOMPARE(sp->compress(), qint64(0));
+		QVERIFY(!sp->isCompressed());
+
+		// Painting over the layer detaches the canvas's tiles
+		stack.editor().getEditableLayer(1).fillRect(QRect(0, 0, 300, 200), Qt::blue, BlendMode::MODE_REPLACE);
+		const qint64 unique = sp->uniqueBytes();
+		QVERIFY(unique > 0);
+
+		QVERIFY(sp->compress() > 0);
+		QVERIFY(sp->isCompressed());
+		QVERIFY(sp->uniqueBytes() < unique);
+
+		// Restoring the savepoint decompresses it
+		stack.editor().restoreSavepoint(sp);
+		QVERIFY(!sp->isCompressed());
+		QCOMPARE(stack.toFlatImage(false, false), original);
+
+		delete sp;
+	}
+};
+
+
+QTEST_MAIN(TestLayerStack)
+#include "layerstack.moc"
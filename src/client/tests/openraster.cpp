@@ -0,0 +1,83 @@
+#include "../ora/orawriter.h"
+#include "../ora/orareader.h"
+#include "../canvas/statetracker.h"
+#include "../canvas/layerlist.h"
+#include "../core/layerstack.h"
+#include "../core/layer.h"
+
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+
+using namespace paintcore;
+
+class TestOpenRaster : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testSaveAndLoad()
+	{
+		LayerStack stack;
+		{
+			auto editor = stack.editor();
+			editor.resize(0, 300, 200, 0);
+			for(int i=1;i<=8;++i) {
+				auto layer = editor.createLayer(i, 0, Qt::transparent, false, false, QString("Layer %1").arg(i));
+				layer.fillRect(QRect(i * 20, i * 10, 100, 80), QColor::fromHsv(i * 40, 255, 255), BlendMode::MODE_NORMAL);
+			}
+		}
+
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		const QString filename = dir.filePath("test.ora");
+
+		QString error;
+		QVERIFY2(openraster::saveOpenRaster(filename, &stack, &error), qPrintable(error));
+
+		const openraster::OraResult result = openraster::loadOpenRaster(filename);
+		QVERIFY2(result.error.isEmpty(), qPrintable(result.error));
+
+		LayerStack loaded;
+		canvas::LayerListModel layerlist;
+		canvas::StateTracker tracker(&loaded, &layerlist, 1);
+		for(const protocol::MessagePtr &msg : result.commands)
+			tracker.receiveCommand(msg);
+
+		QCOMPARE(loaded.layerCount(), stack.layerCount());
+		for(int i=0;i<stack.layerCount();++i)
+			QCOMPARE(loaded.getLayerByIndex(i)->toImage(), stack.getLayerByIndex(i)->toImage());
+	}
+
+	void testLayerImageCache()
+	{
+		LayerStack stack;
+		{
+			auto editor = stack.editor();
+			editor.resize(0, 300, 200, 0);
+			editor.createLayer(1, 0, Qt::transparent, false, false, "Layer 1").fillRect(QRect(10, 10, 50, 50), Qt::red, BlendMode::MODE_NORMAL);
+			editor.createLayer(2, 0, Qt::transparent, false, false, "Layer 2").fillRect(QRect(60, 60, 50, 50), Qt::blue, BlendMode::MODE_NORMAL);
+		}
+
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		const QString filename = dir.filePath("test.ora");
+
+		openraster::LayerImageCache cache;
+		QVERIFY(openraster::saveOpenRaster(filename, &stack, nullptr, &cache));
+		QCOMPARE(cache.layers.size(), 2);
+		const QByteArray png1 = cache.layers[1].png;
+		const QByteArray png2 = cache.layers[2].png;
+
+		// Modify just one layer
+		stack.editor().getEditableLayer(2).fillRect(QRect(0, 0, 10, 10), Qt::green, BlendMode::MODE_NORMAL);
+
+		QVERIFY(openraster::saveOpenRaster(filename, &stack, nullptr, &cache));
+
+		// Unchanged layer was not re-encoded
+		QCOMPARE(cache.layers[1].png.constData(), png1.constData());
+		QVERIFY(cache.layers[2].png != png2);
+	}
+};
+
+
+QTEST_MAIN(TestOpenRaster)
+#include "openraster.moc"
@@ -0,0 +1,119 @@
+#include "../net/commands.h"
+#include "../core/tile.h"
+#include "../../shared/net/image.h"
+
+#include <QtTest/QtTest>
+#include <QPainter>
+
+using namespace protocol;
+
+// Draw the PutImage messages into an image of the given size
+static QImage reassemble(const QList<MessagePtr> &msgs, const QSize &size, const QPoint &offset)
+{
+	QImage img(size, QImage::Format_ARGB32_Premultiplied);
+	img.fill(0);
+
+	QPainter painter(&img);
+	painter.setCompositionMode(QPainter::CompositionMode_Source);
+	for(const MessagePtr &msg : msgs) {
+		const PutImage &pi = msg.cast<PutImage>();
+		const QByteArray data = qUncompress(pi.image());
+		const QImage piece(reinterpret_cast<const uchar*>(data.constData()), pi.width(), pi.height(), QImage::Format_ARGB32_Premultiplied);
+		painter.drawImage(int(pi.x()) - offset.x(), int(pi.y()) - offset.y(), piece);
+	}
+	return img;
+}
+
+static QImage testImage(const QSize &size)
+{
+	QImage img(size, QImage::Format_ARGB32_Premultiplied);
+	img.fill(0);
+
+	// Mix of noise (poorly compressible), gradients and empty areas
+	qsrand(1);
+	for(int y=0;y<size.height();++y) {
+		quint32 *row = reinterpret_cast<quint32*>(img.scanLine(y));
+		for(int x=0;x<size.width();++x) {
+			if(x < size.width() / 3)
+				row[x] = 0xff000000 | (qrand() & 0xffffff);
+			else if(y < size.height() / 2)
+				row[x] = 0xff000000 | (x & 0xff) << 8 | (y & 0xff);
+		}
+	}
+	return img;
+}
+
+class TestPutImage : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testSplitting_data()
+	{
+		QTest::addColumn<QSize>("size");
+		QTest::addColumn<QPoint>("pos");
+
+		QTest::newRow("small") << QSize(100, 100) << QPoint(0, 0);
+		QTest::newRow("large aligned") << QSize(1000, 700) << QPoint(0, 0);
+		QTest::newRow("large unaligned") << QSize(1000, 700) << QPoint(37, 100);
+		QTest::newRow("tall") << QSize(70, 3000) << QPoint(10, 10);
+	}
+
+	void testSplitting()
+	{
+		QFETCH(QSize, size);
+		QFETCH(QPoint, pos);
+
+		const QImage image = testImage(size);
+		const QList<MessagePtr> msgs = net::command::putQImage(1, 1, pos.x(), pos.y(), image, paintcore::BlendMode::MODE_NORMAL, true);
+		QVERIFY(!msgs.isEmpty());
+
+		for(const MessagePtr &msg : msgs) {
+			QCOMPARE(msg->type(), MSG_PUTIMAGE);
+			QVERIFY(msg.cast<PutImage>().image().length() <= PutImage::MAX_LEN);
+		}
+
+		QCOMPARE(reassemble(msgs, size, pos), image);
+
+		// The result must be deterministic
+		const QList<MessagePtr> msgs2 = net::command::putQImage(1, 1, pos.x(), pos.y(), image, paintcore::BlendMode::MODE_NORMAL, true);
+		QCOMPARE(msgs2.size(), msgs.size());
+		for(int i=0;i<msgs.size();++i)
+			QVERIFY(msgs.at(i)->equals(*msgs2.at(i)));
+	}
+
+	void testTileAlignment()
+	{
+		const QImage image = testImage(QSize(1000, 700));
+		const QList<MessagePtr> msgs = net::command::putQImage(1, 1, 37, 100, image, paintcore::BlendMode::MODE_NORMAL, true);
+		QVERIFY(msgs.size() > 1);
+
+		for(const MessagePtr &msg : msgs) {
+			const PutImage &pi = msg.cast<PutImage>();
+			QVERIFY(pi.x() == 37 || pi.x() % paintcore::Tile::SIZE == 0);
+			QVERIFY(pi.y() == 100 || pi.y() % paintcore::Tile::SIZE == 0);
+		}
+	}
+
+	void testMergeAroundEmptyTiles()
+	{
+		// Every tile row has empty tiles, but the rest should still fit in a single message
+		QImage image(1000, 700, QImage::Format_ARGB32_Premultiplied);
+		image.fill(0);
+		QPainter(&image).fillRect(0, 0, 500, 700, QColor(255, 0, 0));
+
+		const QList<MessagePtr> msgs = net::command::putQImage(1, 1, 0, 0, image, paintcore::BlendMode::MODE_NORMAL, true);
+		QCOMPARE(msgs.size(), 1);
+		QCOMPARE(reassemble(msgs, image.size(), QPoint()), image);
+	}
+
+	void testEmpty()
+	{
+		QImage image(2000, 2000, QImage::Format_ARGB32_Premultiplied);
+		image.fill(0);
+		QVERIFY(net::command::putQImage(1, 1, 0, 0, image, paintcore::BlendMode::MODE_NORMAL, true).isEmpty());
+	}
+};
+
+
+QTEST_MAIN(TestPutImage)
+#include "putimage.moc"
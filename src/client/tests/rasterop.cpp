@@ -0,0 +1,237 @@
+#include "../core/rasterop.h"
+#include "../core/tile.h"
+
+#include <QtTest/QtTest>
+
+using namespace paintcore;
+
+Q_DECLARE_METATYPE(BlendMode::Mode)
+Q_DECLARE_METATYPE(SimdLevel)
+
+static const BlendMode::Mode ALL_MODES[] = {
+	BlendMode::MODE_ERASE,
+	BlendMode::MODE_NORMAL,
+	BlendMode::MODE_MULTIPLY,
+	BlendMode::MODE_DIVIDE,
+	BlendMode::MODE_BURN,
+	BlendMode::MODE_DODGE,
+	BlendMode::MODE_DARKEN,
+	BlendMode::MODE_LIGHTEN,
+	BlendMode::MODE_SUBTRACT,
+	BlendMode::MODE_ADD,
+	BlendMode::MODE_RECOLOR,
+	BlendMode::MODE_BEHIND,
+	BlendMode::MODE_COLORERASE,
+	BlendMode::MODE_REPLACE
+};
+
+static quint32 randomPixel()
+{
+	return quint32(qrand() & 0xffff) | (quint32(qrand() & 0xffff) << 16);
+}
+
+static QVector<quint32> randomPixels(int len)
+{
+	QVector<quint32> pixels(len);
+	for(int i=0;i<len;++i) {
+		switch(qrand() % 4) {
+		case 0: pixels[i] = 0; break;
+		case 1: pixels[i] = randomPixel() | 0xff000000; break;
+		default: pixels[i] = qPremultiply(randomPixel());
+		}
+	}
+	return pixels;
+}
+
+static QVector<uchar> randomMask(int len)
+{
+	QVector<uchar> mask(len);
+	for(int i=0;i<len;++i) {
+		switch(qrand() % 4) {
+		case 0: mask[i] = 0; break;
+		case 1: mask[i] = 255; break;
+		default: mask[i] = qrand() % 256;
+		}
+	}
+	return mask;
+}
+
+class TestRasterOp : public QObject
+{
+	Q_OBJECT
+private slots:
+	void cleanup()
+	{
+		setSimdLevel(detectSimdLevel());
+	}
+
+	void testPixelParity_data()
+	{
+		QTest::addColumn<BlendMode::Mode>("mode");
+		for(const auto mode : ALL_MODES)
+			QTest::newRow(qPrintable(findBlendMode(mode).svgname)) << mode;
+	}
+
+	void testPixelParity()
+	{
+		QFETCH(BlendMode::Mode, mode);
+
+		qsrand(uint(mode) + 1);
+		const int len = Tile::LENGTH + 3; // odd length to exercise the unaligned tail
+
+		for(int opacity : {0, 1, 128, 254, 255}) {
+			const QVector<quint32> base = randomPixels(len);
+			const QVector<quint32> over = randomPixels(len);
+
+			QVector<quint32> expected = base;
+			setSimdLevel(SimdLevel::None);
+			compositePixels(mode, expected.data(), over.constData(), len, opacity);
+
+			for(SimdLevel level : {SimdLevel::SSE2, SimdLevel::AVX2}) {
+				setSimdLevel(level);
+				if(simdLevel() != level)
+					continue;
+
+				QVector<quint32> actual = base;
+				compositePixels(mode, actual.data(), over.constData(), len, opacity);
+				QCOMPARE(actual, expected);
+			}
+		}
+	}
+
+	void testMaskParity_data()
+	{
+		testPixelParity_data();
+	}
+
+	void testMaskParity()
+	{
+		QFETCH(BlendMode::Mode, mode);
+
+		qsrand(uint(mode) + 1);
+
+		// Test both sub-vector and odd sized rectangles within a tile
+		for(const QSize size : {QSize(3, 3), QSize(37, 29), QSize(Tile::SIZE, Tile::SIZE)}) {
+			const int w = size.width();
+			const int h = size.height();
+			const int maskskip = 1;
+			const int baseskip = Tile::SIZE - w;
+
+			const QVector<quint32> base = randomPixels(Tile::LENGTH);
+			const QVector<uchar> mask = randomMask((w + maskskip) * h);
+			const quint32 color = randomPixel();
+
+			QVector<quint32> expected = base;
+			setSimdLevel(SimdLevel::None);
+			compositeMask(mode, expected.data(), color, mask.constData(), w, h, maskskip, baseskip);
+
+			for(SimdLevel level : {SimdLevel::SSE2, SimdLevel::AVX2}) {
+				setSimdLevel(level);
+				if(simdLevel() != level)
+					continue;
+
+				QVector<quint32> actual = base;
+				compositeMask(mode, actual.data(), color, mask.constData(), w, h, maskskip, baseskip);
+				QCOMPARE(actual, expected);
+			}
+		}
+	}
+
+	// The vectorized modes reimplement qUnpremultiply and qPremultiply,
+	// so check every alpha and channel value combination
+	void testUnpremultiplyParity_data()
+	{
+		QTest::addColumn<BlendMode::Mode>("mode");
+		for(const auto mode : {BlendMode::MODE_MULTIPLY, BlendMode::MODE_DARKEN, BlendMode::MODE_LIGHTEN,
+				BlendMode::MODE_SUBTRACT, BlendMode::MODE_ADD, BlendMode::MODE_RECOLOR})
+			QTest::newRow(qPrintable(findBlendMode(mode).svgname)) << mode;
+	}
+
+	void testUnpremultiplyParity()
+	{
+		QFETCH(BlendMode::Mode, mode);
+
+		qsrand(uint(mode) + 1);
+
+		QVector<quint32> base;
+		for(int a=0;a<256;++a)
+			for(int c=0;c<=a;++c)
+				base << qRgba(c, a - c, c / 2, a);
+
+		QVector<quint32> over(base.size());
+		for(quint32 &p : over)
+			p = qPremultiply(randomPixel());
+
+		QVector<quint32> expected = base;
+		setSimdLevel(SimdLevel::None);
+		compositePixels(mode, expected.data(), over.constData(), base.size(), 200);
+
+		for(SimdLevel level : {SimdLevel::SSE2, SimdLevel::AVX2}) {
+			setSimdLevel(level);
+			if(simdLevel() != level)
+				continue;
+
+			QVector<quint32> actual = base;
+			compositePixels(mode, actual.data(), over.constData(), base.size(), 200);
+			QCOMPARE(actual, expected);
+		}
+	}
+
+	void benchmarkCompositePixels_data()
+	{
+		QTest::addColumn<BlendMode::Mode>("mode");
+		QTest::addColumn<SimdLevel>("level");
+
+		for(const auto mode : ALL_MODES) {
+			const QString name = findBlendMode(mode).svgname;
+			QTest::newRow(qPrintable(name + " scalar")) << mode << SimdLevel::None;
+			QTest::newRow(qPrintable(name + " sse2")) << mode << SimdLevel::SSE2;
+			QTest::newRow(qPrintable(name + " avx2")) << mode << SimdLevel::AVX2;
+		}
+	}
+
+	void benchmarkCompositePixels()
+	{
+		QFETCH(BlendMode::Mode, mode);
+		QFETCH(SimdLevel, level);
+
+		setSimdLevel(level);
+		if(simdLevel() != level)
+			QSKIP("Instruction set not supported");
+
+		qsrand(1);
+		const QVector<quint32> over = randomPixels(Tile::LENGTH);
+		QVector<quint32> base = randomPixels(Tile::LENGTH);
+
+		QBENCHMARK {
+			compositePixels(mode, base.data(), over.constData(), Tile::LENGTH, 200);
+		}
+	}
+
+	void benchmarkCompositeMask_data()
+	{
+		benchmarkCompositePixels_data();
+	}
+
+	void benchmarkCompositeMask()
+	{
+		QFETCH(BlendMode::Mode, mode);
+		QFETCH(SimdLevel, level);
+
+		setSimdLevel(level);
+		if(simdLevel() != level)
+			QSKIP("Instruction set not supported");
+
+		qsrand(1);
+		const QVector<uchar> mask = randomMask(Tile::LENGTH);
+		QVector<quint32> base = randomPixels(Tile::LENGTH);
+
+		QBENCHMARK {
+			compositeMask(mode, base.data(), 0xff336699, mask.constData(), Tile::SIZE, Tile::SIZE, 0, 0);
+		}
+	}
+};
+
+
+QTEST_MAIN(TestRasterOp)
+#include "rasterop.moc"
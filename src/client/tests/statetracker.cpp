@@ -0,0 +1,126 @@
+#include "../canvas/statetracker.h"
+#include "../canvas/layerlist.h"
+#include "../core/layerstack.h"
+#include "../core/blendmodes.h"
+#include "../core/layer.h"
+#include "../tools/selection.h"
+#include "../../shared/net/layer.h"
+#include "../../shared/net/image.h"
+
+#include <QtTest/QtTest>
+
+using namespace canvas;
+using namespace protocol;
+using paintcore::BlendMode;
+
+class TestStateTracker : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testBatchMatchesSerial()
+	{
+		QList<MessagePtr> setup;
+		setup << MessagePtr(new CanvasResize(1, 0, 300, 200, 0));
+		for(int i=1;i<=3;++i)
+			setup << MessagePtr(new LayerCreate(1, 0x0100 | i, 0, 0, 0, QString("Layer %1").arg(i)));
+
+		// Pixel commands on interleaved layers, with overlapping areas
+		// so that the result depends on the execution order
+		QList<MessagePtr> commands;
+		const BlendMode::Mode modes[] = { BlendMode::MODE_NORMAL, BlendMode::MODE_MULTIPLY, BlendMode::MODE_BEHIND, BlendMode::MODE_ERASE };
+		for(int i=0;i<40;++i) {
+			const int layer = 0x0100 | (1 + i % 3);
+			const quint32 color = 0x80000000 | (i * 0x123457 & 0xffffff);
+			commands << MessagePtr(new FillRect(1 + i % 2, layer, modes[i % 4], (i * 37) % 250, (i * 23) % 150, 40 + i, 30 + i, color));
+		}
+
+		// Serial execution
+		paintcore::LayerStack serialStack;
+		LayerListModel serialLayers;
+		StateTracker serial(&serialStack, &serialLayers, 1);
+		for(const MessagePtr &msg : setup + commands)
+			serial.receiveCommand(msg);
+
+		// Batched execution
+		paintcore::LayerStack batchStack;
+		LayerListModel batchLayers;
+		StateTracker batched(&batchStack, &batchLayers, 1);
+		for(const MessagePtr &msg : setup)
+			batched.receiveCommand(msg);
+		for(const MessagePtr &msg : commands)
+			batched.receiveQueuedCommand(msg);
+
+		QTRY_COMPARE(batchStack.toFlatImage(false, false), serialStack.toFlatImage(false, false));
+
+		for(int i=1;i<=3;++i) {
+			const int id = 0x0100 | i;
+			QCOMPARE(batchStack.getLayer(id)->toImage(), serialStack.getLayer(id)->toImage());
+		}
+	}
+
+	void testMoveRegion_data()
+	{
+		QTest::addColumn<QPolygon>("target");
+
+		QTest::newRow("translate") << QPolygon({QPoint(60, 50), QPoint(159, 50), QPoint(159, 129), QPoint(60, 129)});
+		QTest::newRow("scale") << QPolygon({QPoint(40, 30), QPoint(240, 30), QPoint(240, 190), QPoint(40, 190)});
+		QTest::newRow("rotate") << QPolygon({QPoint(150, 10), QPoint(260, 100), QPoint(150, 190), QPoint(40, 100)});
+	}
+
+	void testMoveRegion()
+	{
+		QFETCH(QPolygon, target);
+
+		const int layerId = 0x0101;
+		const QRect bounds(40, 30, 100, 80);
+
+		const QList<MessagePtr> setup {
+			MessagePtr(new CanvasResize(1, 0, 300, 200, 0)),
+			MessagePtr(new LayerCreate(1, layerId, 0, 0, 0, "Layer")),
+			MessagePtr(new FillRect(1, layerId, BlendMode::MODE_NORMAL, 0, 0, 300, 200, 0xff808080)),
+			MessagePtr(new FillRect(1, layerId, BlendMode::MODE_NORMAL, 50, 40, 60, 50, 0xffff0000)),
+			MessagePtr(new FillRect(1, layerId, BlendMode::MODE_NORMAL, 90, 20, 20, 120, 0x800000ff))
+		};
+
+		paintcore::LayerStack stack;
+		LayerListModel layers;
+		StateTracker tracker(&stack, &layers, 1);
+		for(const MessagePtr &msg : setup)
+			tracker.receiveCommand(msg);
+
+		const paintcore::Layer *layer = stack.getLayer(layerId);
+		const QImage selection = layer->toImage().copy(bounds);
+		QCOMPARE(layer->toImage(bounds), selection);
+
+		// The tile based result should be identical to transforming
+		// the selection as a whole image and drawing it onto the layer
+		paintcore::LayerStack expectedStack;
+		LayerListModel expectedLayers;
+		StateTracker expectedTracker(&expectedStack, &expectedLayers, 1);
+		for(const MessagePtr &msg : setup)
+			expectedTracker.receiveCommand(msg);
+
+		QPoint offset = target[0];
+		QImage transformed = selection;
+		if(target.boundingRect().size() != bounds.size())
+			transformed = tools::SelectionTool::transformSelectionImage(selection, target, &offset);
+		{
+			auto expectedLayer = expectedStack.editor().getEditableLayer(layerId);
+			expectedLayer.fillRect(bounds, Qt::transparent, BlendMode::MODE_REPLACE);
+			expectedLayer.putImage(offset.x(), offset.y(), transformed, BlendMode::MODE_NORMAL);
+		}
+
+		tracker.receiveCommand(MessagePtr(new MoveRegion(1, layerId,
+			bounds.x(), bounds.y(), bounds.width(), bounds.height(),
+			target[0].x(), target[0].y(), target[1].x(), target[1].y(),
+			target[2].x(), target[2].y(), target[3].x(), target[3].y(),
+			QByteArray()
+		)));
+
+		QCOMPARE(layer->toImage(), expectedStack.getLayer(layerId)->toImage());
+	}
+};
+
+
+QTEST_MAIN(TestStateTracker)
+#include "statetracker.moc"
@@ -0,0 +1,70 @@
+#include "../core/tilevector.h"
+#include "../core/layer.h"
+#include "../../shared/net/image.h"
+
+#include <QtTest/QtTest>
+
+using namespace paintcore;
+
+static Tile noiseTile(int seed)
+{
+	qsrand(seed);
+	Tile t;
+	quint32 *data = t.data();
+	for(int i=0;i<Tile::LENGTH;++i)
+		data[i] = 0xff000000 | (qrand() & 0xffffff);
+	return t;
+}
+
+class TestTileVector : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testCompressTiles()
+	{
+		const QSize size(Tile::SIZE*4, Tile::SIZE*3);
+
+		// Two layers with an identical (but separately allocated) tile
+		Layer l1(1, QString(), Qt::transparent, size);
+		Layer l2(2, QString(), Qt::transparent, size);
+		EditableLayer(&l1, nullptr).putTile(1, 1, 0, noiseTile(1));
+		EditableLayer(&l1, nullptr).putTile(2, 2, 0, noiseTile(2));
+		EditableLayer(&l2, nullptr).putTile(0, 0, 0, noiseTile(1));
+
+		QVector<LayerTileSet> sets;
+		sets << LayerTileSet::fromLayer(l1) << LayerTileSet::fromLayer(l2);
+
+		// Reference messages without precompression
+		QList<protocol::MessagePtr> expected;
+		for(int i=0;i<sets.size();++i)
+			expected << LayerTileSet(sets.at(i)).toInitCommands(1, LayerInfo(i+1, QString()));
+
+		LayerTileSet::compressTiles(sets);
+
+		QList<protocol::MessagePtr> actual;
+		for(int i=0;i<sets.size();++i)
+			actual << LayerTileSet(sets.at(i)).toInitCommands(1, LayerInfo(i+1, QString()));
+
+		QCOMPARE(actual.size(), expected.size());
+		for(int i=0;i<actual.size();++i)
+			QVERIFY(actual.at(i)->equals(*expected.at(i)));
+
+		// The duplicate tile was compressed just once
+		const TileRun *dup1 = nullptr, *dup2 = nullptr;
+		for(const TileRun &tr : sets[0].tiles) {
+			if(tr.col == 1 && tr.row == 1)
+				dup1 = &tr;
+		}
+		for(const TileRun &tr : sets[1].tiles) {
+			if(tr.col == 0 && tr.row == 0)
+				dup2 = &tr;
+		}
+		QVERIFY(dup1 && dup2);
+		QVERIFY(!dup1->compressed.isEmpty());
+		QCOMPARE(dup1->compressed.constData(), dup2->compressed.constData());
+	}
+};
+
+
+QTEST_MAIN(TestTileVector)
+#include "tilevector.moc"
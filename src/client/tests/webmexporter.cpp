@@ -0,0 +1,99 @@
+#include "../export/webmexporter.h"
+#include "../canvas/statetracker.h"
+#include "../canvas/layerlist.h"
+#include "../core/layerstack.h"
+#include "../core/blendmodes.h"
+#include "../../shared/net/layer.h"
+#include "../../shared/net/image.h"
+#include "../../shared/net/undo.h"
+
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+
+using namespace protocol;
+
+static bool waitForSignal(QSignalSpy &spy)
+{
+	if(spy.isEmpty() && !spy.wait(60000))
+		return false;
+	spy.removeFirst();
+	return true;
+}
+
+class TestWebmExporter : public QObject
+{
+	Q_OBJECT
+private slots:
+	void benchmarkExport_data()
+	{
+		QTest::addColumn<int>("depth");
+
+		QTest::newRow("unbuffered") << 1;
+		QTest::newRow("queued") << int(WebmExporter::DEFAULT_QUEUE_DEPTH);
+	}
+
+	// Replay a sample drawing session and export a frame after each few strokes
+	void benchmarkExport()
+	{
+		QFETCH(int, depth);
+
+		const int frames = 25;
+		const int strokesPerFrame = 4;
+
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		const QString filename = dir.filePath("test.webm");
+
+		paintcore::LayerStack image;
+		canvas::LayerListModel layers;
+		canvas::StateTracker statetracker(&image, &layers, 1);
+
+		WebmExporter exporter;
+		exporter.setFilename(filename);
+		exporter.setFps(25);
+		exporter.setQueueDepth(depth);
+
+		QSignalSpy ready(&exporter, &VideoExporter::exporterReady);
+		QSignalSpy finished(&exporter, &VideoExporter::exporterFinished);
+		QSignalSpy errors(&exporter, &VideoExporter::exporterError);
+
+		QElapsedTimer timer;
+		timer.start();
+
+		exporter.start();
+		QVERIFY(waitForSignal(ready));
+
+		statetracker.receiveCommand(MessagePtr(new CanvasResize(1, 0, 480, 270, 0)));
+		statetracker.receiveCommand(MessagePtr(new LayerCreate(1, 0x0101, 0, 0xffffffff, 0, "Background")));
+		statetracker.receiveCommand(MessagePtr(new LayerCreate(1, 0x0102, 0, 0, 0, "Drawing")));
+
+		QImage frame(image.size(), QImage::Format_ARGB32_Premultiplied);
+		for(int i=0;i<frames;++i) {
+			for(int j=0;j<strokesPerFrame;++j) {
+				const int n = i * strokesPerFrame + j;
+				statetracker.receiveCommand(MessagePtr(new UndoPoint(1)));
+				statetracker.receiveCommand(MessagePtr(new FillRect(1, 0x0102, paintcore::BlendMode::MODE_NORMAL, (n * 37) % 440, (n * 23) % 240, 40, 30, 0xff000000 | (n * 0x123457 & 0xffffff))));
+			}
+
+			const QRect changed = image.updateFlatImage(frame, image.takeChangedTiles());
+			if(i == 0)
+				exporter.saveFrame(frame, 1);
+			else
+				exporter.saveFrame(frame, changed, 1);
+
+			QVERIFY(waitForSignal(ready));
+		}
+
+		exporter.finish();
+		QVERIFY(waitForSignal(finished));
+		QCOMPARE(errors.count(), 0);
+
+		QTest::setBenchmarkResult(frames * 1000.0 / qMax(qint64(1), timer.elapsed()), QTest::FramesPerSecond);
+
+		QVERIFY(QFileInfo(filename).size() > 0);
+	}
+};
+
+
+QTEST_MAIN(TestWebmExporter)
+#include "webmexporter.moc"
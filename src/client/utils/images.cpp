@@ -87,6 +87,7 @@ QString recordingFormatFilter(bool allFiles)
 		QGuiApplication::tr("Binary Recordings (%1)").arg("*.dprec") + sep +
 		QGuiApplication::tr("Text Recordings (%1)").arg("*.dptxt") + sep +
 		QGuiApplication::tr("Compressed Binary Recordings (%1)").arg("*.dprecz") + sep +
+		QGuiApplication::tr("Seekable Compressed Recordings (%1)").arg("*.dprecb") + sep +
 		QGuiApplication::tr("Compressed Text Recordings (%1)").arg("*.dptxtz");
 
 	if(allFiles)
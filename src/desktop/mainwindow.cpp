@@ -223,8 +223,16 @@ MainWindow::MainWindow(bool restoreWindowPosition)
 	{
 		QLabel *tilemem = new QLabel(this);
 		QTimer *tilememtimer = new QTimer(this);
-		connect(tilememtimer, &QTimer::timeout, [tilemem]() {
-			tilemem->setText(QStringLiteral("Tiles: %1 Mb").arg(paintcore::TileData::megabytesUsed(), 0, 'f', 2));
+		connect(tilememtimer, &QTimer::timeout, [this, tilemem]() {
+			QString text = QStringLiteral("Tiles: %1 Mb").arg(paintcore::TileData::megabytesUsed(), 0, 'f', 2);
+			if(m_doc->canvas()) {
+				const auto sp = m_doc->canvas()->stateTracker()->savepointStats();
+				text += QStringLiteral(" Savepoints: %1 (%2 compressed) %3 Mb")
+					.arg(sp.count)
+					.arg(sp.compressed)
+					.arg(sp.bytes / double(1024*1024), 0, 'f', 2);
+			}
+			tilemem->setText(text);
 		});
 		tilememtimer->setInterval(1000);
 		tilememtimer->start(1000);
@@ -1008,7 +1016,7 @@ void MainWindow::open()
 {
 	// Get a list of supported formats
 	QString dpimages = "*.ora ";
-	QString dprecs = "*.dptxt *.dprec *.dprecz *.dprec.gz *.dptxtz *.dptxt.gz ";
+	QString dprecs = "*.dptxt *.dprec *.dprecz *.dprecb *.dprec.gz *.dptxtz *.dptxt.gz ";
 	QString formats;
 	for(QByteArray format : QImageReader::supportedImageFormats()) {
 		formats += "*." + format + " ";
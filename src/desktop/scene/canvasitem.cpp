@@ -23,9 +23,47 @@
 #include "canvasitem.h"
 
 #include "core/layerstack.h"
+#include "core/tile.h"
 
 namespace drawingboard {
 
+/**
+ * @brief Downscale a region of an image into the next mipmap level
+ *
+ * Each destination pixel is the average of a 2x2 block of source pixels.
+ * At odd sized edges, the last source row/column is repeated.
+ *
+ * @param src source image (ARGB32 premultiplied)
+ * @param dest destination image at half the size (rounded up)
+ * @param rect the area to update in destination image coordinates
+ */
+static void downscaleHalf(const QImage &src, QImage &dest, const QRect &rect)
+{
+	const int sw1 = src.width() - 1;
+	const int sh1 = src.height() - 1;
+
+	for(int y=rect.top();y<=rect.bottom();++y) {
+		const quint32 *row0 = reinterpret_cast<const quint32*>(src.constScanLine(qMin(y*2, sh1)));
+		const quint32 *row1 = reinterpret_cast<const quint32*>(src.constScanLine(qMin(y*2+1, sh1)));
+		quint32 *out = reinterpret_cast<quint32*>(dest.scanLine(y));
+
+		for(int x=rect.left();x<=rect.right();++x) {
+			const int x0 = qMin(x*2, sw1);
+			const int x1 = qMin(x*2+1, sw1);
+			const quint32 p[] = { row0[x0], row0[x1], row1[x0], row1[x1] };
+
+			// Average each channel separately. Two channels at a time fit in
+			// a 32 bit integer without overflowing into each other.
+			quint32 rb = 0, ag = 0;
+			for(const quint32 c : p) {
+				rb += c & 0x00ff00ff;
+				ag += (c >> 8) & 0x00ff00ff;
+			}
+			out[x] = (((rb + 0x00020002) >> 2) & 0x00ff00ff) | ((((ag + 0x00020002) >> 2) & 0x00ff00ff) << 8);
+		}
+	}
+}
+
 /**
  * @param parent use another QGraphicsItem as a parent
  * @param scene the picture to which this layer belongs to
@@ -40,6 +78,19 @@ CanvasItem::CanvasItem(paintcore::LayerStack *layerstack, QGraphicsItem *parent)
 
 void CanvasItem::refreshImage(const QRect &area)
 {
+	// Mark the changed tiles as stale in all mipmap levels
+	const int xtiles = paintcore::Tile::roundTiles(m_image->width());
+	if(m_mipmapDirty.size() == xtiles * paintcore::Tile::roundTiles(m_image->height())) {
+		const QRect r = area & QRect(0, 0, m_image->width(), m_image->height());
+		if(!r.isEmpty()) {
+			for(int ty=r.top()/paintcore::Tile::SIZE;ty<=r.bottom()/paintcore::Tile::SIZE;++ty) {
+				for(int tx=r.left()/paintcore::Tile::SIZE;tx<=r.right()/paintcore::Tile::SIZE;++tx) {
+					m_mipmapDirty[ty*xtiles+tx] = (1 << MIPMAP_LEVELS) - 1;
+				}
+			}
+		}
+	}
+
 	update(area.adjusted(-2, -2, 2, 2));
 }
 
@@ -52,16 +103,89 @@ void CanvasItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option
 	 QWidget *)
 {
 	if((_cache.isNull() || _cache.size() != m_image->size()) && m_image->size().isValid()) {
-		_cache = QPixmap(m_image->size());
-		_cache.fill();
+		_cache = QImage(m_image->size(), QImage::Format_ARGB32_Premultiplied);
+		_cache.fill(Qt::white);
+
+		for(QImage &mipmap : m_mipmaps)
+			mipmap = QImage();
+		m_mipmapDirty.fill((1 << MIPMAP_LEVELS) - 1, paintcore::Tile::roundTiles(_cache.width()) * paintcore::Tile::roundTiles(_cache.height()));
 	}
 
 	QRect exposed = option->exposedRect.adjusted(-1, -1, 1, 1).toAlignedRect();
 	exposed &= _cache.rect();
+	if(exposed.isEmpty())
+		return;
 
 	m_image->paintChangedTiles(exposed, &_cache, true);
 
-	painter->drawPixmap(exposed, _cache, exposed);
+	// When zoomed out, draw from the smallest cache level that still
+	// has at least as many pixels as will be shown on the screen
+	const qreal lod = option->levelOfDetailFromTransform(painter->worldTransform());
+	int level = 0;
+	while(level < MIPMAP_LEVELS && lod <= 1.0 / (2 << level))
+		++level;
+
+	if(level == 0) {
+		painter->drawImage(exposed, _cache, exposed);
+
+	} else {
+		updateMipmaps(level, exposed);
+
+		const qreal scale = 1.0 / (1 << level);
+		const QRectF source(exposed.x() * scale, exposed.y() * scale, exposed.width() * scale, exposed.height() * scale);
+		painter->drawImage(QRectF(exposed), m_mipmaps[level-1], source);
+	}
+}
+
+/**
+ * @brief Bring the mipmap levels up to the given one up to date in the given area
+ * @param level the highest mipmap level needed
+ * @param area the area to update in canvas coordinates
+ */
+void CanvasItem::updateMipmaps(int level, const QRect &area)
+{
+	Q_ASSERT(level>0 && level<=MIPMAP_LEVELS);
+	const int SIZE = paintcore::Tile::SIZE;
+	const int xtiles = paintcore::Tile::roundTiles(_cache.width());
+
+	for(int l=1;l<=level;++l) {
+		const QImage &src = l == 1 ? _cache : m_mipmaps[l-2];
+		QImage &dest = m_mipmaps[l-1];
+		if(dest.isNull()) {
+			dest = QImage((src.width()+1) / 2, (src.height()+1) / 2, QImage::Format_ARGB32_Premultiplied);
+			dest.fill(Qt::white);
+		}
+	}
+
+	const int tx0 = area.left() / SIZE;
+	const int tx1 = area.right() / SIZE;
+	const int ty0 = area.top() / SIZE;
+	const int ty1 = area.bottom() / SIZE;
+
+	for(int ty=ty0;ty<=ty1;++ty) {
+		for(int tx=tx0;tx<=tx1;++tx) {
+			quint8 &dirty = m_mipmapDirty[ty*xtiles+tx];
+
+			// Each level is built from the one above it, so
+			// when a level is updated, the lower ones must be too.
+			for(int l=1;l<=level;++l) {
+				if(!(dirty & (1<<(l-1))))
+					continue;
+
+				const QImage &src = l == 1 ? _cache : m_mipmaps[l-2];
+				QImage &dest = m_mipmaps[l-1];
+				const QRect tileRect = QRect(
+					(tx*SIZE) >> l,
+					(ty*SIZE) >> l,
+					SIZE >> l,
+					SIZE >> l
+				) & dest.rect();
+
+				downscaleHalf(src, dest, tileRect);
+				dirty &= ~(1<<(l-1));
+			}
+		}
+	}
 }
 
 void CanvasItem::canvasResize()
@@ -20,6 +20,8 @@
 #define DP_CANVASITEM_H
 
 #include <QGraphicsObject>
+#include <QImage>
+#include <QVector>
 
 namespace paintcore {
 	class LayerStack;
@@ -51,8 +53,20 @@ protected:
 	void paint(QPainter*, const QStyleOptionGraphicsItem*, QWidget*);
 
 private:
+	//! Number of downscaled cache levels (1/2, 1/4, 1/8)
+	static const int MIPMAP_LEVELS = 3;
+
+	void updateMipmaps(int level, const QRect &area);
+
 	paintcore::LayerStack *m_image;
-	QPixmap _cache;
+	QImage _cache; // an image, so that changed tiles can be copied directly into it
+
+	// Downscaled copies of the cache, used when zoomed out.
+	// Level N is at 1/2^N scale and is allocated when first needed.
+	QImage m_mipmaps[MIPMAP_LEVELS];
+
+	// Bitmask of stale mipmap levels for each canvas tile
+	QVector<quint8> m_mipmapDirty;
 };
 
 }
@@ -19,9 +19,11 @@
 
 #include "database.h"
 #include "dblog.h"
+#include "dbconnection.h"
 #include "../shared/util/passwordhash.h"
 #include "../shared/server/loginhandler.h" // for username validation
 #include "../shared/server/serverlog.h"
+#include "../shared/server/ipbantrie.h"
 
 #include <QSqlDatabase>
 #include <QSqlQuery>
@@ -34,14 +36,38 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QTimer>
+#include <QMutex>
 
 namespace server {
 
 struct Database::Private {
+	// The main connection. Each thread queries the database through
+	// its own clone of this (see threadConnection())
 	QSqlDatabase db;
 	ServerLog *logger;
+
+	// Held while the ban list is edited, so checking for an existing
+	// entry and adding a new one happen atomically.
+	QMutex banEditMutex;
+
+	QSqlDatabase connection() const { return threadConnection(db); }
+
+	// In-memory index of the ipbans table, so incoming connections
+	// can be checked without querying the database.
+	QMutex banMutex;
+	IpBanTrie bans;
 };
 
+static const QString BAN_DATE_FORMAT = QStringLiteral("yyyy-MM-dd HH:mm:ss");
+
+//! Parse a ban expiration time. The times are compared against SQLite's datetime('now'), so they are UTC.
+static QDateTime banExpiration(const QString &str)
+{
+	QDateTime dt = QDateTime::fromString(str, BAN_DATE_FORMAT);
+	dt.setTimeSpec(Qt::UTC);
+	return dt;
+}
+
 static bool initDatabase(QSqlDatabase db)
 {
 	QSqlQuery q(db);
@@ -96,13 +122,28 @@ Database::Database(QObject *parent)
 Database::~Database()
 {
 	delete d->logger;
+
+	const QString connectionName = d->db.connectionName();
+	removeThreadConnections(d->db);
+	d->db = QSqlDatabase();
+	if(!connectionName.isEmpty())
+		QSqlDatabase::removeDatabase(connectionName);
+
 	delete d;
 }
 
 bool Database::openFile(const QString &path)
 {
-	d->db = QSqlDatabase::addDatabase("QSQLITE");
-	d->db.setDatabaseName(path);
+	d->db = QSqlDatabase::addDatabase("QSQLITE", QStringLiteral("drawpile-config-%1").arg(quintptr(this), 0, 16));
+	if(path == QStringLiteral(":memory:")) {
+		// Each thread has its own connection, so the in-memory database must be shared between them
+		d->db.setDatabaseName(QStringLiteral("file:%1?mode=memory&cache=shared").arg(d->db.connectionName()));
+		d->db.setConnectOptions("QSQLITE_OPEN_URI;QSQLITE_BUSY_TIMEOUT=5000");
+	} else {
+		d->db.setDatabaseName(path);
+		d->db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+	}
+
 	if(!d->db.open()) {
 		qCritical("Unable to open database: %s", qPrintable(path));
 		return false;
@@ -122,6 +163,8 @@ bool Database::openFile(const QString &path)
 		d->logger = dblog;
 	}
 
+	loadBans();
+
 	qDebug("Opened configuration database: %s", qPrintable(path));
 
 	// Purge old log entries on startup
@@ -132,7 +175,7 @@ bool Database::openFile(const QString &path)
 
 void Database::setConfigValue(ConfigKey key, const QString &value)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connection());
 	q.prepare("INSERT OR REPLACE INTO settings VALUES (?, ?)");
 	q.bindValue(0, key.name);
 	q.bindValue(1, value);
@@ -141,7 +184,7 @@ void Database::setConfigValue(ConfigKey key, const QString &value)
 
 QString Database::getConfigValue(const ConfigKey key, bool &found) const
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connection());
 	q.prepare("SELECT value FROM settings WHERE key=?");
 	q.bindValue(0, key.name);
 	q.exec();
@@ -165,7 +208,7 @@ bool Database::isAllowedAnnouncementUrl(const QUrl &url) const
 
 	const QString urlStr = url.toString();
 
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connection());
 	q.exec("SELECT url FROM listingservers");
 	while(q.next()) {
 		const QString serverUrl = q.value(0).toString();
@@ -183,25 +226,24 @@ bool Database::isAllowedAnnouncementUrl(const QUrl &url) const
 
 bool Database::isAddressBanned(const QHostAddress &addr) const
 {
-	QSqlQuery q(d->db);
-	q.exec("SELECT ip, subnet FROM ipbans WHERE expires > datetime('now')");
+	QMutexLocker lock(&d->banMutex);
+	return d->bans.find(addr, QDateTime::currentDateTimeUtc()) != 0;
+}
 
-	while(q.next()) {
-		const QHostAddress a(q.value(0).toString());
-		int subnet = q.value(1).toInt();
-		if(subnet==0) {
-			switch(a.protocol()) {
-			case QAbstractSocket::IPv4Protocol: subnet=32; break;
-			case QAbstractSocket::IPv6Protocol: subnet=128; break;
-			default: break;
-			}
-		}
+void Database::loadBans()
+{
+	QMutexLocker editlock(&d->banEditMutex);
+	QMutexLocker banlock(&d->banMutex);
 
-		if(addr.isInSubnet(a, subnet))
-			return true;
-	}
+	d->bans.clear();
 
-	return false;
+	QSqlQuery q(d->connection());
+	q.exec("SELECT rowid, ip, subnet, expires FROM ipbans");
+	while(q.next()) {
+		const QDateTime expires = banExpiration(q.value(3).toString());
+		if(expires.isValid() && !d->bans.add(q.value(0).toInt(), QHostAddress(q.value(1).toString()), q.value(2).toInt(), expires))
+			qWarning("Invalid IP ban entry: %s", qPrintable(q.value(1).toString()));
+	}
 }
 
 static QJsonObject banResultToJson(const QSqlQuery &q)
@@ -219,7 +261,7 @@ static QJsonObject banResultToJson(const QSqlQuery &q)
 QJsonArray Database::getBanlist() const
 {
 	QJsonArray result;
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connection());
 	q.exec("SELECT rowid, ip, subnet, expires, comment, added FROM ipbans");
 
 	while(q.next()) {
@@ -230,7 +272,8 @@ QJsonArray Database::getBanlist() const
 
 QJsonObject Database::addBan(const QHostAddress &ip, int subnet, const QDateTime &expiration, const QString &comment)
 {
-	QSqlQuery q(d->db);
+	QMutexLocker editlock(&d->banEditMutex);
+	QSqlQuery q(d->connection());
 	q.prepare("SELECT rowid, ip, subnet, expires, comment, added FROM ipbans WHERE ip=? AND subnet=?");
 	q.bindValue(0, ip.toString());
 	q.bindValue(1, subnet);
@@ -239,9 +282,8 @@ QJsonObject Database::addBan(const QHostAddress &ip, int subnet, const QDateTime
 		// Matching entry already in database
 		return banResultToJson(q);
 	} else {
-		const QString datefmt = "yyyy-MM-dd HH:mm:ss";
-		QString datestr = expiration.toString(datefmt);
-		QString now = QDateTime::currentDateTime().toString(datefmt);
+		QString datestr = expiration.toString(BAN_DATE_FORMAT);
+		QString now = QDateTime::currentDateTime().toString(BAN_DATE_FORMAT);
 
 		q.prepare("INSERT INTO ipbans (ip, subnet, expires, comment, added) VALUES (?, ?, ?, ?, ?)");
 		q.bindValue(0, ip.toString());
@@ -251,8 +293,14 @@ QJsonObject Database::addBan(const QHostAddress &ip, int subnet, const QDateTime
 		q.bindValue(4, now);
 		q.exec();
 
+		const int id = q.lastInsertId().toInt();
+		{
+			QMutexLocker banlock(&d->banMutex);
+			d->bans.add(id, ip, subnet, banExpiration(datestr));
+		}
+
 		QJsonObject b;
-		b["id"] = q.lastInsertId().toInt();
+		b["id"] = id;
 		b["ip"] = ip.toString();
 		b["subnet"] = subnet;
 		b["expires"] = datestr;
@@ -264,10 +312,15 @@ QJsonObject Database::addBan(const QHostAddress &ip, int subnet, const QDateTime
 
 bool Database::deleteBan(int entryId)
 {
-	QSqlQuery q(d->db);
+	QMutexLocker editlock(&d->banEditMutex);
+	QSqlQuery q(d->connection());
 	q.prepare("DELETE FROM ipbans WHERE rowid=?");
 	q.bindValue(0, entryId);
 	q.exec();
+
+	QMutexLocker banlock(&d->banMutex);
+	d->bans.remove(entryId);
+
 	return q.numRowsAffected()>0;
 }
 
@@ -278,7 +331,7 @@ ServerLog *Database::logger() const
 
 RegisteredUser Database::getUserAccount(const QString &username, const QString &password) const
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connection());
 	q.prepare("SELECT password, locked, flags FROM users WHERE username=?");
 	q.bindValue(0, username);
 	q.exec();
@@ -330,7 +383,7 @@ static QJsonObject userQueryToJson(const QSqlQuery &q)
 QJsonArray Database::getAccountList() const
 {
 	QJsonArray list;
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connection());
 	q.exec("SELECT rowid, username, locked, flags FROM users");
 	while(q.next()) {
 		list << userQueryToJson(q);
@@ -343,7 +396,7 @@ QJsonObject Database::addAccount(const QString &username, const QString &passwor
 	if(!LoginHandler::validateUsername(username))
 		return QJsonObject();
 
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connection());
 	q.prepare("INSERT INTO users (username, password, locked, flags) VALUES (?, ?, ?, ?)");
 	q.bindValue(0, username);
 	q.bindValue(1, passwordhash::hash(password));
@@ -383,7 +436,7 @@ QJsonObject Database::updateAccount(int id, const QJsonObject &update)
 		params << update["flags"].toString();
 	}
 
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connection());
 
 	if(!updates.isEmpty()) {
 		QString sql = QString("UPDATE users SET %1 WHERE rowid=?").arg(updates.join(','));
@@ -406,7 +459,7 @@ QJsonObject Database::updateAccount(int id, const QJsonObject &update)
 
 bool Database::deleteAccount(int userId)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connection());
 	q.prepare("DELETE FROM users WHERE rowid=?");
 	q.bindValue(0, userId);
 	q.exec();
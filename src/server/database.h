@@ -62,6 +62,8 @@ protected:
 	void setConfigValue(ConfigKey key, const QString &value) override;
 
 private:
+	void loadBans();
+
 	struct Private;
 	Private *d;
 };
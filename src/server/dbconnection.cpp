@@ -0,0 +1,89 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2019 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dbconnection.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QHash>
+#include <QStringList>
+
+namespace server {
+
+namespace {
+
+// Names of the clones of each connection
+QMutex g_registryMutex;
+QHash<QString, QStringList> g_clones;
+
+void removeClone(const QString &base, const QString &name)
+{
+	{
+		QMutexLocker lock(&g_registryMutex);
+		auto i = g_clones.find(base);
+		if(i == g_clones.end() || !i->removeOne(name))
+			return;
+		if(i->isEmpty())
+			g_clones.erase(i);
+	}
+	QSqlDatabase::removeDatabase(name);
+}
+
+}
+
+QSqlDatabase threadConnection(const QSqlDatabase &db)
+{
+	QThread *thread = QThread::currentThread();
+	const QString base = db.connectionName();
+	const QString name = QStringLiteral("%1@%2").arg(base).arg(quintptr(thread), 0, 16);
+
+	if(QSqlDatabase::contains(name))
+		return QSqlDatabase::database(name);
+
+	QSqlDatabase clone = QSqlDatabase::cloneDatabase(db, name);
+	if(!clone.open())
+		qWarning("Couldn't open database connection %s", qPrintable(name));
+
+	{
+		QMutexLocker lock(&g_registryMutex);
+		g_clones[base] << name;
+	}
+
+	// The connection is removed in the thread that used it, once all
+	// the queries made in it are gone.
+	QObject::connect(thread, &QThread::finished, [base, name]() {
+		removeClone(base, name);
+	});
+
+	return clone;
+}
+
+void removeThreadConnections(const QSqlDatabase &db)
+{
+	QStringList names;
+	{
+		QMutexLocker lock(&g_registryMutex);
+		names = g_clones.take(db.connectionName());
+	}
+
+	for(const QString &name : names)
+		QSqlDatabase::removeDatabase(name);
+}
+
+}
@@ -0,0 +1,50 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2019 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DBCONNECTION_H
+#define DBCONNECTION_H
+
+#include <QSqlDatabase>
+
+namespace server {
+
+/**
+ * @brief Get a connection to the database for the calling thread
+ *
+ * Qt's SQL connections may only be used in the thread that created them.
+ * This returns a clone of the given connection that belongs to the calling
+ * thread. The clone is opened on first use and removed when the thread finishes.
+ *
+ * Note: an in-memory SQLite database must be opened with a shared cache URI,
+ * otherwise each clone would have its own empty database.
+ *
+ * @param db the connection to clone (need not belong to the calling thread)
+ */
+QSqlDatabase threadConnection(const QSqlDatabase &db);
+
+/**
+ * @brief Remove all remaining per-thread clones of the connection
+ *
+ * This should be called before the connection itself is removed.
+ * None of the clones may be in use anymore.
+ */
+void removeThreadConnections(const QSqlDatabase &db);
+
+}
+
+#endif
@@ -18,16 +18,34 @@
 */
 
 #include "dblog.h"
+#include "dbconnection.h"
 
 #include <QSqlQuery>
 #include <QMetaEnum>
 #include <QSqlError>
+#include <QElapsedTimer>
 
 namespace server {
 
 DbLog::DbLog(const QSqlDatabase &db)
-	: m_db(db)
+	: m_db(db), m_flushRequested(false), m_queuedCount(0), m_writtenCount(0),
+	  m_dropped(0), m_stopping(false), m_writerDone(false), m_writer(this)
 {
+	m_writer.start(QThread::LowPriority);
+}
+
+DbLog::~DbLog()
+{
+	{
+		QMutexLocker lock(&m_queueMutex);
+		m_stopping = true;
+		m_queueChanged.wakeAll();
+	}
+	// The writer writes out whatever is still left in the queue before it stops
+	m_writer.wait();
+
+	if(m_dropped > 0)
+		qWarning("%d log entries were dropped because the log queue was full", m_dropped);
 }
 
 bool DbLog::initDb()
@@ -60,6 +78,9 @@ QList<Log> DbLog::getLogEntries(const QUuid &session, const QDateTime &after, Lo
 
 	sql += " ORDER BY timestamp DESC, rowid DESC";
 
+	// Make sure the latest entries are included in the results
+	flush();
+
 	if(limit>0) {
 		sql += " LIMIT ?";
 		params << limit;
@@ -69,7 +90,7 @@ QList<Log> DbLog::getLogEntries(const QUuid &session, const QDateTime &after, Lo
 		params << offset;
 	}
 
-	QSqlQuery q(m_db);
+	QSqlQuery q(threadConnection(m_db));
 	q.prepare(sql);
 	for(int i=0;i<params.size();++i)
 		q.bindValue(i, params.at(i));
@@ -95,15 +116,121 @@ QList<Log> DbLog::getLogEntries(const QUuid &session, const QDateTime &after, Lo
 
 void DbLog::storeMessage(const Log &entry)
 {
-	QSqlQuery q(m_db);
+	QMutexLocker lock(&m_queueMutex);
+	if(m_queue.size() >= MAX_QUEUE_LENGTH) {
+		// Queue is full: less important entries are dropped right away.
+		// Warnings and errors wait for the writer to make room, but not
+		// indefinitely, so a stalled writer cannot block the caller forever.
+		if(entry.level() <= Log::Level::Warn) {
+			QElapsedTimer waited;
+			waited.start();
+			qint64 remaining = FLUSH_INTERVAL;
+			while(m_queue.size() >= MAX_QUEUE_LENGTH && !m_writerDone && remaining > 0) {
+				m_queueChanged.wait(&m_queueMutex, ulong(remaining));
+				remaining = FLUSH_INTERVAL - waited.elapsed();
+			}
+		}
+
+		if(m_queue.size() >= MAX_QUEUE_LENGTH) {
+			++m_dropped;
+			return;
+		}
+	}
+
+	m_queue.append(entry);
+	++m_queuedCount;
+	if(m_queue.size() >= BATCH_SIZE)
+		m_queueChanged.wakeAll();
+}
+
+void DbLog::flush() const
+{
+	QMutexLocker lock(&m_queueMutex);
+	const qint64 target = m_queuedCount;
+	if(m_writtenCount >= target)
+		return;
+
+	m_flushRequested = true;
+	m_queueChanged.wakeAll();
+
+	while(m_writtenCount < target && !m_writerDone)
+		m_batchWritten.wait(&m_queueMutex);
+}
+
+int DbLog::queueLength() const
+{
+	QMutexLocker lock(&m_queueMutex);
+	return m_queue.size();
+}
+
+int DbLog::droppedEntries() const
+{
+	QMutexLocker lock(&m_queueMutex);
+	return m_dropped;
+}
+
+// Write the whole batch in a single transaction so it is synced to disk only once
+static void writeEntries(const QSqlDatabase &db, const QVector<Log> &batch)
+{
+	QSqlQuery tx(db);
+	tx.exec("BEGIN TRANSACTION");
+
+	QSqlQuery q(db);
 	q.prepare("INSERT INTO serverlog (timestamp, level, topic, user, session, message) VALUES (?, ?, ?, ?, ?, ?)");
-	q.bindValue(0, entry.timestamp().toString(Qt::ISODate));
-	q.bindValue(1, int(entry.level()));
-	q.bindValue(2, QMetaEnum::fromType<Log::Topic>().valueToKey(int(entry.topic())));
-	q.bindValue(3, entry.user());
-	q.bindValue(4, entry.session().toString());
-	q.bindValue(5, entry.message());
-	q.exec();
+	for(const Log &entry : batch) {
+		q.bindValue(0, entry.timestamp().toString(Qt::ISODate));
+		q.bindValue(1, int(entry.level()));
+		q.bindValue(2, QMetaEnum::fromType<Log::Topic>().valueToKey(int(entry.topic())));
+		q.bindValue(3, entry.user());
+		q.bindValue(4, entry.session().toString());
+		q.bindValue(5, entry.message());
+		q.exec();
+	}
+
+	if(!tx.exec("COMMIT"))
+		qWarning("Couldn't store log entries: %s", qPrintable(tx.lastError().databaseText()));
+}
+
+void DbLog::Writer::run()
+{
+	// A connection may only be used in the thread that opened it,
+	// so the writer opens its own.
+	const QString connectionName = m_log->m_db.connectionName() + QStringLiteral("-logwriter");
+	{
+		QSqlDatabase db = QSqlDatabase::cloneDatabase(m_log->m_db, connectionName);
+		if(!db.open())
+			qWarning("Couldn't open log writer database connection: %s", qPrintable(db.lastError().text()));
+
+		QMutexLocker lock(&m_log->m_queueMutex);
+		for(;;) {
+			if(m_log->m_queue.size() < BATCH_SIZE && !m_log->m_flushRequested && !m_log->m_stopping)
+				m_log->m_queueChanged.wait(&m_log->m_queueMutex, FLUSH_INTERVAL);
+
+			QVector<Log> batch;
+			batch.swap(m_log->m_queue);
+			m_log->m_flushRequested = false;
+			const bool stopping = m_log->m_stopping;
+
+			// There is room in the queue again
+			m_log->m_queueChanged.wakeAll();
+
+			if(!batch.isEmpty()) {
+				lock.unlock();
+				writeEntries(db, batch);
+				lock.relock();
+				m_log->m_writtenCount += batch.size();
+			}
+			m_log->m_batchWritten.wakeAll();
+
+			if(stopping && m_log->m_queue.isEmpty())
+				break;
+		}
+
+		m_log->m_writerDone = true;
+		m_log->m_batchWritten.wakeAll();
+	}
+
+	QSqlDatabase::removeDatabase(connectionName);
 }
 
 int DbLog::purgeLogs(int olderThanDays)
@@ -111,7 +238,7 @@ int DbLog::purgeLogs(int olderThanDays)
 	if(olderThanDays<=0)
 		return 0;
 
-	QSqlQuery q(m_db);
+	QSqlQuery q(threadConnection(m_db));
 	q.prepare("DELETE FROM serverlog WHERE timestamp < DATE('now', ?)");
 	q.bindValue(0, QStringLiteral("-%1 days").arg(olderThanDays));
 	if(!q.exec())
@@ -23,16 +23,61 @@
 #include "../shared/server/serverlog.h"
 
 #include <QSqlDatabase>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QVector>
 
 namespace server {
 
+/**
+ * @brief A logger that stores entries in the server database
+ *
+ * Entries are not written immediately. Instead, they are queued and
+ * written in batches by a background thread, so a burst of log messages
+ * does not stall the thread that generated them.
+ *
+ * When the queue is full, new Info and Debug level entries are dropped.
+ * Warnings and errors wait until there is room in the queue.
+ */
 class DbLog : public ServerLog
 {
 public:
+	//! Maximum number of entries waiting to be written
+	static const int MAX_QUEUE_LENGTH = 10000;
+
+	//! Write queued entries when there are at least this many of them
+	static const int BATCH_SIZE = 200;
+
+	//! Write queued entries at least this often (milliseconds)
+	static const int FLUSH_INTERVAL = 1000;
+
+	/**
+	 * @brief Construct a database logger
+	 *
+	 * Each thread accesses the database through its own clone of the connection.
+	 *
+	 * @param db the database connection to use
+	 */
 	explicit DbLog(const QSqlDatabase &db);
+	~DbLog();
 
 	bool initDb();
 
+	/**
+	 * @brief Write all queued entries to the database now
+	 *
+	 * The entries are written by the writer thread. This function
+	 * returns once the entries queued before the call have been written.
+	 */
+	void flush() const;
+
+	//! Get the number of entries waiting to be written
+	int queueLength() const;
+
+	//! Get the number of entries dropped because the queue was full
+	int droppedEntries() const;
+
 	QList<Log> getLogEntries(const QUuid &session, const QDateTime &after, Log::Level atleast, int offset, int limit) const override;
 
 	/**
@@ -46,7 +91,30 @@ protected:
 	void storeMessage(const Log &entry) override;
 
 private:
+	class Writer : public QThread {
+	public:
+		Writer(DbLog *log) : m_log(log) { }
+	protected:
+		void run() override;
+	private:
+		DbLog *m_log;
+	};
+
 	QSqlDatabase m_db;
+
+	// Entries waiting to be written
+	mutable QMutex m_queueMutex;
+	mutable QWaitCondition m_queueChanged; // entries added or removed
+	mutable QWaitCondition m_batchWritten; // the writer has finished a batch
+	mutable QVector<Log> m_queue;
+	mutable bool m_flushRequested;
+	qint64 m_queuedCount;  // total number of entries added to the queue
+	qint64 m_writtenCount; // total number of entries written
+	int m_dropped;
+	bool m_stopping;
+	bool m_writerDone;
+
+	Writer m_writer;
 };
 
 }
@@ -28,7 +28,8 @@ namespace server {
 ConfigFile::ConfigFile(const QString &path, QObject *parent)
 	: ServerConfig(parent),
 	  m_path(path),
-	  m_logger(new InMemoryLog)
+	  m_logger(new InMemoryLog),
+	  m_mutex(QMutex::Recursive)
 {
 	// When the configuration file is compiled in as a qresource,
 	// lastModified() always returns a null datetime. We still
@@ -114,13 +115,11 @@ void ConfigFile::reloadFile() const
 			}
 
 			QHostAddress ipaddr(ip);
-			if(ipaddr.isNull()) {
+			if(ipaddr.isNull() || !m_banlist.add(m_banlist.size()+1, ipaddr, subnet.toInt())) {
 				qWarning("Invalid IP address: %s", qPrintable(ip));
 				continue;
 			}
 
-			m_banlist << QPair<QHostAddress,int> { ipaddr, subnet.toInt() };
-
 		} else if(section == AWL) {
 			QUrl url(line);
 			if(!url.isValid()) {
@@ -150,6 +149,7 @@ void ConfigFile::reloadFile() const
 
 QString ConfigFile::getConfigValue(const ConfigKey key, bool &found) const
 {
+	QMutexLocker lock(&m_mutex);
 	if(isModified())
 		reloadFile();
 
@@ -164,30 +164,16 @@ QString ConfigFile::getConfigValue(const ConfigKey key, bool &found) const
 
 bool ConfigFile::isAddressBanned(const QHostAddress &addr) const
 {
+	QMutexLocker lock(&m_mutex);
 	if(isModified())
 		reloadFile();
 
-	for(const QPair<QHostAddress,int> ipban : m_banlist) {
-		QHostAddress subnet = ipban.first;
-		int mask = ipban.second;
-
-		if(mask==0) {
-			switch(subnet.protocol()) {
-			case QAbstractSocket::IPv4Protocol: mask=32; break;
-			case QAbstractSocket::IPv6Protocol: mask=128; break;
-			default: break;
-			}
-		}
-
-		if(addr.isInSubnet(subnet, mask))
-			return true;
-	}
-
-	return false;
+	return m_banlist.isBanned(addr);
 }
 
 bool ConfigFile::isAllowedAnnouncementUrl(const QUrl &url) const
 {
+	QMutexLocker lock(&m_mutex);
 	if(!getConfigBool(config::AnnounceWhiteList))
 		return true;
 
@@ -196,6 +182,7 @@ bool ConfigFile::isAllowedAnnouncementUrl(const QUrl &url) const
 
 RegisteredUser ConfigFile::getUserAccount(const QString &username, const QString &password) const
 {
+	QMutexLocker lock(&m_mutex);
 	if(m_users.contains(username)) {
 		const User &u = m_users[username];
 		if(u.password.startsWith("*")) {
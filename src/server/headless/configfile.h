@@ -21,10 +21,12 @@
 #define CONFIGFILE_H
 
 #include "../../shared/server/serverconfig.h"
+#include "../../shared/server/ipbantrie.h"
 
 #include <QDateTime>
 #include <QHostAddress>
 #include <QUrl>
+#include <QMutex>
 
 namespace server {
 
@@ -80,9 +82,10 @@ private:
 	};
 
 	// Cached settings:
+	mutable QMutex m_mutex;
 	mutable QHash<QString, QString> m_config;
 	mutable QHash<QString, User> m_users;
-	mutable QList<QPair<QHostAddress, int>> m_banlist;
+	mutable IpBanTrie m_banlist;
 	mutable QList<QUrl> m_announcewhitelist;
 	mutable QDateTime m_lastmod;
 };
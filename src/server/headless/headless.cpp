@@ -139,6 +139,10 @@ bool start() {
 	QCommandLineOption templatesOption(QStringList() << "templates" << "t", "Session templates", "path");
 	parser.addOption(templatesOption);
 
+	// --workers <count>
+	QCommandLineOption workersOption(QStringList() << "workers", "Number of session worker threads", "count");
+	parser.addOption(workersOption);
+
 	// --extauth <url>
 #ifdef HAVE_LIBSODIUM
 	QCommandLineOption extAuthOption(QStringList() << "extauth", "Extauth server URL", "url");
@@ -206,6 +210,22 @@ bool start() {
 
 	server->connect(server, SIGNAL(serverStopped()), QCoreApplication::instance(), SLOT(quit()));
 
+	{
+		// Worker threads must be started before any sessions are loaded
+		int workers;
+		if(parser.isSet(workersOption)) {
+			bool ok;
+			workers = parser.value(workersOption).toInt(&ok);
+			if(!ok || workers<0) {
+				qCritical("Invalid worker thread count %s", qPrintable(parser.value(workersOption)));
+				return false;
+			}
+		} else {
+			workers = qMax(0, serverconfig->getConfigInt(config::WorkerThreads));
+		}
+		server->setWorkerThreads(workers);
+	}
+
 	int port;
 	{
 		bool ok;
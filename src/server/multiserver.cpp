@@ -21,6 +21,7 @@
 #include "initsys.h"
 #include "sslserver.h"
 #include "database.h"
+#include "dblog.h"
 #include "templatefiles.h"
 
 #include "../shared/server/session.h"
@@ -98,6 +99,17 @@ void MultiServer::setSessionDirectory(const QDir &path)
 	m_sessions->setSessionDir(path);
 }
 
+/**
+ * @brief Set the number of worker threads to run the sessions in
+ *
+ * This must be called before any sessions are created.
+ * If zero, all sessions will run in the main thread.
+ */
+void MultiServer::setWorkerThreads(int count)
+{
+	m_sessions->setWorkerThreads(count);
+}
+
 void MultiServer::setTemplateDirectory(const QDir &dir)
 {
 	const TemplateLoader *old = m_sessions->templateLoader();
@@ -430,6 +442,15 @@ JsonApiResult MultiServer::statusJsonApi(JsonApiMethod method, const QStringList
 	result["sessions"] = m_sessions->sessionCount();
 	result["maxSessions"] = m_config->getConfigInt(config::SessionCountLimit);
 	result["users"] = m_sessions->totalUsers();
+	result["workers"] = m_sessions->workerDescriptions();
+
+	const DbLog *dblog = dynamic_cast<const DbLog*>(m_config->logger());
+	if(dblog) {
+		QJsonObject log;
+		log["queued"] = dblog->queueLength();
+		log["dropped"] = dblog->droppedEntries();
+		result["log"] = log;
+	}
 
 	return JsonApiResult { JsonApiResult::Ok, QJsonDocument(result) };
 }
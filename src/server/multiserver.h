@@ -48,6 +48,7 @@ public:
 	void setAutoStop(bool autostop);
 	void setRecordingPath(const QString &path);
 	void setSessionDirectory(const QDir &dir);
+	void setWorkerThreads(int count);
 	void setTemplateDirectory(const QDir &dir);
 
 #ifndef NDEBUG
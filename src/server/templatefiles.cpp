@@ -30,7 +30,7 @@ namespace server {
 TemplateFiles::TemplateFiles(const QDir &dir, QObject *parent)
 	: QObject(parent), m_dir(dir)
 {
-	m_dir.setNameFilters(QStringList() << "*.dprec" << "*.dptxt" << "*.dprecz" << "*.dptxtz" << "*.dprec.*" << "*.dptxt.*");
+	m_dir.setNameFilters(QStringList() << "*.dprec" << "*.dptxt" << "*.dprecz" << "*.dprecb" << "*.dptxtz" << "*.dprec.*" << "*.dptxt.*");
 	m_watcher = new QFileSystemWatcher(QStringList() << dir.absolutePath(), this);
 	connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &TemplateFiles::scanDirectory);
 
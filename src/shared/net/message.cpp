@@ -52,6 +52,18 @@ int Message::serialize(char *data) const
 	return HEADER_LEN + written;
 }
 
+QByteArray Message::serialized() const
+{
+	if(m_serialized.isNull()) {
+		QByteArray buf(length(), Qt::Uninitialized);
+		const int len = serialize(buf.data());
+		Q_ASSERT(len == buf.length());
+		Q_UNUSED(len);
+		m_serialized = buf;
+	}
+	return m_serialized;
+}
+
 bool Message::equals(const Message &m) const
 {
 	if(type() != m.type() || contextId() != m.contextId())
@@ -129,6 +141,25 @@ NullableMessageRef Message::deserialize(const uchar *data, int buflen, bool deco
 	return NullableMessageRef(msg);
 }
 
+NullableMessageRef Message::deserializeShared(const QByteArray &data, bool decodeOpaque)
+{
+	if(data.length() < HEADER_LEN || sniffLength(data.constData()) != data.length())
+		return nullptr;
+
+	const MessageType type = MessageType(uchar(data.at(2)));
+
+	NullableMessageRef msg;
+	if(type >= 64 && !decodeOpaque)
+		msg = NullableMessageRef(new OpaqueMessage(data));
+	else
+		msg = deserialize(reinterpret_cast<const uchar*>(data.constData()), data.length(), decodeOpaque);
+
+	if(!msg.isNull())
+		msg->m_serialized = data;
+
+	return msg;
+}
+
 QString Message::toString() const
 {
 	const Kwargs kw = kwargs();
@@ -22,6 +22,7 @@
 #include <Qt>
 #include <QMap>
 #include <QString>
+#include <QByteArray>
 
 namespace protocol {
 
@@ -175,7 +176,7 @@ public:
 	 *
 	 * @param userid the new user id
 	 */
-	void setContextId(uint8_t userid) { m_contextid = userid; }
+	void setContextId(uint8_t userid) { m_contextid = userid; discardSerialization(); }
 
 	/**
 	 * @brief Get the ID of the layer this command affects
@@ -228,6 +229,31 @@ public:
 	 */
 	int serialize(char *data) const;
 
+	/**
+	 * @brief Get the serialized form of this message
+	 *
+	 * The message is serialized on the first call and the result is
+	 * cached. The returned array shares the cached buffer, so a message
+	 * that is sent to many recipients (and recorded) only needs to be
+	 * serialized once.
+	 *
+	 * Note: the cache is not thread safe.
+	 */
+	QByteArray serialized() const;
+
+	/**
+	 * @brief Is there a cached serialization of this message?
+	 */
+	bool isSerialized() const { return !m_serialized.isNull(); }
+
+	/**
+	 * @brief Drop the cached serialization
+	 *
+	 * This should be called when the message content changes, or when
+	 * the message is kept around but is no longer likely to be sent.
+	 */
+	void discardSerialization() const { m_serialized = QByteArray(); }
+
 	/**
 	 * @brief get the length of the message from the given data
 	 *
@@ -255,6 +281,21 @@ public:
 	 */
 	static NullableMessageRef deserialize(const uchar *data, int buflen, bool decodeOpaque);
 
+	/**
+	 * @brief deserialize a message and keep its serialized form
+	 *
+	 * The buffer must contain exactly one message. The serialization
+	 * cache of the returned message shares the buffer, so the message
+	 * can be sent without being serialized again. If opaque messages
+	 * are not decoded, they share the buffer for their payload too,
+	 * so nothing is copied or parsed.
+	 *
+	 * @param data a complete serialized message
+	 * @param decodeOpaque automatically decode opaque messages rather than returning OpaqueMessage
+	 * @return message or null if the message is invalid
+	 */
+	static NullableMessageRef deserializeShared(const QByteArray &data, bool decodeOpaque);
+
 	/**
 	 * @brief Check if this message has the same content as the other one
 	 * @param m
@@ -317,6 +358,7 @@ private:
 	MessageUndoState _undone;
 	int m_refcount;
 	uint8_t m_contextid;
+	mutable QByteArray m_serialized;
 };
 
 /**
@@ -51,9 +51,11 @@ MessageQueue::MessageQueue(QTcpSocket *socket, QObject *parent)
 
 	m_recvbuffer = new char[MAX_BUF_LEN];
 	m_sendbuffer = new char[MAX_BUF_LEN];
+	m_senddata = nullptr;
 	m_recvbytes = 0;
 	m_sentbytes = 0;
 	m_sendbuflen = 0;
+	m_serializationBytesSaved = 0;
 
 	m_idleTimer = new QTimer(this);
 	connect(m_idleTimer, &QTimer::timeout, this, &MessageQueue::checkIdleTimeout);
@@ -279,7 +281,17 @@ void MessageQueue::writeData() {
 			Q_ASSERT(m_sentbytes == 0);
 
 			MessagePtr msg = m_outbox.dequeue();
-			m_sendbuflen = msg->serialize(m_sendbuffer);
+			if(msg->isSerialized()) {
+				// Message has already been serialized (e.g. for another
+				// recipient): upload directly from the shared buffer
+				m_sendshared = msg->serialized();
+				m_senddata = m_sendshared.constData();
+				m_sendbuflen = m_sendshared.length();
+				m_serializationBytesSaved += m_sendbuflen;
+			} else {
+				m_sendbuflen = msg->serialize(m_sendbuffer);
+				m_senddata = m_sendbuffer;
+			}
 			Q_ASSERT(m_sendbuflen>0);
 			Q_ASSERT(m_sendbuflen <= MAX_BUF_LEN);
 
@@ -298,7 +310,7 @@ void MessageQueue::writeData() {
 			}
 #endif
 
-			const int sent = m_socket->write(m_sendbuffer+m_sentbytes, m_sendbuflen-m_sentbytes);
+			const int sent = m_socket->write(m_senddata+m_sentbytes, m_sendbuflen-m_sentbytes);
 			if(sent<0) {
 				// Error
 				emit socketError(m_socket->errorString());
@@ -312,6 +324,7 @@ void MessageQueue::writeData() {
 				// Complete message sent
 				m_sendbuflen=0;
 				m_sentbytes=0;
+				m_sendshared = QByteArray();
 				if(m_closeWhenReady) {
 					m_socket->disconnectFromHost();
 
@@ -94,6 +94,14 @@ public:
 	 */
 	bool isUploading() const;
 
+	/**
+	 * @brief Get the number of bytes uploaded from cached message serializations
+	 *
+	 * This is the amount of serialization work saved by sharing the
+	 * encoded form of messages between recipients.
+	 */
+	qint64 serializationBytesSaved() const { return m_serializationBytesSaved; }
+
 	/**
 	 * @brief Get the number of milliseconds since the last message sent by the remote end
 	 */
@@ -189,9 +197,12 @@ private:
 
 	char *m_recvbuffer; // raw message reception buffer
 	char *m_sendbuffer; // raw message upload buffer
+	QByteArray m_sendshared; // shared serialization of the message being uploaded
+	const char *m_senddata; // either m_sendbuffer or m_sendshared's data
 	int m_recvbytes;    // number of bytes in reception buffer
 	int m_sentbytes;    // number of bytes in upload buffer already sent
 	int m_sendbuflen;   // length of the data in the upload buffer
+	qint64 m_serializationBytesSaved;
 
 	QQueue<MessagePtr> m_inbox;  // pending messages
 	QQueue<MessagePtr> m_outbox; // messages to be sent
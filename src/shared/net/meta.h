@@ -102,7 +102,7 @@ public:
 	static SessionOwner *fromText(uint8_t ctx, const Kwargs &kwargs);
 
 	QList<uint8_t> ids() const { return m_ids; }
-	void setIds(const QList<uint8_t> ids) { m_ids = ids; }
+	void setIds(const QList<uint8_t> ids) { m_ids = ids; discardSerialization(); }
 
 	QString messageName() const override { return "owner"; }
 
@@ -136,7 +136,7 @@ public:
 	static TrustedUsers *fromText(uint8_t ctx, const Kwargs &kwargs);
 
 	QList<uint8_t> ids() const { return m_ids; }
-	void setIds(const QList<uint8_t> ids) { m_ids = ids; }
+	void setIds(const QList<uint8_t> ids) { m_ids = ids; discardSerialization(); }
 
 	QString messageName() const override { return "trusted"; }
 
@@ -32,20 +32,22 @@
 namespace protocol {
 
 OpaqueMessage::OpaqueMessage(MessageType type, uint8_t ctx, const uchar *payload, int payloadLen)
-	: Message(type, ctx), m_length(payloadLen)
+	: Message(type, ctx),
+	  m_data(reinterpret_cast<const char*>(payload), payloadLen),
+	  m_offset(0),
+	  m_length(payloadLen)
 {
 	Q_ASSERT(type >= 64);
-	if(payloadLen>0) {
-		m_payload = new uchar[payloadLen];
-		memcpy(m_payload, payload, payloadLen);
-	} else {
-		m_payload = nullptr;
-	}
 }
 
-OpaqueMessage::~OpaqueMessage()
+OpaqueMessage::OpaqueMessage(const QByteArray &serialized)
+	: Message(MessageType(uchar(serialized.at(2))), uchar(serialized.at(3))),
+	  m_data(serialized),
+	  m_offset(HEADER_LEN),
+	  m_length(serialized.length() - HEADER_LEN)
 {
-	delete []m_payload;
+	Q_ASSERT(type() >= 64);
+	Q_ASSERT(sniffLength(serialized.constData()) == serialized.length());
 }
 
 NullableMessageRef OpaqueMessage::decode(MessageType type, uint8_t ctx, const uchar *data, uint len)
@@ -95,7 +97,7 @@ NullableMessageRef OpaqueMessage::decode(MessageType type, uint8_t ctx, const uc
 
 NullableMessageRef OpaqueMessage::decode() const
 {
-	return decode(type(), contextId(), m_payload, m_length);
+	return decode(type(), contextId(), payload(), m_length);
 }
 
 int OpaqueMessage::payloadLength() const
@@ -105,7 +107,7 @@ int OpaqueMessage::payloadLength() const
 
 int OpaqueMessage::serializePayload(uchar *data) const
 {
-	memcpy(data, m_payload, m_length);
+	memcpy(data, payload(), m_length);
 	return m_length;
 }
 
@@ -115,7 +117,7 @@ bool OpaqueMessage::payloadEquals(const Message &m) const
 	if(m_length != om.m_length)
 		return false;
 
-	return memcmp(m_payload, om.m_payload, m_length) == 0;
+	return memcmp(payload(), om.payload(), m_length) == 0;
 }
 
 }
@@ -36,7 +36,15 @@ class OpaqueMessage : public Message
 {
 public:
 	OpaqueMessage(MessageType type, uint8_t ctx, const uchar *payload, int payloadLen);
-	~OpaqueMessage();
+
+	/**
+	 * @brief Construct an opaque message that shares a serialized message buffer
+	 *
+	 * The buffer must contain exactly one (opaque) message, header included.
+	 * The payload is not copied.
+	 */
+	explicit OpaqueMessage(const QByteArray &serialized);
+
 	OpaqueMessage(const OpaqueMessage &m) = delete;
 	OpaqueMessage &operator=(const OpaqueMessage &m) = delete;
 
@@ -57,7 +65,10 @@ protected:
 	Kwargs kwargs() const override { return Kwargs(); }
 
 private:
-	uchar *m_payload;
+	const uchar *payload() const { return reinterpret_cast<const uchar*>(m_data.constData()) + m_offset; }
+
+	QByteArray m_data;
+	int m_offset;
 	int m_length;
 };
 
@@ -0,0 +1,427 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2019 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "blockcompression.h"
+
+#include <QFile>
+#include <QBuffer>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+namespace recording {
+
+static const char MAGIC[] = "DPRECB\0\x01";
+static const char INDEX_MAGIC[] = "DPBLKIDX";
+static const int MAGIC_LEN = 8;
+static const int INDEX_ENTRY_LEN = 8 + 8;
+static const int TRAILER_LEN = 8 + 4 + 8 + 8;
+
+BlockCompressionDevice::BlockCompressionDevice(const QString &filename, QObject *parent)
+	: BlockCompressionDevice(new QFile(filename), true, parent)
+{
+}
+
+BlockCompressionDevice::BlockCompressionDevice(QIODevice *device, bool autoclose, QObject *parent)
+	: QIODevice(parent), m_device(device), m_autoclose(autoclose),
+	  m_fileEnd(MAGIC_LEN), m_dataSize(0), m_pos(0), m_cachedFrame(-1)
+{
+	Q_ASSERT(device);
+}
+
+BlockCompressionDevice::~BlockCompressionDevice()
+{
+	close();
+	if(m_autoclose)
+		delete m_device;
+}
+
+bool BlockCompressionDevice::isBlockCompressed(QIODevice *device)
+{
+	return device->peek(MAGIC_LEN) == QByteArray::fromRawData(MAGIC, MAGIC_LEN);
+}
+
+bool BlockCompressionDevice::isBlockCompressed(const QString &filename)
+{
+	QFile f(filename);
+	if(!f.open(QFile::ReadOnly))
+		return false;
+	return isBlockCompressed(&f);
+}
+
+bool BlockCompressionDevice::open(OpenMode mode)
+{
+	if(isOpen())
+		return false;
+
+	const bool reading = mode & ReadOnly;
+	const bool writing = mode & WriteOnly;
+	if(!reading && !writing)
+		return false;
+
+	const bool openedDevice = !m_device->isOpen();
+	if(openedDevice && !m_device->open(mode & ReadWrite)) {
+		setErrorString(m_device->errorString());
+		return false;
+	}
+
+	m_frames.clear();
+	m_fileEnd = MAGIC_LEN;
+	m_dataSize = 0;
+	m_pos = 0;
+	m_writeBuffer.clear();
+	m_cachedFrame = -1;
+	m_frameData.clear();
+
+	bool ok = true;
+	if(reading && (!writing || m_device->size() > 0)) {
+		// Open an existing file
+		if(!m_device->seek(0) || !isBlockCompressed(m_device)) {
+			setErrorString(tr("Not a block compressed file"));
+			ok = false;
+
+		} else {
+			if(!readIndex())
+				scanFrames();
+
+			// New frames will overwrite the old index
+			if(writing)
+				ok = truncateIndex();
+		}
+
+	} else if(m_device->write(MAGIC, MAGIC_LEN) != MAGIC_LEN) {
+		setErrorString(m_device->errorString());
+		ok = false;
+	}
+
+	if(!ok) {
+		if(openedDevice)
+			m_device->close();
+		return false;
+	}
+
+	return QIODevice::open(mode | Unbuffered);
+}
+
+void BlockCompressionDevice::close()
+{
+	if(!isOpen())
+		return;
+
+	if(openMode() & WriteOnly) {
+		if(!writeFrame() || !writeIndex())
+			qWarning("Error while closing block compressed file: %s", qPrintable(errorString()));
+	}
+
+	m_device->close();
+	QIODevice::close();
+
+	m_frames.clear();
+	m_writeBuffer.clear();
+	m_cachedFrame = -1;
+	m_frameData.clear();
+}
+
+bool BlockCompressionDevice::seek(qint64 pos)
+{
+	if(pos < 0 || pos > size())
+		return false;
+
+	QIODevice::seek(pos);
+	m_pos = pos;
+	return true;
+}
+
+qint64 BlockCompressionDevice::size() const
+{
+	return m_dataSize + m_writeBuffer.length();
+}
+
+bool BlockCompressionDevice::flush()
+{
+	if(!(openMode() & WriteOnly))
+		return true;
+
+	if(!writeFrame())
+		return false;
+
+	QFileDevice *fd = qobject_cast<QFileDevice*>(m_device);
+	return !fd || fd->flush();
+}
+
+qint64 BlockCompressionDevice::readData(char *data, qint64 maxlen)
+{
+	qint64 total = 0;
+	while(total < maxlen && m_pos < size()) {
+		const char *src;
+		qint64 available;
+
+		if(m_pos >= m_dataSize) {
+			// Data that hasn't been compressed yet
+			const qint64 offset = m_pos - m_dataSize;
+			src = m_writeBuffer.constData() + offset;
+			available = m_writeBuffer.length() - offset;
+
+		} else {
+			const int frame = frameAt(m_pos);
+			if(!loadFrame(frame))
+				return total > 0 ? total : -1;
+
+			const qint64 offset = m_pos - m_frames.at(frame).dataOffset;
+			src = m_frameData.constData() + offset;
+			available = m_frameData.length() - offset;
+		}
+
+		const qint64 len = qMin(available, maxlen - total);
+		memcpy(data + total, src, len);
+		total += len;
+		m_pos += len;
+	}
+
+	return total;
+}
+
+qint64 BlockCompressionDevice::writeData(const char *data, qint64 len)
+{
+	if(m_pos != size()) {
+		setErrorString(tr("Block compressed files can only be appended to"));
+		return -1;
+	}
+
+	m_writeBuffer.append(data, len);
+	m_pos += len;
+
+	if(m_writeBuffer.length() >= FRAME_SIZE && !writeFrame())
+		return -1;
+
+	return len;
+}
+
+bool BlockCompressionDevice::readIndex()
+{
+	const qint64 fileSize = m_device->size();
+	if(fileSize < MAGIC_LEN + TRAILER_LEN)
+		return false;
+
+	uchar trailer[TRAILER_LEN];
+	if(!m_device->seek(fileSize - TRAILER_LEN) || m_device->read(reinterpret_cast<char*>(trailer), TRAILER_LEN) != TRAILER_LEN)
+		return false;
+
+	if(memcmp(trailer + 20, INDEX_MAGIC, 8) != 0)
+		return false;
+
+	const qint64 indexOffset = qFromBigEndian<quint64>(trailer);
+	const qint64 count = qFromBigEndian<quint32>(trailer + 8);
+	const qint64 dataSize = qFromBigEndian<quint64>(trailer + 12);
+
+	if(indexOffset < MAGIC_LEN || indexOffset + count * INDEX_ENTRY_LEN + TRAILER_LEN != fileSize)
+		return false;
+
+	if(!m_device->seek(indexOffset))
+		return false;
+
+	const QByteArray index = m_device->read(count * INDEX_ENTRY_LEN);
+	if(index.length() != count * INDEX_ENTRY_LEN)
+		return false;
+
+	QVector<Frame> frames;
+	frames.reserve(count);
+
+	const uchar *entry = reinterpret_cast<const uchar*>(index.constData());
+	for(int i=0;i<count;++i,entry+=INDEX_ENTRY_LEN) {
+		const Frame f {
+			qint64(qFromBigEndian<quint64>(entry)),
+			qint64(qFromBigEndian<quint64>(entry + 8))
+		};
+
+		// Frames must be in order and they are never empty
+		if(i == 0) {
+			if(f.fileOffset != MAGIC_LEN || f.dataOffset != 0)
+				return false;
+		} else if(f.fileOffset <= frames.last().fileOffset || f.dataOffset <= frames.last().dataOffset) {
+			return false;
+		}
+		if(f.fileOffset >= indexOffset || f.dataOffset >= dataSize)
+			return false;
+
+		frames << f;
+	}
+
+	if(count == 0 && (indexOffset != MAGIC_LEN || dataSize != 0))
+		return false;
+
+	m_frames = frames;
+	m_fileEnd = indexOffset;
+	m_dataSize = dataSize;
+	return true;
+}
+
+/**
+ * Rebuild the frame index by reading the frame headers.
+ * Each frame begins with its compressed length followed by its uncompressed
+ * length (from the qCompress header,) so the frames can be walked without
+ * decompressing them. A truncated last frame is dropped.
+ */
+void BlockCompressionDevice::scanFrames()
+{
+	const qint64 fileSize = m_device->size();
+
+	m_frames.clear();
+	m_fileEnd = MAGIC_LEN;
+	m_dataSize = 0;
+
+	uchar header[8];
+	while(m_fileEnd + 8 <= fileSize) {
+		if(!m_device->seek(m_fileEnd) || m_device->read(reinterpret_cast<char*>(header), 8) != 8)
+			break;
+
+		const qint64 compressedLen = qFromBigEndian<quint32>(header);
+		const qint64 frameLen = qFromBigEndian<quint32>(header + 4);
+		if(compressedLen < 4 || frameLen == 0 || m_fileEnd + 4 + compressedLen > fileSize)
+			break;
+
+		m_frames << Frame { m_fileEnd, m_dataSize };
+		m_fileEnd += 4 + compressedLen;
+		m_dataSize += frameLen;
+	}
+
+	qWarning("Block compressed file index missing: recovered %d frames", m_frames.size());
+}
+
+bool BlockCompressionDevice::truncateIndex()
+{
+	if(m_device->size() == m_fileEnd)
+		return true;
+
+	if(QFileDevice *fd = qobject_cast<QFileDevice*>(m_device)) {
+		if(!fd->resize(m_fileEnd)) {
+			setErrorString(fd->errorString());
+			return false;
+		}
+		return true;
+	}
+
+	if(QBuffer *buffer = qobject_cast<QBuffer*>(m_device)) {
+		buffer->buffer().truncate(m_fileEnd);
+		return true;
+	}
+
+	setErrorString(tr("Cannot append to this device"));
+	return false;
+}
+
+int BlockCompressionDevice::frameAt(qint64 pos) const
+{
+	const auto it = std::upper_bound(
+		m_frames.constBegin(), m_frames.constEnd(), pos,
+		[](qint64 p, const Frame &f) { return p < f.dataOffset; }
+	);
+	return int(it - m_frames.constBegin()) - 1;
+}
+
+bool BlockCompressionDevice::loadFrame(int frame)
+{
+	Q_ASSERT(frame >= 0 && frame < m_frames.size());
+	if(frame == m_cachedFrame)
+		return true;
+
+	m_cachedFrame = -1;
+
+	const Frame &f = m_frames.at(frame);
+	const qint64 frameLen = (frame+1 < m_frames.size() ? m_frames.at(frame+1).dataOffset : m_dataSize) - f.dataOffset;
+
+	uchar lenbuf[4];
+	if(!m_device->seek(f.fileOffset) || m_device->read(reinterpret_cast<char*>(lenbuf), 4) != 4) {
+		setErrorString(m_device->errorString());
+		return false;
+	}
+
+	const QByteArray compressed = m_device->read(qFromBigEndian<quint32>(lenbuf));
+	m_frameData = qUncompress(compressed);
+
+	if(m_frameData.length() != frameLen) {
+		setErrorString(tr("Corrupted frame at offset %1").arg(f.fileOffset));
+		m_frameData.clear();
+		return false;
+	}
+
+	m_cachedFrame = frame;
+	return true;
+}
+
+bool BlockCompressionDevice::writeFrame()
+{
+	if(m_writeBuffer.isEmpty())
+		return true;
+
+	const QByteArray compressed = qCompress(m_writeBuffer);
+
+	uchar lenbuf[4];
+	qToBigEndian(quint32(compressed.length()), lenbuf);
+
+	// In ReadWrite mode, reading frames moves the underlying device
+	if(!m_device->isSequential() && m_device->pos() != m_fileEnd && !m_device->seek(m_fileEnd)) {
+		setErrorString(m_device->errorString());
+		return false;
+	}
+
+	if(m_device->write(reinterpret_cast<const char*>(lenbuf), 4) != 4 || m_device->write(compressed) != compressed.length()) {
+		setErrorString(m_device->errorString());
+		return false;
+	}
+
+	m_frames << Frame { m_fileEnd, m_dataSize };
+	m_fileEnd += 4 + compressed.length();
+	m_dataSize += m_writeBuffer.length();
+	m_writeBuffer.clear();
+
+	return true;
+}
+
+bool BlockCompressionDevice::writeIndex()
+{
+	QByteArray index(m_frames.size() * INDEX_ENTRY_LEN + TRAILER_LEN, 0);
+	uchar *ptr = reinterpret_cast<uchar*>(index.data());
+
+	for(const Frame &f : m_frames) {
+		qToBigEndian(quint64(f.fileOffset), ptr);
+		qToBigEndian(quint64(f.dataOffset), ptr + 8);
+		ptr += INDEX_ENTRY_LEN;
+	}
+
+	qToBigEndian(quint64(m_fileEnd), ptr);
+	qToBigEndian(quint32(m_frames.size()), ptr + 8);
+	qToBigEndian(quint64(m_dataSize), ptr + 12);
+	memcpy(ptr + 20, INDEX_MAGIC, 8);
+
+	if(!m_device->isSequential() && m_device->pos() != m_fileEnd && !m_device->seek(m_fileEnd)) {
+		setErrorString(m_device->errorString());
+		return false;
+	}
+
+	if(m_device->write(index) != index.length()) {
+		setErrorString(m_device->errorString());
+		return false;
+	}
+
+	return true;
+}
+
+}
@@ -0,0 +1,126 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2019 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DP_REC_BLOCKCOMPRESSION_H
+#define DP_REC_BLOCKCOMPRESSION_H
+
+#include <QIODevice>
+#include <QVector>
+
+namespace recording {
+
+/**
+ * @brief A seekable compressed file
+ *
+ * The data is stored as a sequence of independently deflated frames,
+ * followed by an index of the frames. Seeking only requires the one frame
+ * that contains the target position to be decompressed, so a compressed
+ * recording can be indexed and played back just like an uncompressed one.
+ *
+ * File format:
+ *
+ *     magic: "DPRECB\0" + version (8 bytes)
+ *     frames: [compressed length (u32)][qCompress output] ...
+ *     index: [file offset (u64)][data offset (u64)] for each frame
+ *     trailer: index offset (u64), frame count (u32), data size (u64), "DPBLKIDX"
+ *
+ * All numbers are big endian. If the index is missing (e.g. the writer
+ * crashed,) it is rebuilt by scanning the frames.
+ *
+ * Writing is append only. In ReadWrite mode, an existing file is opened
+ * for appending and new frames are written after the old ones.
+ */
+class BlockCompressionDevice : public QIODevice
+{
+	Q_OBJECT
+public:
+	//! Data is compressed once at least this many bytes have been written
+	static const int FRAME_SIZE = 256 * 1024;
+
+	//! Open the named file
+	explicit BlockCompressionDevice(const QString &filename, QObject *parent=nullptr);
+
+	/**
+	 * @brief Use the given device as the compressed file
+	 * @param device the underlying device
+	 * @param autoclose if true, this object will take ownership of the device
+	 * @param parent
+	 */
+	BlockCompressionDevice(QIODevice *device, bool autoclose, QObject *parent=nullptr);
+
+	~BlockCompressionDevice();
+
+	//! Does the file start with the block compressed file magic number?
+	static bool isBlockCompressed(QIODevice *device);
+	static bool isBlockCompressed(const QString &filename);
+
+	bool open(OpenMode mode) override;
+	void close() override;
+	bool isSequential() const override { return false; }
+	bool seek(qint64 pos) override;
+	qint64 size() const override;
+
+	//! Number of frames written so far
+	int frameCount() const { return m_frames.size(); }
+
+public slots:
+	/**
+	 * @brief Write out the data written so far
+	 *
+	 * The buffered data is compressed as a (possibly short) frame and
+	 * the underlying file is flushed.
+	 *
+	 * @return false on IO error
+	 */
+	bool flush();
+
+protected:
+	qint64 readData(char *data, qint64 maxlen) override;
+	qint64 writeData(const char *data, qint64 len) override;
+
+private:
+	struct Frame {
+		qint64 fileOffset; // position of the frame in the compressed file
+		qint64 dataOffset; // position of the frame's content in the uncompressed data
+	};
+
+	bool readIndex();
+	void scanFrames();
+	bool truncateIndex();
+	int frameAt(qint64 pos) const;
+	bool loadFrame(int frame);
+	bool writeFrame();
+	bool writeIndex();
+
+	QIODevice *m_device;
+	bool m_autoclose;
+
+	QVector<Frame> m_frames;
+	qint64 m_fileEnd;     // end of the last frame in the compressed file
+	qint64 m_dataSize;    // uncompressed size of the frames
+	qint64 m_pos;
+
+	QByteArray m_writeBuffer; // data not yet compressed
+
+	int m_cachedFrame;
+	QByteArray m_frameData;
+};
+
+}
+
+#endif
@@ -19,6 +19,7 @@
 
 #include "reader.h"
 #include "header.h"
+#include "blockcompression.h"
 #include "../net/recording.h"
 #include "../net/textmode.h"
 
@@ -50,12 +51,13 @@ struct Reader::Private {
 	bool autoclose;
 	bool eof;
 	bool isCompressed;
+	bool isSeekable;
 	bool opaque;
 };
 
 bool Reader::isRecordingExtension(const QString &filename)
 {
-	QRegularExpression re("\\.dp(?:rec|txt)(?:z|\\.(?:gz|bz2|xz))?$");
+	QRegularExpression re("\\.dp(?:rec|txt)(?:z|\\.(?:gz|bz2|xz))?$|\\.dprecb$");
 	return re.match(filename).hasMatch();
 }
 
@@ -78,12 +80,20 @@ Reader::Reader(const QString &filename, Encoding encoding, QObject *parent)
 	else if(filename.endsWith(".xz", Qt::CaseInsensitive))
 		ct = KCompressionDevice::Xz;
 
-	if(ct == KCompressionDevice::None) {
+	// Block compressed recordings are also recognized by content, since
+	// compressed server session files keep their original names.
+	if(filename.endsWith(".dprecb", Qt::CaseInsensitive) || (ct == KCompressionDevice::None && BlockCompressionDevice::isBlockCompressed(filename))) {
+		d->file = new BlockCompressionDevice(filename);
+		d->isCompressed = true;
+		d->isSeekable = true;
+	} else if(ct == KCompressionDevice::None) {
 		d->file = new QFile(filename);
 		d->isCompressed = false;
+		d->isSeekable = true;
 	} else {
 		d->file = new KCompressionDevice(filename, ct);
 		d->isCompressed = true;
+		d->isSeekable = false;
 	}
 }
 
@@ -97,7 +107,8 @@ Reader::Reader(const QString &filename, QIODevice *file, bool autoclose, Encodin
 	d->current = -1;
 	d->autoclose = autoclose;
 	d->eof = false;
-	d->isCompressed = false;
+	d->isCompressed = qobject_cast<BlockCompressionDevice*>(file) != nullptr;
+	d->isSeekable = !file->isSequential();
 }
 
 Reader::~Reader()
@@ -117,6 +128,11 @@ bool Reader::isCompressed() const
 	return d->isCompressed;
 }
 
+bool Reader::isSeekable() const
+{
+	return d->isSeekable;
+}
+
 protocol::ProtocolVersion Reader::formatVersion() const
 {
 	return protocol::ProtocolVersion::fromString(d->metadata["version"].toString());
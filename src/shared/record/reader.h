@@ -125,6 +125,15 @@ public:
 	//! Is this recording compressed?
 	bool isCompressed() const;
 
+	/**
+	 * @brief Can this recording be read in random order?
+	 *
+	 * Uncompressed and block compressed (.dprecb) recordings can be seeked
+	 * efficiently and thus indexed. Other compressed recordings can only be
+	 * read sequentially.
+	 */
+	bool isSeekable() const;
+
 	//! Get the last error message
 	QString errorString() const;
 
@@ -19,6 +19,7 @@
 
 #include "writer.h"
 #include "header.h"
+#include "blockcompression.h"
 #include "../net/recording.h"
 
 #include <QVarLengthArray>
@@ -43,7 +44,9 @@ Writer::Writer(const QString &filename, QObject *parent)
 	else if(filename.endsWith(".xz", Qt::CaseInsensitive))
 		ct = KCompressionDevice::Xz;
 
-	if(ct != KCompressionDevice::None)
+	if(filename.endsWith(".dprecb", Qt::CaseInsensitive))
+		m_file = new BlockCompressionDevice(m_file, true);
+	else if(ct != KCompressionDevice::None)
 		m_file = new KCompressionDevice(m_file, true, ct);
 
 	if(filename.contains(".dptxt", Qt::CaseInsensitive) && !filename.contains(".dprec", Qt::CaseInsensitive))
@@ -42,6 +42,8 @@ public:
 	 * @brief Open a writer that writes to the named file
 	 *
 	 * If the file ends with ".dptxt", the text encoding is used.
+	 * Files ending with ".dprecb" are block compressed, so they
+	 * can be seeked without decompressing the whole recording.
 	 *
 	 * @param filename
 	 * @param parent
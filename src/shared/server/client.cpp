@@ -298,6 +298,11 @@ void Client::sendNextHistoryBatch()
 	d->msgqueue->send(batch);
 }
 
+qint64 Client::serializationBytesSaved() const
+{
+	return d->msgqueue->serializationBytesSaved();
+}
+
 void Client::sendDirectMessage(protocol::MessagePtr msg)
 {
 	d->msgqueue->send(msg);
@@ -195,6 +195,11 @@ public:
 	 */
 	void setHistoryPosition(int newpos);
 
+	/**
+	 * @brief Get the number of bytes uploaded to this client from shared message serializations
+	 */
+	qint64 serializationBytesSaved() const;
+
 	/**
 	 * @brief Does this client socket support SSL connections?
 	 *
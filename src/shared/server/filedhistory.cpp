@@ -21,14 +21,16 @@
 #include "../shared/util/passwordhash.h"
 #include "../shared/util/filename.h"
 #include "../shared/record/header.h"
+#include "../shared/record/blockcompression.h"
 #include "../shared/net/meta.h"
 
 #include <QFile>
 #include <QJsonObject>
-#include <QVarLengthArray>
 #include <QDebug>
 #include <QTimerEvent>
 
+#include <algorithm>
+
 namespace server {
 
 // A block is closed when its size goes above this limit
@@ -147,7 +149,8 @@ bool FiledHistory::initRecording()
 
 	QString filename = uniqueRecordingFilename(m_dir, id());
 
-	m_recording = new QFile(m_dir.absoluteFilePath(filename), this);
+	m_recordingPath = m_dir.absoluteFilePath(filename);
+	m_recording = new QFile(m_recordingPath, this);
 	if(!m_recording->open(QFile::ReadWrite)) {
 		qWarning() << filename << m_recording->errorString();
 		return false;
@@ -157,7 +160,7 @@ bool FiledHistory::initRecording()
 	metadata["version"] = m_version.asString(); // the hosting client's protocol version
 	recording::writeRecordingHeader(m_recording, metadata);
 
-	m_recording->flush();
+	flushRecording();
 
 	m_journal->write(QString("FILE %1\n").arg(filename).toUtf8());
 	m_journal->flush();
@@ -299,14 +302,21 @@ bool FiledHistory::load()
 		return false;
 	}
 
-	m_recording = new QFile(m_dir.absoluteFilePath(recordingFile), this);
+	m_recordingPath = m_dir.absoluteFilePath(recordingFile);
 
-	if(!m_recording->exists()) {
+	if(!QFileInfo::exists(m_recordingPath)) {
 		qWarning() << recordingFile << "not found!";
 		return false;
 	}
 
-	if(!m_recording->open(QFile::ReadWrite)) {
+	// Archived sessions may have been compressed. Block compressed recordings
+	// can still be read in random order and appended to.
+	if(recording::BlockCompressionDevice::isBlockCompressed(m_recordingPath))
+		m_recording = new recording::BlockCompressionDevice(m_recordingPath, this);
+	else
+		m_recording = new QFile(m_recordingPath, this);
+
+	if(!m_recording->open(QIODevice::ReadWrite)) {
 		qWarning() << recordingFile << m_recording->errorString();
 		return false;
 	}
@@ -373,7 +383,7 @@ bool FiledHistory::scanBlocks()
 		if(msglen<0) {
 			// Truncated message encountered.
 			// Rewind back to the end of the previous message
-			qWarning() << m_recording->fileName() << "Recording truncated at" << int(b.endOffset);
+			qWarning() << m_recordingPath << "Recording truncated at" << int(b.endOffset);
 			m_recording->seek(b.endOffset);
 			break;
 		}
@@ -421,9 +431,9 @@ void FiledHistory::terminate()
 
 	if(m_archive) {
 		m_journal->rename(m_journal->fileName() + ".archived");
-		m_recording->rename(m_recording->fileName() + ".archived");
+		QFile::rename(m_recordingPath, m_recordingPath + ".archived");
 	} else {
-		m_recording->remove();
+		QFile::remove(m_recordingPath);
 		m_journal->remove();
 	}
 }
@@ -431,7 +441,7 @@ void FiledHistory::terminate()
 void FiledHistory::closeBlock()
 {
 	// Flush the output files just to be safe
-	m_recording->flush();
+	flushRecording();
 	m_journal->flush();
 
 	// Check if anything needs to be done
@@ -539,13 +549,12 @@ void FiledHistory::joinUser(uint8_t id, const QString &name)
 
 std::tuple<QList<protocol::MessagePtr>, int> FiledHistory::getBatch(int after) const
 {
-	// Find the block that contains the index *after*
-	int i=m_blocks.size()-1;
-	for(;i>0;--i) {
-		const Block &b = m_blocks.at(i-1);
-		if(b.startIndex+b.count-1 <= after)
-			break;
-	}
+	// Find the block that contains the index following *after*
+	const auto it = std::upper_bound(
+		m_blocks.constBegin(), m_blocks.constEnd(), after + 1,
+		[](int idx, const Block &b) { return idx < b.startIndex; }
+	);
+	const int i = qMax(0, int(it - m_blocks.constBegin()) - 1);
 
 	const Block &b = m_blocks.at(i);
 
@@ -555,37 +564,101 @@ std::tuple<QList<protocol::MessagePtr>, int> FiledHistory::getBatch(int after) c
 
 	if(b.messages.isEmpty() && b.count>0) {
 		// Load the block worth of messages to memory if not already loaded
+		qDebug() << m_recordingPath << "loading block" << i;
+		const_cast<Block&>(b).messages = readBlock(b);
+		if(b.messages.size() != b.count) {
+			qWarning() << m_recordingPath << "Invalid message in block" << i;
+			m_recording->close();
+		}
+	}
+	Q_ASSERT(b.messages.size() == b.count);
+	return std::make_tuple(b.messages.mid(idxOffset), b.startIndex+b.count-1);
+}
+
+/**
+ * Read the messages of a block from the recording.
+ *
+ * Uncompressed recordings are memory mapped. Block compressed recordings
+ * are read through the device, which only decompresses the frames the
+ * block overlaps. Each message keeps its raw bytes as its serialized form, so it can be sent to any number of clients without being
+ * serialized again. Opaque messages are not decoded at all, since the server
+ * doesn't need to look inside them.
+ *
+ * On error, the messages read so far are returned.
+ */
+QList<protocol::MessagePtr> FiledHistory::readBlock(const Block &b) const
+{
+	QList<protocol::MessagePtr> messages;
+	if(!m_recording->isOpen())
+		return messages;
+
+	messages.reserve(b.count);
+
+	const qint64 blockLen = b.endOffset - b.startOffset;
+	uchar *map = nullptr;
+
+	// Compressed recordings can't be mapped
+	QFile *file = qobject_cast<QFile*>(m_recording);
+	if(file) {
+		// The tail of the open block may still be in the write buffer
+		file->flush();
+		map = file->map(b.startOffset, blockLen);
+		if(!map)
+			qWarning() << m_recordingPath << "unable to map block:" << file->errorString();
+	}
+
+	if(map) {
+		qint64 pos = 0;
+		for(int m=0;m<b.count;++m) {
+			if(blockLen - pos < protocol::Message::HEADER_LEN)
+				break;
+
+			const char *msgptr = reinterpret_cast<const char*>(map + pos);
+			const int len = protocol::Message::sniffLength(msgptr);
+			if(blockLen - pos < len)
+				break;
+
+			protocol::NullableMessageRef msg = protocol::Message::deserializeShared(QByteArray(msgptr, len), false);
+			if(msg.isNull())
+				break;
+
+			messages << protocol::MessagePtr::fromNullable(msg);
+			pos += len;
+		}
+
+		file->unmap(map);
+
+	} else {
+		// Mapping is not supported everywhere, so fall back to reading the file
 		const qint64 prevPos = m_recording->pos();
-		qDebug() << m_recording->fileName() << "loading block" << i;
 		m_recording->seek(b.startOffset);
+
 		QByteArray buffer;
 		for(int m=0;m<b.count;++m) {
-			if(!recording::readRecordingMessage(m_recording, buffer)) {
-				qWarning() << m_recording->fileName() << "read error!";
-				m_recording->close();
+			if(!recording::readRecordingMessage(m_recording, buffer))
 				break;
-			}
-			protocol::NullableMessageRef msg = protocol::Message::deserialize((const uchar*)buffer.constData(), buffer.length(), false);
-			if(msg.isNull()) {
-				qWarning() << m_recording->fileName() << "Invalid message in block" << i;
-				m_recording->close();
+
+			protocol::NullableMessageRef msg = protocol::Message::deserializeShared(
+				buffer.left(protocol::Message::sniffLength(buffer.constData())), false);
+			if(msg.isNull())
 				break;
-			}
-			const_cast<Block&>(b).messages << protocol::MessagePtr::fromNullable(msg);
+
+			messages << protocol::MessagePtr::fromNullable(msg);
 		}
 
 		m_recording->seek(prevPos);
 	}
-	Q_ASSERT(b.messages.size() == b.count);
-	return std::make_tuple(b.messages.mid(idxOffset), b.startIndex+b.count-1);
+
+	return messages;
 }
 
 void FiledHistory::historyAdd(const protocol::MessagePtr &msg)
 {
-	QVarLengthArray<char> buf(msg->length());
-	const int len = msg->serialize(buf.data());
-	Q_ASSERT(len == buf.length());
-	m_recording->write(buf.data(), len);
+	// The serialization is cached in the message so that it can be
+	// reused when the message is uploaded to the session's users.
+	const QByteArray buf = msg->serialized();
+	const int len = buf.length();
+	m_recording->write(buf);
 
 	Block &b = m_blocks.last();
 	b.count++;
@@ -601,8 +674,10 @@ void FiledHistory::historyAdd(const protocol::MessagePtr &msg)
 
 void FiledHistory::historyReset(const QList<protocol::MessagePtr> &newHistory)
 {
-	QFile *oldRecording = m_recording;
+	QIODevice *oldRecording = m_recording;
+	const QString oldRecordingPath = m_recordingPath;
 	oldRecording->close();
+	delete oldRecording;
 
 	m_recording = nullptr;
 	m_blocks.clear();
@@ -611,10 +686,9 @@ void FiledHistory::historyReset(const QList<protocol::MessagePtr> &newHistory)
 	// Remove old recording after the new one has been created so
 	// that the new file will not have the same name.
 	if(m_archive)
-		oldRecording->rename(oldRecording->fileName() + ".archived");
+		QFile::rename(oldRecordingPath, oldRecordingPath + ".archived");
 	else
-		oldRecording->remove();
-	delete oldRecording;
+		QFile::remove(oldRecordingPath);
 
 	for(const protocol::MessagePtr &msg : newHistory)
 		historyAdd(msg);
@@ -654,7 +728,15 @@ void FiledHistory::historyRemoveBan(int id)
 void FiledHistory::timerEvent(QTimerEvent *)
 {
 	if(m_recording)
-		m_recording->flush();
+		flushRecording();
+}
+
+void FiledHistory::flushRecording() const
+{
+	if(QFileDevice *file = qobject_cast<QFileDevice*>(m_recording))
+		file->flush();
+	else if(auto *compressed = qobject_cast<recording::BlockCompressionDevice*>(m_recording))
+		compressed->flush();
 }
 
 void FiledHistory::addAnnouncement(const QString &url)
@@ -130,10 +130,13 @@ private:
 	bool load();
 	bool scanBlocks();
 	bool initRecording();
+	QList<protocol::MessagePtr> readBlock(const Block &b) const;
+	void flushRecording() const;
 
 	QDir m_dir;
 	QFile *m_journal;
-	QFile *m_recording;
+	QIODevice *m_recording; // a QFile or a BlockCompressionDevice
+	QString m_recordingPath;
 
 	// Current state:
 	QString m_alias;
@@ -21,6 +21,8 @@
 
 #include "serverconfig.h"
 
+#include <QMutex>
+
 namespace server {
 
 class ServerLog;
@@ -39,6 +41,7 @@ protected:
 	void setConfigValue(const ConfigKey key, const QString &value) override;
 
 private:
+	mutable QMutex m_mutex;
 	QHash<int, QString> m_config;
 	ServerLog *m_logger;
 };
@@ -20,8 +20,13 @@
 #include "inmemoryhistory.h"
 #include "../util/passwordhash.h"
 
+#include <algorithm>
+
 namespace server {
 
+// Maximum size of a history chunk (and thus a batch) in bytes
+static const uint MAX_CHUNK_SIZE = 0xffff * 10;
+
 InMemoryHistory::InMemoryHistory(const QUuid &id, const QString &alias, const protocol::ProtocolVersion &version, const QString &founder, QObject *parent)
 	: SessionHistory(id, parent),
 	  m_alias(alias),
@@ -30,7 +35,8 @@ InMemoryHistory::InMemoryHistory(const QUuid &id, const QString &alias, const pr
 	  m_startTime(QDateTime::currentDateTime()),
 	  m_maxUsers(254),
 	  m_autoReset(0),
-	  m_flags(0)
+	  m_flags(0),
+	  m_cleanedUpTo(0)
 {
 }
 
@@ -40,19 +46,76 @@ std::tuple<QList<protocol::MessagePtr>, int> InMemoryHistory::getBatch(int after
 		return std::make_tuple(QList<protocol::MessagePtr>(), lastIndex());
 
 	const int offset = qMax(0, after - firstIndex() + 1);
-	Q_ASSERT(offset<m_history.size());
+	const int ci = chunkAt(offset);
+	Q_ASSERT(ci>=0);
+
+	// Return the rest of the chunk. Note that when the whole chunk is
+	// returned, the list is shared rather than copied.
+	const Chunk &c = m_chunks.at(ci);
+	const int chunkOffset = offset - c.startOffset;
+	Q_ASSERT(chunkOffset < c.messages.size());
+
+	return std::make_tuple(
+		c.messages.mid(chunkOffset),
+		firstIndex() + c.startOffset + c.messages.size() - 1
+	);
+}
 
-	return std::make_tuple(m_history.mid(offset), lastIndex());
+int InMemoryHistory::chunkAt(int offset) const
+{
+	// Find the last chunk that starts at or before the given offset
+	const auto it = std::upper_bound(
+		m_chunks.constBegin(), m_chunks.constEnd(), offset,
+		[](int o, const Chunk &c) { return o < c.startOffset; }
+	);
+	return int(it - m_chunks.constBegin()) - 1;
+}
+
+void InMemoryHistory::appendToChunks(const protocol::MessagePtr &msg)
+{
+	if(m_chunks.isEmpty() || m_chunks.last().size >= MAX_CHUNK_SIZE) {
+		const int start = m_chunks.isEmpty() ? 0 : m_chunks.last().startOffset + m_chunks.last().messages.size();
+		m_chunks.append(Chunk { start, 0, QList<protocol::MessagePtr>() });
+	}
+
+	Chunk &c = m_chunks.last();
+	c.size += msg->length();
+	c.messages << msg;
 }
 
 void InMemoryHistory::historyAdd(const protocol::MessagePtr &msg)
 {
-	m_history << msg;
+	// Serialize once here so all recipients can share the same buffer
+	msg->serialized();
+	appendToChunks(msg);
 }
 
 void InMemoryHistory::historyReset(const QList<protocol::MessagePtr> &newHistory)
 {
-	m_history = newHistory;
+	m_chunks.clear();
+	for(const protocol::MessagePtr &msg : newHistory)
+		appendToChunks(msg);
+	m_cleanedUpTo = 0;
+}
+
+void InMemoryHistory::cleanupBatches(int before)
+{
+	// Messages are kept for the lifetime of the session, but once everyone
+	// has received them, their cached serializations are no longer needed.
+	const int end = before - firstIndex();
+	if(end <= m_cleanedUpTo || m_chunks.isEmpty())
+		return;
+
+	for(int ci=qMax(0, chunkAt(m_cleanedUpTo));ci<m_chunks.size();++ci) {
+		const Chunk &c = m_chunks.at(ci);
+		if(c.startOffset >= end)
+			break;
+
+		const int to = qMin(c.messages.size(), end - c.startOffset);
+		for(int i=qMax(0, m_cleanedUpTo - c.startOffset);i<to;++i)
+			c.messages.at(i)->discardSerialization();
+	}
+	m_cleanedUpTo = end;
 }
 
 }
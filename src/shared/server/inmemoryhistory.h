@@ -24,11 +24,16 @@
 
 #include <QDateTime>
 #include <QSet>
+#include <QVector>
 
 namespace server {
 
 /**
  * @brief A session history backend that stores the session in memory
+ *
+ * The history is stored in chunks of bounded size. A batch never spans more
+ * than one chunk, so fetching a batch costs at most one chunk's worth
+ * of copying, no matter how long the history is.
  */
 class InMemoryHistory : public SessionHistory {
 	Q_OBJECT
@@ -38,7 +43,7 @@ public:
 	std::tuple<QList<protocol::MessagePtr>, int> getBatch(int after) const override;
 
 	void terminate() override { /* nothing to do */ }
-	void cleanupBatches(int) override { /* no caching, nothing to do */ }
+	void cleanupBatches(int before) override;
 
 	QString idAlias() const override { return m_alias; }
 	QString founderName() const override { return m_founder; }
@@ -79,7 +84,16 @@ protected:
 	void historyRemoveBan(int) override { /* not persistent */ }
 
 private:
-	QList<protocol::MessagePtr> m_history;
+	struct Chunk {
+		int startOffset; // offset of the first message from the start of the history
+		uint size;       // serialized length of the messages in this chunk
+		QList<protocol::MessagePtr> messages;
+	};
+
+	void appendToChunks(const protocol::MessagePtr &msg);
+	int chunkAt(int offset) const;
+
+	QVector<Chunk> m_chunks;
 	QSet<QString> m_ops;
 	QSet<QString> m_trusted;
 	QSet<QString> m_announcements;
@@ -93,6 +107,7 @@ private:
 	int m_maxUsers;
 	uint m_autoReset;
 	Flags m_flags;
+	int m_cleanedUpTo; // offset of the first message that may still have a cached serialization
 };
 
 }
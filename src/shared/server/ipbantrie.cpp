@@ -0,0 +1,158 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ipbantrie.h"
+
+#include <cstring>
+
+namespace server {
+
+static inline int bitAt(const Q_IPV6ADDR &addr, int bit)
+{
+	return (addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+/**
+ * Convert the address to IPv6 form.
+ *
+ * IPv4 addresses are mapped into the ::ffff:0:0/96 range and the
+ * prefix length is adjusted to match.
+ */
+static bool toIpv6(const QHostAddress &address, Q_IPV6ADDR &out, int *prefix=nullptr)
+{
+	switch(address.protocol()) {
+	case QAbstractSocket::IPv4Protocol: {
+		const quint32 ip4 = address.toIPv4Address();
+		memset(out.c, 0, 10);
+		out[10] = 0xff;
+		out[11] = 0xff;
+		out[12] = ip4 >> 24;
+		out[13] = ip4 >> 16;
+		out[14] = ip4 >> 8;
+		out[15] = ip4;
+		if(prefix)
+			*prefix = *prefix <= 0 || *prefix > 32 ? 128 : *prefix + 96;
+		return true;
+	}
+	case QAbstractSocket::IPv6Protocol:
+		out = address.toIPv6Address();
+		if(prefix)
+			*prefix = *prefix <= 0 || *prefix > 128 ? 128 : *prefix;
+		return true;
+	default:
+		return false;
+	}
+}
+
+IpBanTrie::IpBanTrie()
+{
+	clear();
+}
+
+void IpBanTrie::clear()
+{
+	m_entries.clear();
+	m_nodes.clear();
+	m_nodes.append(Node { {0, 0}, QVector<int>() });
+}
+
+bool IpBanTrie::add(int id, const QHostAddress &address, int subnet, const QDateTime &expires)
+{
+	Entry e;
+	e.prefix = subnet;
+	e.expires = expires;
+	if(!toIpv6(address, e.address, &e.prefix))
+		return false;
+
+	if(m_entries.contains(id)) {
+		m_entries[id] = e;
+		rebuild();
+	} else {
+		m_entries[id] = e;
+		insert(id, e);
+	}
+	return true;
+}
+
+bool IpBanTrie::remove(int id)
+{
+	if(!m_entries.remove(id))
+		return false;
+
+	// Removal is rare (an admin action) so we simply rebuild the
+	// whole trie rather than prune nodes.
+	rebuild();
+	return true;
+}
+
+void IpBanTrie::insert(int id, const Entry &e)
+{
+	int node = 0;
+	for(int bit=0;bit<e.prefix;++bit) {
+		const int b = bitAt(e.address, bit);
+		int next = m_nodes.at(node).child[b];
+		if(!next) {
+			next = m_nodes.size();
+			m_nodes.append(Node { {0, 0}, QVector<int>() });
+			m_nodes[node].child[b] = next;
+		}
+		node = next;
+	}
+	m_nodes[node].entries.append(id);
+}
+
+void IpBanTrie::rebuild()
+{
+	m_nodes.clear();
+	m_nodes.append(Node { {0, 0}, QVector<int>() });
+
+	QHashIterator<int, Entry> i(m_entries);
+	while(i.hasNext()) {
+		i.next();
+		insert(i.key(), i.value());
+	}
+}
+
+int IpBanTrie::find(const QHostAddress &address, const QDateTime &now) const
+{
+	Q_IPV6ADDR addr;
+	if(!toIpv6(address, addr))
+		return 0;
+
+	const Node *nodes = m_nodes.constData();
+	int node = 0;
+	for(int bit=0;;++bit) {
+		for(const int id : nodes[node].entries) {
+			const QDateTime &expires = m_entries.constFind(id)->expires;
+			if(expires.isNull() || expires > now)
+				return id;
+		}
+
+		if(bit == 128)
+			break;
+
+		node = nodes[node].child[bitAt(addr, bit)];
+		if(!node)
+			break;
+	}
+
+	return 0;
+}
+
+}
@@ -0,0 +1,106 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DP_SRV_IPBANTRIE_H
+#define DP_SRV_IPBANTRIE_H
+
+#include <QHostAddress>
+#include <QDateTime>
+#include <QVector>
+#include <QHash>
+
+namespace server {
+
+/**
+ * @brief An index of banned IP address ranges
+ *
+ * Bans are stored in a binary prefix trie, so checking an address
+ * takes at most 128 steps regardless of the number of bans.
+ *
+ * IPv4 addresses and subnets are stored as IPv4-mapped IPv6 addresses,
+ * so an IPv4 ban also matches the same address seen through a dual-stack socket.
+ *
+ * This class is not thread safe.
+ */
+class IpBanTrie {
+public:
+	IpBanTrie();
+
+	/**
+	 * @brief Add a ban entry
+	 *
+	 * If an entry with the same ID exists already, it is replaced.
+	 *
+	 * @param id unique ID of the ban entry
+	 * @param address the banned address
+	 * @param subnet subnet prefix length. If 0, only the exact address is banned
+	 * @param expires expiration time. If null, the ban never expires
+	 * @return false if the address was invalid
+	 */
+	bool add(int id, const QHostAddress &address, int subnet, const QDateTime &expires=QDateTime());
+
+	/**
+	 * @brief Remove a ban entry
+	 * @return true if an entry with the given ID existed
+	 */
+	bool remove(int id);
+
+	//! Remove all entries
+	void clear();
+
+	//! Get the number of ban entries
+	int size() const { return m_entries.size(); }
+
+	/**
+	 * @brief Check if the given address is covered by a ban that hasn't yet expired
+	 *
+	 * @param address the address to check
+	 * @param now the current time (for checking expiration)
+	 * @return the ID of the matching ban entry, or 0 if not banned
+	 */
+	int find(const QHostAddress &address, const QDateTime &now) const;
+
+	//! Check if the address is currently banned
+	bool isBanned(const QHostAddress &address) const { return find(address, QDateTime::currentDateTime()) != 0; }
+
+private:
+	struct Entry {
+		Q_IPV6ADDR address;
+		int prefix;
+		QDateTime expires;
+	};
+
+	struct Node {
+		// Indices of the child nodes for 0 and 1 bits (0 if none)
+		int child[2];
+
+		// IDs of the ban entries whose prefix ends at this node
+		QVector<int> entries;
+	};
+
+	void insert(int id, const Entry &e);
+	void rebuild();
+
+	QHash<int, Entry> m_entries;
+	QVector<Node> m_nodes;
+};
+
+}
+
+#endif
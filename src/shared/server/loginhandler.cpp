@@ -553,8 +553,10 @@ void LoginHandler::handleHostMessage(const protocol::ServerCommand &cmd)
 		return;
 	}
 
-	if(cmd.kwargs["password"].isString())
-		session->setPassword(cmd.kwargs["password"].toString());
+	if(cmd.kwargs["password"].isString()) {
+		const QString password = cmd.kwargs["password"].toString();
+		session->runInSessionThread([session, password]() { session->setPassword(password); });
+	}
 
 	// Mark login phase as complete. No more login messages will be sent to this user
 	protocol::ServerReply reply;
@@ -569,7 +571,7 @@ void LoginHandler::handleHostMessage(const protocol::ServerCommand &cmd)
 	send(reply);
 
 	m_complete = true;
-	session->joinUser(m_client, true);
+	m_server->moveToSession(m_client, session, true);
 
 	deleteLater();
 }
@@ -598,41 +600,58 @@ void LoginHandler::handleJoinMessage(const protocol::ServerCommand &cmd)
 		}
 	}
 
-	if(!m_client->isModerator()) {
-		// Non-moderators have to obey access restrictions
-		if(session->banlist().isBanned(m_client->peerAddress(), m_client->extAuthId())) {
-			sendError("banned", "You have been banned from this session");
-			return;
-		}
-		if(session->isClosed()) {
-			sendError("closed", "This session is closed");
-			return;
-		}
-		if(session->isAuthOnly() && !m_client->isAuthenticated()) {
-			sendError("authOnly", "This session does not allow guest logins");
-			return;
-		}
+	// The session may be running in a worker thread, so the
+	// access checks must be done there.
+	const QString password = cmd.kwargs.value("password").toString();
+	QString errorCode, errorMessage;
+
+	session->runInSessionThread([this, session, password, &errorCode, &errorMessage]() {
+		if(!m_client->isModerator()) {
+			// Non-moderators have to obey access restrictions
+			if(session->banlist().isBanned(m_client->peerAddress(), m_client->extAuthId())) {
+				errorCode = "banned";
+				errorMessage = "You have been banned from this session";
+				return;
+			}
+			if(session->isClosed()) {
+				errorCode = "closed";
+				errorMessage = "This session is closed";
+				return;
+			}
+			if(session->isAuthOnly() && !m_client->isAuthenticated()) {
+				errorCode = "authOnly";
+				errorMessage = "This session does not allow guest logins";
+				return;
+			}
 
-		if(!session->checkPassword(cmd.kwargs.value("password").toString())) {
-			sendError("badPassword", "Incorrect password");
-			return;
+			if(!session->checkPassword(password)) {
+				errorCode = "badPassword";
+				errorMessage = "Incorrect password";
+				return;
+			}
 		}
-	}
 
-	if(session->getClientByUsername(m_client->username())) {
+		if(session->getClientByUsername(m_client->username())) {
 #ifdef NDEBUG
-		sendError("nameInuse", "This username is already in use");
-		return;
+			errorCode = "nameInuse";
+			errorMessage = "This username is already in use";
+			return;
 #else
-		// Allow identical usernames in debug builds, so I don't have to keep changing
-		// the username when testing. There is no technical requirement for unique usernames;
-		// the limitation is solely for the benefit of the human users.
-		m_client->log(Log().about(Log::Level::Warn, Log::Topic::RuleBreak).message("Username clash ignored because this is a debug build."));
+			// Allow identical usernames in debug builds, so I don't have to keep changing
+			// the username when testing. There is no technical requirement for unique usernames;
+			// the limitation is solely for the benefit of the human users.
+			m_client->log(Log().about(Log::Level::Warn, Log::Topic::RuleBreak).message("Username clash ignored because this is a debug build."));
 #endif
-	}
+		}
+
+		// Ok, join the session
+		session->assignId(m_client);
+	});
 
-	// Ok, join the session
-	session->assignId(m_client);
+	if(!errorCode.isEmpty()) {
+		sendError(errorCode, errorMessage);
+		return;
+	}
 
 	protocol::ServerReply reply;
 	reply.type = protocol::ServerReply::RESULT;
@@ -646,7 +665,7 @@ void LoginHandler::handleJoinMessage(const protocol::ServerCommand &cmd)
 
 	m_complete = true;
 
-	session->joinUser(m_client, false);
+	m_server->moveToSession(m_client, session, false);
 
 	deleteLater();
 }
@@ -655,7 +674,8 @@ void LoginHandler::handleAbuseReport(const protocol::ServerCommand &cmd)
 {
 	Session *s = m_server->getSessionById(cmd.kwargs["session"].toString());
 	if(s) {
-		s->sendAbuseReport(m_client, 0, cmd.kwargs["reason"].toString());
+		const QString reason = cmd.kwargs["reason"].toString();
+		s->runInSessionThread([this, s, reason]() { s->sendAbuseReport(m_client, 0, reason); });
 	}
 }
 
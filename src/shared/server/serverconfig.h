@@ -74,7 +74,8 @@ namespace config {
 		LogPurgeDays(18, "logpurgedays", "0", ConfigKey::INT),               // Automatically purge log entries older than this many days (DB log only)
 		AutoresetThreshold(19, "autoResetThreshold", "15mb", ConfigKey::SIZE), // Default autoreset threshold in bytes
 		AllowCustomAvatars(20, "customAvatars", "true", ConfigKey::BOOL),      // Allow users to set a custom avatar when logging in
-		ExtAuthAvatars(21, "extAuthAvatars", "true", ConfigKey::BOOL)          // Use avatars received from ext-auth server (unless a custom avatar has been set)
+		ExtAuthAvatars(21, "extAuthAvatars", "true", ConfigKey::BOOL),         // Use avatars received from ext-auth server (unless a custom avatar has been set)
+		WorkerThreads(22, "workers", "0", ConfigKey::INT)                      // Number of session worker threads (read at startup only)
 		;
 }
 
@@ -112,6 +113,9 @@ struct RegisteredUser {
  * These are the configuration settings that can be changed at runtime.
  * The default storage implementation is a simple in-memory key/value map.
  * Deriving classes can implement persistent storage of settings.
+ *
+ * Implementations must be thread safe, since sessions may run
+ * in worker threads.
  */
 class ServerConfig : public QObject
 {
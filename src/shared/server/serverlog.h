@@ -23,6 +23,7 @@
 #include <QDateTime>
 #include <QUuid>
 #include <QHostAddress>
+#include <QMutex>
 
 class QJsonObject;
 
@@ -151,6 +152,9 @@ private:
 
 /**
  * @brief Abstract base class for server logger implementations
+ *
+ * Implementations must be thread safe, since sessions may
+ * run in worker threads.
  */
 class ServerLog
 {
@@ -211,6 +215,7 @@ protected:
 	void storeMessage(const Log &entry) override;
 
 private:
+	mutable QMutex m_mutex;
 	QList<Log> m_history;
 	int m_limit;
 };
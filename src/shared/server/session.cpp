@@ -33,6 +33,7 @@
 #include "config.h"
 
 #include <QTimer>
+#include <QThread>
 #include <QNetworkRequest>
 #include <QNetworkReply>
 
@@ -48,6 +49,7 @@ Session::Session(SessionHistory *history, ServerConfig *config, QObject *parent)
 	m_recorder(nullptr),
 	m_history(history),
 	m_resetstreamsize(0),
+	m_serializationBytesSaved(0),
 	m_closed(false),
 	m_authOnly(false),
 	m_autoResetRequestStatus(AutoResetState::NotSent)
@@ -180,6 +182,7 @@ void Session::joinUser(Client *user, bool host)
 {
 	user->setSession(this);
 	m_clients.append(user);
+	m_userCount.store(m_clients.size());
 
 	connect(user, &Client::loggedOff, this, &Session::removeUser);
 	connect(history(), &SessionHistory::newMessagesAvailable, user, &Client::sendNextHistoryBatch);
@@ -236,10 +239,12 @@ void Session::removeUser(Client *user)
 {
 	if(!m_clients.removeOne(user))
 		return;
+	m_userCount.store(m_clients.size());
 
 	Q_ASSERT(user->session() == this);
 	user->log(Log().about(Log::Level::Info, Log::Topic::Leave).message("Left session"));
 	user->setSession(nullptr);
+	m_serializationBytesSaved += user->serializationBytesSaved();
 
 	disconnect(user, &Client::loggedOff, this, &Session::removeUser);
 	disconnect(m_history, &SessionHistory::newMessagesAvailable, user, &Client::sendNextHistoryBatch);
@@ -866,15 +871,28 @@ void Session::killSession(bool terminate)
 		c->setSession(nullptr);
 	}
 	m_clients.clear();
+	m_userCount.store(0);
 
 	if(terminate)
 		m_history->terminate();
 
-	this->deleteLater();
+	emit sessionKilled(this);
+}
+
+void Session::runInSessionThread(const SessionTask &task)
+{
+	if(thread() == QThread::currentThread())
+		task();
+	else
+		QMetaObject::invokeMethod(this, "runTask", Qt::BlockingQueuedConnection, Q_ARG(SessionTask, task));
 }
 
 void Session::directToAll(protocol::MessagePtr msg)
 {
+	// Serialize up front so every upload queue can share the same buffer
+	if(m_clients.size() > 1)
+		msg->serialized();
+
 	for(Client *c : m_clients) {
 		c->sendDirectMessage(msg);
 	}
@@ -1246,6 +1264,11 @@ QJsonObject Session::getDescription(bool full) const
 		o["resetThreshold"] = int(m_history->autoResetThreshold());
 		o["deputies"] = m_history->flags().testFlag(SessionHistory::Deputies);
 
+		qint64 serializationSaved = m_serializationBytesSaved;
+		for(const Client *user : m_clients)
+			serializationSaved += user->serializationBytesSaved();
+		o["serializationBytesSaved"] = serializationSaved;
+
 		QJsonArray users;
 		for(const Client *user : m_clients) {
 			users << user->description(false);
@@ -28,6 +28,9 @@
 #include <QElapsedTimer>
 #include <QUuid>
 #include <QJsonObject>
+#include <QAtomicInt>
+
+#include <functional>
 
 #include "../util/announcementapi.h"
 #include "../util/passwordhash.h"
@@ -48,6 +51,9 @@ class Client;
 class ServerConfig;
 class Log;
 
+//! A function to be run in a session's thread
+typedef std::function<void()> SessionTask;
+
 /**
  * The serverside session state.
  */
@@ -250,9 +256,12 @@ public:
 
 	/**
 	 * @brief Get the number of clients in the session
+	 *
+	 * This is safe to call from any thread.
+	 *
 	 * @return user count
 	 */
-	int userCount() const { return m_clients.size(); }
+	int userCount() const { return m_userCount.load(); }
 
 	const QList<Client*> &clients() const { return m_clients; }
 
@@ -318,9 +327,25 @@ public:
 	 * If the terminate parameter is false, the session history
 	 * will not be terminated. This allows the session to survive
 	 * server restarts.
+	 *
+	 * The sessionKilled signal is emitted when done. The session object
+	 * itself is deleted by the session server.
 	 */
 	void killSession(bool terminate=true);
 
+	/**
+	 * @brief Run a function in this session's thread
+	 *
+	 * When sessions are run in worker threads, the session and its
+	 * clients may only be accessed from the thread they live in. This
+	 * function calls the given function in that thread and blocks until
+	 * it returns. If called from the session's own thread, the function
+	 * is called directly.
+	 *
+	 * Note: to avoid deadlocks, only the main thread may block on a session thread.
+	 */
+	void runInSessionThread(const SessionTask &task);
+
 	/**
 	 * @brief Send a direct message to all session participants
 	 *
@@ -482,8 +507,12 @@ signals:
 	 */
 	void sessionAttributeChanged(Session *thisSession);
 
+	//! This session has been shut down and can be deleted
+	void sessionKilled(Session *thisSession);
+
 private slots:
 	void removeUser(Client *user);
+	void runTask(const SessionTask &task) { task(); }
 
 	void refreshAnnouncements();
 
@@ -511,10 +540,12 @@ private:
 	QString m_recordingFile;
 
 	QList<Client*> m_clients;
+	QAtomicInt m_userCount;
 
 	SessionHistory *m_history;
 	QList<protocol::MessagePtr> m_resetstream;
 	uint m_resetstreamsize;
+	qint64 m_serializationBytesSaved; // from users who have already left
 
 	QList<sessionlisting::Announcement> m_publicListings;
 	QTimer *m_refreshTimer;
@@ -529,5 +560,7 @@ private:
 
 }
 
+Q_DECLARE_METATYPE(server::SessionTask)
+
 #endif
 
@@ -59,6 +59,7 @@ int SessionBanList::addBan(const QString &username, const QHostAddress &ip, cons
 		toIpv6(ip), // Always use IPv6 notation for consistency
 		bannedBy
 	};
+	m_ipindex.add(id, ip, 0);
 	return id;
 }
 
@@ -69,6 +70,7 @@ QString SessionBanList::removeBan(int id)
 		SessionBan entry = i.next();
 		if(entry.id == id) {
 			i.remove();
+			m_ipindex.remove(id);
 			return entry.username;
 		}
 	}
@@ -77,13 +79,8 @@ QString SessionBanList::removeBan(int id)
 
 bool SessionBanList::isBanned(const QHostAddress &address, const QString &extAuthId) const
 {
-	if(!address.isNull()) {
-		const QHostAddress ip = toIpv6(address);
-		for(const SessionBan &b : m_banlist) {
-			if(b.ip == ip)
-				return true;
-		}
-	}
+	if(!address.isNull() && m_ipindex.find(address, QDateTime()) != 0)
+		return true;
 	if(!extAuthId.isEmpty()) {
 		for(const SessionBan &b : m_banlist) {
 			if(b.extAuthId == extAuthId)
@@ -19,6 +19,8 @@
 #ifndef DP_SERVER_SESSIONBAN_H
 #define DP_SERVER_SESSIONBAN_H
 
+#include "ipbantrie.h"
+
 #include <QString>
 #include <QHostAddress>
 #include <QList>
@@ -87,6 +89,7 @@ public:
 
 private:
 	QList<SessionBan> m_banlist;
+	IpBanTrie m_ipindex;
 	int m_idautoinc;
 };
 
@@ -28,9 +28,12 @@
 #include "templateloader.h"
 
 #include <QTimer>
+#include <QThread>
 #include <QJsonArray>
 #include <QJsonDocument>
 
+#include <climits>
+
 namespace server {
 
 SessionServer::SessionServer(ServerConfig *config, QObject *parent)
@@ -50,6 +53,54 @@ SessionServer::SessionServer(ServerConfig *config, QObject *parent)
 #endif
 }
 
+SessionServer::~SessionServer()
+{
+	// Sessions and clients in worker threads are deleted
+	// along with their parent object when the thread finishes.
+	for(const Worker &w : m_workers) {
+		w.thread->quit();
+		w.thread->wait();
+	}
+}
+
+void SessionServer::setWorkerThreads(int count)
+{
+	Q_ASSERT(m_workers.isEmpty());
+
+	qRegisterMetaType<SessionTask>("SessionTask");
+
+	for(int i=0;i<count;++i) {
+		QThread *thread = new QThread(this);
+		thread->setObjectName(QStringLiteral("session worker %1").arg(i+1));
+
+		QObject *objectParent = new QObject;
+		objectParent->moveToThread(thread);
+		connect(thread, &QThread::finished, objectParent, &QObject::deleteLater);
+
+		thread->start();
+		m_workers << Worker { thread, objectParent };
+	}
+}
+
+QJsonArray SessionServer::workerDescriptions() const
+{
+	QJsonArray workers;
+	for(const Worker &w : m_workers) {
+		int sessions = 0, users = 0;
+		for(const Session *s : m_sessions) {
+			if(s->thread() == w.thread) {
+				++sessions;
+				users += s->userCount();
+			}
+		}
+		workers << QJsonObject {
+			{"sessions", sessions},
+			{"users", users}
+		};
+	}
+	return workers;
+}
+
 void SessionServer::setSessionDir(const QDir &dir)
 {
 	if(dir.isReadable()) {
@@ -85,8 +136,8 @@ QJsonArray SessionServer::sessionDescriptions() const
 {
 	QJsonArray descs;
 
-	for(const Session *s : m_sessions)
-		descs.append(s->getDescription());
+	for(Session *s : m_sessions)
+		s->runInSessionThread([s, &descs]() { descs.append(s->getDescription()); });
 
 	return descs;
 }
@@ -152,16 +203,38 @@ void SessionServer::initSession(Session *session)
 {
 	m_sessions.append(session);
 
-	connect(session, &Session::userConnected, this, &SessionServer::moveFromLobby);
 	connect(session, &Session::userDisconnected, this, &SessionServer::userDisconnectedEvent);
-	connect(session, &Session::sessionAttributeChanged, this, [this](Session *ses) { emit sessionChanged(ses->getDescription()); });
-	connect(session, &Session::destroyed, this, [this, session]() {
-		m_sessions.removeOne(session);
-		emit sessionEnded(session->idString());
-	});
+	connect(session, &Session::sessionKilled, this, &SessionServer::sessionKilledEvent, Qt::QueuedConnection);
+
+	// The description must be generated in the session's own thread
+	connect(session, &Session::sessionAttributeChanged, this, [this](Session *ses) {
+		QMetaObject::invokeMethod(this, "sessionChanged", Q_ARG(QJsonObject, ses->getDescription()));
+	}, Qt::DirectConnection);
 
 	emit sessionCreated(session);
 	emit sessionChanged(session->getDescription());
+
+	// Pin the session to the least busy worker thread
+	if(!m_workers.isEmpty()) {
+		const Worker *worker = &m_workers.first();
+		int workerSessions = INT_MAX;
+		for(const Worker &w : m_workers) {
+			int count = 0;
+			for(const Session *s : m_sessions) {
+				if(s->thread() == w.thread)
+					++count;
+			}
+			if(count < workerSessions) {
+				worker = &w;
+				workerSessions = count;
+			}
+		}
+
+		QObject *objectParent = worker->objectParent;
+		session->setParent(nullptr);
+		session->moveToThread(worker->thread);
+		session->runInSessionThread([session, objectParent]() { session->setParent(objectParent); });
+	}
 }
 
 Session *SessionServer::getSessionById(const QString &id) const
@@ -215,13 +288,13 @@ void SessionServer::stopAll()
 		c->disconnectShutdown();
 
 	for(Session *s : m_sessions)
-		s->killSession(false);
+		s->runInSessionThread([s]() { s->killSession(false); });
 }
 
 void SessionServer::messageAll(const QString &message, bool alert)
 {
 	for(Session *s : m_sessions) {
-		s->messageAll(message, alert);
+		s->runInSessionThread([s, message, alert]() { s->messageAll(message, alert); });
 	}
 }
 
@@ -241,21 +314,31 @@ void SessionServer::addClient(Client *client)
 	(new LoginHandler(client, this))->startLoginProcess();
 }
 
-/**
- * @brief Handle the move of a client from the lobby to a session
- * @param session
- * @param client
- */
-void SessionServer::moveFromLobby(Session *session, Client *client)
+void SessionServer::moveToSession(Client *client, Session *session, bool host)
 {
 	Q_ASSERT(m_lobby.contains(client));
+	Q_ASSERT(m_sessions.contains(session));
 	m_lobby.removeOne(client);
 
 	// the session handles disconnect events from now on
 	disconnect(client, &Client::loggedOff, this, &SessionServer::lobbyDisconnectedEvent);
 
+	QObject *objectParent = this;
+	if(session->thread() != thread()) {
+		objectParent = session->parent();
+		client->setParent(nullptr);
+		client->moveToThread(session->thread());
+	}
+
+	QJsonObject description;
+	session->runInSessionThread([client, session, host, objectParent, &description]() {
+		client->setParent(objectParent);
+		session->joinUser(client, host);
+		description = session->getDescription();
+	});
+
 	emit userLoggedIn(totalUsers());
-	emit sessionChanged(session->getDescription());
+	emit sessionChanged(description);
 }
 
 /**
@@ -280,36 +363,64 @@ void SessionServer::lobbyDisconnectedEvent(Client *client)
  */
 void SessionServer::userDisconnectedEvent(Session *session)
 {
-	bool delSession = false;
-	if(session->userCount()==0) {
-		session->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Last user left."));
-
-		// A non-persistent session is deleted when the last user leaves
-		// A persistent session can also be deleted if it doesn't contain a snapshot point.
-		if(!session->isPersistent()) {
-			session->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Closing non-persistent session."));
-			delSession = true;
+	// This event may be delivered after the session has already ended
+	if(!m_sessions.contains(session))
+		return;
+
+	QJsonObject description;
+	session->runInSessionThread([session, &description]() {
+		bool delSession = false;
+		if(session->userCount()==0) {
+			session->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Last user left."));
+
+			// A non-persistent session is deleted when the last user leaves
+			// A persistent session can also be deleted if it doesn't contain a snapshot point.
+			if(!session->isPersistent()) {
+				session->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Closing non-persistent session."));
+				delSession = true;
+			}
 		}
-	}
 
-	if(delSession)
-		session->killSession();
-	else
-		emit sessionChanged(session->getDescription());
+		if(delSession)
+			session->killSession();
+		else
+			description = session->getDescription();
+	});
+
+	if(!description.isEmpty())
+		emit sessionChanged(description);
 
 	emit userDisconnected(totalUsers());
 }
 
+/**
+ * @brief Forget about a session that has shut down
+ *
+ * The session is deleted here rather than by itself, so that the
+ * session pointers held by the main thread stay valid until this point.
+ */
+void SessionServer::sessionKilledEvent(Session *session)
+{
+	if(!m_sessions.removeOne(session))
+		return;
+
+	const QString id = session->idString();
+	session->deleteLater();
+	emit sessionEnded(id);
+}
+
 void SessionServer::cleanupSessions()
 {
 	const qint64 expirationTime = m_config->getConfigTime(config::IdleTimeLimit) * 1000;
 
 	if(expirationTime>0) {
 		for(Session *s : m_sessions) {
-			if(s->lastEventTime() > expirationTime) {
-				s->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Idle session expired."));
-				s->killSession();
-			}
+			s->runInSessionThread([s, expirationTime]() {
+				if(s->lastEventTime() > expirationTime) {
+					s->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Idle session expired."));
+					s->killSession();
+				}
+			});
 		}
 	}
 }
@@ -322,10 +433,15 @@ JsonApiResult SessionServer::callSessionJsonApi(JsonApiMethod method, const QStr
 
 	if(!head.isEmpty()) {
 		Session *s = getSessionById(head);
-		if(s)
-			return s->callJsonApi(method, tail, request);
-		else
+		if(s) {
+			JsonApiResult result;
+			s->runInSessionThread([s, method, &tail, &request, &result]() {
+				result = s->callJsonApi(method, tail, request);
+			});
+			return result;
+		} else {
 			return JsonApiNotFound();
+		}
 	}
 
 	if(method == JsonApiMethod::Get) {
@@ -359,9 +475,11 @@ JsonApiResult SessionServer::callUserJsonApi(JsonApiMethod method, const QString
 		for(const Client *c : m_lobby)
 			userlist << c->description();
 
-		for(const Session *s : m_sessions) {
-			for(const Client *c : s->clients())
-				userlist << c->description();
+		for(Session *s : m_sessions) {
+			s->runInSessionThread([s, &userlist]() {
+				for(const Client *c : s->clients())
+					userlist << c->description();
+			});
 		}
 
 		return {JsonApiResult::Ok, QJsonDocument(userlist)};
@@ -22,6 +22,9 @@
 
 #include <QObject>
 #include <QDir>
+#include <QVector>
+
+class QThread;
 
 namespace sessionlisting {
 	class AnnouncementApi;
@@ -40,11 +43,40 @@ class TemplateLoader;
 /**
  * @brief Session manager
  *
+ * The session server itself, the lobby and the login process run in the
+ * thread the session server lives in (the main thread.) Optionally, sessions
+ * can be run in a pool of worker threads, each with its own event loop.
+ * A session and its clients are pinned to a single worker, so a busy
+ * session only slows down the sessions sharing its worker.
+ *
+ * All access to a session from the main thread must go through
+ * Session::runInSessionThread().
  */
 class SessionServer : public QObject {
 Q_OBJECT
 public:
 	SessionServer(ServerConfig *config, QObject *parent=nullptr);
+	~SessionServer();
+
+	/**
+	 * @brief Start worker threads for running sessions
+	 *
+	 * Sessions created after this call are distributed among the workers.
+	 * If the count is zero (the default), sessions run in the main thread.
+	 *
+	 * This should be called only once, before any sessions are created.
+	 *
+	 * @param count number of worker threads
+	 */
+	void setWorkerThreads(int count);
+
+	//! Get the number of session worker threads
+	int workerThreads() const { return m_workers.size(); }
+
+	/**
+	 * @brief Get the session and user count of each worker thread
+	 */
+	QJsonArray workerDescriptions() const;
 
 	/**
 	 * @brief Enable file backed sessions
@@ -92,6 +124,18 @@ public:
 	 */
 	void addClient(Client *client);
 
+	/**
+	 * @brief Move a logged in client from the lobby to a session
+	 *
+	 * If the session runs in a worker thread, the client is moved
+	 * to that thread. The caller must not access the client after this.
+	 *
+	 * @param client the client to move
+	 * @param session the session to join
+	 * @param host is this the hosting user
+	 */
+	void moveToSession(Client *client, Session *session, bool host);
+
 	/**
 	 * @brief Create a new session
 	 * @param id session ID
@@ -202,15 +246,20 @@ signals:
 	void sessionEnded(const QString &id);
 
 private slots:
-	void moveFromLobby(Session *session, Client *client);
 	void lobbyDisconnectedEvent(Client *client);
 	void userDisconnectedEvent(Session *session);
+	void sessionKilledEvent(Session *session);
 	void cleanupSessions();
 
 private:
 	SessionHistory *initHistory(const QUuid &id, const QString alias, const protocol::ProtocolVersion &protocolVersion, const QString &founder);
 	void initSession(Session *session);
 
+	struct Worker {
+		QThread *thread;
+		QObject *objectParent; // parent object for sessions and clients in this thread
+	};
+
 	ServerConfig *m_config;
 	TemplateLoader *m_tpls;
 	QDir m_sessiondir;
@@ -218,6 +267,7 @@ private:
 
 	QList<Session*> m_sessions;
 	QList<Client*> m_lobby;
+	QVector<Worker> m_workers;
 
 	bool m_mustSecure;
 
@@ -1,6 +1,10 @@
 #include "../server/filedhistory.h"
 #include "../util/passwordhash.h"
 #include "../net/meta.h"
+#include "../net/image.h"
+#include "../net/brushes.h"
+#include "../net/opaque.h"
+#include "../record/blockcompression.h"
 
 #include <QtTest/QtTest>
 #include <QTemporaryDir>
@@ -186,6 +190,51 @@ private slots:
 		QCOMPARE(lastIdx, 1);
 	}
 
+	// Block compressed recordings can be loaded and appended to
+	void testBlockCompressed()
+	{
+		QString file = makeTestRecording();
+
+		// Compress the recording in place
+		QString recfile = m_dir.absoluteFilePath(file);
+		recfile.replace(".session", ".dprec");
+		{
+			QFile rf(recfile);
+			QVERIFY(rf.open(QFile::ReadOnly));
+			const QByteArray content = rf.readAll();
+			rf.close();
+
+			recording::BlockCompressionDevice compressed(recfile);
+			QVERIFY(compressed.open(QIODevice::WriteOnly));
+			QCOMPARE(compressed.write(content), qint64(content.length()));
+		}
+		QVERIFY(recording::BlockCompressionDevice::isBlockCompressed(recfile));
+
+		auto testMsg = protocol::MessagePtr(new protocol::Chat(1, 0, 0, QByteArray("appended")));
+
+		QList<protocol::MessagePtr> msgs;
+		int lastIdx;
+		{
+			std::unique_ptr<FiledHistory> fh { FiledHistory::load(m_dir.absoluteFilePath(file)) };
+			QVERIFY(fh.get());
+
+			std::tie(msgs, lastIdx) = fh->getBatch(0);
+			QCOMPARE(msgs.size(), 2);
+			QCOMPARE(msgs.at(0).cast<protocol::Chat>().message(), QString("test2"));
+
+			fh->addMessage(testMsg);
+		}
+
+		std::unique_ptr<FiledHistory> fh { FiledHistory::load(m_dir.absoluteFilePath(file)) };
+		QVERIFY(fh.get());
+
+		std::tie(msgs, lastIdx) = fh->getBatch(-1);
+		QCOMPARE(msgs.size(), 4);
+		QCOMPARE(lastIdx, 3);
+		QCOMPARE(msgs.at(0).cast<protocol::Chat>().message(), QString("test1"));
+		QVERIFY(msgs.last().equals(testMsg));
+	}
+
 	// Check if history reset is handled correctly
 	void testReset()
 	{
@@ -274,6 +323,47 @@ private slots:
 		QCOMPARE(lastIdx, 5);
 	}
 
+	// Loaded messages should keep their raw form and opaque messages should not be decoded
+	void testRawMessages()
+	{
+		const QList<protocol::MessagePtr> original {
+			protocol::MessagePtr(new protocol::Chat(1, 0, 0, QByteArray("test1"))),
+			protocol::MessagePtr(new protocol::FillRect(1, 0x0101, 1, 10, 20, 30, 40, 0xff112233)),
+			protocol::MessagePtr(new protocol::PenUp(1))
+		};
+
+		QUuid id = QUuid::createUuid();
+		{
+			std::unique_ptr<FiledHistory> fh { FiledHistory::startNew(m_dir, id, QString(), protocol::ProtocolVersion::current(), "test") };
+			for(const protocol::MessagePtr &msg : original)
+				fh->addMessage(msg);
+		}
+
+		std::unique_ptr<FiledHistory> fh { FiledHistory::load(m_dir.absoluteFilePath(FiledHistory::journalFilename(id))) };
+		QVERIFY(fh.get());
+
+		QList<protocol::MessagePtr> msgs;
+		int lastIdx;
+		std::tie(msgs, lastIdx) = fh->getBatch(-1);
+		QCOMPARE(msgs.size(), original.size());
+
+		for(int i=0;i<msgs.size();++i) {
+			const protocol::MessagePtr &msg = msgs.at(i);
+			QVERIFY(msg->isSerialized());
+			QCOMPARE(msg->serialized(), original.at(i)->serialized());
+			QCOMPARE(msg->type(), original.at(i)->type());
+
+			if(msg->isOpaque()) {
+				QCOMPARE(msg->messageName(), QStringLiteral("_opaque"));
+				protocol::NullableMessageRef decoded = msg.cast<protocol::OpaqueMessage>().decode();
+				QVERIFY(!decoded.isNull());
+				QVERIFY(decoded->equals(*original.at(i)));
+			} else {
+				QVERIFY(msg.equals(original.at(i)));
+			}
+		}
+	}
+
 	void testUserLeave()
 	{
 		QUuid id = QUuid::createUuid();
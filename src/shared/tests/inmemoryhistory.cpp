@@ -0,0 +1,64 @@
+#include "../server/inmemoryhistory.h"
+#include "../net/control.h"
+
+#include <QtTest/QtTest>
+
+using namespace server;
+using protocol::MessagePtr;
+
+class TestInMemoryHistory: public QObject
+{
+	Q_OBJECT
+private slots:
+	void testBatches()
+	{
+		InMemoryHistory history(QUuid::createUuid(), QString(), protocol::ProtocolVersion::current(), "test");
+
+		// Large enough messages that the history is split into several chunks
+		QList<MessagePtr> messages;
+		for(int i=0;i<100;++i) {
+			MessagePtr msg(new protocol::Command(1, QByteArray(30000, char(i))));
+			messages << msg;
+			QVERIFY(history.addMessage(msg));
+		}
+		QCOMPARE(history.lastIndex(), messages.size() - 1);
+
+		// Fetch the whole history one batch at a time
+		QList<MessagePtr> received = fetchAll(history, -1);
+		QCOMPARE(received.size(), messages.size());
+		for(int i=0;i<messages.size();++i)
+			QVERIFY(received.at(i)->equals(*messages.at(i)));
+
+		// Start from the middle of a chunk
+		received = fetchAll(history, 42);
+		QCOMPARE(received.size(), messages.size() - 43);
+		QVERIFY(received.first()->equals(*messages.at(43)));
+
+		// Index numbering continues after a reset
+		QVERIFY(history.reset(messages.mid(0, 30)));
+		QCOMPARE(history.firstIndex(), 100);
+		received = fetchAll(history, 60);
+		QCOMPARE(received.size(), 30);
+		QVERIFY(received.last()->equals(*messages.at(29)));
+	}
+
+private:
+	static QList<MessagePtr> fetchAll(const SessionHistory &history, int after)
+	{
+		QList<MessagePtr> received;
+		while(after < history.lastIndex()) {
+			QList<MessagePtr> batch;
+			std::tie(batch, after) = history.getBatch(after);
+
+			// Batches should be bounded in size
+			if(batch.isEmpty() || batch.size() > 30)
+				return QList<MessagePtr>();
+
+			received << batch;
+		}
+		return received;
+	}
+};
+
+QTEST_MAIN(TestInMemoryHistory)
+#include "inmemoryhistory.moc"
@@ -0,0 +1,134 @@
+#include "../server/ipbantrie.h"
+
+#include <QtTest/QtTest>
+#include <QHostAddress>
+
+using server::IpBanTrie;
+
+static QHostAddress randomIpv4()
+{
+	return QHostAddress(quint32(qrand() & 0xffff) | (quint32(qrand() & 0xffff) << 16));
+}
+
+class TestIpBanTrie: public QObject
+{
+	Q_OBJECT
+private slots:
+	void testMatching_data()
+	{
+		QTest::addColumn<QString>("ban");
+		QTest::addColumn<int>("subnet");
+		QTest::addColumn<QString>("address");
+		QTest::addColumn<bool>("banned");
+
+		QTest::newRow("ipv4 exact") << "192.168.0.100" << 0 << "192.168.0.100" << true;
+		QTest::newRow("ipv4 exact miss") << "192.168.0.100" << 0 << "192.168.0.101" << false;
+		QTest::newRow("ipv4 /32") << "192.168.0.100" << 32 << "192.168.0.100" << true;
+		QTest::newRow("ipv4 /24") << "192.168.0.0" << 24 << "192.168.0.255" << true;
+		QTest::newRow("ipv4 /24 miss") << "192.168.0.0" << 24 << "192.168.1.0" << false;
+		QTest::newRow("ipv4 /9") << "10.128.0.0" << 9 << "10.200.1.2" << true;
+		QTest::newRow("ipv4 /9 miss") << "10.128.0.0" << 9 << "10.100.1.2" << false;
+		QTest::newRow("ipv4 mapped") << "192.168.0.0" << 16 << "::ffff:192.168.5.5" << true;
+		QTest::newRow("ipv6 exact") << "2001:db8::1" << 0 << "2001:db8::1" << true;
+		QTest::newRow("ipv6 exact miss") << "2001:db8::1" << 0 << "2001:db8::2" << false;
+		QTest::newRow("ipv6 /64") << "2001:db8:1:2::" << 64 << "2001:db8:1:2:aaaa::1" << true;
+		QTest::newRow("ipv6 /64 miss") << "2001:db8:1:2::" << 64 << "2001:db8:1:3::1" << false;
+		QTest::newRow("ipv6 vs ipv4") << "::" << 1 << "1.2.3.4" << true;
+	}
+
+	void testMatching()
+	{
+		QFETCH(QString, ban);
+		QFETCH(int, subnet);
+		QFETCH(QString, address);
+		QFETCH(bool, banned);
+
+		IpBanTrie bans;
+		QVERIFY(bans.add(1, QHostAddress(ban), subnet));
+		QCOMPARE(bans.isBanned(QHostAddress(address)), banned);
+
+		// Cross-check against Qt's subnet matching
+		const QHostAddress addr(address);
+		if(addr.protocol() == QHostAddress(ban).protocol())
+			QCOMPARE(addr.isInSubnet(QHostAddress(ban), subnet > 0 ? subnet : (addr.protocol() == QAbstractSocket::IPv4Protocol ? 32 : 128)), banned);
+	}
+
+	void testAddRemove()
+	{
+		IpBanTrie bans;
+		bans.add(1, QHostAddress("192.168.0.0"), 16);
+		bans.add(2, QHostAddress("192.168.1.0"), 24);
+		QCOMPARE(bans.size(), 2);
+
+		const QHostAddress addr("192.168.1.1");
+		const QDateTime now = QDateTime::currentDateTime();
+		QCOMPARE(bans.find(addr, now), 1);
+
+		QVERIFY(bans.remove(1));
+		QVERIFY(!bans.remove(1));
+		QCOMPARE(bans.find(addr, now), 2);
+
+		// Replacing an entry
+		bans.add(2, QHostAddress("10.0.0.0"), 8);
+		QCOMPARE(bans.find(addr, now), 0);
+		QCOMPARE(bans.find(QHostAddress("10.1.2.3"), now), 2);
+
+		bans.clear();
+		QCOMPARE(bans.size(), 0);
+		QCOMPARE(bans.find(QHostAddress("10.1.2.3"), now), 0);
+	}
+
+	void testExpiration()
+	{
+		IpBanTrie bans;
+		const QDateTime now = QDateTime::currentDateTime();
+		bans.add(1, QHostAddress("192.168.0.0"), 16, now.addSecs(-60));
+		bans.add(2, QHostAddress("192.168.0.0"), 24, now.addSecs(60));
+
+		QCOMPARE(bans.find(QHostAddress("192.168.0.1"), now), 2);
+		QCOMPARE(bans.find(QHostAddress("192.168.1.1"), now), 0);
+		QCOMPARE(bans.find(QHostAddress("192.168.0.1"), now.addSecs(120)), 0);
+	}
+
+	void testInvalid()
+	{
+		IpBanTrie bans;
+		QVERIFY(!bans.add(1, QHostAddress(), 0));
+		QCOMPARE(bans.size(), 0);
+		QVERIFY(!bans.isBanned(QHostAddress()));
+	}
+
+	void benchmarkLookup_data()
+	{
+		QTest::addColumn<int>("count");
+
+		QTest::newRow("10 bans") << 10;
+		QTest::newRow("1000 bans") << 1000;
+		QTest::newRow("100000 bans") << 100000;
+	}
+
+	void benchmarkLookup()
+	{
+		QFETCH(int, count);
+
+		qsrand(1);
+		IpBanTrie bans;
+		const QDateTime expires = QDateTime::currentDateTime().addDays(1);
+		for(int i=0;i<count;++i)
+			bans.add(i+1, randomIpv4(), 16 + qrand() % 17, expires);
+
+		QVector<QHostAddress> addresses;
+		for(int i=0;i<1000;++i)
+			addresses << randomIpv4();
+
+		const QDateTime now = QDateTime::currentDateTime();
+		QBENCHMARK {
+			for(const QHostAddress &a : addresses)
+				bans.find(a, now);
+		}
+	}
+};
+
+
+QTEST_MAIN(TestIpBanTrie)
+#include "ipbantrie.moc"
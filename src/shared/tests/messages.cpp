@@ -127,6 +127,29 @@ private slots:
 		QVERIFY(unwrapped->equals(*original));
 	}
 
+	void testSerializationCache()
+	{
+		MessagePtr msg = MessagePtr(new SessionOwner(1, QList<uint8_t>() << 1 << 2));
+		QVERIFY(!msg->isSerialized());
+
+		QByteArray expected(msg->length(), 0);
+		msg->serialize(expected.data());
+
+		// The serialization should be cached and shared
+		const QByteArray first = msg->serialized();
+		QVERIFY(msg->isSerialized());
+		QCOMPARE(first, expected);
+		QCOMPARE(msg->serialized().constData(), first.constData());
+
+		// Changing the message must invalidate the cache
+		msg.cast<SessionOwner>().setIds(QList<uint8_t>() << 3);
+		QVERIFY(!msg->isSerialized());
+		msg->setContextId(2);
+		expected = QByteArray(msg->length(), 0);
+		msg->serialize(expected.data());
+		QCOMPARE(msg->serialized(), expected);
+	}
+
 	void testLayerOrderSanitation_data()
 	{
 		QTest::addColumn<IdList>("reorder");
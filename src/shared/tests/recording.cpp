@@ -1,6 +1,7 @@
 #include "../record/reader.h"
 #include "../record/writer.h"
 #include "../record/header.h"
+#include "../record/blockcompression.h"
 
 #include "../net/control.h"
 #include "../net/meta.h"
@@ -171,6 +172,73 @@ private slots:
 		QVERIFY(skipRecordingMessage(&buffer)<0);
 	}
 
+	void testBlockCompression()
+	{
+		QBuffer buffer;
+		QVector<qint64> offsets;
+		qint64 dataSize;
+
+		// Enough messages for several frames
+		const int count = 30000;
+		{
+			BlockCompressionDevice device(&buffer, false);
+			QVERIFY(device.open(QIODevice::WriteOnly));
+
+			Writer writer(&device, false);
+			QVERIFY(writer.writeHeader());
+			for(int i=0;i<count;++i) {
+				offsets << device.pos();
+				QVERIFY(writer.writeMessage(Chat(1, 0, 0, QString("Message %1").arg(i))));
+			}
+			QVERIFY(device.frameCount() > 1);
+			dataSize = device.size();
+		}
+		QVERIFY(buffer.size() < dataSize);
+
+		// Messages can be read in random order
+		{
+			Reader reader("test.dprecb", new BlockCompressionDevice(&buffer, false), true);
+			QCOMPARE(reader.open(), COMPATIBLE);
+			QVERIFY(reader.isCompressed());
+			QVERIFY(reader.isSeekable());
+
+			for(const int i : { count-1, 0, count/2, 12345, 1 }) {
+				reader.seekTo(i-1, offsets.at(i));
+				const MessageRecord mr = reader.readNext();
+				QCOMPARE(mr.status, MessageRecord::OK);
+				QCOMPARE(mr.message.cast<Chat>().message(), QString("Message %1").arg(i));
+				QCOMPARE(reader.currentIndex(), i);
+			}
+		}
+
+		// Data can be appended to an existing file
+		{
+			BlockCompressionDevice device(&buffer, false);
+			QVERIFY(device.open(QIODevice::ReadWrite));
+			QCOMPARE(device.size(), dataSize);
+			QVERIFY(device.seek(dataSize));
+			QCOMPARE(device.write("extra", 5), qint64(5));
+		}
+
+		// The index is rebuilt if it's missing
+		QByteArray truncated = buffer.data();
+		truncated.chop(1);
+		QBuffer truncatedBuffer(&truncated);
+		{
+			BlockCompressionDevice device(&truncatedBuffer, false);
+			QVERIFY(device.open(QIODevice::ReadOnly));
+			QCOMPARE(device.size(), dataSize + 5);
+			QVERIFY(device.seek(dataSize));
+			QCOMPARE(device.read(5), QByteArray("extra"));
+			QVERIFY(device.seek(offsets.at(count/2)));
+			QByteArray msgbuf;
+			QVERIFY(readRecordingMessage(&device, msgbuf));
+			const NullableMessageRef msg = Message::deserialize(reinterpret_cast<const uchar*>(msgbuf.constData()), msgbuf.length(), true);
+			QVERIFY(!msg.isNull());
+			QCOMPARE(msg.cast<Chat>().message(), QString("Message %1").arg(count/2));
+		}
+	}
+
 	void testVersionMismatch()
 	{
 		QByteArray testRecording = QByteArray::fromHex(TEST_RECORDING_OLD);
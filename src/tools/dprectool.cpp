@@ -22,6 +22,7 @@
 
 #include "../shared/record/reader.h"
 #include "../shared/record/writer.h"
+#include "../shared/record/blockcompression.h"
 #include "../client/canvas/aclfilter.h"
 
 #include <QCoreApplication>
@@ -41,7 +42,7 @@ void printVersion()
 	printf("Qt version: %s (compiled against %s)\n", qVersion(), QT_VERSION_STR);
 }
 
-bool convertRecording(const QString &inputfilename, const QString &outputfilename, const QString &outputFormat, bool doAclFiltering)
+bool convertRecording(const QString &inputfilename, const QString &outputfilename, const QString &outputFormat, bool blockCompress, bool doAclFiltering)
 {
 	// Open input file
 	Reader reader(inputfilename);
@@ -81,6 +82,10 @@ bool convertRecording(const QString &inputfilename, const QString &outputfilenam
 
 		writer->setEncoding(Writer::Encoding::Text);
 
+	} else if(blockCompress) {
+		// Seekable compressed output, regardless of the file extension
+		writer.reset(new Writer(new BlockCompressionDevice(outputfilename), true));
+
 	} else {
 		writer.reset(new Writer(outputfilename));
 	}
@@ -199,7 +204,7 @@ int main(int argc, char *argv[]) {
 	// Set up command line arguments
 	QCommandLineParser parser;
 
-	parser.setApplicationDescription("Convert Drawpile recordings between text and binary formats");
+	parser.setApplicationDescription("Convert Drawpile recordings between text, binary and compressed formats");
 	parser.addHelpOption();
 
 	// --version, -v
@@ -207,13 +212,17 @@ int main(int argc, char *argv[]) {
 	parser.addOption(versionOption);
 
 	// --out, -o
-	QCommandLineOption outOption(QStringList() << "o" << "out", "Output file", "output");
+	QCommandLineOption outOption(QStringList() << "o" << "out", "Output file (.dprecb for a seekable compressed recording)", "output");
 	parser.addOption(outOption);
 
 	// --format, -f
 	QCommandLineOption formatOption(QStringList() << "f" << "format", "Output format (binary/text/version)", "format");
 	parser.addOption(formatOption);
 
+	// --block-compress, -z
+	QCommandLineOption blockCompressOption(QStringList() << "z" << "block-compress", "Write a seekable compressed recording regardless of the output file extension");
+	parser.addOption(blockCompressOption);
+
 	// --acl, -A
 	QCommandLineOption aclOption(QStringList() << "A" << "acl", "Perform ACL filtering");
 	parser.addOption(aclOption);
@@ -252,6 +261,7 @@ int main(int argc, char *argv[]) {
 		inputfiles.at(0),
 		parser.value(outOption),
 		parser.value(formatOption),
+		parser.isSet(blockCompressOption),
 		parser.isSet(aclOption)
 		))
 		return 1;
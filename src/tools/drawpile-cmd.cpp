@@ -89,6 +89,10 @@ int main(int argc, char *argv[]) {
 	QCommandLineOption fixedSizeOption(QStringList() << "S" << "fixedsize", "Make all images the same size (maxsize if set)");
 	parser.addOption(fixedSizeOption);
 
+	// --jobs, -j <n>
+	QCommandLineOption jobsOption(QStringList() << "j" << "jobs", "Render n parts of an indexed recording in parallel", "n", "1");
+	parser.addOption(jobsOption);
+
 	// Parse
 	parser.process(app);
 
@@ -122,6 +126,12 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
+	const int jobs = parser.value(jobsOption).toInt();
+	if(jobs < 1) {
+		fprintf(stderr, "Number of jobs must be at least 1.\n");
+		return 1;
+	}
+
 	QSize maxSize;
 	if(parser.isSet(maxSizeOption)) {
 		QRegularExpression re("^(\\d+)[xX0](\\d+)$");
@@ -156,7 +166,8 @@ int main(int argc, char *argv[]) {
 		parser.isSet(fixedSizeOption),
 		parser.isSet(mergeAnnotationsOption),
 		parser.isSet(verboseOption),
-		parser.isSet(aclOption)
+		parser.isSet(aclOption),
+		jobs
 	};
 
 	return renderDrawpileRecording(settings);
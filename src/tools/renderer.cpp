@@ -23,16 +23,32 @@
 #include "../client/canvas/layerlist.h"
 #include "../client/canvas/aclfilter.h"
 #include "../client/core/layerstack.h"
+#include "../client/core/layer.h"
+#include "../client/brushes/classicbrushpainter.h"
 #include "../client/ora/orawriter.h"
+#include "../client/recording/indexloader.h"
 #include "../shared/record/reader.h"
 
 #include <QImageWriter>
 #include <QElapsedTimer>
 #include <QPainter>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QFileInfo>
+#include <QFile>
+#include <QDataStream>
 
 struct ExportState {
+	explicit ExportState(const QSize &size=QSize(), int index=1)
+		: lastSize(size), index(index), skipped(0) { }
+
 	QSize lastSize;
 	int index;
+	int skipped;            // number of exports skipped because the canvas was empty
+	QString tempSuffix;     // if set, images are written to temporary files first
+	QStringList files;      // names of the images exported so far
 };
 
 QImage resizeImage(const QImage &img, const QSize &maxSize, bool fixedSize)
@@ -61,13 +77,148 @@ QImage resizeImage(const QImage &img, const QSize &maxSize, bool fixedSize)
 	}
 }
 
-bool saveImage(const DrawpileCmdSettings &settings, const paintcore::LayerStack &layers, ExportState &state)
+/**
+ * A pool of threads that resize and write out exported images.
+ *
+ * Replay threads hand over the flattened images and carry on. The queue
+ * is bounded, so a replay thread that gets too far ahead of the encoders
+ * blocks until there is room.
+ */
+class ImageEncoder {
+public:
+	ImageEncoder(const DrawpileCmdSettings &settings, int threads)
+		: m_settings(settings), m_capacity(threads * 2), m_busy(0), m_quit(false), m_failed(false)
+	{
+		for(int i=0;i<threads;++i) {
+			Thread *t = new Thread(this);
+			t->start();
+			m_threads << t;
+		}
+	}
+
+	~ImageEncoder()
+	{
+		{
+			QMutexLocker lock(&m_mutex);
+			m_quit = true;
+			m_jobAdded.wakeAll();
+		}
+
+		for(Thread *t : m_threads) {
+			t->wait();
+			delete t;
+		}
+	}
+
+	/**
+	 * @brief Queue an image to be written
+	 *
+	 * @param image the image to write
+	 * @param filename the file to write to
+	 * @param format image format (guessed from the filename if empty)
+	 * @param size the image is resized to this size, unless empty
+	 * @param name the filename shown in error messages
+	 */
+	void write(const QImage &image, const QString &filename, const QByteArray &format, const QSize &size, const QString &name)
+	{
+		QMutexLocker lock(&m_mutex);
+		while(m_queue.size() >= m_capacity)
+			m_jobTaken.wait(&m_mutex);
+
+		m_queue.enqueue(Job { image, filename, format, size, name });
+		m_jobAdded.wakeOne();
+	}
+
+	//! Wait until all queued images have been written
+	void waitForDone()
+	{
+		QMutexLocker lock(&m_mutex);
+		while(!m_queue.isEmpty() || m_busy > 0)
+			m_idle.wait(&m_mutex);
+	}
+
+	//! Has writing any image failed?
+	bool hasFailed() const
+	{
+		QMutexLocker lock(&m_mutex);
+		return m_failed;
+	}
+
+private:
+	struct Job {
+		QImage image;
+		QString filename;
+		QByteArray format;
+		QSize size;
+		QString name;
+	};
+
+	class Thread : public QThread {
+	public:
+		explicit Thread(ImageEncoder *encoder) : m_encoder(encoder) { }
+
+	protected:
+		void run() override { m_encoder->encoderLoop(); }
+
+	private:
+		ImageEncoder *m_encoder;
+	};
+
+	void encoderLoop()
+	{
+		QMutexLocker lock(&m_mutex);
+		for(;;) {
+			while(m_queue.isEmpty() && !m_quit)
+				m_jobAdded.wait(&m_mutex);
+
+			// Queued images are written even when quitting
+			if(m_queue.isEmpty())
+				break;
+
+			const Job job = m_queue.dequeue();
+			++m_busy;
+			m_jobTaken.wakeOne();
+			lock.unlock();
+
+			bool ok;
+			{
+				QImageWriter writer(job.filename, job.format);
+				ok = writer.write(job.size.isEmpty() ? job.image : resizeImage(job.image, job.size, m_settings.fixedSize));
+				if(!ok)
+					fprintf(stderr, "[E] %s: %s\n", qPrintable(job.name), qPrintable(writer.errorString()));
+			}
+
+			lock.relock();
+			if(!ok)
+				m_failed = true;
+			if(--m_busy == 0 && m_queue.isEmpty())
+				m_idle.wakeAll();
+		}
+	}
+
+	const DrawpileCmdSettings &m_settings;
+	QVector<Thread*> m_threads;
+
+	QQueue<Job> m_queue;
+	const int m_capacity;
+	int m_busy;
+	bool m_quit;
+	bool m_failed;
+
+	mutable QMutex m_mutex;
+	QWaitCondition m_jobAdded;
+	QWaitCondition m_jobTaken;
+	QWaitCondition m_idle;
+};
+
+bool saveImage(const DrawpileCmdSettings &settings, const paintcore::LayerStack &layers, ExportState &state, ImageEncoder &encoder)
 {
 	if(layers.size().isEmpty() || layers.layerCount()==0) {
 		// The layer stack has no size until the first resize command.
 		// Trying to export before it is not a fatal error.
 		if(settings.verbose)
 			fprintf(stderr, "[I] Image is empty, not saving anything.\n");
+		++state.skipped;
 		return true;
 	}
 
@@ -80,12 +231,15 @@ bool saveImage(const DrawpileCmdSettings &settings, const paintcore::LayerStack
 	if(settings.verbose)
 		fprintf(stderr, "[I] Writing %s...\n", qPrintable(filename));
 
-	QString error;
+	const QString target = filename + state.tempSuffix;
 	bool ok;
 	if(filename.endsWith(".ora", Qt::CaseInsensitive)) {
 		// Special case: Save as OpenRaster with all the layers intact
 		// ORAs are not resized.
-		ok = openraster::saveOpenRaster(filename, &layers, &error);
+		QString error;
+		ok = openraster::saveOpenRaster(target, &layers, &error);
+		if(!ok)
+			fprintf(stderr, "[E] %s: %s\n", qPrintable(filename), qPrintable(error));
 
 	} else {
 		QImage flat = layers.toFlatImage(settings.mergeAnnotations, true);
@@ -93,18 +247,16 @@ bool saveImage(const DrawpileCmdSettings &settings, const paintcore::LayerStack
 		if(settings.fixedSize && state.lastSize.isEmpty())
 			state.lastSize = flat.size();
 
-		if(!state.lastSize.isEmpty())
-			flat = resizeImage(flat, state.lastSize, settings.fixedSize);
+		// Temporary files don't have the right suffix for format detection
+		const QByteArray format = state.tempSuffix.isEmpty() ? QByteArray() : QFileInfo(filename).suffix().toLower().toLatin1();
 
-		QImageWriter writer(filename);
-		ok = writer.write(flat);
-		if(!ok)
-			error = writer.errorString();
+		// Resizing and encoding is done by the encoder threads.
+		// Errors are reported for the image being written, or the next one.
+		encoder.write(flat, target, format, state.lastSize, filename);
+		ok = !encoder.hasFailed();
 	}
 
-	if(!ok)
-		fprintf(stderr, "[E] %s: %s\n", qPrintable(filename), qPrintable(error));
-
+	state.files << filename;
 	++state.index;
 
 	return ok;
@@ -121,110 +273,574 @@ QString prettyDuration(qint64 duration)
 	return QStringLiteral("%1 m %2s").arg(secs/60, 0, 'f', 0).arg(fmod(secs, 60), 0, 'f', 2);
 }
 
-bool renderDrawpileRecording(const DrawpileCmdSettings &settings)
-{
-	// Open recording file
-	recording::Reader reader(settings.inputFilename);
-	recording::Compatibility compat = reader.open();
+/**
+ * Tells the later segments how the first one began exporting.
+ *
+ * Nothing is saved while the canvas is empty and the first image may fix
+ * the output size, so the other segments must wait for the first one to
+ * export something before they can export images of their own.
+ */
+class ExportGate {
+public:
+	void open(const ExportState &state)
+	{
+		QMutexLocker lock(&m_mutex);
+		m_state = state;
+		m_open = true;
+		m_opened.wakeAll();
+	}
 
-	if(compat == recording::CANNOT_READ) {
-		fprintf(stderr, "[E] %s", qPrintable(reader.errorString()));
-		return false;
+	ExportState wait()
+	{
+		QMutexLocker lock(&m_mutex);
+		while(!m_open)
+			m_opened.wait(&m_mutex);
+		return m_state;
 	}
 
-	if(compat != recording::COMPATIBLE && compat != recording::MINOR_INCOMPATIBILITY) {
-		fprintf(stderr, "[E] Recording not compatible\n");
-		return false;
+private:
+	QMutex m_mutex;
+	QWaitCondition m_opened;
+	ExportState m_state;
+	bool m_open = false;
+};
+
+/**
+ * The state of a recording replay.
+ *
+ * In the serial mode, one replay goes through the whole recording. In the
+ * parallel mode, each segment between two index snapshots gets its own.
+ */
+struct Replay {
+	explicit Replay(const QString &filename)
+		: reader(filename), statetracker(&image, &layermodel, 1)
+	{
+		aclfilter.reset(1, false);
 	}
 
-	// Initialize the paint engine
+	recording::Reader reader;
 	paintcore::LayerStack image;
 	canvas::LayerListModel layermodel;
-	canvas::StateTracker statetracker(&image, &layermodel, 1);
+	canvas::StateTracker statetracker;
 	canvas::AclFilter aclfilter;
 
-	aclfilter.reset(1, false);
+	ExportState exportState;
+	int exportCounter = 0;
+
+	int lastIndex = -1; // index of the last message to replay (-1 to replay until the end)
 
 	// Benchmarking
+	qint64 renderTime = 0;
+	qint64 saveTime = 0;
+
+	// Parallel mode
+	int segment = 0;
+	ExportGate *gate = nullptr;
+	bool gatePassed = false;
+	bool skippedLate = false;  // skipped exports not accounted for by the gate
+	bool sizeUnknown = false;  // the fixed output size was not known yet
+	bool failed = false;
+};
+
+static void passGate(const DrawpileCmdSettings &settings, Replay &r)
+{
+	if(!r.gate || r.gatePassed)
+		return;
+
+	r.gatePassed = true;
+	if(r.segment == 0) {
+		r.gate->open(r.exportState);
+
+	} else {
+		const ExportState first = r.gate->wait();
+		r.exportState.index -= first.skipped;
+		if(settings.fixedSize && r.exportState.lastSize.isEmpty()) {
+			r.exportState.lastSize = first.lastSize;
+			r.sizeUnknown = first.lastSize.isEmpty();
+		}
+	}
+}
+
+static bool saveFrame(const DrawpileCmdSettings &settings, Replay &r, ImageEncoder &encoder)
+{
+	if(r.segment > 0)
+		passGate(settings, r);
+
+	const int skipped = r.exportState.skipped;
+	const bool ok = saveImage(settings, r.image, r.exportState, encoder);
+
+	if(r.exportState.skipped != skipped) {
+		if(r.segment > 0 || r.gatePassed)
+			r.skippedLate = true;
+	} else if(r.segment == 0) {
+		passGate(settings, r);
+	}
+
+	return ok;
+}
+
+static bool replay(const DrawpileCmdSettings &settings, Replay &r, ImageEncoder &encoder)
+{
 	QElapsedTimer renderTime;
 	QElapsedTimer saveTime;
-	QElapsedTimer totalTime;
-	qint64 totalRenderTime = 0;
-	qint64 totalSaveTime = 0;
-	totalTime.start();
-
-	// Prepare image exporter
-	ExportState exportState {
-		settings.maxSize,
-		1
-	};
-	int exportCounter = 0;
 
 	// Read and execute commands
 	recording::MessageRecord record;
 	do {
-		const qint64 offset = reader.filePosition();
-		record = reader.readNext();
+		if(r.lastIndex >= 0 && r.reader.currentIndex() >= r.lastIndex)
+			break;
+
+		const qint64 offset = r.reader.filePosition();
+		record = r.reader.readNext();
 
 		if(record.status == recording::MessageRecord::OK) {
-			if(settings.acl && !aclfilter.filterMessage(*record.message)) {
+			if(settings.acl && !r.aclfilter.filterMessage(*record.message)) {
 				if(settings.verbose)
 					fprintf(stderr, "[A] Filtered message %s from %d (idx %d @ %llx)",
 						qPrintable(record.message->messageName()),
 						record.message->contextId(),
-						reader.currentIndex(),
+						r.reader.currentIndex(),
 						offset
 						);
 			}
 
 			if(record.message->isCommand()) {
 				renderTime.start();
-				statetracker.receiveCommand(protocol::MessagePtr::fromNullable(record.message));
-				totalRenderTime += renderTime.nsecsElapsed();
+				r.statetracker.receiveCommand(protocol::MessagePtr::fromNullable(record.message));
+				r.renderTime += renderTime.nsecsElapsed();
 			}
 
 			// Save images
 			if(settings.exportEveryN > 0) {
 				switch(settings.exportEveryMode) {
 				case ExportEvery::Message:
-					++exportCounter;
+					++r.exportCounter;
 					break;
 				case ExportEvery::Sequence:
 					if(record.message->type() == protocol::MSG_UNDOPOINT)
-						++exportCounter;
+						++r.exportCounter;
 					break;
 				}
 
-				if(exportCounter >= settings.exportEveryN) {
-					exportCounter = 0;
+				if(r.exportCounter >= settings.exportEveryN) {
+					r.exportCounter = 0;
 					saveTime.start();
-					if(!saveImage(settings, image, exportState))
+					if(!saveFrame(settings, r, encoder))
 						return false;
-					totalSaveTime += saveTime.nsecsElapsed();
+					r.saveTime += saveTime.nsecsElapsed();
 				}
 			}
 
 		} else if(record.status == recording::MessageRecord::INVALID) {
 			fprintf(stderr, "[E] Invalid message type %d at index %d, offset 0x%llx",
 					record.invalid_type,
-					reader.currentIndex(),
+					r.reader.currentIndex(),
 					offset
 				   );
 			return false;
 		}
 	} while(record.status != recording::MessageRecord::END_OF_RECORDING);
 
+	return true;
+}
+
+static bool openRecording(recording::Reader &reader)
+{
+	recording::Compatibility compat = reader.open();
+
+	if(compat == recording::CANNOT_READ) {
+		fprintf(stderr, "[E] %s", qPrintable(reader.errorString()));
+		return false;
+	}
+
+	if(compat != recording::COMPATIBLE && compat != recording::MINOR_INCOMPATIBILITY) {
+		fprintf(stderr, "[E] Recording not compatible\n");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Get the number of export triggers up to and including the given index stop
+ * and the value of the export counter after it.
+ */
+static int exportsBefore(const DrawpileCmdSettings &settings, const recording::Index &index, int stop, int &counter)
+{
+	counter = 0;
+	if(settings.exportEveryN <= 0)
+		return 0;
+
+	int count;
+	if(settings.exportEveryMode == ExportEvery::Message) {
+		count = index.entry(stop).index + 1;
+
+	} else {
+		// Index stops are undo points and markers
+		count = stop + 1;
+		for(const recording::MarkerEntry &m : index.markers()) {
+			if(int(m.stop) <= stop)
+				--count;
+		}
+	}
+
+	counter = count % settings.exportEveryN;
+	return count / settings.exportEveryN;
+}
+
+/**
+ * Does the state the replay ended in match the snapshot the next segment began from?
+ *
+ * The snapshots do not store everything, so a state that could not be
+ * completely restored from a snapshot never matches.
+ */
+static bool matchesSnapshot(canvas::StateTracker &tracker, const canvas::StateSavepoint &snapshot)
+{
+	const paintcore::LayerStack *layers = tracker.image();
+	for(int i=0;i<layers->layerCount();++i) {
+		if(layers->getLayerByIndex(i)->info().censored)
+			return false;
+	}
+
+	QByteArray replayed, snapshotted;
+	{
+		QDataStream ds(&replayed, QIODevice::WriteOnly);
+		tracker.createSavepoint(-1).toDatastream(ds);
+	}
+	{
+		QDataStream ds(&snapshotted, QIODevice::WriteOnly);
+		snapshot.toDatastream(ds);
+	}
+
+	return replayed == snapshotted;
+}
+
+class SegmentThread : public QThread {
+public:
+	SegmentThread(const DrawpileCmdSettings &settings, Replay *replay, ImageEncoder *encoder)
+		: m_settings(settings), m_replay(replay), m_encoder(encoder) { }
+
+protected:
+	void run() override
+	{
+		m_replay->failed = !replay(m_settings, *m_replay, *m_encoder);
+
+		// Make sure the image numbering is in sync even if nothing was exported
+		passGate(m_settings, *m_replay);
+	}
+
+private:
+	const DrawpileCmdSettings &m_settings;
+	Replay *m_replay;
+	ImageEncoder *m_encoder;
+};
+
+/**
+ * Prepare segments for parallel rendering.
+ *
+ * The recording is split at index snapshots. Each segment (except the first)
+ * starts from the snapshot and replays the messages up to the next one.
+ * The last segment replays up to the last snapshot in the index, so its
+ * state can be checked too, and the rest of the recording is replayed
+ * once it has been found good.
+ *
+ * snapshots[i] is the snapshot segment i starts from. If there is one more
+ * snapshot than there are segments, it is the one the last segment ends at.
+ *
+ * @return false if the recording cannot be rendered in parallel
+ */
+static bool prepareSegments(const DrawpileCmdSettings &settings, QVector<Replay*> &segments, QVector<canvas::StateSavepoint> &snapshots)
+{
+	if(settings.acl) {
+		// ACL filtering depends on the whole session history
+		fprintf(stderr, "[I] ACL filtering is not supported in parallel mode.\n");
+		return false;
+	}
+
+	if(!segments.first()->reader.isSeekable()) {
+		fprintf(stderr, "[I] Compressed recording is not seekable.\n");
+		return false;
+	}
+
+	QString indexfile = settings.inputFilename;
+	indexfile = indexfile.left(indexfile.lastIndexOf('.')) + ".dpidx";
+	if(!QFileInfo(indexfile).exists()) {
+		fprintf(stderr, "[I] No index for the recording.\n");
+		return false;
+	}
+
+	recording::IndexLoader loader(settings.inputFilename, indexfile);
+	if(!loader.open()) {
+		fprintf(stderr, "[I] Could not load the index.\n");
+		return false;
+	}
+	const recording::Index &index = loader.index();
+
+	// Split the recording into roughly equal parts
+	QVector<int> stops;
+	for(int i=1;i<settings.jobs;++i) {
+		const int stop = index.findClosestSnapshot(qint64(index.actionCount()) * i / settings.jobs);
+		if(stop > 0 && (stops.isEmpty() || stop > stops.last()))
+			stops << stop;
+	}
+
+	if(stops.isEmpty()) {
+		fprintf(stderr, "[I] Recording is too short to split.\n");
+		return false;
+	}
+
+	snapshots << canvas::StateSavepoint();
+
+	for(int i=0;i<stops.size();++i) {
+		const recording::StopEntry &se = index.entry(stops.at(i));
+		const canvas::StateSavepoint snapshot = loader.loadSavepoint(stops.at(i));
+		if(!snapshot) {
+			fprintf(stderr, "[E] Could not load snapshot %d\n", stops.at(i));
+			return false;
+		}
+
+		segments.last()->lastIndex = se.index;
+
+		Replay *r = new Replay(settings.inputFilename);
+		segments << r;
+		snapshots << snapshot;
+
+		if(!openRecording(r->reader))
+			return false;
+
+		// The snapshot was taken after the message at the stop was executed
+		r->reader.seekTo(se.index - 1, se.pos);
+		const recording::MessageRecord record = r->reader.readNext();
+		if(record.status != recording::MessageRecord::OK || r->reader.currentIndex() != int(se.index) ||
+			(record.message->type() != protocol::MSG_UNDOPOINT && record.message->type() != protocol::MSG_MARKER)
+		) {
+			fprintf(stderr, "[E] Index does not match the recording\n");
+			return false;
+		}
+
+		r->statetracker.resetToSavepoint(snapshot);
+
+		r->segment = segments.size() - 1;
+		r->exportState = ExportState(settings.maxSize, 1 + exportsBefore(settings, index, stops.at(i), r->exportCounter));
+		r->exportState.tempSuffix = QStringLiteral(".part%1").arg(r->segment);
+	}
+
+	// Find a snapshot to check the end of the last segment against
+	for(int stop=index.size()-1;stop>stops.last();--stop) {
+		if(!(index.entry(stop).flags & recording::StopEntry::HAS_SNAPSHOT))
+			continue;
+
+		const canvas::StateSavepoint snapshot = loader.loadSavepoint(stop);
+		if(snapshot) {
+			segments.last()->lastIndex = index.entry(stop).index;
+			snapshots << snapshot;
+		}
+		break;
+	}
+
+	return true;
+}
+
+/**
+ * Render the segments in parallel.
+ *
+ * The result must be identical to serial rendering, but a segment can turn
+ * out differently from the corresponding part of a serial replay if
+ * - an undo needed history from before the segment's start,
+ * - an earlier segment skipped exporting an empty canvas (this shifts the image numbering),
+ * - the fixed output size was not known when the segment started exporting,
+ * - or the snapshot could not fully capture the canvas state.
+ * Such segments (and all after them) are discarded and the rest of the
+ * recording is replayed serially, continuing from the last good segment.
+ *
+ * A segment whose end state does not match the next snapshot is discarded
+ * along with the segment that started from it: either one may be the one that
+ * went wrong. The first segment replays from the beginning, so it is always good.
+ * The last segment is checked against the final snapshot, or discarded
+ * if there is none.
+ *
+ * Images of all but the first segment are written to temporary files that
+ * are renamed once the segment has been found good.
+ *
+ * @return the segment that replayed the end of the recording, or nullptr on error
+ */
+static Replay *renderSegments(const DrawpileCmdSettings &settings, const QVector<Replay*> &segments, const QVector<canvas::StateSavepoint> &snapshots, ImageEncoder &encoder)
+{
+	ExportGate gate;
+	for(Replay *r : segments)
+		r->gate = &gate;
+
+	QVector<SegmentThread*> threads;
+	for(int i=1;i<segments.size();++i) {
+		SegmentThread *t = new SegmentThread(settings, segments.at(i), &encoder);
+		t->start();
+		threads << t;
+	}
+
+	// The calling thread renders the first segment
+	Replay *first = segments.first();
+	first->failed = !replay(settings, *first, encoder);
+	passGate(settings, *first);
+
+	for(SegmentThread *t : threads) {
+		t->wait();
+		delete t;
+	}
+
+	// Find out how many segments came out right
+	int good = segments.size();
+	int failed = -1;
+	for(int i=0;i<=segments.size();++i) {
+		const char *reason = nullptr;
+		int keep = i; // number of segments to keep if this boundary is bad
+
+		if(i == segments.size()) {
+			// End of the last segment
+			if(snapshots.size() <= i) {
+				reason = "no snapshot to check the last segment against";
+				keep = i - 1;
+			} else if(!matchesSnapshot(segments.at(i-1)->statetracker, snapshots.at(i))) {
+				reason = "state mismatch at the final snapshot";
+				keep = i - 1;
+			}
+
+		} else if(i > 0) {
+			const Replay *r = segments.at(i);
+			const Replay *prev = segments.at(i-1);
+
+			if(r->statetracker.truncatedUndoCount() > 0)
+				reason = "undo history needed from before the segment";
+			else if(prev->skippedLate)
+				reason = "image numbering shifted by an empty canvas";
+			else if(r->sizeUnknown && i > 1)
+				reason = "output image size not known";
+			else if(!matchesSnapshot(segments.at(i-1)->statetracker, snapshots.at(i))) {
+				reason = "state mismatch at the snapshot";
+				keep = i - 1;
+			}
+		}
+
+		if(reason) {
+			good = qMax(1, keep);
+			fprintf(stderr, "[I] Segment %d: %s. Rendering the rest serially.\n", good, reason);
+			break;
+		}
+
+		if(i < segments.size() && segments.at(i)->failed) {
+			failed = i;
+			good = i + 1;
+			break;
+		}
+	}
+
+	// Keep the images of the good segments and discard the rest
+	encoder.waitForDone();
+
+	for(int i=1;i<segments.size();++i) {
+		ExportState &state = segments.at(i)->exportState;
+		for(const QString &file : state.files) {
+			const QString temp = file + state.tempSuffix;
+			if(i < good) {
+				QFile::remove(file);
+				QFile::rename(temp, file);
+			} else {
+				QFile::remove(temp);
+			}
+		}
+		state.files.clear();
+		state.tempSuffix = QString();
+	}
+
+	if(failed >= 0)
+		return nullptr;
+
+	Replay *last = segments.at(good - 1);
+
+	if(last->lastIndex >= 0) {
+		// Continue from where the last good segment stopped
+		last->lastIndex = -1;
+		last->gate = nullptr;
+		if(!replay(settings, *last, encoder))
+			return nullptr;
+	}
+
+	return last;
+}
+
+static bool renderRecording(const DrawpileCmdSettings &settings, QVector<Replay*> &segments)
+{
+	if(!openRecording(segments.first()->reader))
+		return false;
+
+	// Benchmarking
+	QElapsedTimer saveTime;
+	QElapsedTimer totalTime;
+	totalTime.start();
+
+	// Prepare image exporter
+	ImageEncoder encoder(settings, QThread::idealThreadCount());
+	segments.first()->exportState = ExportState(settings.maxSize);
+
+	bool parallel = false;
+	QVector<canvas::StateSavepoint> snapshots;
+	if(settings.jobs > 1) {
+		parallel = prepareSegments(settings, segments, snapshots);
+		if(!parallel) {
+			fprintf(stderr, "[I] Rendering serially.\n");
+			while(segments.size() > 1)
+				delete segments.takeLast();
+			segments.first()->lastIndex = -1;
+
+		} else if(settings.verbose) {
+			fprintf(stderr, "[I] Rendering %d segments in parallel.\n", segments.size());
+		}
+	}
+
+	Replay *last;
+	if(parallel) {
+		last = renderSegments(settings, segments, snapshots, encoder);
+	} else {
+		last = segments.first();
+		if(!replay(settings, *last, encoder))
+			last = nullptr;
+	}
+
+	qint64 totalRenderTime = 0;
+	qint64 totalSaveTime = 0;
+	for(const Replay *r : segments) {
+		totalRenderTime += r->renderTime;
+		totalSaveTime += r->saveTime;
+	}
+
+	if(!last)
+		return false;
+
 	fprintf(stderr, "[I] Total processing time: %s\n", qPrintable(prettyDuration(totalTime.nsecsElapsed())));
 	fprintf(stderr, "[I] Cumulative render time: %s\n", qPrintable(prettyDuration(totalRenderTime)));
+	if(settings.verbose) {
+		const auto stampCache = brushes::brushStampCacheStats();
+		fprintf(stderr, "[I] Brush stamp cache: %d hits, %d misses (%d stamps, %d bytes)\n",
+			stampCache.hits, stampCache.misses, stampCache.entries, stampCache.totalCost);
+	}
 
 	// Save the final result
 	saveTime.start();
-	if(!saveImage(settings, image, exportState))
-		return false;
+	const bool ok = saveImage(settings, last->image, last->exportState, encoder);
+	encoder.waitForDone();
 	totalSaveTime += saveTime.nsecsElapsed();
 
 	fprintf(stderr, "[I] Cumulative saving time: %s\n", qPrintable(prettyDuration(totalSaveTime)));
 
-	return true;
+	return ok && !encoder.hasFailed();
 }
 
+bool renderDrawpileRecording(const DrawpileCmdSettings &settings)
+{
+	QVector<Replay*> segments;
+	segments << new Replay(settings.inputFilename);
+
+	const bool ok = renderRecording(settings, segments);
+
+	qDeleteAll(segments);
+	return ok;
+}
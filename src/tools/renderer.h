@@ -40,6 +40,9 @@ struct DrawpileCmdSettings {
 	bool mergeAnnotations;
 	bool verbose;
 	bool acl;
+
+	//! Number of recording segments to render in parallel (requires an index)
+	int jobs;
 };
 
 bool renderDrawpileRecording(const DrawpileCmdSettings &settings);